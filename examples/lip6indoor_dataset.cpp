@@ -14,13 +14,18 @@
 //  You should have received a copy of the GNU General Public License
 //  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
 
-#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
 
 #include <boost/filesystem.hpp>
 
 #include <opencv2/opencv.hpp>
 
+#include "libhaloc/candidate_file.h"
 #include "libhaloc/hash.h"
+#include "libhaloc/knn_graph.h"
+#include "libhaloc/pairwise_engine.h"
 
 namespace fs = boost::filesystem;
 
@@ -84,6 +89,7 @@ int main(int argc, char** argv) {
   // Operational variables
   int img_idx = 0;
   int discard_window = 10;
+  int min_overlap = 1;
   std::map<int, std::vector<float> > hash_table;
 
   // Loop over the images
@@ -121,64 +127,98 @@ int main(int argc, char** argv) {
     std::cout << std::endl;
   }
 
-  // Find loop closings
-  ROS_INFO("Generating the output matrix...");
-  for (float eps=0.6; eps <= 1.0; eps=eps+0.02) {
-    std::stringstream hist_file, output_file;
-    hist_file << "/tmp/histogram" << eps << ".csv";
-    output_file << "/tmp/output" << eps << ".csv";
-    std::fstream hist(hist_file.str().c_str(), std::ios::out);
-    std::fstream output(output_file.str().c_str(), std::ios::out);
-    hist << std::fixed << std::setprecision(10);
-    output << std::fixed << std::setprecision(10);
-
-    ROS_INFO_STREAM("Processing eps: " << eps);
-
-    int great_3 = 0;
-    int great_4 = 0;
-    int great_5 = 0;
-    int great_6 = 0;
-
-    for (uint i=0; i < hash_table.size(); ++i) {
-      for (uint j=0; j < hash_table.size(); ++j) {
-        int dist_original = 0;
-        int dist = 0;
-        int neighbourhood = abs(i-j);
-        if (neighbourhood > 20 && j < i) {
-          dist_original = haloc.CalcDist(hash_table[i], hash_table[j], eps);
-          if (dist_original > 3) great_3++;
-          if (dist_original > 4) great_4++;
-          if (dist_original > 5) great_5++;
-          if (dist_original > 6) great_6++;
-
-          if (dist_original < 4) {
-            dist = 0;
-          } else {
-            dist = 1;
-          }
+  // Thresholds to evaluate
+  std::vector<float> eps_values;
+  for (float eps=0.6; eps <= 1.0; eps=eps+0.02)
+    eps_values.push_back(eps);
+
+  // Precompute the bucket metadata of every hash
+  std::vector<haloc::BucketedHash> bucketed_table;
+  for (uint i=0; i < hash_table.size(); ++i)
+    bucketed_table.push_back(haloc.BuildBucketedHash(hash_table[i]));
+
+  // One candidate file per threshold, with the pairs that overlap
+  std::vector< std::shared_ptr<haloc::CandidateWriter> > writers;
+  std::vector<std::string> candidate_files;
+  haloc::CandidateWriter::Params writer_params;
+  writer_params.min_overlap = min_overlap;
+  for (uint e=0; e < eps_values.size(); ++e) {
+    std::stringstream candidate_file;
+    candidate_file << "/tmp/candidates" << eps_values[e] << ".bin";
+    candidate_files.push_back(candidate_file.str());
+    writers.push_back(std::make_shared<haloc::CandidateWriter>(
+      writer_params));
+    writers[e]->Open(candidate_files[e], bucketed_table.size(),
+      bucketed_table.size(), eps_values[e]);
+  }
+
+  // Find loop closings. Only the pairs out of the neighbourhood band are
+  // computed, in parallel, and the bucket distances of every pair are
+  // computed only once and then evaluated for all the thresholds. Every
+  // thread streams its candidates to the files in blocks.
+  ROS_INFO("Generating the candidate files...");
+  haloc::PairwiseEngine engine(haloc);
+  const float max_eps = eps_values.back();
+  const uint block_size = 1024;
+  typedef std::vector< std::vector<haloc::PairMatch> > Pending;
+  std::vector<Pending> pending(engine.GetNumThreads(),
+    Pending(eps_values.size()));
+  engine.VisitLowerTriangle(bucketed_table.size(), 20,
+    [&](int thread, int i, int j) {
+      haloc::DistanceProfile profile = haloc.CalcDistProfile(
+        bucketed_table[i], bucketed_table[j], max_eps);
+      for (uint e=0; e < eps_values.size(); ++e) {
+        const int overlap = profile.Overlap(eps_values[e]);
+        if (overlap < min_overlap) continue;
+        pending[thread][e].push_back(haloc::PairMatch(i, j, overlap,
+          profile.Shift(eps_values[e])));
+        if (pending[thread][e].size() >= block_size) {
+          writers[e]->Append(pending[thread][e]);
+          pending[thread][e].clear();
         }
+      }
+    });
+  for (uint e=0; e < eps_values.size(); ++e) {
+    for (uint t=0; t < pending.size(); ++t)
+      writers[e]->Append(pending[t][e]);
+    writers[e]->Close();
+  }
 
-        // Log
-        hist << dist_original << ", ";
+  // Evaluation from the sparse overlap matrices
+  for (uint e=0; e < eps_values.size(); ++e) {
+    haloc::CandidateReader reader;
+    Eigen::SparseMatrix<int> overlap;
+    if (!reader.Open(candidate_files[e]) || !reader.ReadMatrix(overlap))
+      continue;
 
-        // Log
-        if (j != hash_table.size()-1) {
-          output << dist << ", ";
-        } else {
-          output << dist << std::endl;
-        }
+    int great_3 = 0, great_4 = 0, great_5 = 0, great_6 = 0;
+    for (int k=0; k < overlap.outerSize(); ++k) {
+      for (Eigen::SparseMatrix<int>::InnerIterator it(overlap, k); it;
+          ++it) {
+        if (it.value() > 3) great_3++;
+        if (it.value() > 4) great_4++;
+        if (it.value() > 5) great_5++;
+        if (it.value() > 6) great_6++;
       }
     }
-    hist.close();
-    output.close();
 
+    ROS_INFO_STREAM("Eps: " << eps_values[e] << " (" << overlap.nonZeros() <<
+      " candidates)");
     ROS_INFO_STREAM("  >3: " << great_3);
     ROS_INFO_STREAM("  >4: " << great_4);
     ROS_INFO_STREAM("  >5: " << great_5);
     ROS_INFO_STREAM("  >6: " << great_6);
-
   }
 
+  // Approximate 10 nearest neighbours of every frame, and their recall on a
+  // sample of frames
+  haloc::KnnGraphBuilder knn(haloc);
+  std::vector< std::vector<haloc::Match> > graph = knn.Build(bucketed_table,
+    0.8);
+  ROS_INFO_STREAM("kNN graph: " << knn.GetNumDistances() << " distances in " <<
+    knn.GetNumIterations() << " iterations, recall " <<
+    knn.EstimateRecall(bucketed_table, graph, 0.8, 100) << ".");
+
   ROS_INFO_STREAM("Finished!");
 
   ros::shutdown();
@@ -0,0 +1,108 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_ALIGNED_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_ALIGNED_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace haloc {
+
+/**
+ * @brief      The alignment (in bytes) of the contiguous buffers. Matches the
+ *             cache line and the widest (AVX-512) vector registers.
+ */
+static const std::size_t kAlignment = 64;
+
+/**
+ * @brief      STL allocator returning kAlignment-aligned memory.
+ */
+template <typename T>
+class AlignedAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef std::size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+
+  template <typename U>
+  struct rebind {typedef AlignedAllocator<U> other;};
+
+  AlignedAllocator() {}
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U>&) {}
+
+  T* allocate(std::size_t n) {
+    void* ptr = NULL;
+    const std::size_t bytes = n > 0 ? n * sizeof(T) : kAlignment;
+    if (posix_memalign(&ptr, kAlignment, bytes) != 0)
+      throw std::bad_alloc();
+    return static_cast<T*>(ptr);
+  }
+
+  void deallocate(T* ptr, std::size_t) {free(ptr);}
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U>&) const {return true;}
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U>&) const {return false;}
+};
+
+/**
+ * @brief      Contiguous float buffer aligned to kAlignment bytes.
+ */
+typedef std::vector<float, AlignedAllocator<float> > AlignedFloatVector;
+
+/**
+ * @brief      Contiguous byte buffer aligned to kAlignment bytes.
+ */
+typedef std::vector<uint8_t, AlignedAllocator<uint8_t> > AlignedByteVector;
+
+/**
+ * @brief      Rounds a number of floats up so that consecutive rows of that
+ *             length stay aligned to kAlignment bytes.
+ *
+ * @param[in]  n     The number of floats.
+ *
+ * @return     The padded number of floats.
+ */
+inline int AlignedStride(const int& n) {
+  const int step = kAlignment / sizeof(float);
+  return ((n + step - 1) / step) * step;
+}
+
+/**
+ * @brief      Same as AlignedStride for rows of bytes.
+ *
+ * @param[in]  n     The number of bytes.
+ *
+ * @return     The padded number of bytes.
+ */
+inline int AlignedByteStride(const int& n) {
+  return ((n + kAlignment - 1) / kAlignment) * kAlignment;
+}
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_ALIGNED_H_
@@ -0,0 +1,131 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_BINARY_IO_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_BINARY_IO_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <istream>
+#include <ostream>
+
+namespace haloc {
+
+/**
+ * @brief      Little-endian binary values of the model and codebook files,
+ *             so a file saved on one host loads on any other one. The values
+ *             are swapped on big-endian hosts.
+ */
+namespace binary_io {
+
+/**
+ * @brief      Determines if the host is little-endian.
+ *
+ * @return     True if little-endian.
+ */
+inline bool IsLittleEndian() {
+  const uint16_t probe = 1;
+  return *reinterpret_cast<const uint8_t*>(&probe) == 1;
+}
+
+/**
+ * @brief      Writes values of 4 or 8 bytes (integers and floats).
+ *
+ * @param      stream  The stream.
+ * @param[in]  values  The values.
+ * @param[in]  count   The number of values.
+ */
+template <typename T>
+inline void WriteArray(std::ostream& stream, const T* values,
+    const std::size_t& count) {
+  if (IsLittleEndian()) {
+    stream.write(reinterpret_cast<const char*>(values), count*sizeof(T));
+    return;
+  }
+  for (std::size_t i=0; i < count; ++i) {
+    char bytes[sizeof(T)];
+    const char* value = reinterpret_cast<const char*>(&values[i]);
+    std::reverse_copy(value, value + sizeof(T), bytes);
+    stream.write(bytes, sizeof(T));
+  }
+}
+
+/**
+ * @brief      Reads values written with WriteArray.
+ *
+ * @param      stream  The stream.
+ * @param[out] values  The values.
+ * @param[in]  count   The number of values.
+ */
+template <typename T>
+inline void ReadArray(std::istream& stream, T* values,
+    const std::size_t& count) {
+  stream.read(reinterpret_cast<char*>(values), count*sizeof(T));
+  if (IsLittleEndian()) return;
+  for (std::size_t i=0; i < count; ++i) {
+    char* value = reinterpret_cast<char*>(&values[i]);
+    std::reverse(value, value + sizeof(T));
+  }
+}
+
+/**
+ * @brief      Writes one value.
+ *
+ * @param      stream  The stream.
+ * @param[in]  value   The value.
+ */
+template <typename T>
+inline void WriteValue(std::ostream& stream, const T& value) {
+  WriteArray(stream, &value, 1);
+}
+
+/**
+ * @brief      Reads one value.
+ *
+ * @param      stream  The stream.
+ *
+ * @return     The value (0 if the read failed).
+ */
+template <typename T>
+inline T ReadValue(std::istream& stream) {
+  T value = T();
+  ReadArray(stream, &value, 1);
+  return stream.good() ? value : T();
+}
+
+/**
+ * @brief      Returns the bytes left in a stream open for reading.
+ *
+ * @param      stream  The stream.
+ *
+ * @return     The remaining bytes (0 if the stream failed).
+ */
+inline uint64_t Remaining(std::istream& stream) {
+  if (!stream.good()) return 0;
+  const std::streampos position = stream.tellg();
+  stream.seekg(0, std::ios::end);
+  const std::streampos end = stream.tellg();
+  stream.seekg(position);
+  return (end > position) ? static_cast<uint64_t>(end - position) : 0;
+}
+
+}  // namespace binary_io
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_BINARY_IO_H_
@@ -0,0 +1,46 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_BINARY_SIGNATURE_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_BINARY_SIGNATURE_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace haloc {
+
+/**
+ * @brief      One bit per hash coefficient: bit m of a bucket is set when
+ *             coefficient m is above the learned median of that coefficient.
+ *             Every bucket takes words_per_bucket 64-bit words (the last one
+ *             zero padded), so the signature is 32x smaller than the hash.
+ */
+struct BinarySignature {
+  /**
+   * @brief      Default constructor.
+   */
+  BinarySignature() : occupancy(0), words_per_bucket(0) {}
+
+  // Signature variables
+  std::vector<uint64_t> bits;   //!> The bits, bucket after bucket
+  uint64_t occupancy;           //!> Bit i is set when bucket i is not empty
+  int words_per_bucket;         //!> Number of words of every bucket
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_BINARY_SIGNATURE_H_
@@ -0,0 +1,91 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_BUCKETED_HASH_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_BUCKETED_HASH_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace haloc {
+
+/**
+ * @brief      Maximum number of buckets supported by the occupancy bitmasks.
+ */
+static const int kMaxMaskBuckets = 64;
+
+/**
+ * @brief      Hash plus per-bucket metadata, computed once when the hash is
+ *             generated so the distance does not need to scan the
+ *             coefficients to find the empty buckets.
+ */
+struct BucketedHash {
+  /**
+   * @brief      Default constructor.
+   */
+  BucketedHash() : occupancy(0) {}
+
+  // Hash variables
+  std::vector<float> hash;        //!> The hash coefficients (as GetHash returns them)
+  uint64_t occupancy;             //!> Bit i is set when bucket i is not empty
+  std::vector<float> bucket_sum;  //!> Sum of the coefficients of every bucket
+};
+
+/**
+ * @brief      Rotates a bucket bitmask so that bit j of the output is bit
+ *             (j + shift) % num_buckets of the input. This pairs bucket j of a
+ *             hash with bucket j + shift of another one.
+ *
+ * @param[in]  mask         The bitmask.
+ * @param[in]  shift        The cyclic shift (0 <= shift < num_buckets).
+ * @param[in]  num_buckets  The number of buckets (<= kMaxMaskBuckets).
+ *
+ * @return     The rotated bitmask.
+ */
+inline uint64_t RotateBucketMask(const uint64_t& mask, const int& shift,
+    const int& num_buckets) {
+  if (shift == 0) return mask;
+  const uint64_t all = (num_buckets >= 64) ? ~0ULL :
+    ((1ULL << num_buckets) - 1);
+  return ((mask >> shift) | (mask << (num_buckets - shift))) & all;
+}
+
+/**
+ * @brief      Returns the number of set bits.
+ *
+ * @param[in]  mask  The bitmask.
+ *
+ * @return     The number of set bits.
+ */
+inline int CountBuckets(const uint64_t& mask) {
+  return __builtin_popcountll(mask);
+}
+
+/**
+ * @brief      Returns the index of the lowest set bit. mask must not be 0.
+ *
+ * @param[in]  mask  The bitmask.
+ *
+ * @return     The bit index.
+ */
+inline int FirstBucket(const uint64_t& mask) {
+  return __builtin_ctzll(mask);
+}
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_BUCKETED_HASH_H_
@@ -0,0 +1,270 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_CANDIDATE_FILE_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_CANDIDATE_FILE_H_
+
+#include <stdint.h>
+
+#include <Eigen/Sparse>
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "libhaloc/pairwise_engine.h"
+
+namespace haloc {
+
+/**
+ * @brief      Header of the loop candidate files. All the values are in the
+ *             host byte order. The header is followed by num_records
+ *             CandidateRecord, in the order they were written.
+ */
+struct CandidateFileHeader {
+  char magic[8];              //!> "HALOCCND"
+  uint32_t version;           //!> Format version of the writer
+  uint32_t header_size;       //!> Bytes of the header
+  uint64_t num_rows;          //!> Rows of the pair matrix
+  uint64_t num_cols;          //!> Columns of the pair matrix
+  float eps;                  //!> The threshold of the overlaps
+  uint32_t min_overlap;       //!> Smallest overlap stored
+  uint64_t num_records;       //!> Stored pairs (kUnfinished until closed)
+
+  // Value of num_records while the file is being written
+  static const uint64_t kUnfinished = ~0ULL;
+};
+
+/**
+ * @brief      One stored pair.
+ */
+struct CandidateRecord {
+  int32_t i;                  //!> Row
+  int32_t j;                  //!> Column
+  int16_t overlap;            //!> Number of overlapping buckets
+  int16_t shift;              //!> Best cyclic shift (-1 if unknown)
+};
+
+/**
+ * @brief      Streams the loop candidates of a pair matrix to a binary file,
+ *             keeping only the pairs with a minimum overlap. The pairs are
+ *             buffered and written in blocks, so the whole matrix never has
+ *             to be in memory and the file grows with the number of
+ *             candidates instead of with the square of the number of frames.
+ *             The threads of a PairwiseEngine can append concurrently.
+ */
+class CandidateWriter {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int min_overlap;             //!> Smallest overlap written
+    int buffer_size;             //!> Pairs buffered before a write
+
+    // Default values
+    static const int             DEFAULT_MIN_OVERLAP = 1;
+    static const int             DEFAULT_BUFFER_SIZE = 4096;
+  };
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  params  The parameters.
+   */
+  explicit CandidateWriter(const Params& params = Params());
+
+  /**
+   * @brief      Class destructor. Closes the file.
+   */
+  ~CandidateWriter();
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Creates a file (truncating it) and writes its header.
+   *
+   * @param[in]  filename  The file.
+   * @param[in]  num_rows  The rows of the pair matrix.
+   * @param[in]  num_cols  The columns of the pair matrix.
+   * @param[in]  eps       The threshold used to compute the overlaps (only
+   *                       stored for the readers).
+   *
+   * @return     False if the file cannot be created.
+   */
+  bool Open(const std::string& filename, const int& num_rows,
+    const int& num_cols, const float& eps);
+
+  /**
+   * @brief      Writes the buffered pairs and the final header, and closes
+   *             the file.
+   *
+   * @return     False if some write failed.
+   */
+  bool Close();
+
+  /**
+   * @brief      Determines if a file is open.
+   *
+   * @return     True if a file is open.
+   */
+  inline bool IsOpen() const {return file_.is_open();}
+
+  /**
+   * @brief      Appends a pair if its overlap is large enough. Safe from any
+   *             thread.
+   *
+   * @param[in]  pair  The pair.
+   *
+   * @return     False if the file is not open or a write failed.
+   */
+  bool Append(const PairMatch& pair);
+
+  /**
+   * @brief      Appends the pairs whose overlap is large enough, at once.
+   *             Safe from any thread.
+   *
+   * @param[in]  pairs  The pairs.
+   *
+   * @return     False if the file is not open or a write failed.
+   */
+  bool Append(const std::vector<PairMatch>& pairs);
+
+  /**
+   * @brief      Returns the number of pairs appended to the file.
+   *
+   * @return     The number of pairs.
+   */
+  uint64_t Size();
+
+ protected:
+  /**
+   * @brief      Buffers a pair if its overlap is large enough, writing the
+   *             buffer when it is full. The mutex must be held.
+   *
+   * @param[in]  pair  The pair.
+   *
+   * @return     False if a write failed.
+   */
+  bool Push(const PairMatch& pair);
+
+  /**
+   * @brief      Writes the buffered pairs. The mutex must be held.
+   *
+   * @return     False if the write failed.
+   */
+  bool WriteBuffer();
+
+ private:
+  CandidateWriter(const CandidateWriter&);
+  CandidateWriter& operator=(const CandidateWriter&);
+
+  // Properties
+  Params params_;                         //!> Stores parameters
+  std::ofstream file_;                    //!> The output file
+  std::string filename_;                  //!> The name of the output file
+  CandidateFileHeader header_;            //!> The header (count updated at Close)
+  std::vector<CandidateRecord> buffer_;   //!> The pairs not yet written
+  std::mutex mutex_;                      //!> Protects the file and the buffer
+};
+
+/**
+ * @brief      Reads the loop candidate files, record by record or at once
+ *             into sparse matrices for the evaluation.
+ */
+class CandidateReader {
+ public:
+  /**
+   * @brief      Class constructor.
+   */
+  CandidateReader();
+
+  /**
+   * @brief      Opens a file and reads its header. The records of a file that
+   *             was never closed (e.g. a crashed run) are readable up to the
+   *             last complete one.
+   *
+   * @param[in]  filename  The file.
+   *
+   * @return     False if the file cannot be read or is not a candidate file.
+   */
+  bool Open(const std::string& filename);
+
+  /**
+   * @brief      Closes the file.
+   */
+  inline void Close() {file_.close();}
+
+  /**
+   * @brief      Returns the header of the open file.
+   *
+   * @return     The header.
+   */
+  inline CandidateFileHeader GetHeader() const {return header_;}
+
+  /**
+   * @brief      Returns the number of records of the open file.
+   *
+   * @return     The number of records.
+   */
+  inline uint64_t Size() const {return num_records_;}
+
+  /**
+   * @brief      Reads the next record.
+   *
+   * @param[out] pair  The pair.
+   *
+   * @return     False at the end of the file.
+   */
+  bool Next(PairMatch& pair);
+
+  /**
+   * @brief      Reads the remaining records into sparse matrices of
+   *             num_rows x num_cols.
+   *
+   * @param[out] overlap  The overlap of every stored pair.
+   * @param[out] shift    Optional. The best shift of every stored pair, with
+   *                      the same non-zero pattern as the overlaps (so shift
+   *                      0 is an explicit entry).
+   *
+   * @return     False if the file is not open.
+   */
+  bool ReadMatrix(Eigen::SparseMatrix<int>& overlap,
+    Eigen::SparseMatrix<int>* shift = NULL);
+
+ private:
+  // Properties
+  std::ifstream file_;                    //!> The input file
+  CandidateFileHeader header_;            //!> The header
+  uint64_t num_records_;                  //!> Records of the file
+  uint64_t num_read_;                     //!> Records already read
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_CANDIDATE_FILE_H_
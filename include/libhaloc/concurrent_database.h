@@ -0,0 +1,276 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_CONCURRENT_DATABASE_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_CONCURRENT_DATABASE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "libhaloc/aligned.h"
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+
+namespace haloc {
+
+/**
+ * @brief      Hash database for one writer thread and any number of reader
+ *             threads, without locks. The rows are appended to fixed-size
+ *             segments that never move, listed in an immutable view, and a
+ *             row becomes visible to the readers when the writer publishes
+ *             the new row count of its segment (release store). Every query
+ *             works on the snapshot given by the view and the counts it
+ *             reads (acquire loads), so it never waits for the writer and
+ *             the writer never waits for it. Removed frames are marked with
+ *             an atomic tombstone. Once the tombstones outnumber the live
+ *             rows, the writer copies the live rows of the segments that
+ *             have tombstones into new segments and publishes a new view.
+ *             The old segments are freed when no query can see them any
+ *             more, which is tracked with two epoch counters: a query
+ *             registers in the counter of the current epoch, and the writer
+ *             only advances the epoch (and frees what was retired two epochs
+ *             before) once the counter of the previous one is back to zero.
+ */
+class ConcurrentDatabase {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int segment_size;            //!> Rows per segment
+    int max_segments;            //!> Maximum number of segments in use
+
+    // Default values
+    static const int             DEFAULT_SEGMENT_SIZE = 1024;
+    static const int             DEFAULT_MAX_SEGMENTS = 4096;
+  };
+
+  /**
+   * @brief      Class constructor. The capacity is
+   *             params.segment_size*params.max_segments rows, tombstones
+   *             included until they are reclaimed.
+   *
+   * @param[in]  hash    The hash object that produces the hashes. It must
+   *                     outlive the database and keep its parameters.
+   * @param[in]  params  The parameters.
+   */
+  explicit ConcurrentDatabase(const Hash& hash,
+    const Params& params = Params());
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Returns the number of published frames that are not
+   *             removed. Safe from any thread.
+   *
+   * @return     The size.
+   */
+  inline int Size() const {return size_.load(std::memory_order_acquire);}
+
+  /**
+   * @brief      Returns the number of segments in use. Writer thread only.
+   *
+   * @return     The number of segments.
+   */
+  inline int GetNumSegments() const {return segments_.size();}
+
+  /**
+   * @brief      Returns the number of retired segments that some query may
+   *             still see. Writer thread only.
+   *
+   * @return     The number of retired segments.
+   */
+  int GetNumRetiredSegments() const;
+
+  /**
+   * @brief      Determines if a frame is stored. Writer thread only.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     True if the frame is stored.
+   */
+  inline bool Contains(const int& id) const {return rows_.count(id) > 0;}
+
+  /**
+   * @brief      Adds and publishes the hash of a frame. Writer thread only.
+   *
+   * @param[in]  id    The frame id.
+   * @param[in]  hash  The hash, as returned by Hash::GetHash.
+   *
+   * @return     False if the id already exists, the hash length is wrong or
+   *             the database is full.
+   */
+  bool Add(const int& id, const std::vector<float>& hash);
+
+  /**
+   * @brief      Removes the hash of a frame. The queries that start after
+   *             the call do not return it. Writer thread only.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     False if the id does not exist.
+   */
+  bool Remove(const int& id);
+
+  /**
+   * @brief      Copies the live rows of the segments with tombstones into
+   *             new segments and retires the old ones. Add and Remove call it
+   *             when needed. Writer thread only.
+   */
+  void Compact();
+
+  /**
+   * @brief      Finds the k frames with the largest overlap with the query,
+   *             among the frames published when the query starts. Safe from
+   *             any thread, concurrently with Add and Remove.
+   *
+   * @param[in]  hash          The query hash, as returned by Hash::GetHash.
+   * @param[in]  k             The maximum number of candidates.
+   * @param[in]  eps           The maximum L1 distance between matching buckets.
+   * @param[in]  query_id      The frame id of the query (-1 if none).
+   * @param[in]  min_neighbor  When query_id >= 0, the frames with
+   *                           |id - query_id| <= min_neighbor are skipped.
+   *
+   * @return     The candidates with overlap > 0, best first.
+   */
+  std::vector<Match> Query(const std::vector<float>& hash, const int& k,
+    float eps, const int& query_id = -1, const int& min_neighbor = 0) const;
+
+ protected:
+  /**
+   * @brief      Rows of one segment, allocated at once so they never move.
+   */
+  struct Segment {
+    AlignedFloatVector hashes;                     //!> The hash rows
+    std::vector<float> bucket_sums;                //!> The bucket sums of every row
+    std::vector<uint64_t> occupancy;               //!> The occupancy bitmask of every row
+    std::vector<int> ids;                          //!> The frame id of every row
+    std::unique_ptr<std::atomic<bool>[]> removed;  //!> The tombstone of every row
+    std::atomic<int> num_rows;                     //!> Published rows
+    int num_live;                                  //!> Rows without tombstone (writer only)
+  };
+
+  /**
+   * @brief      The segments seen by a query, and their layout. Never
+   *             modified once published.
+   */
+  struct View {
+    std::vector<Segment*> segments;  //!> The segments, the open one last
+    int hash_length;                 //!> Number of floats per hash
+    int hash_stride;                 //!> Aligned row length of the hashes
+    int num_buckets;                 //!> Number of buckets per hash
+  };
+
+  /**
+   * @brief      A view and the segments replaced by a newer view, freed when
+   *             no query can see them.
+   */
+  struct Retired {
+    uint64_t epoch;                                   //!> Epoch of the replacement
+    std::unique_ptr<View> view;                       //!> The replaced view
+    std::vector< std::unique_ptr<Segment> > segments;  //!> The dropped segments
+  };
+
+  /**
+   * @brief      Query on one view (see Query).
+   *
+   * @param[in]  view          The view.
+   * @param[in]  hash          The query hash.
+   * @param[in]  k             The maximum number of candidates.
+   * @param[in]  eps           The maximum L1 distance between matching buckets.
+   * @param[in]  query_id      The frame id of the query (-1 if none).
+   * @param[in]  min_neighbor  The temporal exclusion window.
+   *
+   * @return     The candidates with overlap > 0, best first.
+   */
+  std::vector<Match> QueryView(const View& view,
+    const std::vector<float>& hash, const int& k, float eps,
+    const int& query_id, const int& min_neighbor) const;
+
+  /**
+   * @brief      Allocates an empty segment.
+   *
+   * @return     The segment.
+   */
+  std::unique_ptr<Segment> NewSegment() const;
+
+  /**
+   * @brief      Appends a row to a segment that has room, without publishing
+   *             it.
+   *
+   * @param      segment  The segment.
+   * @param[in]  id       The frame id.
+   * @param[in]  hash     The hash.
+   *
+   * @return     The row in the segment.
+   */
+  int AppendRow(Segment* segment, const int& id, const float* hash);
+
+  /**
+   * @brief      Publishes a view of the current segments and retires the
+   *             previous one with the dropped segments.
+   *
+   * @param[in]  dropped  The segments that are not used any more.
+   */
+  void Publish(std::vector< std::unique_ptr<Segment> > dropped);
+
+  /**
+   * @brief      Advances the epoch if no query is registered in the previous
+   *             one, and frees what no query can see. Never waits.
+   */
+  void Reclaim();
+
+ private:
+  ConcurrentDatabase(const ConcurrentDatabase&);
+  ConcurrentDatabase& operator=(const ConcurrentDatabase&);
+
+  // Properties
+  Params params_;                                   //!> Stores parameters
+  const Hash& hash_;                                //!> The hash object (projections and distance)
+  int hash_length_;                                 //!> Number of floats per hash
+  int hash_stride_;                                 //!> Aligned row length of the hashes
+  int num_buckets_;                                 //!> Number of buckets per hash
+  std::vector< std::unique_ptr<Segment> > segments_;  //!> The segments in use (writer only)
+  std::unique_ptr<View> view_;                      //!> The published view (writer only)
+  std::atomic<const View*> published_;              //!> The view read by the queries
+  std::deque<Retired> retired_;                     //!> Views and segments waiting to be freed
+  std::atomic<uint64_t> epoch_;                     //!> Current epoch
+  mutable std::atomic<int> readers_[2];             //!> Queries registered in the even and odd epochs
+  std::atomic<int> size_;                           //!> Published frames that are not removed
+  int num_removed_;                                 //!> Tombstones in the segments in use (writer only)
+  std::unordered_map<int, std::pair<Segment*, int> > rows_;  //!> Location of every frame id (writer only)
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_CONCURRENT_DATABASE_H_
@@ -0,0 +1,82 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_DISTANCE_PROFILE_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_DISTANCE_PROFILE_H_
+
+#include <algorithm>
+#include <vector>
+
+namespace haloc {
+
+/**
+ * @brief      Compact summary of all the bucket distances between two hashes.
+ *             The overlap for a threshold eps is the largest k such that some
+ *             cyclic shift has k bucket pairs with distance <= eps. That is,
+ *             the number of entries of eps_k that are <= eps, where eps_k[k-1]
+ *             is the minimum over the shifts of the k-th smallest bucket
+ *             distance. eps_k is sorted, so any threshold is answered with a
+ *             binary search.
+ */
+struct DistanceProfile {
+  /**
+   * @brief      Returns the overlap for a threshold. Same result as
+   *             Hash::CalcDist with this eps.
+   *
+   * @param[in]  eps   The maximum L1 distance between matching buckets.
+   *
+   * @return     The number of buckets seeing the same view.
+   */
+  inline int Overlap(const float& eps) const {
+    return std::upper_bound(eps_k.begin(), eps_k.end(), eps) - eps_k.begin();
+  }
+
+  /**
+   * @brief      Returns the overlap for every threshold.
+   *
+   * @param[in]  eps   The thresholds.
+   *
+   * @return     The overlap for every threshold.
+   */
+  inline std::vector<int> Overlap(const std::vector<float>& eps) const {
+    std::vector<int> overlap(eps.size());
+    for (size_t i=0; i < eps.size(); ++i)
+      overlap[i] = Overlap(eps[i]);
+    return overlap;
+  }
+
+  /**
+   * @brief      Returns a cyclic shift that gives the overlap of a threshold
+   *             (see Hash::CalcDist). When several shifts give it, this is
+   *             not always the smallest one.
+   *
+   * @param[in]  eps   The maximum L1 distance between matching buckets.
+   *
+   * @return     The shift (-1 if the overlap is 0).
+   */
+  inline int Shift(const float& eps) const {
+    const int overlap = Overlap(eps);
+    return (overlap == 0) ? -1 : shift_k[overlap - 1];
+  }
+
+  // Profile variables
+  std::vector<float> eps_k;  //!> Minimum threshold to overlap k+1 buckets (ascending)
+  std::vector<int> shift_k;  //!> The shift that reaches eps_k[k]
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_DISTANCE_PROFILE_H_
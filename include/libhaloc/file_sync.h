@@ -0,0 +1,46 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_FILE_SYNC_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_FILE_SYNC_H_
+
+#include <string>
+
+namespace haloc {
+
+/**
+ * @brief      Syncs the data of a file to disk.
+ *
+ * @param[in]  filename  The file.
+ *
+ * @return     False if the file cannot be opened or synced.
+ */
+bool SyncFile(const std::string& filename);
+
+/**
+ * @brief      Syncs the directory that contains a file, so its creation or
+ *             a rename over it survives a crash. Syncing the file itself
+ *             only covers its data, not its directory entry.
+ *
+ * @param[in]  filename  The file.
+ *
+ * @return     False if the directory cannot be opened or synced.
+ */
+bool SyncParentDirectory(const std::string& filename);
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_FILE_SYNC_H_
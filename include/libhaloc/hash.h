@@ -23,8 +23,19 @@
 #include <vector>
 #include <utility>
 #include <numeric>
+#include <memory>
+#include <limits>
 
+#include "libhaloc/aligned.h"
+#include "libhaloc/binary_signature.h"
+#include "libhaloc/bucketed_hash.h"
+#include "libhaloc/distance_profile.h"
+#include "libhaloc/hash_context.h"
+#include "libhaloc/hash_model.h"
 #include "libhaloc/publisher.h"
+#include "libhaloc/quantized_hash.h"
+#include "libhaloc/sparse_hash.h"
+#include "libhaloc/worker_pool.h"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/features2d/features2d.hpp>
@@ -34,26 +45,9 @@ namespace haloc {
 class Hash {
  public:
   /**
-   * @brief      Struct for class parameters
+   * @brief      The class parameters (see HashModel::Params).
    */
-  struct Params {
-    /**
-     * @brief      Default constructor
-     */
-    Params();
-
-    // Class parameters
-    int bucket_rows;             //!> Number of horizontal divisions for the descriptors bucketing
-    int bucket_cols;             //!> Number of vertical divisions for the descriptors bucketing
-    int max_desc;                //!> Maximum number of descriptors per image
-    int num_proj;                //!> Number of projections required
-
-    // Default values
-    static const int             DEFAULT_BUCKET_ROWS = 3;
-    static const int             DEFAULT_BUCKET_COLS = 4;
-    static const int             DEFAULT_MAX_DESC = 100;
-    static const int             DEFAULT_NUM_PROJ = 2;
-  };
+  typedef HashModel::Params Params;
 
   /**
    * @brief      Empty class constructor.
@@ -61,12 +55,14 @@ class Hash {
   Hash();
 
   /**
-   * @brief      Sets the parameters.
+   * @brief      Sets the parameters. The model is rebuilt with the next hash,
+   *             so the quantization and signature calibrations are reset.
    *
    * @param[in]  params  The parameters.
    */
   inline void SetParams(const Params& params) {
-    params_ = params; initialized_ = false;}
+    params_ = params; model_.reset(); context_ = HashContext(model_);
+    pool_.reset();}
 
   /**
    * @brief      Returns the parameters.
@@ -80,14 +76,65 @@ class Hash {
    *
    * @return     True if initialized, False otherwise.
    */
-  inline bool IsInitialized() const {return initialized_;}
+  inline bool IsInitialized() const {return static_cast<bool>(model_);}
 
   /**
-   * @brief      Gets the state.
+   * @brief      Gets the state of the last GetHash call.
    *
    * @return     The state.
    */
-  inline State GetState() const {return state_;}
+  inline State GetState() const {return context_.GetState();}
+
+  /**
+   * @brief      Returns the length of the hashes. Only valid once the class
+   *             is initialized.
+   *
+   * @return     The hash length.
+   */
+  inline int GetHashLength() const {
+    return params_.bucket_rows*params_.bucket_cols*params_.num_proj*
+      desc_length_;}
+
+  /**
+   * @brief      Returns true when the class hashes binary (CV_8U)
+   *             descriptors. Only valid once the class is initialized.
+   *
+   * @return     True for binary descriptors.
+   */
+  inline bool IsBinary() const {return model_ && model_->IsBinary();}
+
+  /**
+   * @brief      Returns the number of hash coefficients per projection of a
+   *             descriptor matrix: its columns for float (CV_32F)
+   *             descriptors and its bits for binary (CV_8U) ones, like ORB,
+   *             BRISK or AKAZE.
+   *
+   * @param[in]  desc  The descriptors.
+   *
+   * @return     The descriptor length.
+   */
+  static inline int GetDescriptorLength(const cv::Mat& desc) {
+    return HashModel::DescriptorLength(desc);}
+
+  /**
+   * @brief      Returns the projection model, to hash from other threads
+   *             with their own HashContext. Only valid once the class is
+   *             initialized.
+   *
+   * @return     The model (null if the class is not initialized).
+   */
+  inline std::shared_ptr<const HashModel> GetModel() const {return model_;}
+
+  /**
+   * @brief      Uses an existing projection model (e.g. the one of another
+   *             hash object or one loaded with HashModel::Load), so both
+   *             produce comparable hashes. The parameters are taken from the
+   *             model, except the number of threads, and so are the
+   *             quantization and signature calibrations.
+   *
+   * @param[in]  model  The model.
+   */
+  void SetModel(const std::shared_ptr<const HashModel>& model);
 
   /**
    * @brief      Bucket the features and compute a hash for every bucket.
@@ -101,97 +148,469 @@ class Hash {
   std::vector<float> GetHash(const std::vector<cv::KeyPoint>& kp,
     const cv::Mat& desc, const cv::Size& img_size);
 
+  /**
+   * @brief      Same as GetHash, but the hash is written into a caller
+   *             buffer. Once the scratch buffers of the class have grown to
+   *             the largest image seen, no memory is allocated.
+   *
+   * @param[in]  kp           The keypoints vector.
+   * @param[in]  desc         The descriptors.
+   * @param[in]  img_size     The image size.
+   * @param[out] hash         The output buffer.
+   * @param[in]  hash_length  The buffer length (at least GetHashLength(),
+   *                          which is known after the first hash).
+   *
+   * @return     False if the descriptors or the buffer are not valid.
+   */
+  bool GetHash(const std::vector<cv::KeyPoint>& kp, const cv::Mat& desc,
+    const cv::Size& img_size, float* hash, const int& hash_length);
+
+  /**
+   * @brief      Same as above with a vector, which is only resized when its
+   *             length is not GetHashLength().
+   *
+   * @param[in]  kp        The keypoints vector.
+   * @param[in]  desc      The descriptors.
+   * @param[in]  img_size  The image size.
+   * @param[out] hash      The output hash.
+   *
+   * @return     False if the descriptors are not valid.
+   */
+  bool GetHash(const std::vector<cv::KeyPoint>& kp, const cv::Mat& desc,
+    const cv::Size& img_size, std::vector<float>& hash);
+
+  /**
+   * @brief      Same as GetHash, but also returns the binary signature of the
+   *             hash.
+   *
+   * @param[in]  kp         The keypoints vector.
+   * @param[in]  desc       The descriptors.
+   * @param[in]  img_size   The image size.
+   * @param[out] signature  The binary signature.
+   *
+   * @return     The bucketed hash.
+   */
+  std::vector<float> GetHash(const std::vector<cv::KeyPoint>& kp,
+    const cv::Mat& desc, const cv::Size& img_size,
+    BinarySignature& signature);
+
+  /**
+   * @brief      Compute the hashes of a batch of images using a pool of
+   *             Params::num_threads threads. The projection model is the same
+   *             as in GetHash, so every row is identical to the hash GetHash
+   *             returns for the same image. The state is not updated.
+   *
+   * @param[in]  kp        The keypoints vector of every image.
+   * @param[in]  desc      The descriptors of every image.
+   * @param[in]  img_size  The size of every image.
+   * @param[out] hashes    The hashes, one per row (N x hash length, CV_32F).
+   *                       The matrix is only reallocated when its size or
+   *                       type does not match.
+   */
+  void GetHashes(const std::vector< std::vector<cv::KeyPoint> >& kp,
+    const std::vector<cv::Mat>& desc, const std::vector<cv::Size>& img_size,
+    cv::Mat& hashes);
+
+  /**
+   * @brief      Same as GetHash, but also computes the per-bucket metadata
+   *             used to speed up the distance computation.
+   *
+   * @param[in]  kp        The keypoints vector.
+   * @param[in]  desc      The descriptors.
+   * @param[in]  img_size  The image size.
+   *
+   * @return     The bucketed hash with its metadata.
+   */
+  BucketedHash GetBucketedHash(const std::vector<cv::KeyPoint>& kp,
+    const cv::Mat& desc, const cv::Size& img_size);
+
+  /**
+   * @brief      Computes the per-bucket metadata of a hash returned by
+   *             GetHash (e.g. to wrap previously stored hashes).
+   *
+   * @param[in]  hash  The hash.
+   *
+   * @return     The bucketed hash with its metadata.
+   */
+  BucketedHash BuildBucketedHash(const std::vector<float>& hash) const;
+
+  /**
+   * @brief      Computes the per-bucket metadata of a hash stored in a raw
+   *             buffer.
+   *
+   * @param[in]  hash        The hash (GetHashLength() elements).
+   * @param[out] bucket_sum  The sum of every bucket (one per bucket).
+   * @param[out] occupancy   The occupancy bitmask.
+   */
+  void SummarizeBuckets(const float* hash, float* bucket_sum,
+    uint64_t& occupancy) const;
+
   /**
    * @brief      Compute the distance between 2 hashes.
    *
    * @param[in]  hash_1  The hash 1.
    * @param[in]  hash_2  The hash 2.
+   * @param[in]  eps     The maximum L1 distance between matching buckets.
+   * @param[in]  prune   When true, a shift is abandoned as soon as it cannot
+   *                     beat the best one and the L1 accumulation of a bucket
+   *                     stops once it exceeds eps. The result is the same.
    *
    * @return     Distance: the number of buckets seeing the same view.
    */
   int CalcDist(const std::vector<float>& hash_1,
-    const std::vector<float>& hash_2, float eps);
+    const std::vector<float>& hash_2, float eps, bool prune = false) const;
 
   /**
-   * @brief      Publishes the state and debug variables. Must be called after a
-   *             hash computation.
+   * @brief      Compute the distance between 2 bucketed hashes. Same result as
+   *             the plain version, but the empty buckets are skipped with bit
+   *             operations and the bucket pairs whose sums differ more than
+   *             eps are rejected without reading their coefficients, since
+   *             |sum_a - sum_b| is a lower bound of their L1 distance.
    *
-   * @param[in]  img   The original image
+   * @param[in]  hash_1  The hash 1.
+   * @param[in]  hash_2  The hash 2.
+   * @param[in]  eps     The maximum L1 distance between matching buckets.
+   * @param[in]  prune   When true, shifts that cannot beat the best one are
+   *                     abandoned and the L1 accumulation of a bucket stops
+   *                     once it exceeds eps. The result is the same.
+   *
+   * @return     Distance: the number of buckets seeing the same view.
    */
-  void PublishState(const cv::Mat& img);
+  int CalcDist(const BucketedHash& hash_1, const BucketedHash& hash_2,
+    float eps, bool prune = false) const;
 
- protected:
   /**
-   * @brief      Init the class.
+   * @brief      Same as above, also returning the cyclic shift that gives the
+   *             overlap: bucket j of hash 1 is paired with bucket
+   *             (j + best_shift) % num_buckets of hash 2. When several shifts
+   *             give the same overlap, the smallest one is returned.
    *
-   * @param[in]  img_size     The image size.
-   * @param[in]  num_feat     The number of features for the input image.
-   * @param[in]  desc_length  The descriptor length
+   * @param[in]  hash_1      The hash 1.
+   * @param[in]  hash_2      The hash 2.
+   * @param[in]  eps         The maximum L1 distance between matching buckets.
+   * @param[out] best_shift  The best shift (-1 if the overlap is 0).
+   * @param[in]  prune       True to enable the early termination. The result
+   *                         and the shift are the same.
+   *
+   * @return     Distance: the number of buckets seeing the same view.
    */
-  void Init(const cv::Size& img_size, const int& num_feat,
-    const int& desc_length);
+  int CalcDist(const BucketedHash& hash_1, const BucketedHash& hash_2,
+    float eps, int& best_shift, bool prune = false) const;
 
   /**
-   * @brief      Compute the combinations required for the match calculation
+   * @brief      Same as above for hashes and metadata stored in raw buffers
+   *             (e.g. the rows of a contiguous database).
+   *
+   * @param[in]  hash_1       The hash 1.
+   * @param[in]  sum_1        The bucket sums of hash 1.
+   * @param[in]  occupancy_1  The occupancy bitmask of hash 1.
+   * @param[in]  hash_2       The hash 2.
+   * @param[in]  sum_2        The bucket sums of hash 2.
+   * @param[in]  occupancy_2  The occupancy bitmask of hash 2.
+   * @param[in]  eps          The maximum L1 distance between matching buckets.
+   * @param[in]  prune        True to enable the early termination.
+   *
+   * @return     Distance: the number of buckets seeing the same view.
    */
-  void InitCombinations();
+  int CalcDist(const float* hash_1, const float* sum_1,
+    const uint64_t& occupancy_1, const float* hash_2, const float* sum_2,
+    const uint64_t& occupancy_2, float eps, bool prune = false) const;
+
+  /**
+   * @brief      Same as above, also returning the best shift (see the
+   *             BucketedHash version).
+   */
+  int CalcDist(const float* hash_1, const float* sum_1,
+    const uint64_t& occupancy_1, const float* hash_2, const float* sum_2,
+    const uint64_t& occupancy_2, float eps, int& best_shift,
+    bool prune = false) const;
 
   /**
-   * @brief      Initializes the random vectors for projections.
+   * @brief      Compute the distance between 2 hashes for several thresholds.
+   *             The bucket distances are computed only once.
    *
-   * @param[in]  size  The size.
+   * @param[in]  hash_1  The hash 1.
+   * @param[in]  hash_2  The hash 2.
+   * @param[in]  eps     The thresholds.
+   *
+   * @return     The distance (number of overlapping buckets) for every
+   *             threshold, the same as calling CalcDist with each of them.
    */
-  void InitProjections(const int& size);
+  std::vector<int> CalcDist(const BucketedHash& hash_1,
+    const BucketedHash& hash_2, const std::vector<float>& eps) const;
 
   /**
-   * @brief      Calculates a random vector.
+   * @brief      Compute the distance profile between 2 hashes, which gives the
+   *             distance for any threshold up to max_eps without touching the
+   *             hashes again.
    *
-   * @param[in]  size  The size.
-   * @param[in]  seed  The seed.
+   * @param[in]  hash_1   The hash 1.
+   * @param[in]  hash_2   The hash 2.
+   * @param[in]  max_eps  The largest threshold that will be queried. Bucket
+   *                      pairs further than max_eps are discarded early.
    *
-   * @return     The random vector.
+   * @return     The distance profile.
+   */
+  DistanceProfile CalcDistProfile(const BucketedHash& hash_1,
+    const BucketedHash& hash_2,
+    float max_eps = std::numeric_limits<float>::infinity()) const;
+
+  /**
+   * @brief      Same as above for hashes returned by GetHash.
    */
-  std::vector<float> ComputeRandomVector(const int& size, int seed);
+  DistanceProfile CalcDistProfile(const std::vector<float>& hash_1,
+    const std::vector<float>& hash_2,
+    float max_eps = std::numeric_limits<float>::infinity()) const;
 
   /**
-   * @brief      Makes a vector unitary.
+   * @brief      Same as GetHash, but the empty buckets are left out.
    *
-   * @param[in]  x     The input vector.
+   * @param[in]  kp        The keypoints vector.
+   * @param[in]  desc      The descriptors.
+   * @param[in]  img_size  The image size.
    *
-   * @return     The output unit vector.
+   * @return     The sparse hash.
    */
-  std::vector<float> UnitVector(const std::vector<float>& x);
+  SparseHash GetSparseHash(const std::vector<cv::KeyPoint>& kp,
+    const cv::Mat& desc, const cv::Size& img_size);
 
   /**
-   * @brief      Bucket the descriptors.
+   * @brief      Converts a hash returned by GetHash to the sparse format.
+   *             Only supported up to kMaxMaskBuckets buckets.
    *
-   * @param[in]  kp    The keypoint vector.
-   * @param[in]  desc  The descriptors.
+   * @param[in]  hash  The hash.
    *
-   * @return     The bucketed descriptors.
+   * @return     The sparse hash (empty on error).
    */
-  std::vector<cv::Mat> BucketDescriptors(const std::vector<cv::KeyPoint>& kp,
-    const cv::Mat& desc);
+  SparseHash ToSparse(const std::vector<float>& hash) const;
 
   /**
-   * @brief      Compute the hash by projecting the descriptors.
+   * @brief      Converts a sparse hash back to the format of GetHash.
    *
-   * @param[in]  desc  The descriptors.
+   * @param[in]  hash  The sparse hash.
    *
    * @return     The hash.
    */
-  std::vector<float> ProjectDescriptors(const cv::Mat& desc);
+  std::vector<float> ToDense(const SparseHash& hash) const;
+
+  /**
+   * @brief      Compute the distance between 2 sparse hashes. Same result as
+   *             for the dense hashes, but only the pairs of populated buckets
+   *             are visited.
+   *
+   * @param[in]  hash_1  The hash 1.
+   * @param[in]  hash_2  The hash 2.
+   * @param[in]  eps     The maximum L1 distance between matching buckets.
+   * @param[in]  prune   True to enable the early termination.
+   *
+   * @return     Distance: the number of buckets seeing the same view.
+   */
+  int CalcDist(const SparseHash& hash_1, const SparseHash& hash_2, float eps,
+    bool prune = false) const;
+
+  /**
+   * @brief      Calibrates the uint8 quantization so that the range of the
+   *             coefficients of the non-empty buckets (without the 0.1%
+   *             tails at each side) maps to [0, 255]. The calibration is
+   *             stored in the model (see SetQuantization).
+   *
+   * @param[in]  hashes  A representative set of hashes returned by GetHash.
+   *
+   * @return     False if the hashes have no valid coefficients.
+   */
+  bool CalibrateQuantization(const std::vector< std::vector<float> >& hashes);
+
+  /**
+   * @brief      Sets the quantization (e.g. a previously calibrated one).
+   *             Only valid once the class is initialized: the model is
+   *             replaced by a calibrated copy with the same fingerprint, so
+   *             GetModel and HashModel::Save carry the calibration.
+   *
+   * @param[in]  offset  The value of code 0.
+   * @param[in]  scale   The value step between consecutive codes (> 0).
+   */
+  void SetQuantization(const float& offset, const float& scale);
+
+  /**
+   * @brief      Returns the value of code 0.
+   *
+   * @return     The quantization offset.
+   */
+  inline float GetQuantizationOffset() const {
+    return GetCalibration().quant_offset;}
+
+  /**
+   * @brief      Returns the value step between consecutive codes.
+   *
+   * @return     The quantization scale.
+   */
+  inline float GetQuantizationScale() const {
+    return GetCalibration().quant_scale;}
+
+  /**
+   * @brief      Determines if the quantization was calibrated or set. The
+   *             default one (codes of 1/255 from 0) does not fit the range of
+   *             the hashes.
+   *
+   * @return     True if the quantization is not the default one.
+   */
+  bool IsQuantizationCalibrated() const;
+
+  /**
+   * @brief      Quantizes a hash to one byte per coefficient. Only supported
+   *             up to kMaxMaskBuckets buckets.
+   *
+   * @param[in]  hash  The hash, as returned by GetHash.
+   *
+   * @return     The quantized hash (empty on error).
+   */
+  QuantizedHash Quantize(const std::vector<float>& hash) const;
+
+  /**
+   * @brief      Approximate distance between 2 quantized hashes. The L1
+   *             distance between buckets is scale times the sum of absolute
+   *             differences of their codes, which is computed with the
+   *             PSADBW/VPSADBW kernels.
+   *
+   * @param[in]  hash_1  The hash 1.
+   * @param[in]  hash_2  The hash 2.
+   * @param[in]  eps     The maximum L1 distance between matching buckets.
+   * @param[in]  prune   True to enable the early termination.
+   *
+   * @return     Distance: the number of buckets seeing the same view.
+   */
+  int CalcDist(const QuantizedHash& hash_1, const QuantizedHash& hash_2,
+    float eps, bool prune = false) const;
+
+  /**
+   * @brief      Same as above for quantized hashes stored in raw buffers.
+   *
+   * @param[in]  code_1       The codes of hash 1.
+   * @param[in]  sum_1        The bucket code sums of hash 1.
+   * @param[in]  occupancy_1  The occupancy bitmask of hash 1.
+   * @param[in]  code_2       The codes of hash 2.
+   * @param[in]  sum_2        The bucket code sums of hash 2.
+   * @param[in]  occupancy_2  The occupancy bitmask of hash 2.
+   * @param[in]  eps          The maximum L1 distance between matching buckets.
+   * @param[in]  prune        True to enable the early termination.
+   *
+   * @return     Distance: the number of buckets seeing the same view.
+   */
+  int CalcDist(const uint8_t* code_1, const uint32_t* sum_1,
+    const uint64_t& occupancy_1, const uint8_t* code_2, const uint32_t* sum_2,
+    const uint64_t& occupancy_2, float eps, bool prune = false) const;
+
+  /**
+   * @brief      Learns the binary signature thresholds: the median of every
+   *             coefficient of the bucket vectors, over the non-empty buckets
+   *             of a set of hashes. The same thresholds are used for all the
+   *             buckets, so the signatures of different buckets stay
+   *             comparable under the cyclic shifts. Until this is called the
+   *             threshold is 0.5, the value of a null projection.
+   *
+   * @param[in]  hashes  A representative set of hashes returned by GetHash.
+   *
+   * @return     False if the hashes have no valid coefficients.
+   */
+  bool CalibrateSignature(const std::vector< std::vector<float> >& hashes);
+
+  /**
+   * @brief      Sets the binary signature thresholds (e.g. previously
+   *             calibrated ones). Only valid once the class is initialized,
+   *             they are stored in the model as in SetQuantization.
+   *
+   * @param[in]  medians  One threshold per bucket coefficient (empty for
+   *                      0.5).
+   */
+  void SetSignatureMedians(const std::vector<float>& medians);
+
+  /**
+   * @brief      Returns the binary signature thresholds.
+   *
+   * @return     One threshold per bucket coefficient (empty if not
+   *             calibrated).
+   */
+  inline std::vector<float> GetSignatureMedians() const {
+    return GetCalibration().sign_median;}
+
+  /**
+   * @brief      Computes the binary signature of a hash. Only supported up to
+   *             kMaxMaskBuckets buckets.
+   *
+   * @param[in]  hash  The hash, as returned by GetHash.
+   *
+   * @return     The signature (empty on error).
+   */
+  BinarySignature GetSignature(const std::vector<float>& hash) const;
+
+  /**
+   * @brief      Coarse distance between 2 binary signatures, with the same
+   *             semantics as CalcDist: the maximum over the cyclic shifts of
+   *             the number of non-empty bucket pairs whose Hamming distance is
+   *             <= max_bits.
+   *
+   * @param[in]  signature_1  The signature 1.
+   * @param[in]  signature_2  The signature 2.
+   * @param[in]  max_bits     The maximum Hamming distance between matching
+   *                          buckets (>= 0).
+   * @param[in]  prune        True to abandon the shifts that cannot beat the
+   *                          best one. The result is the same.
+   *
+   * @return     Distance: the number of buckets seeing the same view.
+   */
+  int CalcDist(const BinarySignature& signature_1,
+    const BinarySignature& signature_2, const int& max_bits,
+    bool prune = false) const;
+
+  /**
+   * @brief      Publishes the state and debug variables. Must be called after a
+   *             hash computation.
+   *
+   * @param[in]  img   The original image
+   */
+  void PublishState(const cv::Mat& img);
+
+ protected:
+  /**
+   * @brief      Init the class.
+   *
+   * @param[in]  img_size     The image size.
+   * @param[in]  num_feat     The number of features for the input image.
+   * @param[in]  desc_length  The descriptor length
+   * @param[in]  binary       True for binary descriptors
+   */
+  void Init(const cv::Size& img_size, const int& num_feat,
+    const int& desc_length, const bool& binary);
+
+  /**
+   * @brief      Compute the combinations required for the match calculation
+   */
+  void InitCombinations();
+
+  /**
+   * @brief      Returns the calibration of the model (the default one until
+   *             the class is initialized).
+   *
+   * @return     The calibration.
+   */
+  const HashModel::Calibration& GetCalibration() const;
+
+  /**
+   * @brief      Replaces the model by a copy with another calibration.
+   *
+   * @param[in]  calibration  The calibration.
+   */
+  void SetCalibration(const HashModel::Calibration& calibration);
 
  private:
   // Properties
   Params params_;                        //!> Stores parameters
-  State state_;                          //!> Stores the state after every hash computation
-  cv::Size img_size_;                    //!> Image size (only needed for bucketing)
-  int desc_length_;                      //!> The length of the descriptors used
-  std::vector< std::vector<float> > r_;  //!> Vector of random values
-  bool initialized_;                     //!> True when class has been initialized
+  std::shared_ptr<const HashModel> model_;  //!> The projection model (null until initialized)
+  HashContext context_;                  //!> Working buffers and state of GetHash
+  int desc_length_;                      //!> The descriptor length of the model
   std::vector< std::vector< std::pair<int, int> > > comb_;  //!> Combinations for the match
   Publisher pub_;                        //!> The publisher for debugging purposes
+  std::shared_ptr<WorkerPool> pool_;     //!> The threads for batch hashing
 };
 
 }  // namespace haloc
@@ -0,0 +1,113 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_HASH_CONTEXT_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_HASH_CONTEXT_H_
+
+#include <memory>
+#include <vector>
+
+#include "libhaloc/hash_model.h"
+#include "libhaloc/state.h"
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace haloc {
+
+/**
+ * @brief      Per-thread hashing context: the working buffers and the state
+ *             of the last hash computed with a shared HashModel. Contexts are
+ *             cheap, so every thread (e.g. every camera of a rig) keeps its
+ *             own and no lock is needed. A context must not be used by two
+ *             threads at the same time.
+ */
+class HashContext {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  model     The model.
+   * @param[in]  num_feat  The expected number of keypoints per image, to
+   *                       reserve the working buffers (0 to grow on demand).
+   */
+  explicit HashContext(const std::shared_ptr<const HashModel>& model,
+    const int& num_feat = 0);
+
+  /**
+   * @brief      Returns the model.
+   *
+   * @return     The model.
+   */
+  inline std::shared_ptr<const HashModel> GetModel() const {return model_;}
+
+  /**
+   * @brief      Returns the state of the last hash computation.
+   *
+   * @return     The state.
+   */
+  inline const State& GetState() const {return state_;}
+
+  /**
+   * @brief      Bucket the features and compute a hash for every bucket.
+   *
+   * @param[in]  kp    The keypoints vector.
+   * @param[in]  desc  The descriptors.
+   *
+   * @return     The bucketed hash (empty on error).
+   */
+  std::vector<float> GetHash(const std::vector<cv::KeyPoint>& kp,
+    const cv::Mat& desc);
+
+  /**
+   * @brief      Same as above, but the hash is written into a caller buffer.
+   *             Once the working buffers have grown to the largest image
+   *             seen, no memory is allocated.
+   *
+   * @param[in]  kp           The keypoints vector.
+   * @param[in]  desc         The descriptors.
+   * @param[out] hash         The output buffer.
+   * @param[in]  hash_length  The buffer length (at least
+   *                          HashModel::GetHashLength()).
+   *
+   * @return     False if the descriptors or the buffer are not valid.
+   */
+  bool GetHash(const std::vector<cv::KeyPoint>& kp, const cv::Mat& desc,
+    float* hash, const int& hash_length);
+
+  /**
+   * @brief      Same as above with a vector, which is only resized when its
+   *             length is not the hash length.
+   *
+   * @param[in]  kp    The keypoints vector.
+   * @param[in]  desc  The descriptors.
+   * @param[out] hash  The output hash.
+   *
+   * @return     False if the descriptors are not valid.
+   */
+  bool GetHash(const std::vector<cv::KeyPoint>& kp, const cv::Mat& desc,
+    std::vector<float>& hash);
+
+ private:
+  // Properties
+  std::shared_ptr<const HashModel> model_;  //!> The shared projection model
+  State state_;                             //!> The state after the last hash
+  HashModel::Scratch scratch_;              //!> The working buffers
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_HASH_CONTEXT_H_
@@ -0,0 +1,311 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_HASH_DATABASE_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_HASH_DATABASE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "libhaloc/aligned.h"
+#include "libhaloc/hash.h"
+#include "libhaloc/worker_pool.h"
+
+namespace haloc {
+
+/**
+ * @brief      A database candidate returned by the queries.
+ */
+struct Match {
+  /**
+   * @brief      Default constructor.
+   */
+  Match() : id(-1), overlap(0) {}
+
+  /**
+   * @brief      Constructor.
+   *
+   * @param[in]  id       The frame id.
+   * @param[in]  overlap  The overlap with the query.
+   */
+  Match(const int& id, const int& overlap) : id(id), overlap(overlap) {}
+
+  /**
+   * @brief      Ranking order: larger overlap first, then smaller id.
+   *
+   * @param[in]  other  The other match.
+   *
+   * @return     True if this match ranks before the other one.
+   */
+  inline bool operator<(const Match& other) const {
+    return (overlap > other.overlap) ||
+      (overlap == other.overlap && id < other.id);
+  }
+
+  // Match variables
+  int id;       //!> The frame id
+  int overlap;  //!> The number of buckets seeing the same view
+};
+
+/**
+ * @brief      Stores the hashes of a set of frames and finds the best loop
+ *             closing candidates for a query hash. The hashes, bucket sums and
+ *             occupancy masks are kept as separate contiguous arrays
+ *             (structure of arrays) with 64-byte aligned hash rows, so the
+ *             scan streams through memory without any pointer chasing.
+ */
+class HashDatabase {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int num_threads;             //!> Number of threads for the queries (0 = all cores)
+    int min_parallel_size;       //!> Minimum database size to use the threads
+
+    // Default values
+    static const int             DEFAULT_NUM_THREADS = 0;
+    static const int             DEFAULT_MIN_PARALLEL_SIZE = 256;
+  };
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash  The hash object that produces the hashes. It must
+   *                   outlive the database and keep its parameters.
+   */
+  explicit HashDatabase(const Hash& hash);
+
+  /**
+   * @brief      Sets the parameters.
+   *
+   * @param[in]  params  The parameters.
+   */
+  inline void SetParams(const Params& params) {
+    params_ = params;
+    pool_.reset(new WorkerPool(params_.num_threads));}
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Returns the number of stored hashes.
+   *
+   * @return     The size.
+   */
+  inline int Size() const {return ids_.size();}
+
+  /**
+   * @brief      Determines if a frame is stored.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     True if the frame is stored.
+   */
+  inline bool Contains(const int& id) const {return rows_.count(id) > 0;}
+
+  /**
+   * @brief      Adds the hash of a frame.
+   *
+   * @param[in]  id    The frame id.
+   * @param[in]  hash  The hash, as returned by Hash::GetHash.
+   *
+   * @return     False if the id already exists or the hash length is wrong.
+   */
+  bool Add(const int& id, const std::vector<float>& hash);
+
+  /**
+   * @brief      Removes the hash of a frame.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     False if the id does not exist.
+   */
+  bool Remove(const int& id);
+
+  /**
+   * @brief      Removes all the hashes.
+   */
+  void Clear();
+
+  /**
+   * @brief      Returns the stored hash of a frame.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     The hash (empty if the id does not exist).
+   */
+  std::vector<float> GetHash(const int& id) const;
+
+  /**
+   * @brief      Finds the k frames with the largest overlap with the query.
+   *             The database is scanned by several threads, each one keeping
+   *             a bounded heap with its best k candidates. Several threads
+   *             can query at once (the scans share the pool in turns).
+   *
+   * @param[in]  hash          The query hash, as returned by Hash::GetHash.
+   * @param[in]  k             The maximum number of candidates.
+   * @param[in]  eps           The maximum L1 distance between matching buckets.
+   * @param[in]  query_id      The frame id of the query (-1 if none).
+   * @param[in]  min_neighbor  When query_id >= 0, the frames with
+   *                           |id - query_id| <= min_neighbor are skipped.
+   *
+   * @return     The candidates with overlap > 0, best first.
+   */
+  std::vector<Match> Query(const std::vector<float>& hash, const int& k,
+    float eps, const int& query_id = -1, const int& min_neighbor = 0) const;
+
+  /**
+   * @brief      Same as Query, but only the given frames are scored. Used to
+   *             rerank the candidates retrieved by an index.
+   *
+   * @param[in]  hash          The query hash, as returned by Hash::GetHash.
+   * @param[in]  ids           The frame ids to score (unknown ids are skipped).
+   * @param[in]  k             The maximum number of candidates.
+   * @param[in]  eps           The maximum L1 distance between matching buckets.
+   * @param[in]  query_id      The frame id of the query (-1 if none).
+   * @param[in]  min_neighbor  When query_id >= 0, the frames with
+   *                           |id - query_id| <= min_neighbor are skipped.
+   *
+   * @return     The candidates with overlap > 0, best first.
+   */
+  std::vector<Match> Rerank(const std::vector<float>& hash,
+    const std::vector<int>& ids, const int& k, float eps,
+    const int& query_id = -1, const int& min_neighbor = 0) const;
+
+ private:
+  // Properties
+  Params params_;                         //!> Stores parameters
+  const Hash& hash_;                      //!> The hash object (projections and distance)
+  int hash_length_;                       //!> Number of floats per hash
+  int hash_stride_;                       //!> Aligned row length of hashes_
+  int num_buckets_;                       //!> Number of buckets per hash
+  AlignedFloatVector hashes_;             //!> The hashes, one aligned row per frame
+  std::vector<float> bucket_sums_;        //!> The bucket sums, num_buckets_ per frame
+  std::vector<uint64_t> occupancy_;       //!> The occupancy bitmask of every frame
+  std::vector<int> ids_;                  //!> The frame id of every row
+  std::unordered_map<int, int> rows_;     //!> The row of every frame id
+  std::unique_ptr<WorkerPool> pool_;      //!> The threads for the queries
+};
+
+/**
+ * @brief      Bounded heap that keeps the k best matches.
+ */
+class TopMatches {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  k     The maximum number of matches.
+   */
+  explicit TopMatches(const int& k) : k_(k) {}
+
+  /**
+   * @brief      Adds a match if it ranks among the k best.
+   *
+   * @param[in]  match  The match.
+   */
+  void Push(const Match& match);
+
+  /**
+   * @brief      Returns the matches, best first. Empties the heap.
+   *
+   * @return     The sorted matches.
+   */
+  std::vector<Match> Sorted();
+
+ private:
+  // Properties
+  int k_;                     //!> The maximum number of matches
+  std::vector<Match> heap_;   //!> Heap with the worst kept match on top
+};
+
+/**
+ * @brief      Scans the rows of a database for the k best matches. This is
+ *             the query loop of every database: only the row layout and the
+ *             distance change, and they come in as functors. Large scans are
+ *             split in chunks over the threads, every chunk keeps its own
+ *             bounded heap and the heaps are merged at the end, so the
+ *             result does not depend on the number of threads.
+ *
+ * @param[in]  num_rows           The number of rows.
+ * @param[in]  k                  The maximum number of matches.
+ * @param[in]  query_id           The frame id of the query (-1 if none).
+ * @param[in]  min_neighbor       The temporal exclusion window.
+ * @param[in]  row_id             int(int row): the frame id of a row.
+ * @param[in]  row_overlap        int(int row): the overlap of the query with
+ *                                a row (0 skips the row). Called from
+ *                                several threads at once.
+ * @param      pool               The threads (NULL scans serially).
+ * @param[in]  min_parallel_size  The minimum number of rows to use the
+ *                                threads.
+ *
+ * @return     The matches with overlap > 0, best first.
+ */
+template <typename RowId, typename RowOverlap>
+std::vector<Match> ScanTopMatches(const int& num_rows, const int& k,
+    const int& query_id, const int& min_neighbor, const RowId& row_id,
+    const RowOverlap& row_overlap, WorkerPool* pool = NULL,
+    const int& min_parallel_size = 0) {
+  const auto scan = [&](const int& begin, const int& end, TopMatches& top) {
+    for (int row=begin; row < end; ++row) {
+      // Temporal neighbours are never loop closings
+      const int id = row_id(row);
+      if (query_id >= 0 && abs(id - query_id) <= min_neighbor) continue;
+
+      const int overlap = row_overlap(row);
+      if (overlap > 0) top.Push(Match(id, overlap));
+    }
+  };
+  TopMatches top(k);
+  if (num_rows <= 0 || k <= 0) return top.Sorted();
+
+  // Small databases are not worth the synchronization
+  if (!pool || num_rows < min_parallel_size) {
+    scan(0, num_rows, top);
+    return top.Sorted();
+  }
+  std::mutex top_mutex;
+  const int grain = std::max(64, num_rows / (4 * pool->GetNumThreads()));
+  pool->ParallelFor(num_rows, grain, [&](int begin, int end) {
+    TopMatches chunk(k);
+    scan(begin, end, chunk);
+    const std::vector<Match> matches = chunk.Sorted();
+    std::lock_guard<std::mutex> lock(top_mutex);
+    for (uint i=0; i < matches.size(); ++i) top.Push(matches[i]);
+  });
+  return top.Sorted();
+}
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_HASH_DATABASE_H_
@@ -0,0 +1,218 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_HASH_LOG_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_HASH_LOG_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libhaloc/hash.h"
+
+namespace haloc {
+
+/**
+ * @brief      Crash-safe append-only log of the inserted hashes. Every record
+ *             holds a frame id and its hash, protected by a CRC-32. Append
+ *             only copies the record to a memory buffer; a background thread
+ *             writes the buffered records in batches and syncs them to disk,
+ *             so at most Params::sync_period milliseconds of hashes are lost
+ *             on a crash. The torn records at the end of the file (short or
+ *             never written, as a crash while writing a batch leaves them)
+ *             are detected and dropped on Open, but a corrupted record
+ *             followed by valid ones makes Open fail and the file is left
+ *             as it is, since those records would be lost. Compact folds the
+ *             log into a MappedDatabase snapshot.
+ */
+class HashLog {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int sync_period;             //!> Maximum time (ms) between disk syncs
+    int max_pending;             //!> Buffered records that trigger an early sync
+
+    // Default values
+    static const int             DEFAULT_SYNC_PERIOD = 100;
+    static const int             DEFAULT_MAX_PENDING = 64;
+  };
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash  The hash object that produces the hashes. It must
+   *                   outlive the log and keep its model.
+   */
+  explicit HashLog(const Hash& hash);
+
+  /**
+   * @brief      Class destructor. Syncs the buffered records and closes the
+   *             log.
+   */
+  ~HashLog();
+
+  /**
+   * @brief      Sets the parameters. Only used by the next Open.
+   *
+   * @param[in]  params  The parameters.
+   */
+  inline void SetParams(const Params& params) {params_ = params;}
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Opens the log for appending, creating it if needed, and
+   *             starts the background writer. The hash object must be
+   *             initialized with the model that produced the logged hashes.
+   *
+   * @param[in]  filename  The log file.
+   * @param[in]  snapshot  The snapshot file written by Compact and read by
+   *                       Recover (empty for none).
+   *
+   * @return     False if the log cannot be opened, was written with a
+   *             different hashing model or has a corrupted record followed
+   *             by valid ones.
+   */
+  bool Open(const std::string& filename, const std::string& snapshot = "");
+
+  /**
+   * @brief      Syncs the buffered records, stops the background writer and
+   *             closes the log.
+   */
+  void Close();
+
+  /**
+   * @brief      Determines if the log is open.
+   *
+   * @return     True if the log is open.
+   */
+  inline bool IsOpen() const {return fd_ >= 0;}
+
+  /**
+   * @brief      Appends the hash of a frame. Does not wait for the disk.
+   *
+   * @param[in]  id    The frame id.
+   * @param[in]  hash  The hash, as returned by Hash::GetHash.
+   *
+   * @return     False if the log is not open, the hash length is wrong or a
+   *             previous write failed.
+   */
+  bool Append(const int& id, const std::vector<float>& hash);
+
+  /**
+   * @brief      Waits until all the appended records are synced to disk.
+   *
+   * @return     False if a write failed.
+   */
+  bool Flush();
+
+  /**
+   * @brief      Reads the snapshot and the synced log. When a frame appears
+   *             several times, the last hash is kept.
+   *
+   * @param[out] ids     The frame ids, in insertion order.
+   * @param[out] hashes  The hash of every frame.
+   *
+   * @return     False if the snapshot or the log cannot be read.
+   */
+  bool Recover(std::vector<int>& ids,
+    std::vector< std::vector<float> >& hashes);
+
+  /**
+   * @brief      Folds the records synced so far into the snapshot and empties
+   *             the log. The snapshot is replaced atomically before the log
+   *             is truncated, so a crash in between only replays records
+   *             that are already in the snapshot. Append does not wait for
+   *             the compaction.
+   *
+   * @return     False if there is no snapshot file or it cannot be written.
+   */
+  bool Compact();
+
+ protected:
+  /**
+   * @brief      Reads the records of the log file, up to the first bad
+   *             record when no valid record follows it (torn by a crash).
+   *
+   * @param[out] valid_size  The bytes up to the end of the last valid record.
+   * @param[out] ids         The frame ids (NULL to only validate).
+   * @param[out] hashes      The hashes (NULL to only validate).
+   *
+   * @return     False if the file cannot be read or a bad record is followed
+   *             by a valid one.
+   */
+  bool ReadRecords(uint64_t& valid_size, std::vector<int>* ids,
+    std::vector< std::vector<float> >* hashes) const;
+
+  /**
+   * @brief      Same as Recover, without syncing the buffered records.
+   *
+   * @param[out] ids     The frame ids.
+   * @param[out] hashes  The hash of every frame.
+   *
+   * @return     False if the snapshot or the log cannot be read.
+   */
+  bool ReadAll(std::vector<int>& ids,
+    std::vector< std::vector<float> >& hashes) const;
+
+  /**
+   * @brief      Main loop of the background writer.
+   */
+  void WriterLoop();
+
+ private:
+  // Properties
+  Params params_;                         //!> Stores parameters
+  const Hash& hash_;                      //!> The hash object (model and layout)
+  std::string filename_;                  //!> The log file
+  std::string snapshot_;                  //!> The snapshot file
+  int fd_;                                //!> The log file descriptor (-1 if closed)
+  int hash_length_;                       //!> Floats per logged hash
+  std::thread writer_;                    //!> The background writer
+  std::mutex mutex_;                      //!> Protects the buffer and the counters
+  std::mutex io_mutex_;                   //!> Serializes the file writes and the compaction
+  std::condition_variable writer_cv_;     //!> Wakes the writer
+  std::condition_variable synced_cv_;     //!> Signals a sync
+  std::vector<char> pending_;             //!> Records waiting for the writer
+  std::vector<char> batch_;               //!> Records being written
+  int num_pending_;                       //!> Records in pending_
+  uint64_t appended_;                     //!> Records appended since Open
+  uint64_t synced_;                       //!> Records synced since Open
+  bool flush_;                            //!> True when a Flush is waiting
+  bool stop_;                             //!> True to stop the writer
+  bool failed_;                           //!> True after a write error
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_HASH_LOG_H_
@@ -0,0 +1,360 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_HASH_MODEL_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_HASH_MODEL_H_
+
+#include <Eigen/Eigen>
+#include <Eigen/Dense>
+
+#include <stdint.h>
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "libhaloc/aligned.h"
+#include "libhaloc/state.h"
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace haloc {
+
+/**
+ * @brief      The projection model of the hashes: the parameters, the
+ *             descriptor layout and the random projection vectors. It is
+ *             immutable once built, so a single model can be shared (e.g.
+ *             through a std::shared_ptr<const HashModel>) by any number of
+ *             threads, each one hashing with its own HashContext. The
+ *             calibration of the quantized hashes and binary signatures is
+ *             part of the model too, since it only holds for the hashes of
+ *             these projections.
+ */
+class HashModel {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int bucket_rows;             //!> Number of horizontal divisions for the descriptors bucketing
+    int bucket_cols;             //!> Number of vertical divisions for the descriptors bucketing
+    int max_desc;                //!> Maximum number of descriptors per image
+    int num_proj;                //!> Number of projections required
+    int num_threads;             //!> Number of threads for batch hashing (0 = all cores)
+    unsigned int seed;           //!> Seed of the projection vectors
+
+    // Default values
+    static const int             DEFAULT_BUCKET_ROWS = 3;
+    static const int             DEFAULT_BUCKET_COLS = 4;
+    static const int             DEFAULT_MAX_DESC = 100;
+    static const int             DEFAULT_NUM_PROJ = 2;
+    static const int             DEFAULT_NUM_THREADS = 0;
+    static const unsigned int    DEFAULT_SEED = 0;
+  };
+
+  /**
+   * @brief      Calibration of the compact representations of the hashes,
+   *             learnt from a set of hashes (see Hash::CalibrateQuantization
+   *             and Hash::CalibrateSignature). It does not change the hashes,
+   *             so it is not part of the fingerprint.
+   */
+  struct Calibration {
+    /**
+     * @brief      Default constructor: codes of 1/255 from 0 and the
+     *             signature threshold of a null projection (0.5).
+     */
+    Calibration();
+
+    float quant_offset;              //!> Value of the quantization code 0
+    float quant_scale;               //!> Value step between quantization codes
+    std::vector<float> sign_median;  //!> Binary signature threshold of every bucket coefficient (empty = 0.5)
+  };
+
+  /**
+   * @brief      Working buffers of the hash computation. They keep their
+   *             capacity between calls, so after the first images the hash
+   *             computation does not allocate.
+   */
+  struct Scratch {
+    std::vector<int> bucket;         //!> Bucket of every keypoint
+    std::vector<int> count;          //!> Keypoints per bucket (prefix sums)
+    std::vector<int> next;           //!> Next free position of every bucket
+    std::vector<int> order;          //!> Keypoint indices sorted by bucket
+    std::vector<int> selected;       //!> Descriptor rows of every bucket
+    std::vector<int> offsets;        //!> First row of every bucket in selected
+    std::vector<int> valid;          //!> Buckets with enough features
+    AlignedFloatVector stacked;      //!> Stacked input of the projection
+    AlignedFloatVector projected;    //!> Output of the projection
+    std::vector<uint8_t> rows;       //!> Gathered binary descriptors
+  };
+
+  /**
+   * @brief      Class constructor. Builds the projection vectors from
+   *             Params::seed, so the same parameters give the same model
+   *             (and the same hashes) on every run.
+   *
+   * @param[in]  params       The parameters.
+   * @param[in]  img_size     The image size (only needed for bucketing).
+   * @param[in]  desc_length  The descriptor length (bits for binary ones).
+   * @param[in]  binary       True for binary descriptors.
+   */
+  HashModel(const Params& params, const cv::Size& img_size,
+    const int& desc_length, const bool& binary);
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Returns the image size used for the bucketing.
+   *
+   * @return     The image size.
+   */
+  inline cv::Size GetImageSize() const {return img_size_;}
+
+  /**
+   * @brief      Returns the number of hash coefficients per projection.
+   *
+   * @return     The descriptor length.
+   */
+  inline int GetDescriptorLength() const {return desc_length_;}
+
+  /**
+   * @brief      Returns true when the model hashes binary (CV_8U)
+   *             descriptors.
+   *
+   * @return     True for binary descriptors.
+   */
+  inline bool IsBinary() const {return binary_;}
+
+  /**
+   * @brief      Returns the random projection vectors.
+   *
+   * @return     The vectors, one per projection.
+   */
+  inline const std::vector< std::vector<float> >& GetProjections() const {
+    return r_;}
+
+  /**
+   * @brief      Returns the calibration of the quantized hashes and binary
+   *             signatures.
+   *
+   * @return     The calibration.
+   */
+  inline const Calibration& GetCalibration() const {return calibration_;}
+
+  /**
+   * @brief      Returns a copy of the model with another calibration. The
+   *             model itself is not modified, so the threads hashing with it
+   *             are not disturbed.
+   *
+   * @param[in]  calibration  The calibration.
+   *
+   * @return     The calibrated model, with the same fingerprint.
+   */
+  std::shared_ptr<const HashModel> Calibrated(
+    const Calibration& calibration) const;
+
+  /**
+   * @brief      Returns the length of the hashes.
+   *
+   * @return     The hash length.
+   */
+  inline int GetHashLength() const {
+    return params_.bucket_rows*params_.bucket_cols*params_.num_proj*
+      desc_length_;}
+
+  /**
+   * @brief      Returns the number of hash coefficients per projection of a
+   *             descriptor matrix: its columns for float (CV_32F)
+   *             descriptors and its bits for binary (CV_8U) ones, like ORB,
+   *             BRISK or AKAZE.
+   *
+   * @param[in]  desc  The descriptors.
+   *
+   * @return     The descriptor length.
+   */
+  static inline int DescriptorLength(const cv::Mat& desc) {
+    return (desc.type() == CV_8U) ? 8*desc.cols : desc.cols;}
+
+  /**
+   * @brief      Checks that a descriptor matrix can be hashed with this
+   *             model: same type (CV_32F or CV_8U) and length.
+   *
+   * @param[in]  desc  The descriptors.
+   *
+   * @return     True if the descriptors are valid.
+   */
+  bool CheckDescriptors(const cv::Mat& desc) const;
+
+  /**
+   * @brief      Returns a 64-bit fingerprint (FNV-1a) of everything that
+   *             changes the hashes: the bucketing, the image size, the
+   *             descriptor layout and the projection vectors. Hashes can only
+   *             be compared when their models have the same fingerprint.
+   *
+   * @return     The fingerprint.
+   */
+  uint64_t GetFingerprint() const;
+
+  /**
+   * @brief      Saves the model to a binary file (little-endian): format
+   *             version, parameters, descriptor layout, calibration and
+   *             projection vectors. The number of threads is not saved.
+   *
+   * @param[in]  filename  The file.
+   *
+   * @return     False if the file cannot be written.
+   */
+  bool Save(const std::string& filename) const;
+
+  /**
+   * @brief      Loads a model saved with Save. The projection vectors are
+   *             read as they were saved, so the hashes are identical to the
+   *             ones of the saved model. The files of the first version have
+   *             no calibration and get the default one.
+   *
+   * @param[in]  filename  The file.
+   *
+   * @return     The model (null if the file cannot be read or is not a
+   *             valid model).
+   */
+  static std::shared_ptr<const HashModel> Load(const std::string& filename);
+
+  /**
+   * @brief      Reserves the scratch buffers for this model.
+   *
+   * @param      scratch   The buffers.
+   * @param[in]  num_feat  The expected number of keypoints per image.
+   */
+  void ReserveScratch(Scratch& scratch, const int& num_feat) const;
+
+  /**
+   * @brief      Compute the hash of one image. Does not modify the model, so
+   *             it can run concurrently with different state and scratch.
+   *
+   * @param[in]  kp       The keypoint vector.
+   * @param[in]  desc     The descriptors (checked with CheckDescriptors).
+   * @param      state    The state to fill with the bucketing results.
+   * @param      scratch  The working buffers.
+   * @param[out] hash     The output hash (GetHashLength() elements).
+   */
+  void ComputeHash(const std::vector<cv::KeyPoint>& kp, const cv::Mat& desc,
+    State& state, Scratch& scratch, float* hash) const;
+
+ protected:
+  /**
+   * @brief      Empty constructor, used by Load.
+   */
+  HashModel();
+
+  /**
+   * @brief      Initializes the random vectors for projections.
+   *
+   * @param[in]  size  The size.
+   */
+  void InitProjections(const int& size);
+
+  /**
+   * @brief      Stacks the random vectors as the aligned rows of the
+   *             projection matrix.
+   */
+  void StackProjections();
+
+  /**
+   * @brief      Calculates a random vector with values in [0, 1). The values
+   *             are built from the raw generator output, which is the same
+   *             in every standard library (unlike the std distributions).
+   *
+   * @param[in]  size       The size.
+   * @param      generator  The random generator.
+   *
+   * @return     The random vector.
+   */
+  std::vector<float> ComputeRandomVector(const int& size,
+    std::mt19937& generator);
+
+  /**
+   * @brief      Makes a vector unitary.
+   *
+   * @param[in]  x     The input vector.
+   *
+   * @return     The output unit vector.
+   */
+  std::vector<float> UnitVector(const std::vector<float>& x);
+
+  /**
+   * @brief      Bucket the descriptors. The keypoints are grouped by bucket
+   *             with a counting sort over their indices and the best
+   *             max_features_x_bucket of every bucket (by response) are
+   *             chosen with a partial sort. No descriptor is copied.
+   *             Keypoints outside the image go to the closest bucket.
+   *
+   * @param[in]  kp       The keypoint vector.
+   * @param      state    The state to fill with the bucketing results.
+   * @param      scratch  The working buffers. On return, scratch.selected
+   *                      has the descriptor rows chosen for every bucket,
+   *                      bucket after bucket, by decreasing response, and
+   *                      bucket i uses selected[offsets[i]] to
+   *                      selected[offsets[i+1]-1].
+   */
+  void BucketDescriptors(const std::vector<cv::KeyPoint>& kp, State& state,
+    Scratch& scratch) const;
+
+  /**
+   * @brief      Compute the hash by projecting the bucketed descriptors. The
+   *             projections of all the buckets are computed with a single
+   *             matrix product (runtime dispatched SIMD kernel, or BLAS when
+   *             built with HALOC_USE_BLAS). Binary descriptors are projected
+   *             straight from the packed bytes, with every bit as +1 or -1.
+   *
+   * @param[in]  desc     The descriptors of the image.
+   * @param      scratch  The working buffers, with the rows of every bucket
+   *                      (see BucketDescriptors).
+   * @param[out] hash     The hash (GetHashLength() elements).
+   */
+  void ProjectDescriptors(const cv::Mat& desc, Scratch& scratch,
+    float* hash) const;
+
+ private:
+  typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic,
+    Eigen::RowMajor> RowMatrix;
+
+  // Properties
+  Params params_;                        //!> Stores parameters
+  cv::Size img_size_;                    //!> Image size (only needed for bucketing)
+  int desc_length_;                      //!> The length of the descriptors used (bits for binary ones)
+  bool binary_;                          //!> True when hashing binary descriptors
+  std::vector< std::vector<float> > r_;  //!> Vector of random values
+  AlignedFloatVector proj_;              //!> Random vectors stacked as aligned rows
+  int proj_stride_;                      //!> Distance between rows of proj_
+  Calibration calibration_;              //!> Calibration of the compact hashes
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_HASH_MODEL_H_
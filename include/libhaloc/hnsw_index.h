@@ -0,0 +1,198 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_HNSW_INDEX_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_HNSW_INDEX_H_
+
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "libhaloc/bucketed_hash.h"
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+
+namespace haloc {
+
+/**
+ * @brief      Hierarchical navigable small world graph over whole image
+ *             hashes. The graph distance is derived from the CalcDist overlap:
+ *             num_buckets - overlap(eps), plus a fraction in (0, 1] that grows
+ *             with the threshold needed to overlap one more bucket (1 when
+ *             tie_eps <= eps or no threshold up to tie_eps adds a bucket). The
+ *             fraction only breaks the ties between frames with the same
+ *             overlap (the distances of two overlaps never mix), which keeps
+ *             the greedy search moving where the integer overlap alone is
+ *             flat. Frames are inserted one by one, so a live node can add
+ *             every keyframe as soon as it is hashed. The class is not thread
+ *             safe.
+ */
+class HnswIndex {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int max_links;               //!> Maximum links per node and layer (2x on layer 0)
+    int ef_construction;         //!> Size of the candidate list when inserting
+    int ef_search;               //!> Default size of the candidate list when querying
+    float eps;                   //!> Maximum L1 distance between matching buckets
+    float tie_eps;               //!> Largest threshold used to break the ties
+    unsigned int seed;           //!> Seed of the level generator
+
+    // Default values
+    static const int             DEFAULT_MAX_LINKS = 16;
+    static const int             DEFAULT_EF_CONSTRUCTION = 100;
+    static const int             DEFAULT_EF_SEARCH = 50;
+    static constexpr float       DEFAULT_EPS = 0.8;
+    static constexpr float       DEFAULT_TIE_EPS = 1.6;
+    static const unsigned int    DEFAULT_SEED = 0;
+  };
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash  The hash object that produces the hashes. It must
+   *                   outlive the index and keep its parameters.
+   */
+  explicit HnswIndex(const Hash& hash);
+
+  /**
+   * @brief      Sets the parameters. The index is cleared.
+   *
+   * @param[in]  params  The parameters.
+   */
+  inline void SetParams(const Params& params) {params_ = params; Clear();}
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Returns the number of indexed frames.
+   *
+   * @return     The size.
+   */
+  inline int Size() const {return nodes_.size();}
+
+  /**
+   * @brief      Inserts the hash of a frame in the graph.
+   *
+   * @param[in]  id    The frame id.
+   * @param[in]  hash  The hash, as returned by Hash::GetHash.
+   *
+   * @return     False if the id already exists or the hash length is wrong.
+   */
+  bool Add(const int& id, const std::vector<float>& hash);
+
+  /**
+   * @brief      Removes all the frames.
+   */
+  void Clear();
+
+  /**
+   * @brief      Finds approximately the k frames with the largest overlap
+   *             with the query.
+   *
+   * @param[in]  hash          The query hash, as returned by Hash::GetHash.
+   * @param[in]  k             The maximum number of candidates.
+   * @param[in]  query_id      The frame id of the query (-1 if none).
+   * @param[in]  min_neighbor  When query_id >= 0, the frames with
+   *                           |id - query_id| <= min_neighbor are never
+   *                           returned (they are still used to navigate).
+   * @param[in]  ef            Size of the candidate list (0 = ef_search).
+   *
+   * @return     The candidates with overlap > 0, best first.
+   */
+  std::vector<Match> Query(const std::vector<float>& hash, const int& k,
+    const int& query_id = -1, const int& min_neighbor = 0,
+    const int& ef = 0) const;
+
+ protected:
+  /**
+   * @brief      (distance, node) pair.
+   */
+  typedef std::pair<float, int> Candidate;
+
+  /**
+   * @brief      Graph distance between a hash and a node: num_buckets -
+   *             overlap plus the tie fraction in (0, 1].
+   *
+   * @param[in]  hash  The hash.
+   * @param[in]  node  The node index.
+   *
+   * @return     The distance.
+   */
+  float Distance(const BucketedHash& hash, const int& node) const;
+
+  /**
+   * @brief      Best first search on one layer.
+   *
+   * @param[in]  hash          The query hash.
+   * @param[in]  entry         The entry points.
+   * @param[in]  ef            Size of the candidate list.
+   * @param[in]  layer         The layer.
+   * @param[in]  query_id      The frame id of the query (-1 if none).
+   * @param[in]  min_neighbor  The temporal exclusion window.
+   *
+   * @return     Up to ef nodes, closest first. Excluded nodes are traversed
+   *             but not returned.
+   */
+  std::vector<Candidate> SearchLayer(const BucketedHash& hash,
+    const std::vector<Candidate>& entry, const int& ef, const int& layer,
+    const int& query_id, const int& min_neighbor) const;
+
+  /**
+   * @brief      Keeps the closest links of a node within the layer limit.
+   *
+   * @param[in]  node   The node index.
+   * @param[in]  layer  The layer.
+   */
+  void ShrinkLinks(const int& node, const int& layer);
+
+ private:
+  /**
+   * @brief      Graph node.
+   */
+  struct Node {
+    int id;                                 //!> The frame id
+    BucketedHash hash;                      //!> The hash and its metadata
+    std::vector< std::vector<int> > links;  //!> Neighbours on every layer
+  };
+
+  // Properties
+  Params params_;                         //!> Stores parameters
+  const Hash& hash_;                      //!> The hash object
+  std::vector<Node> nodes_;               //!> The nodes
+  std::unordered_map<int, int> node_ids_; //!> The node of every frame id
+  int entry_;                             //!> Entry point (node on the top layer)
+  int max_layer_;                         //!> Top layer of the graph
+  std::mt19937 generator_;                //!> Level generator
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_HNSW_INDEX_H_
@@ -0,0 +1,176 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_INVERTED_INDEX_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_INVERTED_INDEX_H_
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+#include "libhaloc/posting_table.h"
+
+namespace haloc {
+
+/**
+ * @brief      Inverted file over coarse per-bucket codes. The coefficients of
+ *             every bucket are split in num_groups groups and the code of the
+ *             bucket is the tuple of the group sums quantized with step
+ *             cell_width. Since the L1 distance of two buckets is larger than
+ *             the difference of any of their group sums, two buckets within
+ *             eps of each other have codes that differ at most by
+ *             r = ceil(eps/cell_width) cells in every dimension. A query only
+ *             visits the postings of the (2r + 1)^num_groups neighbour codes
+ *             of its buckets, so no loop closing is lost, and the frames found
+ *             are reranked with the exact distance. The index is fastest with
+ *             cell_width >= eps (r = 1).
+ */
+class InvertedIndex {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    float cell_width;            //!> Quantization step of the group sums (best >= query eps)
+    int num_groups;              //!> Number of groups (code dimensions) per bucket
+    int min_votes;               //!> Minimum bucket hits in one shift to rerank a frame
+
+    // Default values
+    static constexpr float       DEFAULT_CELL_WIDTH = 1.0;
+    static const int             DEFAULT_NUM_GROUPS = 2;
+    static const int             DEFAULT_MIN_VOTES = 1;
+  };
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash  The hash object that produces the hashes. It must
+   *                   outlive the index and keep its parameters.
+   */
+  explicit InvertedIndex(const Hash& hash);
+
+  /**
+   * @brief      Sets the parameters. The index is cleared.
+   *
+   * @param[in]  params  The parameters.
+   */
+  inline void SetParams(const Params& params) {params_ = params; Clear();}
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Returns the number of indexed frames.
+   *
+   * @return     The size.
+   */
+  inline int Size() const {return db_.Size();}
+
+  /**
+   * @brief      Returns the database with the indexed hashes.
+   *
+   * @return     The database.
+   */
+  inline const HashDatabase& GetDatabase() const {return db_;}
+
+  /**
+   * @brief      Adds the hash of a frame.
+   *
+   * @param[in]  id    The frame id.
+   * @param[in]  hash  The hash, as returned by Hash::GetHash.
+   *
+   * @return     False if the id already exists or the hash length is wrong.
+   */
+  bool Add(const int& id, const std::vector<float>& hash);
+
+  /**
+   * @brief      Removes the hash of a frame.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     False if the id does not exist.
+   */
+  bool Remove(const int& id);
+
+  /**
+   * @brief      Removes all the hashes.
+   */
+  void Clear();
+
+  /**
+   * @brief      Finds the k frames with the largest overlap with the query
+   *             among the frames that share at least one nearby bucket code.
+   *             When eps needs more than kMaxNeighborCodes neighbour codes
+   *             per bucket, the whole database is scanned instead.
+   *
+   * @param[in]  hash          The query hash, as returned by Hash::GetHash.
+   * @param[in]  k             The maximum number of candidates.
+   * @param[in]  eps           The maximum L1 distance between matching buckets.
+   * @param[in]  query_id      The frame id of the query (-1 if none).
+   * @param[in]  min_neighbor  When query_id >= 0, the frames with
+   *                           |id - query_id| <= min_neighbor are skipped.
+   *
+   * @return     The candidates with overlap > 0, best first.
+   */
+  std::vector<Match> Query(const std::vector<float>& hash, const int& k,
+    float eps, const int& query_id = -1, const int& min_neighbor = 0) const;
+
+ protected:
+  /**
+   * @brief      Computes the quantized group sums of a bucket.
+   *
+   * @param[in]  bucket  The bucket coefficients.
+   * @param[out] cells   The cell of every group.
+   */
+  void ComputeCells(const float* bucket, std::vector<int>& cells) const;
+
+  /**
+   * @brief      Packs a tuple of cells into a posting list key.
+   *
+   * @param[in]  cells  The cells.
+   *
+   * @return     The key.
+   */
+  static uint64_t Key(const std::vector<int>& cells);
+
+ private:
+  // Largest number of neighbour codes probed per query bucket
+  static const int kMaxNeighborCodes = 4096;
+
+  // Properties
+  Params params_;                                          //!> Stores parameters
+  const Hash& hash_;                                       //!> The hash object
+  HashDatabase db_;                                        //!> The hashes for the rerank
+  PostingTable postings_;                                  //!> Posting lists
+  std::unordered_map<int, std::vector<uint64_t> > frame_keys_;  //!> Keys of every frame
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_INVERTED_INDEX_H_
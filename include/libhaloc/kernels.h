@@ -0,0 +1,223 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_KERNELS_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_KERNELS_H_
+
+#include <stdint.h>
+
+namespace haloc {
+
+/**
+ * @brief      Low level numeric kernels. Every kernel has a scalar reference
+ *             implementation and SSE4.2, AVX2, AVX-512 or POPCNT versions
+ *             where they pay off. The best version for the running CPU is
+ *             selected once, at the first call, so the same binary runs on
+ *             old and new x86 machines. The projections add the same
+ *             products in the same order (without FMA) in every version, so
+ *             they are bit-identical to the scalar reference and a hash does
+ *             not depend on the CPU that computed it. The distances may
+ *             differ from the scalar reference by the rounding of their sums.
+ */
+namespace kernels {
+
+/**
+ * @brief      Instruction sets with a kernel implementation.
+ */
+enum Isa {
+  SCALAR = 0,
+  SSE42 = 1,
+  AVX2 = 2,
+  AVX512 = 3
+};
+
+/**
+ * @brief      Returns the instruction set used by the dispatched kernels.
+ *
+ * @return     The instruction set.
+ */
+Isa GetIsa();
+
+/**
+ * @brief      Returns the name of an instruction set.
+ *
+ * @param[in]  isa   The instruction set.
+ *
+ * @return     The name.
+ */
+const char* GetIsaName(const Isa& isa);
+
+/**
+ * @brief      Selects the kernels of an instruction set instead of the best
+ *             one, e.g. to test every version on the same machine. Not safe
+ *             while other threads call the kernels.
+ *
+ * @param[in]  isa   The instruction set.
+ *
+ * @return     False if the running CPU does not support it (the selection is
+ *             not changed).
+ */
+bool SetIsa(const Isa& isa);
+
+/**
+ * @brief      L1 distance between two float vectors.
+ *
+ * @param[in]  a     The first vector.
+ * @param[in]  b     The second vector.
+ * @param[in]  n     The vectors length.
+ *
+ * @return     sum(|a - b|).
+ */
+float L1Distance(const float* a, const float* b, const int& n);
+
+/**
+ * @brief      L1 distance with early termination. The partial sums are
+ *             checked against the bound every few elements and the
+ *             accumulation stops as soon as they exceed it. The partial sums
+ *             only grow, so the comparison against the bound gives the same
+ *             answer as with the full L1Distance.
+ *
+ * @param[in]  a      The first vector.
+ * @param[in]  b      The second vector.
+ * @param[in]  n      The vectors length.
+ * @param[in]  bound  The bound.
+ *
+ * @return     The same value as L1Distance when it is <= bound, otherwise
+ *             a partial sum that is > bound.
+ */
+float L1DistanceBounded(const float* a, const float* b, const int& n,
+  const float& bound);
+
+/**
+ * @brief      Scalar reference of L1Distance.
+ */
+float L1DistanceScalar(const float* a, const float* b, const int& n);
+
+/**
+ * @brief      Scalar reference of L1DistanceBounded.
+ */
+float L1DistanceScalar(const float* a, const float* b, const int& n,
+  const float& bound);
+
+/**
+ * @brief      Sum of absolute differences between two byte vectors (the L1
+ *             distance of uint8 codes), computed with PSADBW/VPSADBW.
+ *
+ * @param[in]  a     The first vector.
+ * @param[in]  b     The second vector.
+ * @param[in]  n     The vectors length.
+ *
+ * @return     sum(|a - b|).
+ */
+uint32_t SadDistance(const uint8_t* a, const uint8_t* b, const int& n);
+
+/**
+ * @brief      SadDistance with early termination, like L1DistanceBounded.
+ *
+ * @param[in]  a      The first vector.
+ * @param[in]  b      The second vector.
+ * @param[in]  n      The vectors length.
+ * @param[in]  bound  The bound.
+ *
+ * @return     The same value as SadDistance when it is <= bound, otherwise
+ *             a partial sum that is > bound.
+ */
+uint32_t SadDistanceBounded(const uint8_t* a, const uint8_t* b, const int& n,
+  const uint32_t& bound);
+
+/**
+ * @brief      Scalar reference of SadDistance.
+ */
+uint32_t SadDistanceScalar(const uint8_t* a, const uint8_t* b, const int& n);
+
+/**
+ * @brief      Scalar reference of SadDistanceBounded.
+ */
+uint32_t SadDistanceScalar(const uint8_t* a, const uint8_t* b, const int& n,
+  const uint32_t& bound);
+
+/**
+ * @brief      Hamming distance between two bit vectors, computed with POPCNT
+ *             when the CPU supports it.
+ *
+ * @param[in]  a     The first vector.
+ * @param[in]  b     The second vector.
+ * @param[in]  n     The number of 64-bit words.
+ *
+ * @return     The number of different bits.
+ */
+uint32_t HammingDistance(const uint64_t* a, const uint64_t* b, const int& n);
+
+/**
+ * @brief      Scalar reference of HammingDistance.
+ */
+uint32_t HammingDistanceScalar(const uint64_t* a, const uint64_t* b,
+  const int& n);
+
+/**
+ * @brief      Projects a row-major matrix with a set of vectors:
+ *             out(p, c) = sum_m r(p, m) * x(m, c).
+ *
+ * @param[in]  r         The projection vectors, one per row.
+ * @param[in]  r_stride  The distance (in floats) between rows of r.
+ * @param[in]  num_proj  The number of projection vectors.
+ * @param[in]  x         The matrix to project (rows x cols, contiguous).
+ * @param[in]  rows      The number of rows of x.
+ * @param[in]  cols      The number of columns of x.
+ * @param[out] out       The projections (num_proj x cols, contiguous).
+ */
+void Project(const float* r, const int& r_stride, const int& num_proj,
+  const float* x, const int& rows, const int& cols, float* out);
+
+/**
+ * @brief      Scalar reference of Project.
+ */
+void ProjectScalar(const float* r, const int& r_stride, const int& num_proj,
+  const float* x, const int& rows, const int& cols, float* out);
+
+/**
+ * @brief      Projects packed binary descriptors with a set of vectors, with
+ *             every bit read as +1 (set) or -1 (clear):
+ *             out(p, n) = sum_m r(p, m) * (2*bit(m, n) - 1), where bit n of
+ *             a row is bit n % 8 of its byte n / 8. The bits are never
+ *             unpacked: the scalar version only visits the set bits and the
+ *             AVX-512 version uses 16 bits at a time as an add mask.
+ *
+ * @param[in]  r         The projection vectors, one per row.
+ * @param[in]  r_stride  The distance (in floats) between rows of r.
+ * @param[in]  num_proj  The number of projection vectors.
+ * @param[in]  x         The packed descriptors, one per row.
+ * @param[in]  x_step    The distance (in bytes) between rows of x.
+ * @param[in]  rows      The number of rows of x.
+ * @param[in]  num_bytes The number of bytes per descriptor.
+ * @param[out] out       The projections (num_proj x 8*num_bytes, contiguous).
+ */
+void ProjectBits(const float* r, const int& r_stride, const int& num_proj,
+  const uint8_t* x, const int& x_step, const int& rows, const int& num_bytes,
+  float* out);
+
+/**
+ * @brief      Scalar reference of ProjectBits.
+ */
+void ProjectBitsScalar(const float* r, const int& r_stride,
+  const int& num_proj, const uint8_t* x, const int& x_step, const int& rows,
+  const int& num_bytes, float* out);
+
+}  // namespace kernels
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_KERNELS_H_
@@ -0,0 +1,255 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_KNN_GRAPH_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_KNN_GRAPH_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "libhaloc/bucketed_hash.h"
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+#include "libhaloc/worker_pool.h"
+
+namespace haloc {
+
+/**
+ * @brief      Builds approximately the k nearest neighbour graph of a
+ *             sequence (every frame with its k frames of largest CalcDist
+ *             overlap) with NN-descent: starting from the closest frames in
+ *             time and a few random ones, every iteration compares the
+ *             neighbours of the neighbours of each frame (in both
+ *             directions) and keeps the best ones. Only a sample of the new
+ *             neighbours is joined per iteration and the build stops when
+ *             few lists change, so the number of distances grows roughly as
+ *             N*k^2 per iteration instead of N^2. As in HnswIndex, the
+ *             neighbours with the same overlap are ranked by the threshold
+ *             they need to overlap one more bucket, otherwise most lists
+ *             would be flat at overlap 0 and the descent would have nothing
+ *             to follow. The quality is measured with EstimateRecall against
+ *             the exact neighbours of a sample of frames.
+ */
+class KnnGraphBuilder {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int k;                       //!> Neighbours per frame
+    int max_iterations;          //!> Maximum number of NN-descent iterations
+    float sample_rate;           //!> Fraction of k new neighbours joined per iteration
+    float delta;                 //!> Stop when fewer than delta*N*k links change
+    float tie_eps;               //!> Largest threshold used to break the ties
+    int num_sequence_seeds;      //!> Initial neighbours taken from the sequence, per side
+    int min_neighbor;            //!> Frames i, j with |i - j| <= min_neighbor are never linked
+    int batch_size;              //!> Frames joined before their updates are applied
+    int num_threads;             //!> Number of threads (0 = all cores)
+    unsigned int seed;           //!> Seed of the random samples
+
+    // Default values
+    static const int             DEFAULT_K = 10;
+    static const int             DEFAULT_MAX_ITERATIONS = 12;
+    static constexpr float       DEFAULT_SAMPLE_RATE = 1.0;
+    static constexpr float       DEFAULT_DELTA = 0.001;
+    static constexpr float       DEFAULT_TIE_EPS = 1.6;
+    static const int             DEFAULT_NUM_SEQUENCE_SEEDS = 2;
+    static const int             DEFAULT_MIN_NEIGHBOR = 0;
+    static const int             DEFAULT_BATCH_SIZE = 4096;
+    static const int             DEFAULT_NUM_THREADS = 0;
+    static const unsigned int    DEFAULT_SEED = 0;
+  };
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash  The hash object that produced the hashes. It must
+   *                   outlive the builder and keep its parameters.
+   */
+  explicit KnnGraphBuilder(const Hash& hash);
+
+  /**
+   * @brief      Sets the parameters.
+   *
+   * @param[in]  params  The parameters.
+   */
+  inline void SetParams(const Params& params) {
+    params_ = params; pool_.reset();}
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Returns the number of iterations of the last build.
+   *
+   * @return     The number of iterations.
+   */
+  inline int GetNumIterations() const {return num_iterations_;}
+
+  /**
+   * @brief      Returns the number of distances computed by the last build.
+   *
+   * @return     The number of distances.
+   */
+  inline int64_t GetNumDistances() const {return num_distances_;}
+
+  /**
+   * @brief      Builds the approximate k nearest neighbour graph. The result
+   *             is deterministic for a given seed, whatever the number of
+   *             threads.
+   *
+   * @param[in]  hashes  The hashes of the sequence.
+   * @param[in]  eps     The maximum L1 distance between matching buckets.
+   *
+   * @return     For every frame, its neighbours (index in hashes) with
+   *             overlap > 0, at most k, best first (the same overlaps ranked
+   *             as in the build).
+   */
+  std::vector< std::vector<Match> > Build(
+    const std::vector<BucketedHash>& hashes, float eps);
+
+  /**
+   * @brief      Computes the exact neighbours of a random sample of frames
+   *             and compares them with a graph. A graph neighbour counts as
+   *             found when its overlap is at least the overlap of the k-th
+   *             exact neighbour, so the ties between frames with the same
+   *             overlap are not counted as misses.
+   *
+   * @param[in]  hashes       The hashes of the sequence.
+   * @param[in]  graph        The graph, as returned by Build.
+   * @param[in]  eps          The maximum L1 distance between matching
+   *                          buckets.
+   * @param[in]  num_samples  The number of sampled frames.
+   *
+   * @return     The fraction of the exact neighbours (overlap > 0) of the
+   *             sampled frames that are found in the graph (1 if they have
+   *             none).
+   */
+  double EstimateRecall(const std::vector<BucketedHash>& hashes,
+    const std::vector< std::vector<Match> >& graph, float eps,
+    const int& num_samples);
+
+ protected:
+  /**
+   * @brief      A neighbour of the graph under construction.
+   */
+  struct Neighbor {
+    Match match;  //!> The frame and its overlap
+    float tie;    //!> Ranks the same overlaps (lower is better)
+    bool is_new;  //!> True until it takes part in a local join
+
+    /**
+     * @brief      Ranking order: larger overlap first, then smaller tie and
+     *             then smaller id.
+     *
+     * @param[in]  other  The other neighbour.
+     *
+     * @return     True if this neighbour ranks before the other one.
+     */
+    inline bool operator<(const Neighbor& other) const {
+      if (match.overlap != other.match.overlap)
+        return match.overlap > other.match.overlap;
+      if (tie != other.tie) return tie < other.tie;
+      return match.id < other.match.id;
+    }
+  };
+
+  /**
+   * @brief      A distance computed by a local join.
+   */
+  struct Update {
+    int a;        //!> The first frame
+    int b;        //!> The second frame
+    int overlap;  //!> Their overlap
+    float tie;    //!> Ranks the same overlaps
+  };
+
+  /**
+   * @brief      Determines if two frames may be linked.
+   *
+   * @param[in]  a     The first frame.
+   * @param[in]  b     The second frame.
+   *
+   * @return     True if they are out of the neighbourhood window.
+   */
+  inline bool Linkable(const int& a, const int& b) const {
+    return abs(a - b) > std::max(0, params_.min_neighbor);}
+
+  /**
+   * @brief      Computes the overlap of two frames and its tie breaker: the
+   *             threshold needed to overlap one more bucket, mapped to
+   *             (0, 1].
+   *
+   * @param[in]  hash_1   The hash 1.
+   * @param[in]  hash_2   The hash 2.
+   * @param[in]  eps      The maximum L1 distance between matching buckets.
+   * @param[out] overlap  The overlap.
+   * @param[out] tie      The tie breaker (1 if tie_eps <= eps).
+   */
+  void Distance(const BucketedHash& hash_1, const BucketedHash& hash_2,
+    float eps, int& overlap, float& tie) const;
+
+  /**
+   * @brief      Inserts a neighbour in a list, which is kept sorted and with
+   *             at most k entries.
+   *
+   * @param[in]  list     The neighbour list.
+   * @param[in]  id       The neighbour frame.
+   * @param[in]  overlap  The overlap.
+   * @param[in]  tie      The tie breaker.
+   *
+   * @return     True if the list changed.
+   */
+  bool Insert(std::vector<Neighbor>& list, const int& id, const int& overlap,
+    const float& tie);
+
+  /**
+   * @brief      Keeps a random sample of a list.
+   *
+   * @param[in]  list       The list (sampled in place).
+   * @param[in]  size       The maximum size of the sample.
+   * @param[in]  generator  The random generator.
+   */
+  static void Sample(std::vector<int>& list, const int& size,
+    std::mt19937& generator);
+
+ private:
+  // Properties
+  Params params_;                         //!> Stores parameters
+  const Hash& hash_;                      //!> The hash object (distance)
+  std::unique_ptr<WorkerPool> pool_;      //!> The threads
+  int num_iterations_;                    //!> Iterations of the last build
+  int64_t num_distances_;                 //!> Distances of the last build
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_KNN_GRAPH_H_
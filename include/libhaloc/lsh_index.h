@@ -0,0 +1,187 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_LSH_INDEX_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_LSH_INDEX_H_
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "libhaloc/aligned.h"
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+#include "libhaloc/posting_table.h"
+
+namespace haloc {
+
+/**
+ * @brief      Multi-table locality sensitive hashing over the bucket vectors
+ *             of the hashes. Every table concatenates num_functions p-stable
+ *             hash functions h(v) = floor((a*v + b) / bucket_width) with
+ *             Cauchy distributed a, so buckets close in L1 distance collide
+ *             with high probability. A query collects the frames (and the
+ *             bucket alignments) colliding with its buckets, keeps the frames
+ *             with more votes in a single shift and verifies them with the
+ *             exact distance. More tables raise the recall, more functions per
+ *             table lower the number of candidates. Two buckets at distance
+ *             eps collide in a function with a probability that only depends
+ *             on eps / bucket_width, so bucket_width must be at least the
+ *             query eps.
+ */
+class LshIndex {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int num_tables;              //!> Number of hash tables
+    int num_functions;           //!> Number of hash functions per table
+    float bucket_width;          //!> Quantization width (a few times the query eps, at least eps)
+    int max_candidates;          //!> Maximum frames to verify (0 = all colliding)
+    unsigned int seed;           //!> Seed of the random hash functions
+
+    // Default values
+    static const int             DEFAULT_NUM_TABLES = 8;
+    static const int             DEFAULT_NUM_FUNCTIONS = 4;
+    static constexpr float       DEFAULT_BUCKET_WIDTH = 4.0;
+    static const int             DEFAULT_MAX_CANDIDATES = 0;
+    static const unsigned int    DEFAULT_SEED = 0;
+  };
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash  The hash object that produces the hashes. It must
+   *                   outlive the index and keep its parameters.
+   */
+  explicit LshIndex(const Hash& hash);
+
+  /**
+   * @brief      Sets the parameters. The index is cleared.
+   *
+   * @param[in]  params  The parameters.
+   */
+  inline void SetParams(const Params& params) {params_ = params; Clear();}
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Returns the number of indexed frames.
+   *
+   * @return     The size.
+   */
+  inline int Size() const {return db_.Size();}
+
+  /**
+   * @brief      Returns the database with the indexed hashes.
+   *
+   * @return     The database.
+   */
+  inline const HashDatabase& GetDatabase() const {return db_;}
+
+  /**
+   * @brief      Adds the hash of a frame.
+   *
+   * @param[in]  id    The frame id.
+   * @param[in]  hash  The hash, as returned by Hash::GetHash.
+   *
+   * @return     False if the id already exists or the hash length is wrong.
+   */
+  bool Add(const int& id, const std::vector<float>& hash);
+
+  /**
+   * @brief      Removes the hash of a frame.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     False if the id does not exist.
+   */
+  bool Remove(const int& id);
+
+  /**
+   * @brief      Removes all the hashes. The hash functions are drawn again
+   *             with the seed of the parameters.
+   */
+  void Clear();
+
+  /**
+   * @brief      Finds the k frames with the largest overlap with the query
+   *             among the frames colliding with its buckets. When eps is
+   *             larger than bucket_width the matching buckets rarely collide,
+   *             so the whole database is scanned instead.
+   *
+   * @param[in]  hash          The query hash, as returned by Hash::GetHash.
+   * @param[in]  k             The maximum number of candidates.
+   * @param[in]  eps           The maximum L1 distance between matching buckets.
+   * @param[in]  query_id      The frame id of the query (-1 if none).
+   * @param[in]  min_neighbor  When query_id >= 0, the frames with
+   *                           |id - query_id| <= min_neighbor are skipped.
+   *
+   * @return     The candidates with overlap > 0, best first.
+   */
+  std::vector<Match> Query(const std::vector<float>& hash, const int& k,
+    float eps, const int& query_id = -1, const int& min_neighbor = 0) const;
+
+ protected:
+  /**
+   * @brief      Draws the hash functions for the current bucket length.
+   *
+   * @param[in]  bucket_length  The number of coefficients per bucket.
+   */
+  void InitFunctions(const int& bucket_length);
+
+  /**
+   * @brief      Computes the table keys of every non empty bucket of a hash.
+   *
+   * @param[in]  hash  The hash.
+   * @param[out] keys  The keys, num_tables per bucket (bucket major). Empty
+   *                   buckets get no keys.
+   * @param[out] full  True for the non empty buckets.
+   */
+  void ComputeKeys(const std::vector<float>& hash, std::vector<uint64_t>& keys,
+    std::vector<bool>& full) const;
+
+ private:
+  // Properties
+  Params params_;                      //!> Stores parameters
+  const Hash& hash_;                   //!> The hash object
+  HashDatabase db_;                    //!> The hashes for the verification
+  int bucket_length_;                  //!> Coefficients per bucket
+  int func_stride_;                    //!> Aligned row length of func_a_
+  AlignedFloatVector func_a_;          //!> Projection of every hash function (rows)
+  std::vector<float> func_b_;          //!> Offset of every hash function
+  std::vector<PostingTable> tables_;   //!> The hash tables
+  std::unordered_map<int, std::vector< std::pair<int, uint64_t> > >
+    frame_keys_;                       //!> (table, key) of every frame bucket
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_LSH_INDEX_H_
@@ -0,0 +1,328 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_MAPPED_DATABASE_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_MAPPED_DATABASE_H_
+
+#include <stdint.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+#include "libhaloc/worker_pool.h"
+
+namespace haloc {
+
+/**
+ * @brief      Header of the mapped database files. All the values are in the
+ *             host byte order and all the offsets are in bytes from the
+ *             start of the file. Readers locate every block through the
+ *             offsets and the header size, so later versions can add header
+ *             fields or blocks and stay readable by older readers, as long
+ *             as min_version is not raised.
+ */
+struct MappedDatabaseHeader {
+  char magic[8];              //!> "HALOCDB" followed by a null character
+  uint32_t version;           //!> Format version of the writer
+  uint32_t min_version;       //!> Oldest reader version able to read the file
+  uint32_t header_size;       //!> Bytes of the header (with padding)
+  uint32_t reserved;          //!> Always 0
+  uint64_t fingerprint;       //!> HashModel::GetFingerprint of the hashes
+  uint32_t bucket_rows;       //!> Hash::Params::bucket_rows
+  uint32_t bucket_cols;       //!> Hash::Params::bucket_cols
+  uint32_t num_proj;          //!> Hash::Params::num_proj
+  uint32_t desc_length;       //!> Hash coefficients per projection
+  uint32_t hash_length;       //!> Floats per hash
+  uint32_t hash_stride;       //!> Floats per (aligned) hash row
+  uint64_t num_rows;          //!> Number of stored hashes
+  uint64_t hashes_offset;     //!> Hash rows (num_rows x hash_stride floats)
+  uint64_t sums_offset;       //!> Bucket sums (num_rows x buckets floats)
+  uint64_t occupancy_offset;  //!> Occupancy bitmasks (num_rows uint64)
+  uint64_t ids_offset;        //!> Frame id of every row (num_rows int32)
+  uint64_t index_offset;      //!> (id, row) int32 pairs sorted by id
+};
+
+/**
+ * @brief      Streams the hashes of a mapped database to its file. The hash
+ *             rows, which are most of the file, go straight to disk as they
+ *             are appended, and only the bucket summaries and the ids of the
+ *             frames are kept until Close writes the remaining blocks. The
+ *             file is written next to the target and renamed over it at
+ *             Close, so readers never see a partial file. Not thread safe.
+ */
+class MappedDatabaseWriter {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash  The hash object that produces the hashes. It must
+   *                   outlive the writer and keep its model.
+   */
+  explicit MappedDatabaseWriter(const Hash& hash);
+
+  /**
+   * @brief      Class destructor. A file that was not closed is discarded.
+   */
+  ~MappedDatabaseWriter();
+
+  /**
+   * @brief      Starts a database file. The hash object must be initialized.
+   *
+   * @param[in]  filename  The file.
+   *
+   * @return     False if the file cannot be created.
+   */
+  bool Open(const std::string& filename);
+
+  /**
+   * @brief      Appends the hash of a frame.
+   *
+   * @param[in]  id    The frame id (unique in the database).
+   * @param[in]  hash  The hash, as returned by Hash::GetHash.
+   *
+   * @return     False if no file is open, the hash is not valid or the write
+   *             failed.
+   */
+  bool Append(const int& id, const std::vector<float>& hash);
+
+  /**
+   * @brief      Writes the remaining blocks and the header, syncs the file
+   *             and renames it over the target.
+   *
+   * @return     False if an id was appended twice or a write failed. The file
+   *             is then discarded.
+   */
+  bool Close();
+
+  /**
+   * @brief      Determines if a file is open.
+   *
+   * @return     True if a file is open.
+   */
+  inline bool IsOpen() const {return file_.is_open();}
+
+  /**
+   * @brief      Returns the number of appended hashes.
+   *
+   * @return     The size.
+   */
+  inline int Size() const {return ids_.size();}
+
+ protected:
+  /**
+   * @brief      Closes and removes the temporary file.
+   */
+  void Discard();
+
+ private:
+  MappedDatabaseWriter(const MappedDatabaseWriter&);
+  MappedDatabaseWriter& operator=(const MappedDatabaseWriter&);
+
+  // Properties
+  const Hash& hash_;                      //!> The hash object (bucket summaries)
+  std::ofstream file_;                    //!> The temporary file
+  std::string filename_;                  //!> The target file
+  MappedDatabaseHeader header_;           //!> The header (blocks set at Close)
+  std::vector<float> padding_;            //!> Zeros up to the row stride
+  std::vector<float> bucket_sums_;        //!> The bucket sums of every row
+  std::vector<uint64_t> occupancy_;       //!> The occupancy bitmask of every row
+  std::vector<int32_t> ids_;              //!> The frame id of every row
+};
+
+/**
+ * @brief      Read-only hash database stored in a file and memory mapped.
+ *             The hash rows (64-byte aligned), bucket sums and occupancy
+ *             masks are laid out on disk as in HashDatabase, so the queries
+ *             scan the mapped pages in place: opening does not read the
+ *             hashes, the page cache is shared by all the processes that
+ *             map the same file and the database can be larger than the RAM.
+ */
+class MappedDatabase {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int num_threads;             //!> Number of threads for the queries (0 = all cores)
+    int min_parallel_size;       //!> Minimum database size to use the threads
+
+    // Default values
+    static const int             DEFAULT_NUM_THREADS = 0;
+    static const int             DEFAULT_MIN_PARALLEL_SIZE = 256;
+  };
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash  The hash object that produces the hashes. It must
+   *                   outlive the database and keep its model.
+   */
+  explicit MappedDatabase(const Hash& hash);
+
+  /**
+   * @brief      Class destructor. Unmaps the file.
+   */
+  ~MappedDatabase();
+
+  /**
+   * @brief      Writes a database file at once with a MappedDatabaseWriter.
+   *             The file is written next to the target, synced to disk and
+   *             renamed over it, so readers never see a partial file.
+   *
+   * @param[in]  filename  The file.
+   * @param[in]  hash      The hash object that produced the hashes. It must
+   *                       be initialized.
+   * @param[in]  ids       The frame id of every hash (unique).
+   * @param[in]  hashes    The hashes, as returned by Hash::GetHash.
+   *
+   * @return     False if the hashes are not valid or the file cannot be
+   *             written.
+   */
+  static bool Write(const std::string& filename, const Hash& hash,
+    const std::vector<int>& ids,
+    const std::vector< std::vector<float> >& hashes);
+
+  /**
+   * @brief      Sets the parameters.
+   *
+   * @param[in]  params  The parameters.
+   */
+  inline void SetParams(const Params& params) {
+    params_ = params;
+    pool_.reset(new WorkerPool(params_.num_threads));}
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Maps a database file. The hash object must be initialized
+   *             with the model that produced the hashes (same fingerprint).
+   *             The blocks must fit in the file and the index must be sorted
+   *             by id and point to existing rows.
+   *
+   * @param[in]  filename  The file.
+   *
+   * @return     False if the file cannot be mapped or does not match the
+   *             hash object.
+   */
+  bool Open(const std::string& filename);
+
+  /**
+   * @brief      Unmaps the file.
+   */
+  void Close();
+
+  /**
+   * @brief      Determines if a file is mapped.
+   *
+   * @return     True if a file is mapped.
+   */
+  inline bool IsOpen() const {return data_ != NULL;}
+
+  /**
+   * @brief      Returns the number of stored hashes.
+   *
+   * @return     The size.
+   */
+  inline int Size() const {return IsOpen() ? header_->num_rows : 0;}
+
+  /**
+   * @brief      Determines if a frame is stored.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     True if the frame is stored.
+   */
+  inline bool Contains(const int& id) const {return FindRow(id) >= 0;}
+
+  /**
+   * @brief      Returns the frame ids, in the order they were written.
+   *
+   * @return     The frame ids.
+   */
+  std::vector<int> GetIds() const;
+
+  /**
+   * @brief      Returns the stored hash of a frame.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     The hash (empty if the id does not exist).
+   */
+  std::vector<float> GetHash(const int& id) const;
+
+  /**
+   * @brief      Finds the k frames with the largest overlap with the query.
+   *             Same result as HashDatabase::Query with the same hashes.
+   *             Several threads can query at once.
+   *
+   * @param[in]  hash          The query hash, as returned by Hash::GetHash.
+   * @param[in]  k             The maximum number of candidates.
+   * @param[in]  eps           The maximum L1 distance between matching buckets.
+   * @param[in]  query_id      The frame id of the query (-1 if none).
+   * @param[in]  min_neighbor  When query_id >= 0, the frames with
+   *                           |id - query_id| <= min_neighbor are skipped.
+   *
+   * @return     The candidates with overlap > 0, best first.
+   */
+  std::vector<Match> Query(const std::vector<float>& hash, const int& k,
+    float eps, const int& query_id = -1, const int& min_neighbor = 0) const;
+
+ protected:
+  /**
+   * @brief      Finds the row of a frame with a binary search in the index.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     The row (-1 if the id does not exist).
+   */
+  int FindRow(const int& id) const;
+
+ private:
+  MappedDatabase(const MappedDatabase&);
+  MappedDatabase& operator=(const MappedDatabase&);
+
+  // Properties
+  Params params_;                         //!> Stores parameters
+  const Hash& hash_;                      //!> The hash object (projections and distance)
+  uint8_t* data_;                         //!> The mapped file (NULL if closed)
+  size_t size_;                           //!> Bytes of the mapped file
+  const MappedDatabaseHeader* header_;    //!> The header of the file
+  const float* hashes_;                   //!> The hash rows
+  const float* bucket_sums_;              //!> The bucket sums of every row
+  const uint64_t* occupancy_;             //!> The occupancy bitmask of every row
+  const int32_t* ids_;                    //!> The frame id of every row
+  const int32_t* index_;                  //!> (id, row) pairs sorted by id
+  std::unique_ptr<WorkerPool> pool_;      //!> The threads for the queries
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_MAPPED_DATABASE_H_
@@ -0,0 +1,245 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_PAIRWISE_ENGINE_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_PAIRWISE_ENGINE_H_
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "libhaloc/bucketed_hash.h"
+#include "libhaloc/hash.h"
+#include "libhaloc/worker_pool.h"
+
+namespace haloc {
+
+/**
+ * @brief      A pair of frames and their overlap.
+ */
+struct PairMatch {
+  /**
+   * @brief      Default constructor.
+   */
+  PairMatch() : i(-1), j(-1), overlap(0), shift(-1) {}
+
+  /**
+   * @brief      Constructor.
+   *
+   * @param[in]  i        The first frame (row).
+   * @param[in]  j        The second frame (column).
+   * @param[in]  overlap  The overlap between both frames.
+   * @param[in]  shift    The cyclic shift of the overlap (-1 if unknown).
+   */
+  PairMatch(const int& i, const int& j, const int& overlap,
+      const int& shift = -1) :
+    i(i), j(j), overlap(overlap), shift(shift) {}
+
+  /**
+   * @brief      Row-major order.
+   *
+   * @param[in]  other  The other pair.
+   *
+   * @return     True if this pair goes before the other one.
+   */
+  inline bool operator<(const PairMatch& other) const {
+    return (i < other.i) || (i == other.i && j < other.j);
+  }
+
+  // Pair variables
+  int i;        //!> The first frame (row)
+  int j;        //!> The second frame (column)
+  int overlap;  //!> The number of buckets seeing the same view
+  int shift;    //!> The best cyclic shift (see Hash::CalcDist)
+};
+
+/**
+ * @brief      Computes the similarity of many pairs of frames: all the
+ *             pairs of a sequence (lower triangle) or every query against
+ *             every database frame. The pair matrix is cut in square tiles
+ *             whose row and column hashes (and bucket sums) fit together in
+ *             Params::cache_size bytes, so they stay in cache while the tile
+ *             is computed: with the default 3072-float hash and 256 KB, a
+ *             tile has 10 rows and columns. The tiles are numbered and never
+ *             stored: every thread starts with a contiguous range of tile
+ *             numbers and, once it is done, steals tiles from the end of the
+ *             other ranges (without locks), so the partial tiles of the
+ *             diagonal do not unbalance the threads. The pairs of the
+ *             neighbourhood band are never visited.
+ */
+class PairwiseEngine {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int tile_size;               //!> Rows and columns per tile (0 = from cache_size)
+    int cache_size;              //!> Cache bytes per thread for the hashes of a tile
+    int num_threads;             //!> Number of threads (0 = all cores)
+
+    // Default values
+    static const int             DEFAULT_TILE_SIZE = 0;
+    static const int             DEFAULT_CACHE_SIZE = 256*1024;
+    static const int             DEFAULT_NUM_THREADS = 0;
+  };
+
+  /**
+   * @brief      Function called for every pair: thread index (in
+   *             [0, GetNumThreads()), to keep per-thread results without
+   *             locks), row and column.
+   */
+  typedef std::function<void(int, int, int)> PairFunction;
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash  The hash object that produced the hashes. It must
+   *                   outlive the engine and keep its parameters.
+   */
+  explicit PairwiseEngine(const Hash& hash);
+
+  /**
+   * @brief      Sets the parameters.
+   *
+   * @param[in]  params  The parameters.
+   */
+  inline void SetParams(const Params& params) {
+    params_ = params; pool_.reset();}
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Returns the number of threads, i.e. the range of the thread
+   *             index given to the pair functions.
+   *
+   * @return     The number of threads.
+   */
+  int GetNumThreads();
+
+  /**
+   * @brief      Returns the rows and columns per tile: Params::tile_size, or
+   *             the most that fit in Params::cache_size with the hash length
+   *             of the hash object (64 if it is not initialized).
+   *
+   * @return     The tile size.
+   */
+  int GetTileSize() const;
+
+  /**
+   * @brief      Calls a function for every pair (i, j) of a sequence with
+   *             i - j > band (the lower triangle without the neighbourhood
+   *             band).
+   *
+   * @param[in]  size  The number of frames.
+   * @param[in]  band  The neighbourhood band (0 = every pair with j < i).
+   * @param[in]  fn    The function. It runs concurrently on all threads.
+   */
+  void VisitLowerTriangle(const int& size, const int& band,
+    const PairFunction& fn);
+
+  /**
+   * @brief      Calls a function for every pair (i, j) with i < rows and
+   *             j < cols.
+   *
+   * @param[in]  rows  The number of rows (queries).
+   * @param[in]  cols  The number of columns (database frames).
+   * @param[in]  fn    The function. It runs concurrently on all threads.
+   */
+  void VisitRectangle(const int& rows, const int& cols,
+    const PairFunction& fn);
+
+  /**
+   * @brief      Finds the pairs of a sequence that overlap, skipping the
+   *             neighbourhood band.
+   *
+   * @param[in]  hashes       The hashes of the sequence.
+   * @param[in]  eps          The maximum L1 distance between matching
+   *                          buckets.
+   * @param[in]  min_overlap  The minimum overlap of the returned pairs.
+   * @param[in]  band         Only pairs with i - j > band are computed.
+   *
+   * @return     The pairs (i > j) with overlap >= min_overlap and their best
+   *             shift, sorted by row and column.
+   */
+  std::vector<PairMatch> AllPairs(const std::vector<BucketedHash>& hashes,
+    float eps, const int& min_overlap, const int& band = 0);
+
+  /**
+   * @brief      Finds the overlapping pairs of every query with every
+   *             database frame.
+   *
+   * @param[in]  queries      The query hashes (rows).
+   * @param[in]  database     The database hashes (columns).
+   * @param[in]  eps          The maximum L1 distance between matching
+   *                          buckets.
+   * @param[in]  min_overlap  The minimum overlap of the returned pairs.
+   *
+   * @return     The pairs with overlap >= min_overlap and their best shift,
+   *             sorted by row and column.
+   */
+  std::vector<PairMatch> ManyVsMany(const std::vector<BucketedHash>& queries,
+    const std::vector<BucketedHash>& database, float eps,
+    const int& min_overlap);
+
+ protected:
+  /**
+   * @brief      Runs the tiles with work stealing.
+   *
+   * @param[in]  num_tiles  The number of tiles.
+   * @param[in]  fn         The function to run for every tile, with the
+   *                        thread index and the tile number.
+   */
+  void RunTiles(const int& num_tiles, const std::function<void(int, int)>& fn);
+
+  /**
+   * @brief      Collects the overlapping pairs computed by a visit.
+   *
+   * @param[in]  visit        Runs the visit with the given pair function.
+   * @param[in]  rows         The row hashes.
+   * @param[in]  cols         The column hashes.
+   * @param[in]  eps          The maximum L1 distance between matching
+   *                          buckets.
+   * @param[in]  min_overlap  The minimum overlap of the returned pairs.
+   *
+   * @return     The pairs, sorted by row and column.
+   */
+  std::vector<PairMatch> CollectPairs(
+    const std::function<void(const PairFunction&)>& visit,
+    const std::vector<BucketedHash>& rows,
+    const std::vector<BucketedHash>& cols, float eps,
+    const int& min_overlap);
+
+ private:
+  // Properties
+  Params params_;                         //!> Stores parameters
+  const Hash& hash_;                      //!> The hash object (distance)
+  std::unique_ptr<WorkerPool> pool_;      //!> The threads
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_PAIRWISE_ENGINE_H_
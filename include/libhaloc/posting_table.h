@@ -0,0 +1,154 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_POSTING_TABLE_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_POSTING_TABLE_H_
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "libhaloc/hash_database.h"
+
+namespace haloc {
+
+/**
+ * @brief      Key of a tuple of integer cells (FNV-1a over the cells). Two
+ *             tuples may share a key, which only adds candidates to the exact
+ *             verification of the indexes.
+ */
+class CellsKey {
+ public:
+  /**
+   * @brief      Class constructor. The key of the empty tuple.
+   */
+  CellsKey() : key_(14695981039346656037ULL) {}
+
+  /**
+   * @brief      Appends a cell to the tuple.
+   *
+   * @param[in]  cell  The cell.
+   */
+  inline void Add(const int& cell) {
+    key_ = (key_ ^ static_cast<uint32_t>(cell)) * 1099511628211ULL;}
+
+  /**
+   * @brief      Returns the key of the tuple.
+   *
+   * @return     The key.
+   */
+  inline uint64_t Get() const {return key_;}
+
+ private:
+  uint64_t key_;  //!> The running FNV-1a value
+};
+
+/**
+ * @brief      Entry of a posting list: a bucket of a frame filed under the
+ *             code of its coefficients.
+ */
+struct Posting {
+  int id;      //!> The frame id
+  int bucket;  //!> The bucket of the frame
+};
+
+/**
+ * @brief      Posting lists of the bucket codes of the indexed frames, used
+ *             by the candidate tables of InvertedIndex and LshIndex.
+ */
+class PostingTable {
+ public:
+  /**
+   * @brief      Files a bucket of a frame under a key.
+   *
+   * @param[in]  key     The key.
+   * @param[in]  id      The frame id.
+   * @param[in]  bucket  The bucket.
+   */
+  void Add(const uint64_t& key, const int& id, const int& bucket);
+
+  /**
+   * @brief      Removes one posting of a frame from the list of a key (a
+   *             frame is removed by calling it once per Add).
+   *
+   * @param[in]  key   The key.
+   * @param[in]  id    The frame id.
+   */
+  void Remove(const uint64_t& key, const int& id);
+
+  /**
+   * @brief      Removes all the postings.
+   */
+  inline void Clear() {lists_.clear();}
+
+  /**
+   * @brief      Returns the posting list of a key.
+   *
+   * @param[in]  key   The key.
+   *
+   * @return     The list (null if there is none).
+   */
+  const std::vector<Posting>* Find(const uint64_t& key) const;
+
+ private:
+  std::unordered_map<uint64_t, std::vector<Posting> > lists_;  //!> The lists
+};
+
+/**
+ * @brief      Counts, for every frame found in the posting lists, how many
+ *             query buckets it matches with every cyclic shift, the same
+ *             bucket alignments as Hash::CalcDist.
+ */
+class ShiftVotes {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  num_buckets   The number of buckets per hash.
+   * @param[in]  query_id      The frame id of the query (-1 if none).
+   * @param[in]  min_neighbor  When query_id >= 0, the frames with
+   *                           |id - query_id| <= min_neighbor get no votes.
+   */
+  ShiftVotes(const int& num_buckets, const int& query_id,
+    const int& min_neighbor);
+
+  /**
+   * @brief      Adds the votes of a posting list found for a query bucket.
+   *
+   * @param[in]  list          The posting list.
+   * @param[in]  query_bucket  The query bucket.
+   */
+  void Vote(const std::vector<Posting>& list, const int& query_bucket);
+
+  /**
+   * @brief      Returns the votes of the best shift of every frame.
+   *
+   * @return     One match per frame, with the votes as overlap (unsorted).
+   */
+  std::vector<Match> BestShifts() const;
+
+ private:
+  int num_buckets_;                       //!> Buckets per hash
+  int query_id_;                          //!> The query frame
+  int min_neighbor_;                      //!> The temporal window
+  std::unordered_map<int, std::vector<int> >
+    votes_;                               //!> Votes per frame and shift
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_POSTING_TABLE_H_
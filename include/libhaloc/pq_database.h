@@ -0,0 +1,174 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_PQ_DATABASE_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_PQ_DATABASE_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+#include "libhaloc/product_quantizer.h"
+#include "libhaloc/worker_pool.h"
+
+namespace haloc {
+
+/**
+ * @brief      Compressed hash database: every frame is stored as the product
+ *             quantization codes of its buckets plus the occupancy bitmask
+ *             (num_buckets*num_subspaces + 8 bytes per frame). A query builds
+ *             one distance table per bucket and scores the frames with table
+ *             lookups, with the same shifts as Hash::CalcDist. The float
+ *             hashes are not kept, so the overlaps are approximate.
+ */
+class PqDatabase {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int num_threads;             //!> Number of threads for the queries (0 = all cores)
+    int min_parallel_size;       //!> Minimum database size to use the threads
+
+    // Default values
+    static const int             DEFAULT_NUM_THREADS = 0;
+    static const int             DEFAULT_MIN_PARALLEL_SIZE = 256;
+  };
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash       The hash object that produces the hashes.
+   * @param[in]  quantizer  The trained codec. Both must outlive the database
+   *                        and keep their parameters and codebooks.
+   */
+  PqDatabase(const Hash& hash, const ProductQuantizer& quantizer);
+
+  /**
+   * @brief      Sets the parameters.
+   *
+   * @param[in]  params  The parameters.
+   */
+  inline void SetParams(const Params& params) {
+    params_ = params;
+    pool_.reset(new WorkerPool(params_.num_threads));}
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Returns the number of stored frames.
+   *
+   * @return     The size.
+   */
+  inline int Size() const {return ids_.size();}
+
+  /**
+   * @brief      Determines if a frame is stored.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     True if the frame is stored.
+   */
+  inline bool Contains(const int& id) const {return rows_.count(id) > 0;}
+
+  /**
+   * @brief      Encodes and adds the hash of a frame.
+   *
+   * @param[in]  id    The frame id.
+   * @param[in]  hash  The hash, as returned by Hash::GetHash.
+   *
+   * @return     False if the id already exists, the hash length is wrong or
+   *             the codec is not trained.
+   */
+  bool Add(const int& id, const std::vector<float>& hash);
+
+  /**
+   * @brief      Removes a frame.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     False if the id does not exist.
+   */
+  bool Remove(const int& id);
+
+  /**
+   * @brief      Removes all the frames.
+   */
+  void Clear();
+
+  /**
+   * @brief      Finds the k frames with the largest approximate overlap with
+   *             the query. Several threads can query at once.
+   *
+   * @param[in]  hash          The query hash, as returned by Hash::GetHash.
+   * @param[in]  k             The maximum number of candidates.
+   * @param[in]  eps           The maximum L1 distance between matching buckets.
+   * @param[in]  query_id      The frame id of the query (-1 if none).
+   * @param[in]  min_neighbor  When query_id >= 0, the frames with
+   *                           |id - query_id| <= min_neighbor are skipped.
+   *
+   * @return     The candidates with overlap > 0, best first.
+   */
+  std::vector<Match> Query(const std::vector<float>& hash, const int& k,
+    float eps, const int& query_id = -1, const int& min_neighbor = 0) const;
+
+ protected:
+  /**
+   * @brief      Approximate overlap between the query and a stored frame.
+   *
+   * @param[in]  tables       The distance tables of the query buckets.
+   * @param[in]  occupancy_q  The occupancy bitmask of the query.
+   * @param[in]  row          The row of the frame.
+   * @param[in]  eps          The maximum L1 distance between matching buckets.
+   *
+   * @return     Distance: the number of buckets seeing the same view.
+   */
+  int CalcDist(const std::vector<float>& tables, const uint64_t& occupancy_q,
+    const int& row, float eps) const;
+
+ private:
+  // Properties
+  Params params_;                         //!> Stores parameters
+  const Hash& hash_;                      //!> The hash object
+  const ProductQuantizer& quantizer_;     //!> The codec
+  int num_buckets_;                       //!> Number of buckets per hash
+  int code_length_;                       //!> Code bytes per bucket
+  int table_size_;                        //!> Floats of the distance table of a bucket
+  std::vector<uint8_t> codes_;            //!> The codes, num_buckets_*code_length_ per frame
+  std::vector<uint64_t> occupancy_;       //!> The occupancy bitmask of every frame
+  std::vector<int> ids_;                  //!> The frame id of every row
+  std::unordered_map<int, int> rows_;     //!> The row of every frame id
+  std::unique_ptr<WorkerPool> pool_;      //!> The threads for the queries
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_PQ_DATABASE_H_
@@ -0,0 +1,209 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_PRODUCT_QUANTIZER_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_PRODUCT_QUANTIZER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "libhaloc/aligned.h"
+#include "libhaloc/hash.h"
+
+namespace haloc {
+
+/**
+ * @brief      Product quantization codec for the bucket vectors of the hashes.
+ *             Every bucket vector is split into num_subspaces consecutive
+ *             slices and every slice is replaced by the index of its closest
+ *             centroid, so a bucket takes num_subspaces bytes. The hash
+ *             distance is L1, so the codebooks are trained with k-medians
+ *             (the per-coordinate median minimizes the L1 error of a
+ *             cluster). A query bucket is compared with the codes through a
+ *             lookup table with its L1 distance to every centroid (asymmetric
+ *             distance computation): the query is never quantized.
+ */
+class ProductQuantizer {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int num_subspaces;           //!> Number of slices (and code bytes) per bucket
+    int num_centroids;           //!> Centroids per slice (<= 256)
+    int num_iterations;          //!> Maximum k-medians iterations
+    unsigned int seed;           //!> Seed of the centroid initialization
+
+    // Default values
+    static const int             DEFAULT_NUM_SUBSPACES = 8;
+    static const int             DEFAULT_NUM_CENTROIDS = 256;
+    static const int             DEFAULT_NUM_ITERATIONS = 20;
+    static const unsigned int    DEFAULT_SEED = 0;
+  };
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash  The hash object that produces the hashes. It must
+   *                   outlive the codec and keep its parameters.
+   */
+  explicit ProductQuantizer(const Hash& hash);
+
+  /**
+   * @brief      Sets the parameters. The codebooks must be trained again.
+   *
+   * @param[in]  params  The parameters.
+   */
+  inline void SetParams(const Params& params) {
+    params_ = params; trained_ = false;}
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Determines if the codebooks are trained.
+   *
+   * @return     True if trained.
+   */
+  inline bool IsTrained() const {return trained_;}
+
+  /**
+   * @brief      Returns the number of code bytes per bucket.
+   *
+   * @return     The code length.
+   */
+  inline int GetCodeLength() const {return params_.num_subspaces;}
+
+  /**
+   * @brief      Returns the length of the bucket vectors.
+   *
+   * @return     The bucket length.
+   */
+  inline int GetBucketLength() const {return bucket_length_;}
+
+  /**
+   * @brief      Trains the codebooks with the non-empty buckets of a sample
+   *             of hashes. Meant to run offline.
+   *
+   * @param[in]  hashes  The hashes, as returned by Hash::GetHash.
+   *
+   * @return     False if the hashes have no valid buckets.
+   */
+  bool Train(const std::vector< std::vector<float> >& hashes);
+
+  /**
+   * @brief      Saves the trained codebooks to a binary file (little-endian):
+   *             format version, fingerprint of the hash model, parameters
+   *             and centroids. A database encoded offline can then be queried
+   *             with the same codebooks.
+   *
+   * @param[in]  filename  The file.
+   *
+   * @return     False if the codebooks are not trained or the file cannot be
+   *             written.
+   */
+  bool Save(const std::string& filename) const;
+
+  /**
+   * @brief      Loads codebooks saved with Save, replacing the parameters
+   *             and the current codebooks. The hash object must be
+   *             initialized with the model the codebooks were trained for
+   *             (same fingerprint).
+   *
+   * @param[in]  filename  The file.
+   *
+   * @return     False if the file cannot be read, is not a codebook file or
+   *             belongs to another model. The codebooks are then untrained.
+   */
+  bool Load(const std::string& filename);
+
+  /**
+   * @brief      Encodes a bucket vector.
+   *
+   * @param[in]  bucket  The bucket vector (GetBucketLength() elements).
+   * @param[out] code    The code (GetCodeLength() bytes).
+   */
+  void Encode(const float* bucket, uint8_t* code) const;
+
+  /**
+   * @brief      Computes the asymmetric distance table of a query bucket.
+   *
+   * @param[in]  bucket  The query bucket vector.
+   * @param[out] table   The L1 distance between every slice of the query and
+   *                     every centroid of that slice
+   *                     (num_subspaces x num_centroids).
+   */
+  void ComputeTable(const float* bucket, float* table) const;
+
+  /**
+   * @brief      Approximate L1 distance between a query bucket and a code.
+   *
+   * @param[in]  table  The distance table of the query bucket.
+   * @param[in]  code   The code.
+   *
+   * @return     The distance.
+   */
+  inline float Distance(const float* table, const uint8_t* code) const {
+    float dist = 0.0;
+    for (int s=0; s < params_.num_subspaces; ++s)
+      dist += table[s*params_.num_centroids + code[s]];
+    return dist;
+  }
+
+ protected:
+  /**
+   * @brief      Splits the bucket vectors in num_subspaces slices, as even as
+   *             possible.
+   *
+   * @param[in]  bucket_length  The length of the bucket vectors.
+   */
+  void InitSlices(const int& bucket_length);
+
+  /**
+   * @brief      Returns the closest centroid of a slice.
+   *
+   * @param[in]  s      The slice.
+   * @param[in]  slice  The slice values.
+   *
+   * @return     The centroid index.
+   */
+  int ClosestCentroid(const int& s, const float* slice) const;
+
+ private:
+  // Properties
+  Params params_;                         //!> Stores parameters
+  const Hash& hash_;                      //!> The hash object
+  bool trained_;                          //!> True when the codebooks are trained
+  int bucket_length_;                     //!> Length of the bucket vectors
+  std::vector<int> slice_begin_;          //!> First coordinate of every slice (plus the end)
+  std::vector<AlignedFloatVector> centroids_;  //!> Centroids of every slice, one per row
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_PRODUCT_QUANTIZER_H_
@@ -0,0 +1,164 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_QUANTIZED_DATABASE_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_QUANTIZED_DATABASE_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "libhaloc/aligned.h"
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+#include "libhaloc/worker_pool.h"
+
+namespace haloc {
+
+/**
+ * @brief      Same as HashDatabase, but the hashes are stored quantized to one
+ *             byte per coefficient (4x less memory and scan bandwidth) and
+ *             scored with the SAD kernels. Optionally, the float hashes are
+ *             also kept to rerank the best quantized candidates with the exact
+ *             distance. The quantization of the hash object must be
+ *             calibrated before adding any frame.
+ */
+class QuantizedDatabase {
+ public:
+  /**
+   * @brief      Struct for class parameters
+   */
+  struct Params {
+    /**
+     * @brief      Default constructor
+     */
+    Params();
+
+    // Class parameters
+    int num_threads;             //!> Number of threads for the queries (0 = all cores)
+    int min_parallel_size;       //!> Minimum database size to use the threads
+    int rerank_size;             //!> Quantized candidates reranked with the float hashes (0 = no rerank)
+
+    // Default values
+    static const int             DEFAULT_NUM_THREADS = 0;
+    static const int             DEFAULT_MIN_PARALLEL_SIZE = 256;
+    static const int             DEFAULT_RERANK_SIZE = 0;
+  };
+
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  hash  The hash object that produces the hashes. It must
+   *                   outlive the database and keep its parameters.
+   */
+  explicit QuantizedDatabase(const Hash& hash);
+
+  /**
+   * @brief      Sets the parameters. The database is cleared.
+   *
+   * @param[in]  params  The parameters.
+   */
+  inline void SetParams(const Params& params) {
+    params_ = params;
+    pool_.reset(new WorkerPool(params_.num_threads)); Clear();}
+
+  /**
+   * @brief      Returns the parameters.
+   *
+   * @return     The parameters.
+   */
+  inline Params GetParams() const {return params_;}
+
+  /**
+   * @brief      Returns the number of stored hashes.
+   *
+   * @return     The size.
+   */
+  inline int Size() const {return ids_.size();}
+
+  /**
+   * @brief      Determines if a frame is stored.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     True if the frame is stored.
+   */
+  inline bool Contains(const int& id) const {return rows_.count(id) > 0;}
+
+  /**
+   * @brief      Adds the hash of a frame.
+   *
+   * @param[in]  id    The frame id.
+   * @param[in]  hash  The hash, as returned by Hash::GetHash.
+   *
+   * @return     False if the id already exists, the hash is not valid or the
+   *             quantization is not calibrated.
+   */
+  bool Add(const int& id, const std::vector<float>& hash);
+
+  /**
+   * @brief      Removes the hash of a frame.
+   *
+   * @param[in]  id    The frame id.
+   *
+   * @return     False if the id does not exist.
+   */
+  bool Remove(const int& id);
+
+  /**
+   * @brief      Removes all the hashes.
+   */
+  void Clear();
+
+  /**
+   * @brief      Finds the k frames with the largest overlap with the query.
+   *             When rerank_size > 0, the best rerank_size quantized
+   *             candidates are scored again with the float hashes. Several
+   *             threads can query at once.
+   *
+   * @param[in]  hash          The query hash, as returned by Hash::GetHash.
+   * @param[in]  k             The maximum number of candidates.
+   * @param[in]  eps           The maximum L1 distance between matching buckets.
+   * @param[in]  query_id      The frame id of the query (-1 if none).
+   * @param[in]  min_neighbor  When query_id >= 0, the frames with
+   *                           |id - query_id| <= min_neighbor are skipped.
+   *
+   * @return     The candidates with overlap > 0, best first.
+   */
+  std::vector<Match> Query(const std::vector<float>& hash, const int& k,
+    float eps, const int& query_id = -1, const int& min_neighbor = 0) const;
+
+ private:
+  // Properties
+  Params params_;                         //!> Stores parameters
+  const Hash& hash_;                      //!> The hash object (quantization and distance)
+  int hash_length_;                       //!> Number of codes per hash
+  int code_stride_;                       //!> Aligned row length of codes_
+  int num_buckets_;                       //!> Number of buckets per hash
+  AlignedByteVector codes_;               //!> The codes, one aligned row per frame
+  std::vector<uint32_t> bucket_sums_;     //!> The bucket code sums, num_buckets_ per frame
+  std::vector<uint64_t> occupancy_;       //!> The occupancy bitmask of every frame
+  std::vector<int> ids_;                  //!> The frame id of every row
+  std::unordered_map<int, int> rows_;     //!> The row of every frame id
+  HashDatabase float_db_;                 //!> The float hashes (only with rerank)
+  std::unique_ptr<WorkerPool> pool_;      //!> The threads for the queries
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_QUANTIZED_DATABASE_H_
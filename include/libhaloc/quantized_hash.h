@@ -0,0 +1,47 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_QUANTIZED_HASH_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_QUANTIZED_HASH_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace haloc {
+
+/**
+ * @brief      Hash quantized to one byte per coefficient:
+ *             value ~= offset + scale * code, with the offset and scale
+ *             calibrated by the hash object. The empty buckets are only
+ *             told by the occupancy bitmask, since a bucket can have all its
+ *             codes at 0.
+ */
+struct QuantizedHash {
+  /**
+   * @brief      Default constructor.
+   */
+  QuantizedHash() : occupancy(0) {}
+
+  // Hash variables
+  std::vector<uint8_t> code;        //!> The quantized coefficients
+  uint64_t occupancy;               //!> Bit i is set when bucket i is not empty
+  std::vector<uint32_t> bucket_sum; //!> Sum of the codes of every bucket
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_QUANTIZED_HASH_H_
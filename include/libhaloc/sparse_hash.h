@@ -0,0 +1,59 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_SPARSE_HASH_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_SPARSE_HASH_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "libhaloc/bucketed_hash.h"
+
+namespace haloc {
+
+/**
+ * @brief      Hash without the empty buckets: the occupancy bitmask plus the
+ *             coefficients of the populated buckets only, in bucket order.
+ *             Bucket i is stored at block BlockIndex(i).
+ */
+struct SparseHash {
+  /**
+   * @brief      Default constructor.
+   */
+  SparseHash() : occupancy(0) {}
+
+  /**
+   * @brief      Returns the block of a populated bucket: the number of
+   *             populated buckets before it.
+   *
+   * @param[in]  bucket  The bucket (its occupancy bit must be set).
+   *
+   * @return     The block index.
+   */
+  inline int BlockIndex(const int& bucket) const {
+    return CountBuckets(occupancy & ((1ULL << bucket) - 1));
+  }
+
+  // Hash variables
+  uint64_t occupancy;             //!> Bit i is set when bucket i is not empty
+  std::vector<float> blocks;      //!> The coefficients of the populated buckets
+  std::vector<float> bucket_sum;  //!> Sum of the coefficients of every block
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_SPARSE_HASH_H_
@@ -0,0 +1,102 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIBHALOC_INCLUDE_LIBHALOC_WORKER_POOL_H_
+#define LIBHALOC_INCLUDE_LIBHALOC_WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace haloc {
+
+/**
+ * @brief      Fixed-size pool of worker threads. The threads are created once
+ *             and sleep between jobs, so the pool can be reused for every batch
+ *             without paying the thread creation cost again.
+ */
+class WorkerPool {
+ public:
+  /**
+   * @brief      Class constructor.
+   *
+   * @param[in]  num_threads  The total number of threads, including the
+   *                          calling thread (0 = hardware concurrency).
+   */
+  explicit WorkerPool(int num_threads = 0);
+
+  /**
+   * @brief      Class destructor. Joins the worker threads.
+   */
+  ~WorkerPool();
+
+  /**
+   * @brief      Returns the number of threads that run the jobs.
+   *
+   * @return     The number of threads (workers plus the calling thread).
+   */
+  inline int GetNumThreads() const {return workers_.size() + 1;}
+
+  /**
+   * @brief      Splits the range [0, size) in chunks of grain elements and
+   *             runs them over all threads. The calling thread also takes
+   *             chunks and the function returns when all of them are done.
+   *             If fn throws, the chunks not yet started are skipped and the
+   *             first exception is rethrown in the calling thread once every
+   *             thread has left the job.
+   *
+   * @param[in]  size   The number of elements.
+   * @param[in]  grain  The number of elements per chunk.
+   * @param[in]  fn     The function to run for every chunk [begin, end).
+   */
+  void ParallelFor(const int& size, const int& grain,
+    const std::function<void(int, int)>& fn);
+
+ private:
+  /**
+   * @brief      Main loop of every worker thread.
+   */
+  void WorkerLoop();
+
+  /**
+   * @brief      Takes chunks of the current job until it is exhausted. An
+   *             exception of the job is stored and ends the job.
+   */
+  void RunChunks();
+
+  // Properties
+  std::vector<std::thread> workers_;             //!> The worker threads
+  std::mutex run_mutex_;                         //!> Serializes the jobs
+  std::mutex mutex_;                             //!> Protects the job state
+  std::condition_variable job_cv_;               //!> Signals a new job
+  std::condition_variable done_cv_;              //!> Signals the job end
+  const std::function<void(int, int)>* job_;     //!> The current job
+  int job_size_;                                 //!> Size of the current job
+  int job_grain_;                                //!> Chunk size of the current job
+  std::atomic<int> next_;                        //!> Next element to process
+  int pending_;                                  //!> Workers still running the job
+  std::exception_ptr error_;                     //!> First exception of the current job
+  unsigned long generation_;                     //!> Job counter
+  bool stop_;                                    //!> True to stop the workers
+};
+
+}  // namespace haloc
+
+#endif  // LIBHALOC_INCLUDE_LIBHALOC_WORKER_POOL_H_
@@ -0,0 +1,228 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "libhaloc/candidate_file.h"
+
+// Candidate file signature and format version. Files with a newer version
+// are rejected by the reader.
+static const char kCandidateMagic[8] = {'H', 'A', 'L', 'O', 'C', 'C', 'N',
+  'D'};
+static const uint32_t kCandidateVersion = 1;
+
+haloc::CandidateWriter::Params::Params() :
+  min_overlap(DEFAULT_MIN_OVERLAP),
+  buffer_size(DEFAULT_BUFFER_SIZE)
+{}
+
+haloc::CandidateWriter::CandidateWriter(const Params& params) :
+  params_(params) {
+  params_.buffer_size = std::max(1, params_.buffer_size);
+  memset(&header_, 0, sizeof(header_));
+}
+
+haloc::CandidateWriter::~CandidateWriter() {
+  Close();
+}
+
+bool haloc::CandidateWriter::Open(const std::string& filename,
+    const int& num_rows, const int& num_cols, const float& eps) {
+  Close();
+  std::lock_guard<std::mutex> lock(mutex_);
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, kCandidateMagic, sizeof(kCandidateMagic));
+  header_.version = kCandidateVersion;
+  header_.header_size = sizeof(CandidateFileHeader);
+  header_.num_rows = num_rows;
+  header_.num_cols = num_cols;
+  header_.eps = eps;
+  header_.min_overlap = params_.min_overlap;
+
+  // The count is only written at Close, so the readers can tell an
+  // unfinished file
+  CandidateFileHeader unfinished = header_;
+  unfinished.num_records = CandidateFileHeader::kUnfinished;
+  file_.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+  if (file_.is_open()) {
+    file_.write(reinterpret_cast<const char*>(&unfinished),
+      sizeof(unfinished));
+  }
+  if (!file_.is_open() || file_.fail()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot create the candidate file " <<
+      filename << ".");
+    file_.close();
+    return false;
+  }
+  filename_ = filename;
+  buffer_.clear();
+  buffer_.reserve(params_.buffer_size);
+  return true;
+}
+
+bool haloc::CandidateWriter::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!file_.is_open()) return true;
+  bool valid = WriteBuffer();
+  file_.seekp(0);
+  file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+  file_.close();
+  valid = valid && !file_.fail();
+  if (!valid) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot write the candidate file " <<
+      filename_ << ".");
+  }
+  return valid;
+}
+
+bool haloc::CandidateWriter::Append(const PairMatch& pair) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return file_.is_open() && Push(pair);
+}
+
+bool haloc::CandidateWriter::Append(const std::vector<PairMatch>& pairs) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!file_.is_open()) return false;
+  for (uint k=0; k < pairs.size(); ++k)
+    if (!Push(pairs[k])) return false;
+  return true;
+}
+
+uint64_t haloc::CandidateWriter::Size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return header_.num_records + buffer_.size();
+}
+
+bool haloc::CandidateWriter::Push(const PairMatch& pair) {
+  if (pair.overlap < params_.min_overlap) return true;
+  CandidateRecord record;
+  record.i = pair.i;
+  record.j = pair.j;
+  record.overlap = pair.overlap;
+  record.shift = pair.shift;
+  buffer_.push_back(record);
+  return buffer_.size() < params_.buffer_size || WriteBuffer();
+}
+
+bool haloc::CandidateWriter::WriteBuffer() {
+  if (buffer_.empty()) return !file_.fail();
+  file_.write(reinterpret_cast<const char*>(buffer_.data()),
+    buffer_.size()*sizeof(CandidateRecord));
+  header_.num_records += buffer_.size();
+  buffer_.clear();
+  return !file_.fail();
+}
+
+haloc::CandidateReader::CandidateReader() : num_records_(0), num_read_(0) {
+  memset(&header_, 0, sizeof(header_));
+}
+
+bool haloc::CandidateReader::Open(const std::string& filename) {
+  Close();
+  num_records_ = 0;
+  num_read_ = 0;
+  file_.clear();
+  file_.open(filename.c_str(), std::ios::binary);
+  if (!file_.is_open()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot open the candidate file " <<
+      filename << ".");
+    return false;
+  }
+
+  // Header
+  memset(&header_, 0, sizeof(header_));
+  file_.seekg(0, std::ios::end);
+  const uint64_t file_size = file_.tellg();
+  file_.seekg(0);
+  file_.read(reinterpret_cast<char*>(&header_), sizeof(header_));
+  if (file_.fail() ||
+      memcmp(header_.magic, kCandidateMagic, sizeof(kCandidateMagic)) != 0 ||
+      header_.version > kCandidateVersion ||
+      header_.header_size < sizeof(CandidateFileHeader) ||
+      header_.header_size > file_size) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> " << filename << " is not a " <<
+      "candidate file or was written by a newer version.");
+    Close();
+    return false;
+  }
+  file_.seekg(header_.header_size);
+
+  // Only the complete records of an unfinished file
+  const uint64_t available = (file_size - header_.header_size) /
+    sizeof(CandidateRecord);
+  if (header_.num_records == CandidateFileHeader::kUnfinished) {
+    ROS_WARN_STREAM("[Haloc:] WARNING -> The candidate file " << filename <<
+      " was not closed, reading its " << available << " complete records.");
+    num_records_ = available;
+  } else if (header_.num_records > available) {
+    ROS_WARN_STREAM("[Haloc:] WARNING -> The candidate file " << filename <<
+      " is truncated, reading its " << available << " complete records.");
+    num_records_ = available;
+  } else {
+    num_records_ = header_.num_records;
+  }
+  return true;
+}
+
+bool haloc::CandidateReader::Next(PairMatch& pair) {
+  if (!file_.is_open() || num_read_ >= num_records_) return false;
+  CandidateRecord record;
+  file_.read(reinterpret_cast<char*>(&record), sizeof(record));
+  if (file_.fail()) return false;
+  num_read_++;
+  pair = PairMatch(record.i, record.j, record.overlap, record.shift);
+  return true;
+}
+
+bool haloc::CandidateReader::ReadMatrix(Eigen::SparseMatrix<int>& overlap,
+    Eigen::SparseMatrix<int>* shift) {
+  if (!file_.is_open()) return false;
+
+  // Read in blocks
+  typedef Eigen::Triplet<int> Triplet;
+  std::vector<Triplet> overlaps, shifts;
+  overlaps.reserve(num_records_ - num_read_);
+  if (shift) shifts.reserve(num_records_ - num_read_);
+  std::vector<CandidateRecord> block(4096);
+  while (num_read_ < num_records_) {
+    const uint64_t n = std::min<uint64_t>(block.size(),
+      num_records_ - num_read_);
+    file_.read(reinterpret_cast<char*>(block.data()),
+      n*sizeof(CandidateRecord));
+    if (file_.fail()) break;
+    num_read_ += n;
+    for (uint k=0; k < n; ++k) {
+      const CandidateRecord& r = block[k];
+      if (r.i < 0 || r.j < 0 || r.i >= header_.num_rows ||
+          r.j >= header_.num_cols) continue;
+      overlaps.push_back(Triplet(r.i, r.j, r.overlap));
+      if (shift) shifts.push_back(Triplet(r.i, r.j, r.shift));
+    }
+  }
+
+  // A pair written twice keeps its last record
+  const auto last = [](const int& a, const int& b) {return b;};
+  overlap.resize(header_.num_rows, header_.num_cols);
+  overlap.setFromTriplets(overlaps.begin(), overlaps.end(), last);
+  if (shift) {
+    shift->resize(header_.num_rows, header_.num_cols);
+    shift->setFromTriplets(shifts.begin(), shifts.end(), last);
+  }
+  return true;
+}
@@ -0,0 +1,292 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <algorithm>
+
+#include "libhaloc/concurrent_database.h"
+
+haloc::ConcurrentDatabase::Params::Params() :
+  segment_size(DEFAULT_SEGMENT_SIZE),
+  max_segments(DEFAULT_MAX_SEGMENTS)
+{}
+
+haloc::ConcurrentDatabase::ConcurrentDatabase(const Hash& hash,
+    const Params& params) :
+  params_(params), hash_(hash), hash_length_(0), hash_stride_(0),
+  num_buckets_(0), epoch_(0), size_(0), num_removed_(0) {
+  params_.segment_size = std::max(1, params_.segment_size);
+  params_.max_segments = std::max(1, params_.max_segments);
+  readers_[0].store(0);
+  readers_[1].store(0);
+  view_.reset(new View());
+  view_->hash_length = 0;
+  view_->hash_stride = 0;
+  view_->num_buckets = 0;
+  published_.store(view_.get());
+}
+
+int haloc::ConcurrentDatabase::GetNumRetiredSegments() const {
+  int num_segments = 0;
+  for (uint i=0; i < retired_.size(); ++i)
+    num_segments += retired_[i].segments.size();
+  return num_segments;
+}
+
+bool haloc::ConcurrentDatabase::Add(const int& id,
+    const std::vector<float>& hash) {
+  // The layout is taken from the hash object when the first hash arrives.
+  // The queries take it from the view they read.
+  if (segments_.empty()) {
+    const Hash::Params params = hash_.GetParams();
+    hash_length_ = hash_.GetHashLength();
+    hash_stride_ = AlignedStride(hash_length_);
+    num_buckets_ = params.bucket_rows*params.bucket_cols;
+  }
+
+  // Sanity checks
+  if (hash.size() != hash_length_ || hash_length_ == 0) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot add frame " << id << " to " <<
+      "the database: the hash length is " << hash.size() << " and the " <<
+      "database expects " << hash_length_ << ".");
+    return false;
+  }
+  if (Contains(id)) {
+    ROS_WARN_STREAM("[Haloc:] WARNING -> Frame " << id << " is already in " <<
+      "the database.");
+    return false;
+  }
+
+  // New segment, fully allocated before anybody can see it. When all the
+  // segments are in use the tombstones are reclaimed first.
+  const auto open_is_full = [&]() {
+    return segments_.empty() || segments_.back()->num_rows.load(
+      std::memory_order_relaxed) == params_.segment_size;
+  };
+  if (open_is_full()) {
+    if (segments_.size() >= params_.max_segments && num_removed_ > 0)
+      Compact();
+    if (open_is_full()) {
+      if (segments_.size() >= params_.max_segments) {
+        ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot add frame " << id <<
+          " to the database: it is full (" << Size() << " frames).");
+        return false;
+      }
+      segments_.push_back(NewSegment());
+      Publish(std::vector< std::unique_ptr<Segment> >());
+    }
+  }
+
+  // Fill the row, then publish it
+  Segment* segment = segments_.back().get();
+  const int r = AppendRow(segment, id, &hash[0]);
+  rows_[id] = std::make_pair(segment, r);
+  segment->num_rows.store(r + 1, std::memory_order_release);
+  size_.fetch_add(1, std::memory_order_release);
+  Reclaim();
+  return true;
+}
+
+bool haloc::ConcurrentDatabase::Remove(const int& id) {
+  std::unordered_map<int, std::pair<Segment*, int> >::iterator it =
+    rows_.find(id);
+  if (it == rows_.end()) return false;
+
+  Segment* segment = it->second.first;
+  segment->removed[it->second.second].store(true, std::memory_order_release);
+  segment->num_live--;
+  num_removed_++;
+  size_.fetch_sub(1, std::memory_order_release);
+  rows_.erase(it);
+
+  // The tombstones are reclaimed once they outnumber the live rows, so
+  // every row is copied a bounded number of times
+  if (num_removed_ >= std::max(params_.segment_size,
+      size_.load(std::memory_order_relaxed)))
+    Compact();
+  else
+    Reclaim();
+  return true;
+}
+
+void haloc::ConcurrentDatabase::Compact() {
+  if (num_removed_ == 0) return;
+
+  // The full segments without tombstones are kept. The live rows of the
+  // other ones are copied to new segments, which are only visible once the
+  // new view is published, so a query never sees a frame twice.
+  std::vector< std::unique_ptr<Segment> > kept, dropped;
+  for (uint s=0; s < segments_.size(); ++s) {
+    const int num_rows = segments_[s]->num_rows.load(
+      std::memory_order_relaxed);
+    if (num_rows == params_.segment_size &&
+        segments_[s]->num_live == num_rows)
+      kept.push_back(std::move(segments_[s]));
+    else
+      dropped.push_back(std::move(segments_[s]));
+  }
+  segments_.swap(kept);
+  for (uint s=0; s < dropped.size(); ++s) {
+    const Segment& source = *dropped[s];
+    const int num_rows = source.num_rows.load(std::memory_order_relaxed);
+    for (int r=0; r < num_rows; ++r) {
+      if (source.removed[r].load(std::memory_order_relaxed)) continue;
+      if (segments_.empty() || segments_.back()->num_rows.load(
+          std::memory_order_relaxed) == params_.segment_size)
+        segments_.push_back(NewSegment());
+      Segment* target = segments_.back().get();
+      const int row = AppendRow(target, source.ids[r],
+        &source.hashes[r*hash_stride_]);
+      target->num_rows.store(row + 1, std::memory_order_relaxed);
+      rows_[source.ids[r]] = std::make_pair(target, row);
+    }
+  }
+  num_removed_ = 0;
+  Publish(std::move(dropped));
+}
+
+std::vector<haloc::Match> haloc::ConcurrentDatabase::Query(
+    const std::vector<float>& hash, const int& k, float eps,
+    const int& query_id, const int& min_neighbor) const {
+  // Register in the current epoch, so the view is not freed under the query.
+  // If the epoch changed meanwhile the writer may have missed the
+  // registration, so it is done again.
+  uint64_t epoch = 0;
+  while (true) {
+    epoch = epoch_.load();
+    readers_[epoch & 1].fetch_add(1);
+    if (epoch_.load() == epoch) break;
+    readers_[epoch & 1].fetch_sub(1);
+  }
+  const std::vector<Match> matches = QueryView(*published_.load(), hash, k,
+    eps, query_id, min_neighbor);
+  readers_[epoch & 1].fetch_sub(1, std::memory_order_release);
+  return matches;
+}
+
+std::vector<haloc::Match> haloc::ConcurrentDatabase::QueryView(
+    const View& view, const std::vector<float>& hash, const int& k, float eps,
+    const int& query_id, const int& min_neighbor) const {
+  if (view.segments.empty() || k <= 0) return std::vector<Match>();
+  if (hash.size() != view.hash_length) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The query hash length is " <<
+      hash.size() << " and the database expects " << view.hash_length <<
+      ".");
+    return std::vector<Match>();
+  }
+
+  // The snapshot: every row below the published count of its segment is
+  // complete
+  std::vector<int> segment_end(view.segments.size());
+  int num_rows = 0;
+  for (uint s=0; s < view.segments.size(); ++s) {
+    num_rows += view.segments[s]->num_rows.load(std::memory_order_acquire);
+    segment_end[s] = num_rows;
+  }
+
+  // Query metadata
+  std::vector<float> sum(view.num_buckets);
+  uint64_t occupancy = 0;
+  hash_.SummarizeBuckets(&hash[0], &sum[0], occupancy);
+
+  // Removed rows score 0, so they are never returned
+  const auto locate = [&](const int& row, int& r) {
+    const int s = std::upper_bound(segment_end.begin(), segment_end.end(),
+      row) - segment_end.begin();
+    r = (s == 0) ? row : row - segment_end[s - 1];
+    return view.segments[s];
+  };
+  const auto row_id = [&](const int& row) {
+    int r = 0;
+    const Segment* segment = locate(row, r);
+    return segment->ids[r];
+  };
+  const auto row_overlap = [&](const int& row) {
+    int r = 0;
+    const Segment* segment = locate(row, r);
+    if (segment->removed[r].load(std::memory_order_acquire)) return 0;
+    return hash_.CalcDist(&hash[0], &sum[0], occupancy,
+      &segment->hashes[r*view.hash_stride],
+      &segment->bucket_sums[r*view.num_buckets], segment->occupancy[r], eps,
+      true);
+  };
+  return ScanTopMatches(num_rows, k, query_id, min_neighbor, row_id,
+    row_overlap);
+}
+
+std::unique_ptr<haloc::ConcurrentDatabase::Segment>
+    haloc::ConcurrentDatabase::NewSegment() const {
+  std::unique_ptr<Segment> segment(new Segment());
+  segment->hashes.assign(params_.segment_size*hash_stride_, 0.0f);
+  segment->bucket_sums.resize(params_.segment_size*num_buckets_);
+  segment->occupancy.resize(params_.segment_size);
+  segment->ids.resize(params_.segment_size);
+  segment->removed.reset(new std::atomic<bool>[params_.segment_size]);
+  for (int i=0; i < params_.segment_size; ++i)
+    segment->removed[i].store(false, std::memory_order_relaxed);
+  segment->num_rows.store(0, std::memory_order_relaxed);
+  segment->num_live = 0;
+  return segment;
+}
+
+int haloc::ConcurrentDatabase::AppendRow(Segment* segment, const int& id,
+    const float* hash) {
+  const int r = segment->num_rows.load(std::memory_order_relaxed);
+  std::copy(hash, hash + hash_length_,
+    segment->hashes.begin() + r*hash_stride_);
+  hash_.SummarizeBuckets(&segment->hashes[r*hash_stride_],
+    &segment->bucket_sums[r*num_buckets_], segment->occupancy[r]);
+  segment->ids[r] = id;
+  segment->num_live++;
+  return r;
+}
+
+void haloc::ConcurrentDatabase::Publish(
+    std::vector< std::unique_ptr<Segment> > dropped) {
+  std::unique_ptr<View> view(new View());
+  for (uint s=0; s < segments_.size(); ++s)
+    view->segments.push_back(segments_[s].get());
+  view->hash_length = hash_length_;
+  view->hash_stride = hash_stride_;
+  view->num_buckets = num_buckets_;
+  published_.store(view.get());
+
+  // The queries registered up to the current epoch may still see the
+  // previous view
+  Retired retired;
+  retired.epoch = epoch_.load();
+  retired.view = std::move(view_);
+  retired.segments = std::move(dropped);
+  retired_.push_back(std::move(retired));
+  view_ = std::move(view);
+  Reclaim();
+}
+
+void haloc::ConcurrentDatabase::Reclaim() {
+  if (retired_.empty()) return;
+
+  // The queries of the previous epoch share their counter with the next
+  // one, which can only start once they are all done
+  const uint64_t epoch = epoch_.load();
+  if (readers_[(epoch + 1) & 1].load() == 0) epoch_.store(epoch + 1);
+
+  // What was retired in epoch e is only seen by the queries of epoch e or
+  // older, which are done when the epoch reaches e + 2
+  const uint64_t current = epoch_.load();
+  while (!retired_.empty() && retired_.front().epoch + 2 <= current)
+    retired_.pop_front();
+}
@@ -16,51 +16,144 @@
 
 #include <ros/ros.h>
 
+#include <algorithm>
+
 #include "libhaloc/hash.h"
+#include "libhaloc/kernels.h"
 
 #include <opencv2/core/eigen.hpp>
 
-haloc::Hash::Params::Params() :
-  bucket_rows(DEFAULT_BUCKET_ROWS), bucket_cols(DEFAULT_BUCKET_COLS),
-  max_desc(DEFAULT_MAX_DESC), num_proj(DEFAULT_NUM_PROJ)
-{}
+// Relative slack of the |sum_a - sum_b| lower bound of the L1 distance
+static const float kSumBoundTolerance = 1e-4;
+
+// Fraction of the coefficients left out at each side of the calibrated
+// quantization range, so a few outliers do not waste the codes
+static const float kQuantizationClip = 1e-3;
 
-haloc::Hash::Hash() : initialized_(false) {}
+haloc::Hash::Hash() : context_(std::shared_ptr<const HashModel>()),
+  desc_length_(0) {}
 
 std::vector<float> haloc::Hash::GetHash(
     const std::vector<cv::KeyPoint>& kp, const cv::Mat& desc,
     const cv::Size& img_size) {
+  std::vector<float> hash;
+  if (!GetHash(kp, desc, img_size, hash)) hash.clear();
+  return hash;
+}
+
+bool haloc::Hash::GetHash(const std::vector<cv::KeyPoint>& kp,
+    const cv::Mat& desc, const cv::Size& img_size, float* hash,
+    const int& hash_length) {
   // Initialize first time
-  if (!IsInitialized()) Init(img_size, kp.size(), desc.cols);
-  state_.Clear();
+  if (!IsInitialized()) {
+    Init(img_size, kp.size(), GetDescriptorLength(desc),
+      desc.type() == CV_8U);
+  }
+  return context_.GetHash(kp, desc, hash, hash_length);
+}
 
-  // Initialize output
-  std::vector<float> hash;
+bool haloc::Hash::GetHash(const std::vector<cv::KeyPoint>& kp,
+    const cv::Mat& desc, const cv::Size& img_size, std::vector<float>& hash) {
+  // The length is only known once the class is initialized
+  if (!IsInitialized()) {
+    Init(img_size, kp.size(), GetDescriptorLength(desc),
+      desc.type() == CV_8U);
+  }
+  return context_.GetHash(kp, desc, hash);
+}
 
-  // The maximum number of features per bucket
-  int max_features_x_bucket = static_cast<int>(
-    floor(params_.max_desc/(params_.bucket_cols*params_.bucket_rows)));
+std::vector<float> haloc::Hash::GetHash(
+    const std::vector<cv::KeyPoint>& kp, const cv::Mat& desc,
+    const cv::Size& img_size, BinarySignature& signature) {
+  std::vector<float> hash = GetHash(kp, desc, img_size);
+  signature = hash.empty() ? BinarySignature() : GetSignature(hash);
+  return hash;
+}
 
-  // Bucket descriptors
-  std::vector<cv::Mat> bucket_desc = BucketDescriptors(kp, desc);
+void haloc::Hash::GetHashes(
+    const std::vector< std::vector<cv::KeyPoint> >& kp,
+    const std::vector<cv::Mat>& desc, const std::vector<cv::Size>& img_size,
+    cv::Mat& hashes) {
+  // Sanity checks
+  if (kp.size() != desc.size() || img_size.size() != desc.size()) {
+    ROS_ERROR("[Haloc:] ERROR -> The keypoints, descriptors and image sizes "
+      "of the batch must have the same length.");
+    return;
+  }
+  if (desc.empty()) return;
 
-  // Get a hash for every bucket
-  const int min_feat = static_cast<int>(0.7 * max_features_x_bucket);
-  for (uint i=0; i < bucket_desc.size(); ++i) {
-    std::vector<float> bucketed_hash;
-    if (bucket_desc[i].rows >= min_feat) {
-      bucketed_hash = ProjectDescriptors(bucket_desc[i]);
-    } else {
-      for (uint i=0; i < desc.cols*params_.num_proj; ++i)
-        bucketed_hash.push_back(0.0);
+  // Initialize first time
+  if (!IsInitialized()) {
+    Init(img_size[0], kp[0].size(), GetDescriptorLength(desc[0]),
+      desc[0].type() == CV_8U);
+  }
+  for (uint i=0; i < desc.size(); ++i) {
+    if (!model_->CheckDescriptors(desc[i])) {
+      ROS_ERROR_STREAM("[Haloc:] ERROR -> The descriptor length of image " <<
+        i << " (" << GetDescriptorLength(desc[i]) << ") or type does not " <<
+        "match the ones used to initialize the hash (" << desc_length_ <<
+        ").");
+      return;
+    }
+    if (kp[i].size() != desc[i].rows) {
+      ROS_ERROR_STREAM("[Haloc:] ERROR -> Image " << i << " has " <<
+        kp[i].size() << " keypoints and " << desc[i].rows <<
+        " descriptors.");
+      return;
     }
-    hash.insert(hash.end(), bucketed_hash.begin(), bucketed_hash.end());
   }
-  return hash;
+
+  // Contiguous output, one hash per row
+  hashes.create(desc.size(), GetHashLength(), CV_32F);
+
+  // The pool is created once and reused for every batch
+  if (!pool_) pool_ = std::make_shared<WorkerPool>(params_.num_threads);
+
+  // Images are handed out in small chunks to balance the load
+  const int grain = std::max(1, static_cast<int>(
+    desc.size() / (8 * pool_->GetNumThreads())));
+  pool_->ParallelFor(desc.size(), grain, [&](int begin, int end) {
+    HashContext context(model_, kp[begin].size());
+    for (int i=begin; i < end; ++i)
+      context.GetHash(kp[i], desc[i], hashes.ptr<float>(i), hashes.cols);
+  });
+}
+
+haloc::BucketedHash haloc::Hash::GetBucketedHash(
+    const std::vector<cv::KeyPoint>& kp, const cv::Mat& desc,
+    const cv::Size& img_size) {
+  return BuildBucketedHash(GetHash(kp, desc, img_size));
+}
+
+haloc::BucketedHash haloc::Hash::BuildBucketedHash(
+    const std::vector<float>& hash) const {
+  BucketedHash out;
+  out.hash = hash;
+
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  const int bucket_length = desc_length_*params_.num_proj;
+  if (hash.size() != num_buckets*bucket_length) return out;
+
+  out.bucket_sum.resize(num_buckets);
+  SummarizeBuckets(&hash[0], &out.bucket_sum[0], out.occupancy);
+  return out;
+}
+
+void haloc::Hash::SummarizeBuckets(const float* hash, float* bucket_sum,
+    uint64_t& occupancy) const {
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  const int bucket_length = desc_length_*params_.num_proj;
+  occupancy = 0;
+  for (int i=0; i < num_buckets; ++i) {
+    const float* first = hash + i*bucket_length;
+    bucket_sum[i] = std::accumulate(first, first + bucket_length, 0.0);
+    if (bucket_sum[i] != 0.0 && i < kMaxMaskBuckets)
+      occupancy |= (1ULL << i);
+  }
 }
 
 int haloc::Hash::CalcDist(const std::vector<float>& hash_a,
-    const std::vector<float>& hash_b, float eps) {
+    const std::vector<float>& hash_b, float eps, bool prune) const {
   // Init
   const int num_buckets = params_.bucket_cols*params_.bucket_rows;
   // const float eps = 0.6;
@@ -70,6 +163,11 @@ int haloc::Hash::CalcDist(const std::vector<float>& hash_a,
   for (uint i=0; i < comb_.size(); ++i) {
     int comb_overlap = 0;
     for (uint j=0; j < num_buckets; ++j) {
+      // Even if all the remaining buckets match, this shift cannot beat the
+      // best one
+      if (prune && comb_overlap + num_buckets - j <= num_buckets_overlap)
+        break;
+
       int idx_a = comb_[i][j].first  * params_.num_proj * desc_length_;
       int idx_b = comb_[i][j].second * params_.num_proj * desc_length_;
 
@@ -86,241 +184,645 @@ int haloc::Hash::CalcDist(const std::vector<float>& hash_a,
       float sum_b = std::accumulate(b_first, b_last, 0.0);
       if (sum_b == 0.0) continue;
 
-      float proj_sum = 0.0;
-      for (uint k=0; k < desc_length_*params_.num_proj; ++k) {
-        proj_sum += fabs(hash_a[idx_a+k] - hash_b[idx_b+k]);
-      }
+      float proj_sum = prune ?
+        kernels::L1DistanceBounded(&hash_a[idx_a], &hash_b[idx_b],
+          desc_length_*params_.num_proj, eps) :
+        kernels::L1Distance(&hash_a[idx_a], &hash_b[idx_b],
+          desc_length_*params_.num_proj);
       if (proj_sum <= eps) comb_overlap++;
     }
     if (comb_overlap > num_buckets_overlap) {
       num_buckets_overlap = comb_overlap;
     }
+    if (prune && num_buckets_overlap == num_buckets) break;
   }
   return num_buckets_overlap;
 }
 
-void haloc::Hash::PublishState(const cv::Mat& img) {
-  // The bucketed image
-  pub_.PublishBucketedImage(state_, img, params_.bucket_rows,
-    params_.bucket_cols);
+int haloc::Hash::CalcDist(const BucketedHash& hash_a,
+    const BucketedHash& hash_b, float eps, bool prune) const {
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  if (hash_a.bucket_sum.size() != num_buckets ||
+      hash_b.bucket_sum.size() != num_buckets)
+    return CalcDist(hash_a.hash, hash_b.hash, eps, prune);
+  return CalcDist(&hash_a.hash[0], &hash_a.bucket_sum[0], hash_a.occupancy,
+    &hash_b.hash[0], &hash_b.bucket_sum[0], hash_b.occupancy, eps, prune);
+}
 
-  // The bucketed info
-  int max_features_x_bucket = static_cast<int>(
-    floor(params_.max_desc/(params_.bucket_cols*params_.bucket_rows)));
-  pub_.PublishBucketedInfo(state_, max_features_x_bucket);
+int haloc::Hash::CalcDist(const BucketedHash& hash_a,
+    const BucketedHash& hash_b, float eps, int& best_shift,
+    bool prune) const {
+  best_shift = -1;
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  if (hash_a.bucket_sum.size() != num_buckets ||
+      hash_b.bucket_sum.size() != num_buckets) {
+    // Hashes without metadata get it now
+    const BucketedHash a = BuildBucketedHash(hash_a.hash);
+    const BucketedHash b = BuildBucketedHash(hash_b.hash);
+    if (a.bucket_sum.size() != num_buckets ||
+        b.bucket_sum.size() != num_buckets) return 0;
+    return CalcDist(a, b, eps, best_shift, prune);
+  }
+  return CalcDist(&hash_a.hash[0], &hash_a.bucket_sum[0], hash_a.occupancy,
+    &hash_b.hash[0], &hash_b.bucket_sum[0], hash_b.occupancy, eps,
+    best_shift, prune);
 }
 
-void haloc::Hash::Init(const cv::Size& img_size, const int& num_feat,
-    const int& desc_length) {
-  InitProjections(params_.max_desc);
-  InitCombinations();
-  img_size_ = img_size;
-  desc_length_ = desc_length;
+int haloc::Hash::CalcDist(const float* hash_a, const float* sum_a,
+    const uint64_t& occupancy_a, const float* hash_b, const float* sum_b,
+    const uint64_t& occupancy_b, float eps, bool prune) const {
+  int best_shift;
+  return CalcDist(hash_a, sum_a, occupancy_a, hash_b, sum_b, occupancy_b, eps,
+    best_shift, prune);
+}
 
-  // Sanity check
-  if (params_.max_desc < num_feat * 0.7) {
-    ROS_WARN_STREAM("[Haloc:] WARNING -> Please setup the maximum number " <<
-      "descriptors correctly. The current image has " << num_feat << " and " <<
-      "the max_desc param is " << params_.max_desc << ". The parameter for " <<
-      "the maximum number of descriptors must be smaller than the number" <<
-      "of real features in the images.");
+int haloc::Hash::CalcDist(const float* hash_a, const float* sum_a,
+    const uint64_t& occupancy_a, const float* hash_b, const float* sum_b,
+    const uint64_t& occupancy_b, float eps, int& best_shift,
+    bool prune) const {
+  // Init
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  const int bucket_length = desc_length_*params_.num_proj;
+  const bool use_masks = num_buckets <= kMaxMaskBuckets;
+  int num_buckets_overlap = 0;
+  best_shift = -1;
+
+  // Checks if bucket idx_a of a matches bucket idx_b of b
+  auto bucket_match = [&](const int& idx_a, const int& idx_b) {
+    // Lower bound of the L1 distance. The tolerance covers the rounding
+    // of the float accumulation in the distance kernel.
+    const float tolerance = kSumBoundTolerance*(fabs(sum_a[idx_a]) +
+      fabs(sum_b[idx_b]));
+    if (fabs(sum_a[idx_a] - sum_b[idx_b]) > eps + tolerance) return false;
+
+    const float* a = hash_a + idx_a*bucket_length;
+    const float* b = hash_b + idx_b*bucket_length;
+    float proj_sum = prune ?
+      kernels::L1DistanceBounded(a, b, bucket_length, eps) :
+      kernels::L1Distance(a, b, bucket_length);
+    return proj_sum <= eps;
+  };
+
+  // No shift can pair more buckets than the occupied ones
+  const int max_overlap = use_masks ? std::min(CountBuckets(occupancy_a),
+    CountBuckets(occupancy_b)) : num_buckets;
+
+  // Compute the distance. Shift i pairs bucket j of a with bucket
+  // (j + i) % num_buckets of b, like comb_[i].
+  for (int i=0; i < num_buckets; ++i) {
+    if (prune && num_buckets_overlap == max_overlap) break;
+
+    int comb_overlap = 0;
+    if (use_masks) {
+      uint64_t pairs = occupancy_a &
+        RotateBucketMask(occupancy_b, i, num_buckets);
+      int remaining = CountBuckets(pairs);
+      while (pairs) {
+        // Even if all the remaining pairs match, this shift cannot beat the
+        // best one
+        if (prune && comb_overlap + remaining <= num_buckets_overlap) break;
+
+        const int idx_a = FirstBucket(pairs);
+        pairs &= pairs - 1;
+        remaining--;
+        if (bucket_match(idx_a, (idx_a + i) % num_buckets)) comb_overlap++;
+      }
+    } else {
+      // Too many buckets for the masks, the sums tell the empty ones
+      for (int j=0; j < num_buckets; ++j) {
+        if (prune && comb_overlap + num_buckets - j <= num_buckets_overlap)
+          break;
+        const int idx_b = (j + i) % num_buckets;
+        if (sum_a[j] == 0.0 || sum_b[idx_b] == 0.0) continue;
+        if (bucket_match(j, idx_b)) comb_overlap++;
+      }
+    }
+    if (comb_overlap > num_buckets_overlap) {
+      num_buckets_overlap = comb_overlap;
+      best_shift = i;
+    }
   }
+  return num_buckets_overlap;
+}
 
-  initialized_ = true;
+std::vector<int> haloc::Hash::CalcDist(const BucketedHash& hash_a,
+    const BucketedHash& hash_b, const std::vector<float>& eps) const {
+  if (eps.empty()) return std::vector<int>();
+  const float max_eps = *std::max_element(eps.begin(), eps.end());
+  return CalcDistProfile(hash_a, hash_b, max_eps).Overlap(eps);
 }
 
-void haloc::Hash::InitCombinations() {
-  comb_.clear();
-  int num_buckets = params_.bucket_cols*params_.bucket_rows;
-  int second_idx_shift = 0;
-  for (uint i=0; i < num_buckets; ++i) {
-    std::vector< std::pair<int, int> > combinations_row;
-    for (uint j=0; j < num_buckets; ++j) {
-      int second_idx = j + second_idx_shift;
-      if (second_idx > num_buckets-1) {
-        second_idx = second_idx - num_buckets;
+haloc::DistanceProfile haloc::Hash::CalcDistProfile(
+    const BucketedHash& hash_a, const BucketedHash& hash_b,
+    float max_eps) const {
+  DistanceProfile profile;
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  if (hash_a.bucket_sum.size() != num_buckets ||
+      hash_b.bucket_sum.size() != num_buckets)
+    return profile;
+  const int bucket_length = desc_length_*params_.num_proj;
+
+  // eps_k[k] is the minimum over the shifts of the (k+1)-th smallest bucket
+  // distance: with eps >= eps_k[k] at least one shift overlaps k+1 buckets.
+  std::vector<float> eps_k(num_buckets,
+    std::numeric_limits<float>::infinity());
+  std::vector<int> shift_k(num_buckets, -1);
+  std::vector<float> dists;
+  dists.reserve(num_buckets);
+  for (int i=0; i < num_buckets; ++i) {
+    dists.clear();
+    for (int j=0; j < num_buckets; ++j) {
+      const int idx_a = j;
+      const int idx_b = (j + i) % num_buckets;
+
+      // Check if buckets are empty
+      const float sum_a = hash_a.bucket_sum[idx_a];
+      const float sum_b = hash_b.bucket_sum[idx_b];
+      if (sum_a == 0.0 || sum_b == 0.0) continue;
+
+      // Discard the pairs that will never be queried
+      const float tolerance = kSumBoundTolerance*(fabs(sum_a) + fabs(sum_b));
+      if (fabs(sum_a - sum_b) > max_eps + tolerance) continue;
+      float proj_sum = kernels::L1DistanceBounded(
+        &hash_a.hash[idx_a*bucket_length], &hash_b.hash[idx_b*bucket_length],
+        bucket_length, max_eps);
+      if (proj_sum <= max_eps) dists.push_back(proj_sum);
+    }
+    std::sort(dists.begin(), dists.end());
+    for (uint k=0; k < dists.size(); ++k) {
+      if (dists[k] < eps_k[k]) {
+        eps_k[k] = dists[k];
+        shift_k[k] = i;
       }
-      combinations_row.push_back(std::make_pair(j, second_idx));
     }
-    comb_.push_back(combinations_row);
-    second_idx_shift++;
   }
+
+  // Only the reachable overlaps are kept
+  for (int k=0; k < num_buckets && eps_k[k] <= max_eps; ++k) {
+    profile.eps_k.push_back(eps_k[k]);
+    profile.shift_k.push_back(shift_k[k]);
+  }
+  return profile;
+}
+
+haloc::DistanceProfile haloc::Hash::CalcDistProfile(
+    const std::vector<float>& hash_a, const std::vector<float>& hash_b,
+    float max_eps) const {
+  return CalcDistProfile(BuildBucketedHash(hash_a), BuildBucketedHash(hash_b),
+    max_eps);
 }
 
-void haloc::Hash::InitProjections(const int& desc_size) {
-  // Initializations
-  int seed = time(NULL);
-  r_.clear();
+haloc::SparseHash haloc::Hash::GetSparseHash(
+    const std::vector<cv::KeyPoint>& kp, const cv::Mat& desc,
+    const cv::Size& img_size) {
+  const std::vector<float> hash = GetHash(kp, desc, img_size);
+  return hash.empty() ? SparseHash() : ToSparse(hash);
+}
 
-  // The maximum number of features per bucket
-  int max_features_x_bucket = static_cast<int>(
-    floor(params_.max_desc/(params_.bucket_cols*params_.bucket_rows)));
+haloc::SparseHash haloc::Hash::ToSparse(
+    const std::vector<float>& hash) const {
+  SparseHash out;
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  const int bucket_length = desc_length_*params_.num_proj;
+  if (hash.size() != num_buckets*bucket_length || hash.empty()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot convert a hash of length " <<
+      hash.size() << " to the sparse format, expected " <<
+      num_buckets*bucket_length << ".");
+    return out;
+  }
+  if (num_buckets > kMaxMaskBuckets) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The sparse hashes support up to " <<
+      kMaxMaskBuckets << " buckets.");
+    return out;
+  }
 
-  // The size of the descriptors may vary...
-  // But, we limit the number of descriptors per bucket.
-  int v_size = max_features_x_bucket;
-
-  // We will generate N-orthogonal vectors creating a linear system of type Ax=b
-  // Generate a first random vector
-  std::vector<float> r = ComputeRandomVector(v_size, seed);
-  r_.push_back(UnitVector(r));
-
-  // Generate the set of orthogonal vectors
-  for (uint i=1; i < params_.num_proj; i++) {
-    // Generate a random vector of the correct size
-    std::vector<float> new_v = ComputeRandomVector(v_size - i, seed + i);
-
-    // Get the right terms (b)
-    Eigen::VectorXf b(r_.size());
-    for (uint n=0; n < r_.size(); n++) {
-      std::vector<float> cur_v = r_[n];
-      float sum = 0.0;
-      for (uint m=0; m < new_v.size(); m++)
-        sum += new_v[m]*cur_v[m];
-      b(n) = -sum;
+  std::vector<float> bucket_sum(num_buckets);
+  SummarizeBuckets(&hash[0], &bucket_sum[0], out.occupancy);
+  out.blocks.reserve(CountBuckets(out.occupancy)*bucket_length);
+  for (uint64_t mask=out.occupancy; mask; mask &= mask - 1) {
+    const int i = FirstBucket(mask);
+    out.blocks.insert(out.blocks.end(), hash.begin() + i*bucket_length,
+      hash.begin() + (i + 1)*bucket_length);
+    out.bucket_sum.push_back(bucket_sum[i]);
+  }
+  return out;
+}
+
+std::vector<float> haloc::Hash::ToDense(const SparseHash& hash) const {
+  const int bucket_length = desc_length_*params_.num_proj;
+  std::vector<float> out(GetHashLength(), 0.0f);
+  if (hash.blocks.size() != CountBuckets(hash.occupancy)*bucket_length)
+    return out;
+  int block = 0;
+  for (uint64_t mask=hash.occupancy; mask; mask &= mask - 1, ++block) {
+    const int i = FirstBucket(mask);
+    std::copy(hash.blocks.begin() + block*bucket_length,
+      hash.blocks.begin() + (block + 1)*bucket_length,
+      out.begin() + i*bucket_length);
+  }
+  return out;
+}
+
+int haloc::Hash::CalcDist(const SparseHash& hash_a, const SparseHash& hash_b,
+    float eps, bool prune) const {
+  // Init
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  const int bucket_length = desc_length_*params_.num_proj;
+  const int max_overlap = std::min(CountBuckets(hash_a.occupancy),
+    CountBuckets(hash_b.occupancy));
+  if (num_buckets > kMaxMaskBuckets || max_overlap == 0 ||
+      hash_a.bucket_sum.size()*bucket_length != hash_a.blocks.size() ||
+      hash_b.bucket_sum.size()*bucket_length != hash_b.blocks.size())
+    return 0;
+  int num_buckets_overlap = 0;
+
+  // Only the pairs with both buckets populated are visited. The block of a
+  // bucket is the number of populated buckets before it.
+  for (int i=0; i < num_buckets; ++i) {
+    if (prune && num_buckets_overlap == max_overlap) break;
+
+    int comb_overlap = 0;
+    uint64_t pairs = hash_a.occupancy &
+      RotateBucketMask(hash_b.occupancy, i, num_buckets);
+    int remaining = CountBuckets(pairs);
+    while (pairs) {
+      if (prune && comb_overlap + remaining <= num_buckets_overlap) break;
+
+      const int idx_a = FirstBucket(pairs);
+      pairs &= pairs - 1;
+      remaining--;
+      const int block_a = hash_a.BlockIndex(idx_a);
+      const int block_b = hash_b.BlockIndex((idx_a + i) % num_buckets);
+
+      // Same bound as the dense version
+      const float sum_a = hash_a.bucket_sum[block_a];
+      const float sum_b = hash_b.bucket_sum[block_b];
+      const float tolerance = kSumBoundTolerance*(fabs(sum_a) + fabs(sum_b));
+      if (fabs(sum_a - sum_b) > eps + tolerance) continue;
+
+      const float* a = &hash_a.blocks[block_a*bucket_length];
+      const float* b = &hash_b.blocks[block_b*bucket_length];
+      const float proj_sum = prune ?
+        kernels::L1DistanceBounded(a, b, bucket_length, eps) :
+        kernels::L1Distance(a, b, bucket_length);
+      if (proj_sum <= eps) comb_overlap++;
     }
+    if (comb_overlap > num_buckets_overlap) {
+      num_buckets_overlap = comb_overlap;
+    }
+  }
+  return num_buckets_overlap;
+}
 
-    // Get the matrix of equations (A)
-    Eigen::MatrixXf A(i, i);
-    for (uint n=0; n < r_.size(); n++) {
-      uint k = 0;
-      for (uint m=r_[n].size()-i; m < r_[n].size(); m++) {
-        A(n, k) = r_[n][m];
-        k++;
-      }
+bool haloc::Hash::CalibrateQuantization(
+    const std::vector< std::vector<float> >& hashes) {
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  const int bucket_length = desc_length_*params_.num_proj;
+
+  // The empty buckets are told by the occupancy, do not fit their zeros
+  std::vector<float> values;
+  for (uint h=0; h < hashes.size(); ++h) {
+    if (hashes[h].size() != num_buckets*bucket_length) continue;
+    for (int i=0; i < num_buckets; ++i) {
+      std::vector<float>::const_iterator first = hashes[h].begin() +
+        i*bucket_length;
+      std::vector<float>::const_iterator last = first + bucket_length;
+      if (std::accumulate(first, last, 0.0) == 0.0) continue;
+      values.insert(values.end(), first, last);
     }
+  }
+  if (values.empty()) {
+    ROS_ERROR("[Haloc:] ERROR -> Cannot calibrate the quantization: no "
+      "valid hash coefficients.");
+    return false;
+  }
+
+  const int clip = static_cast<int>(kQuantizationClip*(values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + clip, values.end());
+  const float low = values[clip];
+  std::nth_element(values.begin(), values.end() - 1 - clip, values.end());
+  const float high = values[values.size() - 1 - clip];
+  SetQuantization(low, (high > low) ? (high - low) / 255.0 : 1.0);
+  return true;
+}
 
-    // Apply the solver
-    Eigen::VectorXf x = A.colPivHouseholderQr().solve(b);
+void haloc::Hash::SetQuantization(const float& offset, const float& scale) {
+  if (!(scale > 0.0)) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The quantization scale (" << scale <<
+      ") must be positive.");
+    return;
+  }
+  HashModel::Calibration calibration = GetCalibration();
+  calibration.quant_offset = offset;
+  calibration.quant_scale = scale;
+  SetCalibration(calibration);
+}
 
-    // Add the solutions to the new vector
-    for (uint n=0; n < r_.size(); n++)
-      new_v.push_back(x(n));
-    new_v = UnitVector(new_v);
+bool haloc::Hash::IsQuantizationCalibrated() const {
+  const HashModel::Calibration default_calibration;
+  const HashModel::Calibration& calibration = GetCalibration();
+  return calibration.quant_offset != default_calibration.quant_offset ||
+    calibration.quant_scale != default_calibration.quant_scale;
+}
+
+haloc::QuantizedHash haloc::Hash::Quantize(
+    const std::vector<float>& hash) const {
+  QuantizedHash out;
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  const int bucket_length = desc_length_*params_.num_proj;
+  if (hash.size() != num_buckets*bucket_length || hash.empty()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot quantize a hash of length " <<
+      hash.size() << ", expected " << num_buckets*bucket_length << ".");
+    return out;
+  }
+  if (num_buckets > kMaxMaskBuckets) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The quantized hashes support up to " <<
+      kMaxMaskBuckets << " buckets.");
+    return out;
+  }
 
-    // Push the new vector
-    r_.push_back(new_v);
+  std::vector<float> bucket_sum(num_buckets);
+  SummarizeBuckets(&hash[0], &bucket_sum[0], out.occupancy);
+  out.code.assign(hash.size(), 0);
+  out.bucket_sum.assign(num_buckets, 0);
+  const HashModel::Calibration& calibration = GetCalibration();
+  const float inv_scale = 1.0 / calibration.quant_scale;
+  for (int i=0; i < num_buckets; ++i) {
+    if (!(out.occupancy & (1ULL << i))) continue;
+    for (int m=i*bucket_length; m < (i+1)*bucket_length; ++m) {
+      const float code = round((hash[m] - calibration.quant_offset) *
+        inv_scale);
+      out.code[m] = static_cast<uint8_t>(std::max(0.0f,
+        std::min(255.0f, code)));
+      out.bucket_sum[i] += out.code[m];
+    }
   }
+  return out;
 }
 
-std::vector<float> haloc::Hash::ComputeRandomVector(const int& size, int seed) {
-  std::vector<float> h;
-  for (int i=0; i < size; i++)
-    h.push_back((float)rand()/RAND_MAX);
-  return h;
+int haloc::Hash::CalcDist(const QuantizedHash& hash_a,
+    const QuantizedHash& hash_b, float eps, bool prune) const {
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  if (hash_a.bucket_sum.size() != num_buckets ||
+      hash_b.bucket_sum.size() != num_buckets)
+    return 0;
+  return CalcDist(&hash_a.code[0], &hash_a.bucket_sum[0], hash_a.occupancy,
+    &hash_b.code[0], &hash_b.bucket_sum[0], hash_b.occupancy, eps, prune);
 }
 
-std::vector<float> haloc::Hash::UnitVector(const std::vector<float>& x) {
-  // Compute the norm
-  float sum = 0.0;
-  for (uint i=0; i < x.size(); i++)
-    sum += pow(x[i], 2.0);
-  float x_norm = sqrt(sum);
+int haloc::Hash::CalcDist(const uint8_t* code_a, const uint32_t* sum_a,
+    const uint64_t& occupancy_a, const uint8_t* code_b, const uint32_t* sum_b,
+    const uint64_t& occupancy_b, float eps, bool prune) const {
+  // Init
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  const int bucket_length = desc_length_*params_.num_proj;
+  const uint32_t bound = static_cast<uint32_t>(std::min(
+    floor(eps / GetCalibration().quant_scale), 4294967295.0));
+  int num_buckets_overlap = 0;
+
+  // No shift can pair more buckets than the occupied ones
+  const int max_overlap = std::min(CountBuckets(occupancy_a),
+    CountBuckets(occupancy_b));
 
-  // x^ = x/|x|
-  std::vector<float> out;
-  for (uint i=0; i < x.size(); i++)
-    out.push_back(x[i] / x_norm);
+  // Same shifts as the float version. The sums are integers, so their
+  // difference bounds the SAD without any tolerance.
+  for (int i=0; i < num_buckets; ++i) {
+    if (prune && num_buckets_overlap == max_overlap) break;
 
-  return out;
+    int comb_overlap = 0;
+    uint64_t pairs = occupancy_a &
+      RotateBucketMask(occupancy_b, i, num_buckets);
+    int remaining = CountBuckets(pairs);
+    while (pairs) {
+      if (prune && comb_overlap + remaining <= num_buckets_overlap) break;
+
+      const int idx_a = FirstBucket(pairs);
+      const int idx_b = (idx_a + i) % num_buckets;
+      pairs &= pairs - 1;
+      remaining--;
+      const uint32_t diff = (sum_a[idx_a] > sum_b[idx_b]) ?
+        sum_a[idx_a] - sum_b[idx_b] : sum_b[idx_b] - sum_a[idx_a];
+      if (diff > bound) continue;
+
+      const uint8_t* a = code_a + idx_a*bucket_length;
+      const uint8_t* b = code_b + idx_b*bucket_length;
+      const uint32_t sad = prune ?
+        kernels::SadDistanceBounded(a, b, bucket_length, bound) :
+        kernels::SadDistance(a, b, bucket_length);
+      if (sad <= bound) comb_overlap++;
+    }
+    if (comb_overlap > num_buckets_overlap) {
+      num_buckets_overlap = comb_overlap;
+    }
+  }
+  return num_buckets_overlap;
 }
 
-std::vector<cv::Mat> haloc::Hash::BucketDescriptors(
-    const std::vector<cv::KeyPoint>& kp, const cv::Mat& desc) {
-  // Find max values
-  float u_max = 0;
-  float v_max = 0;
-  std::vector<cv::KeyPoint> kp_in = kp;
-  for (std::vector<cv::KeyPoint>::iterator it = kp_in.begin();
-      it != kp_in.end(); it++) {
-    if (it->pt.x > u_max) u_max = it->pt.x;
-    if (it->pt.y > v_max) v_max = it->pt.y;
+bool haloc::Hash::CalibrateSignature(
+    const std::vector< std::vector<float> >& hashes) {
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  const int bucket_length = desc_length_*params_.num_proj;
+
+  // Coefficient m of all the non-empty buckets
+  std::vector< std::vector<float> > values(bucket_length);
+  for (uint h=0; h < hashes.size(); ++h) {
+    if (hashes[h].size() != num_buckets*bucket_length) continue;
+    for (int i=0; i < num_buckets; ++i) {
+      const float* bucket = &hashes[h][i*bucket_length];
+      if (std::accumulate(bucket, bucket + bucket_length, 0.0) == 0.0)
+        continue;
+      for (int m=0; m < bucket_length; ++m) values[m].push_back(bucket[m]);
+    }
+  }
+  if (bucket_length == 0 || values[0].empty()) {
+    ROS_ERROR("[Haloc:] ERROR -> Cannot calibrate the binary signature: no "
+      "valid hash coefficients.");
+    return false;
   }
 
-  // Compute width and height of the buckets
-  float bucket_width  = img_size_.width / params_.bucket_cols;
-  float bucket_height = img_size_.height / params_.bucket_rows;
+  std::vector<float> medians(bucket_length);
+  for (int m=0; m < bucket_length; ++m) {
+    std::vector<float>::iterator middle = values[m].begin() +
+      values[m].size()/2;
+    std::nth_element(values[m].begin(), middle, values[m].end());
+    medians[m] = *middle;
+  }
+  SetSignatureMedians(medians);
+  return true;
+}
 
-  // Allocate number of buckets needed
-  std::vector<cv::Mat> desc_buckets(params_.bucket_cols*params_.bucket_rows);
-  std::vector< std::vector<cv::KeyPoint> > kp_buckets(
-    params_.bucket_cols*params_.bucket_rows);
+void haloc::Hash::SetSignatureMedians(const std::vector<float>& medians) {
+  const int bucket_length = desc_length_*params_.num_proj;
+  if (!medians.empty() && medians.size() != bucket_length) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Got " << medians.size() <<
+      " signature thresholds, expected one per bucket coefficient (" <<
+      bucket_length << ").");
+    return;
+  }
+  HashModel::Calibration calibration = GetCalibration();
+  calibration.sign_median = medians;
+  SetCalibration(calibration);
+}
 
-  // Assign descriptors to their buckets
-  for (uint i=0; i < kp_in.size(); ++i) {
-    int u = static_cast<int>(floor(kp_in[i].pt.x/bucket_width));
-    int v = static_cast<int>(floor(kp_in[i].pt.y/bucket_height));
+haloc::BinarySignature haloc::Hash::GetSignature(
+    const std::vector<float>& hash) const {
+  BinarySignature out;
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  const int bucket_length = desc_length_*params_.num_proj;
+  if (hash.size() != num_buckets*bucket_length || hash.empty()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot compute the signature of a " <<
+      "hash of length " << hash.size() << ", expected " <<
+      num_buckets*bucket_length << ".");
+    return out;
+  }
+  if (num_buckets > kMaxMaskBuckets) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The binary signatures support up " <<
+      "to " << kMaxMaskBuckets << " buckets.");
+    return out;
+  }
+  const std::vector<float>& medians = GetCalibration().sign_median;
+  const bool calibrated = medians.size() == bucket_length;
+
+  std::vector<float> bucket_sum(num_buckets);
+  SummarizeBuckets(&hash[0], &bucket_sum[0], out.occupancy);
+  out.words_per_bucket = (bucket_length + 63) / 64;
+  out.bits.assign(num_buckets*out.words_per_bucket, 0);
+  for (int i=0; i < num_buckets; ++i) {
+    if (!(out.occupancy & (1ULL << i))) continue;
+    const float* bucket = &hash[i*bucket_length];
+    uint64_t* words = &out.bits[i*out.words_per_bucket];
+    for (int m=0; m < bucket_length; ++m) {
+      const float median = calibrated ? medians[m] : 0.5;
+      if (bucket[m] > median) words[m / 64] |= (1ULL << (m % 64));
+    }
+  }
+  return out;
+}
 
-    desc_buckets[v*params_.bucket_cols+u].push_back(desc.row(i));
-    kp_buckets[v*params_.bucket_cols+u].push_back(kp_in[i]);
+int haloc::Hash::CalcDist(const BinarySignature& signature_a,
+    const BinarySignature& signature_b, const int& max_bits,
+    bool prune) const {
+  // Init
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  const int num_words = signature_a.words_per_bucket;
+  if (num_words == 0 || signature_b.words_per_bucket != num_words ||
+      signature_a.bits.size() != num_buckets*num_words ||
+      signature_b.bits.size() != num_buckets*num_words)
+    return 0;
+  if (max_bits < 0) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The maximum Hamming distance (" <<
+      max_bits << ") must not be negative.");
+    return 0;
   }
+  const uint32_t max_distance = max_bits;
+  const uint64_t* bits_a = &signature_a.bits[0];
+  const uint64_t* bits_b = &signature_b.bits[0];
+  int num_buckets_overlap = 0;
 
-  // The maximum number of features per bucket
-  int max_features_x_bucket = static_cast<int>(
-    floor(params_.max_desc/(params_.bucket_cols*params_.bucket_rows)));
+  // No shift can pair more buckets than the occupied ones
+  const int max_overlap = std::min(CountBuckets(signature_a.occupancy),
+    CountBuckets(signature_b.occupancy));
 
-  // Select the best keypoints for each bucket
-  std::vector<cv::Mat> out_desc(params_.bucket_cols*params_.bucket_rows);
-  for (int i=0; i < params_.bucket_cols*params_.bucket_rows; ++i) {
-    // Sort keypoints by response
-    std::vector<cv::KeyPoint> cur_kps = kp_buckets[i];
-    std::vector<int> index(cur_kps.size(), 0);
-    for (uint j=0; j<index.size(); j++) {
-      index[j] = j;
+  // Same shifts as the float version
+  for (int i=0; i < num_buckets; ++i) {
+    if (prune && num_buckets_overlap == max_overlap) break;
+
+    int comb_overlap = 0;
+    uint64_t pairs = signature_a.occupancy &
+      RotateBucketMask(signature_b.occupancy, i, num_buckets);
+    int remaining = CountBuckets(pairs);
+    while (pairs) {
+      if (prune && comb_overlap + remaining <= num_buckets_overlap) break;
+
+      const int idx_a = FirstBucket(pairs);
+      const int idx_b = (idx_a + i) % num_buckets;
+      pairs &= pairs - 1;
+      remaining--;
+      const uint32_t bits = kernels::HammingDistance(
+        bits_a + idx_a*num_words, bits_b + idx_b*num_words, num_words);
+      if (bits <= max_distance) comb_overlap++;
     }
-    std::sort(index.begin(), index.end(), [&](const int& a, const int& b) {
-      return (cur_kps[a].response > cur_kps[b].response);
-    });
-
-    // Add up to max_features_x_bucket features from this bucket
-    int k = 0;
-    int num_kp = 0;
-    for (uint j=0; j < cur_kps.size(); ++j) {
-      if (k < max_features_x_bucket) {
-        out_desc[i].push_back(desc_buckets[i].row(index[j]));
-        state_.bucketed_kp.push_back(kp_buckets[i][index[j]]);
-        num_kp++;
-      } else {
-        state_.unbucketed_kp.push_back(kp_buckets[i][index[j]]);
-      }
-      k++;
+    if (comb_overlap > num_buckets_overlap) {
+      num_buckets_overlap = comb_overlap;
     }
-    state_.num_kp_per_bucket.push_back(num_kp);
   }
+  return num_buckets_overlap;
+}
 
-  return out_desc;
+void haloc::Hash::PublishState(const cv::Mat& img) {
+  // The bucketed image
+  pub_.PublishBucketedImage(context_.GetState(), img, params_.bucket_rows,
+    params_.bucket_cols);
+
+  // The bucketed info
+  int max_features_x_bucket = static_cast<int>(
+    floor(params_.max_desc/(params_.bucket_cols*params_.bucket_rows)));
+  pub_.PublishBucketedInfo(context_.GetState(), max_features_x_bucket);
 }
 
-std::vector<float> haloc::Hash::ProjectDescriptors(const cv::Mat& desc) {
-  // Initialize first time
-  if (!IsInitialized()) Init(cv::Size(0, 0), desc.rows, desc.cols);
+void haloc::Hash::Init(const cv::Size& img_size, const int& num_feat,
+    const int& desc_length, const bool& binary) {
+  model_ = std::make_shared<const HashModel>(params_, img_size, desc_length,
+    binary);
+  context_ = HashContext(model_, num_feat);
+  desc_length_ = desc_length;
+  InitCombinations();
 
-  // Initialize output
-  std::vector<float> hash;
+  // Sanity check
+  if (params_.max_desc < num_feat * 0.7) {
+    ROS_WARN_STREAM("[Haloc:] WARNING -> Please setup the maximum number " <<
+      "descriptors correctly. The current image has " << num_feat << " and " <<
+      "the max_desc param is " << params_.max_desc << ". The parameter for " <<
+      "the maximum number of descriptors must be smaller than the number" <<
+      "of real features in the images.");
+  }
+}
 
-  // Sanity checks
-  if (desc.rows == 0) {
-    ROS_ERROR("[Haloc:] ERROR -> Descriptor matrix is empty.");
-    return hash;
+void haloc::Hash::SetModel(const std::shared_ptr<const HashModel>& model) {
+  if (!model) {
+    ROS_ERROR("[Haloc:] ERROR -> Cannot set an empty hashing model.");
+    return;
   }
+  // The threads are not part of the model
+  const int num_threads = params_.num_threads;
+  params_ = model->GetParams();
+  params_.num_threads = num_threads;
+  model_ = model;
+  context_ = HashContext(model_);
+  desc_length_ = model_->GetDescriptorLength();
+  pool_.reset();
+  InitCombinations();
+}
 
-  if (desc.rows > r_[0].size()) {
-    ROS_ERROR_STREAM("[Haloc:] ERROR -> The number of descriptors is " <<
-      "larger than the size of the projection vector. This should not happen.");
-    return hash;
+const haloc::HashModel::Calibration& haloc::Hash::GetCalibration() const {
+  static const HashModel::Calibration kDefault;
+  return model_ ? model_->GetCalibration() : kDefault;
+}
+
+void haloc::Hash::SetCalibration(const HashModel::Calibration& calibration) {
+  if (!model_) {
+    ROS_ERROR("[Haloc:] ERROR -> The hash object must be initialized "
+      "before setting its calibration.");
+    return;
   }
+  model_ = model_->Calibrated(calibration);
+  context_ = HashContext(model_);
+}
 
-  // Project the descriptors
-  for (uint i=0; i < r_.size(); i++) {
-    for (int n=0; n < desc.cols; n++) {
-      float desc_sum = 0.0;
-      for (uint m=0; m < desc.rows; m++) {
-        float projected = r_[i][m]*desc.at<float>(m, n);
-        float projected_normalized = (projected + 1.0) / 2.0;
-        desc_sum += projected_normalized;
+void haloc::Hash::InitCombinations() {
+  comb_.clear();
+  int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  int second_idx_shift = 0;
+  for (uint i=0; i < num_buckets; ++i) {
+    std::vector< std::pair<int, int> > combinations_row;
+    for (uint j=0; j < num_buckets; ++j) {
+      int second_idx = j + second_idx_shift;
+      if (second_idx > num_buckets-1) {
+        second_idx = second_idx - num_buckets;
       }
-      hash.push_back(desc_sum / static_cast<float>(desc.rows));
+      combinations_row.push_back(std::make_pair(j, second_idx));
     }
+    comb_.push_back(combinations_row);
+    second_idx_shift++;
   }
-  return hash;
 }
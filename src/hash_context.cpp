@@ -0,0 +1,75 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include "libhaloc/hash_context.h"
+
+haloc::HashContext::HashContext(
+    const std::shared_ptr<const HashModel>& model, const int& num_feat) :
+  model_(model) {
+  if (model_) model_->ReserveScratch(scratch_, num_feat);
+}
+
+std::vector<float> haloc::HashContext::GetHash(
+    const std::vector<cv::KeyPoint>& kp, const cv::Mat& desc) {
+  std::vector<float> hash;
+  if (!GetHash(kp, desc, hash)) hash.clear();
+  return hash;
+}
+
+bool haloc::HashContext::GetHash(const std::vector<cv::KeyPoint>& kp,
+    const cv::Mat& desc, float* hash, const int& hash_length) {
+  state_.Clear();
+
+  // Sanity checks
+  if (!model_) {
+    ROS_ERROR("[Haloc:] ERROR -> The hashing context has no model.");
+    return false;
+  }
+  if (!model_->CheckDescriptors(desc)) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The descriptor length (" <<
+      HashModel::DescriptorLength(desc) << ") or type does not match the " <<
+      "ones of the model (" << model_->GetDescriptorLength() << ").");
+    return false;
+  }
+  if (kp.size() != desc.rows) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> There are " << kp.size() <<
+      " keypoints and " << desc.rows << " descriptors.");
+    return false;
+  }
+  if (hash_length < model_->GetHashLength() || hash == NULL) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The output buffer has " <<
+      hash_length << " elements and the hash needs " <<
+      model_->GetHashLength() << ".");
+    return false;
+  }
+
+  model_->ComputeHash(kp, desc, state_, scratch_, hash);
+  return true;
+}
+
+bool haloc::HashContext::GetHash(const std::vector<cv::KeyPoint>& kp,
+    const cv::Mat& desc, std::vector<float>& hash) {
+  if (!model_) {
+    ROS_ERROR("[Haloc:] ERROR -> The hashing context has no model.");
+    return false;
+  }
+  if (hash.size() != model_->GetHashLength())
+    hash.resize(model_->GetHashLength());
+  if (hash.empty()) return false;
+  return GetHash(kp, desc, &hash[0], hash.size());
+}
@@ -0,0 +1,182 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <algorithm>
+
+#include "libhaloc/hash_database.h"
+
+haloc::HashDatabase::Params::Params() :
+  num_threads(DEFAULT_NUM_THREADS),
+  min_parallel_size(DEFAULT_MIN_PARALLEL_SIZE)
+{}
+
+haloc::HashDatabase::HashDatabase(const Hash& hash) :
+  hash_(hash), hash_length_(0), hash_stride_(0), num_buckets_(0),
+  pool_(new WorkerPool(params_.num_threads)) {}
+
+bool haloc::HashDatabase::Add(const int& id, const std::vector<float>& hash) {
+  // The layout is taken from the hash object when the first hash arrives,
+  // since it is only known once the hash object is initialized
+  if (ids_.empty()) {
+    const Hash::Params params = hash_.GetParams();
+    hash_length_ = hash_.GetHashLength();
+    hash_stride_ = AlignedStride(hash_length_);
+    num_buckets_ = params.bucket_rows*params.bucket_cols;
+  }
+
+  // Sanity checks
+  if (hash.size() != hash_length_ || hash_length_ == 0) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot add frame " << id << " to " <<
+      "the database: the hash length is " << hash.size() << " and the " <<
+      "database expects " << hash_length_ << ".");
+    return false;
+  }
+  if (Contains(id)) {
+    ROS_WARN_STREAM("[Haloc:] WARNING -> Frame " << id << " is already in " <<
+      "the database.");
+    return false;
+  }
+
+  // Append a new row to every array
+  const int row = ids_.size();
+  hashes_.resize((row + 1)*hash_stride_, 0.0f);
+  std::copy(hash.begin(), hash.end(), hashes_.begin() + row*hash_stride_);
+  bucket_sums_.resize((row + 1)*num_buckets_);
+  occupancy_.push_back(0);
+  hash_.SummarizeBuckets(&hashes_[row*hash_stride_],
+    &bucket_sums_[row*num_buckets_], occupancy_[row]);
+  ids_.push_back(id);
+  rows_[id] = row;
+  return true;
+}
+
+bool haloc::HashDatabase::Remove(const int& id) {
+  std::unordered_map<int, int>::iterator it = rows_.find(id);
+  if (it == rows_.end()) return false;
+
+  // Move the last row into the gap to keep the arrays contiguous
+  const int row = it->second;
+  const int last = ids_.size() - 1;
+  if (row != last) {
+    std::copy(hashes_.begin() + last*hash_stride_,
+      hashes_.begin() + (last + 1)*hash_stride_,
+      hashes_.begin() + row*hash_stride_);
+    std::copy(bucket_sums_.begin() + last*num_buckets_,
+      bucket_sums_.begin() + (last + 1)*num_buckets_,
+      bucket_sums_.begin() + row*num_buckets_);
+    occupancy_[row] = occupancy_[last];
+    ids_[row] = ids_[last];
+    rows_[ids_[row]] = row;
+  }
+  hashes_.resize(last*hash_stride_);
+  bucket_sums_.resize(last*num_buckets_);
+  occupancy_.pop_back();
+  ids_.pop_back();
+  rows_.erase(id);
+  return true;
+}
+
+void haloc::HashDatabase::Clear() {
+  hashes_.clear();
+  bucket_sums_.clear();
+  occupancy_.clear();
+  ids_.clear();
+  rows_.clear();
+}
+
+std::vector<float> haloc::HashDatabase::GetHash(const int& id) const {
+  std::unordered_map<int, int>::const_iterator it = rows_.find(id);
+  if (it == rows_.end()) return std::vector<float>();
+  AlignedFloatVector::const_iterator first =
+    hashes_.begin() + it->second*hash_stride_;
+  return std::vector<float>(first, first + hash_length_);
+}
+
+std::vector<haloc::Match> haloc::HashDatabase::Query(
+    const std::vector<float>& hash, const int& k, float eps,
+    const int& query_id, const int& min_neighbor) const {
+  if (ids_.empty() || k <= 0) return std::vector<Match>();
+  if (hash.size() != hash_length_) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The query hash length is " <<
+      hash.size() << " and the database expects " << hash_length_ << ".");
+    return std::vector<Match>();
+  }
+
+  // Query metadata
+  std::vector<float> sum(num_buckets_);
+  uint64_t occupancy = 0;
+  hash_.SummarizeBuckets(&hash[0], &sum[0], occupancy);
+
+  const auto row_id = [&](const int& row) {return ids_[row];};
+  const auto row_overlap = [&](const int& row) {
+    return hash_.CalcDist(&hash[0], &sum[0], occupancy,
+      &hashes_[row*hash_stride_], &bucket_sums_[row*num_buckets_],
+      occupancy_[row], eps, true);
+  };
+  return ScanTopMatches(ids_.size(), k, query_id, min_neighbor, row_id,
+    row_overlap, pool_.get(), params_.min_parallel_size);
+}
+
+std::vector<haloc::Match> haloc::HashDatabase::Rerank(
+    const std::vector<float>& hash, const std::vector<int>& ids, const int& k,
+    float eps, const int& query_id, const int& min_neighbor) const {
+  if (ids_.empty() || k <= 0) return std::vector<Match>();
+  if (hash.size() != hash_length_) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The query hash length is " <<
+      hash.size() << " and the database expects " << hash_length_ << ".");
+    return std::vector<Match>();
+  }
+
+  // Query metadata
+  std::vector<float> sum(num_buckets_);
+  uint64_t occupancy = 0;
+  hash_.SummarizeBuckets(&hash[0], &sum[0], occupancy);
+
+  TopMatches top(k);
+  for (uint i=0; i < ids.size(); ++i) {
+    std::unordered_map<int, int>::const_iterator it = rows_.find(ids[i]);
+    if (it == rows_.end()) continue;
+    if (query_id >= 0 && abs(ids[i] - query_id) <= min_neighbor) continue;
+
+    const int row = it->second;
+    const int overlap = hash_.CalcDist(&hash[0], &sum[0], occupancy,
+      &hashes_[row*hash_stride_], &bucket_sums_[row*num_buckets_],
+      occupancy_[row], eps, true);
+    if (overlap > 0) top.Push(Match(ids[i], overlap));
+  }
+  return top.Sorted();
+}
+
+void haloc::TopMatches::Push(const Match& match) {
+  if (k_ <= 0) return;
+  if (heap_.size() < k_) {
+    heap_.push_back(match);
+    std::push_heap(heap_.begin(), heap_.end());
+  } else if (match < heap_.front()) {
+    std::pop_heap(heap_.begin(), heap_.end());
+    heap_.back() = match;
+    std::push_heap(heap_.begin(), heap_.end());
+  }
+}
+
+std::vector<haloc::Match> haloc::TopMatches::Sorted() {
+  std::sort_heap(heap_.begin(), heap_.end());
+  std::vector<Match> out;
+  out.swap(heap_);
+  return out;
+}
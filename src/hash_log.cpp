@@ -0,0 +1,377 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+#include "libhaloc/file_sync.h"
+#include "libhaloc/hash_log.h"
+#include "libhaloc/mapped_database.h"
+
+// Log file signature and format version. Files with a newer version are
+// rejected by Open.
+static const char kLogMagic[8] = {'H', 'A', 'L', 'O', 'C', 'W', 'A', 'L'};
+static const uint32_t kLogVersion = 1;
+
+// Header at the start of the log file (host byte order)
+struct LogHeader {
+  char magic[8];         // kLogMagic
+  uint32_t version;      // Format version
+  uint32_t hash_length;  // Floats per hash
+  uint64_t fingerprint;  // HashModel::GetFingerprint of the hashes
+};
+
+// Header of every record. The record payload is the frame id (int32)
+// followed by the hash, and the CRC covers the whole payload.
+struct RecordHeader {
+  uint32_t size;         // Bytes of the payload
+  uint32_t crc;          // CRC-32 of the payload
+};
+
+// Updates a CRC-32 (IEEE 802.3 polynomial, as zlib) with a block of bytes.
+// Start with crc = 0.
+static uint32_t Crc32(uint32_t crc, const void* data, const size_t& size) {
+  static const std::vector<uint32_t> table = [] {
+    std::vector<uint32_t> t(256);
+    for (uint32_t i=0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k=0; k < 8; ++k)
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      t[i] = c;
+    }
+    return t;
+  }();
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+  for (size_t i=0; i < size; ++i)
+    crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+// Writes a whole buffer, retrying the partial writes
+static bool WriteAll(const int& fd, const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t written = write(fd, data, size);
+    if (written < 0) return false;
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+haloc::HashLog::Params::Params() :
+  sync_period(DEFAULT_SYNC_PERIOD),
+  max_pending(DEFAULT_MAX_PENDING)
+{}
+
+haloc::HashLog::HashLog(const Hash& hash) :
+  hash_(hash), fd_(-1), hash_length_(0), num_pending_(0), appended_(0),
+  synced_(0), flush_(false), stop_(false), failed_(false) {}
+
+haloc::HashLog::~HashLog() {
+  Close();
+}
+
+bool haloc::HashLog::Open(const std::string& filename,
+    const std::string& snapshot) {
+  Close();
+  if (!hash_.IsInitialized()) {
+    ROS_ERROR("[Haloc:] ERROR -> The hash object must be initialized to "
+      "open a log.");
+    return false;
+  }
+  fd_ = open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  struct stat st;
+  if (fd_ < 0 || fstat(fd_, &st) != 0) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot open the log " << filename <<
+      ".");
+    if (fd_ >= 0) close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  filename_ = filename;
+  snapshot_ = snapshot;
+  hash_length_ = hash_.GetHashLength();
+
+  LogHeader expected;
+  memset(&expected, 0, sizeof(expected));
+  memcpy(expected.magic, kLogMagic, sizeof(kLogMagic));
+  expected.version = kLogVersion;
+  expected.hash_length = hash_length_;
+  expected.fingerprint = hash_.GetModel()->GetFingerprint();
+
+  // A new log (or one whose header was never completed) starts with the
+  // header of the current model. Its directory entry is synced too, or a
+  // crash could lose the whole file.
+  bool valid = true;
+  if (st.st_size < sizeof(LogHeader)) {
+    valid = ftruncate(fd_, 0) == 0 &&
+      WriteAll(fd_, reinterpret_cast<const char*>(&expected),
+        sizeof(expected)) && fsync(fd_) == 0 &&
+      SyncParentDirectory(filename_);
+  } else {
+    LogHeader header;
+    valid = pread(fd_, &header, sizeof(header), 0) == sizeof(header) &&
+      memcmp(header.magic, kLogMagic, sizeof(kLogMagic)) == 0 &&
+      header.version <= kLogVersion &&
+      header.hash_length == expected.hash_length &&
+      header.fingerprint == expected.fingerprint;
+
+    // Drop the torn records of a crash. A corrupted record followed by
+    // valid ones makes ReadRecords fail, and the log is left untouched.
+    uint64_t valid_size = 0;
+    valid = valid && ReadRecords(valid_size, NULL, NULL);
+    if (valid && valid_size < st.st_size) {
+      ROS_WARN_STREAM("[Haloc:] WARNING -> Dropping the " <<
+        st.st_size - valid_size << " bytes of incomplete records at the " <<
+        "end of the log " << filename << ".");
+      valid = ftruncate(fd_, valid_size) == 0 && fsync(fd_) == 0;
+    }
+  }
+  if (!valid) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The log " << filename << " cannot " <<
+      "be used: it is not a log, it was written with a different hashing " <<
+      "model, it is corrupted or it cannot be written.");
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+
+  // Start the background writer
+  num_pending_ = 0;
+  appended_ = 0;
+  synced_ = 0;
+  flush_ = false;
+  stop_ = false;
+  failed_ = false;
+  writer_ = std::thread(&HashLog::WriterLoop, this);
+  return true;
+}
+
+void haloc::HashLog::Close() {
+  if (fd_ < 0) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  writer_cv_.notify_one();
+  writer_.join();
+  close(fd_);
+  fd_ = -1;
+}
+
+bool haloc::HashLog::Append(const int& id, const std::vector<float>& hash) {
+  if (hash.size() != hash_length_ || hash_length_ == 0) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot log frame " << id << ": the " <<
+      "hash length is " << hash.size() << " and the log expects " <<
+      hash_length_ << ".");
+    return false;
+  }
+
+  // The checksum is computed before taking the lock
+  const int32_t record_id = id;
+  RecordHeader record;
+  record.size = sizeof(record_id) + hash.size()*sizeof(float);
+  record.crc = Crc32(0, &record_id, sizeof(record_id));
+  record.crc = Crc32(record.crc, hash.data(), hash.size()*sizeof(float));
+
+  bool wake = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0 || failed_) return false;
+    const char* bytes = reinterpret_cast<const char*>(&record);
+    pending_.insert(pending_.end(), bytes, bytes + sizeof(record));
+    bytes = reinterpret_cast<const char*>(&record_id);
+    pending_.insert(pending_.end(), bytes, bytes + sizeof(record_id));
+    bytes = reinterpret_cast<const char*>(hash.data());
+    pending_.insert(pending_.end(), bytes,
+      bytes + hash.size()*sizeof(float));
+    num_pending_++;
+    appended_++;
+    wake = num_pending_ >= params_.max_pending;
+  }
+  if (wake) writer_cv_.notify_one();
+  return true;
+}
+
+bool haloc::HashLog::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (fd_ < 0) return false;
+  const uint64_t target = appended_;
+  flush_ = true;
+  writer_cv_.notify_one();
+  synced_cv_.wait(lock, [&] {return synced_ >= target;});
+  return !failed_;
+}
+
+bool haloc::HashLog::Recover(std::vector<int>& ids,
+    std::vector< std::vector<float> >& hashes) {
+  if (!Flush()) return false;
+  std::lock_guard<std::mutex> io_lock(io_mutex_);
+  return ReadAll(ids, hashes);
+}
+
+bool haloc::HashLog::Compact() {
+  if (fd_ < 0) return false;
+  if (snapshot_.empty()) {
+    ROS_ERROR("[Haloc:] ERROR -> The log has no snapshot file to compact "
+      "into.");
+    return false;
+  }
+
+  // The writer waits, but the records keep being buffered meanwhile
+  std::lock_guard<std::mutex> io_lock(io_mutex_);
+  std::vector<int> ids;
+  std::vector< std::vector<float> > hashes;
+  if (!ReadAll(ids, hashes)) return false;
+  if (!MappedDatabase::Write(snapshot_, hash_, ids, hashes)) return false;
+  if (ftruncate(fd_, sizeof(LogHeader)) != 0 || fsync(fd_) != 0) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot truncate the log " <<
+      filename_ << ".");
+    return false;
+  }
+  return true;
+}
+
+bool haloc::HashLog::ReadRecords(uint64_t& valid_size, std::vector<int>* ids,
+    std::vector< std::vector<float> >* hashes) const {
+  std::ifstream file(filename_.c_str(), std::ios::binary);
+  if (!file.is_open()) return false;
+  file.seekg(0, std::ios::end);
+  const uint64_t file_size = file.tellg();
+  file.seekg(sizeof(LogHeader));
+  valid_size = sizeof(LogHeader);
+
+  // A crash while a batch is written leaves a short record, or records
+  // whose size was extended but whose data never reached the disk (zeros).
+  // A bad record is that torn tail when no valid record follows it, and
+  // corruption otherwise.
+  const uint32_t payload_size = sizeof(int32_t) + hash_length_*sizeof(float);
+  const uint64_t record_size = sizeof(RecordHeader) + payload_size;
+  std::vector<char> payload(payload_size);
+  RecordHeader record;
+  const auto read_record = [&]() {
+    file.read(reinterpret_cast<char*>(&record), sizeof(record));
+    file.read(payload.data(), payload_size);
+    return file && record.size == payload_size &&
+      Crc32(0, payload.data(), payload_size) == record.crc;
+  };
+  while (file_size - valid_size >= record_size) {
+    if (!read_record()) {
+      if (!file) return false;
+      for (uint64_t next=valid_size + record_size;
+          file_size - next >= record_size; next += record_size) {
+        if (read_record()) {
+          ROS_ERROR_STREAM("[Haloc:] ERROR -> The record at byte " <<
+            valid_size << " of the log " << filename_ << " is corrupted.");
+          return false;
+        }
+        if (!file) return false;
+      }
+      break;
+    }
+    valid_size += record_size;
+
+    if (ids != NULL && hashes != NULL) {
+      int32_t id = 0;
+      memcpy(&id, payload.data(), sizeof(id));
+      const float* hash = reinterpret_cast<const float*>(
+        payload.data() + sizeof(id));
+      ids->push_back(id);
+      hashes->push_back(std::vector<float>(hash, hash + hash_length_));
+    }
+  }
+  return true;
+}
+
+bool haloc::HashLog::ReadAll(std::vector<int>& ids,
+    std::vector< std::vector<float> >& hashes) const {
+  std::vector<int> all_ids;
+  std::vector< std::vector<float> > all_hashes;
+
+  // The snapshot first, then the log on top
+  if (!snapshot_.empty() && access(snapshot_.c_str(), F_OK) == 0) {
+    MappedDatabase snapshot(hash_);
+    if (!snapshot.Open(snapshot_)) return false;
+    all_ids = snapshot.GetIds();
+    for (uint i=0; i < all_ids.size(); ++i)
+      all_hashes.push_back(snapshot.GetHash(all_ids[i]));
+  }
+  uint64_t valid_size = 0;
+  if (!ReadRecords(valid_size, &all_ids, &all_hashes)) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot read the log " << filename_ <<
+      ".");
+    return false;
+  }
+
+  // The last hash of every frame wins
+  std::unordered_map<int, int> position;
+  ids.clear();
+  hashes.clear();
+  for (uint i=0; i < all_ids.size(); ++i) {
+    std::unordered_map<int, int>::iterator it = position.find(all_ids[i]);
+    if (it != position.end()) {
+      hashes[it->second].swap(all_hashes[i]);
+    } else {
+      position[all_ids[i]] = ids.size();
+      ids.push_back(all_ids[i]);
+      hashes.push_back(std::vector<float>());
+      hashes.back().swap(all_hashes[i]);
+    }
+  }
+  return true;
+}
+
+void haloc::HashLog::WriterLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    writer_cv_.wait_for(lock, std::chrono::milliseconds(params_.sync_period),
+      [this] {return stop_ || flush_ || num_pending_ >= params_.max_pending;});
+    flush_ = false;
+
+    // Take the buffered records and write them without holding the lock
+    if (!pending_.empty()) {
+      batch_.swap(pending_);
+      pending_.clear();
+      num_pending_ = 0;
+      const uint64_t target = appended_;
+      lock.unlock();
+      bool ok;
+      {
+        std::lock_guard<std::mutex> io_lock(io_mutex_);
+        ok = WriteAll(fd_, batch_.data(), batch_.size()) &&
+          fdatasync(fd_) == 0;
+      }
+      lock.lock();
+      if (!ok && !failed_) {
+        ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot write the log " <<
+          filename_ << ". The next records will be rejected.");
+        failed_ = true;
+      }
+      synced_ = target;
+    }
+    synced_cv_.notify_all();
+    if (stop_ && pending_.empty()) return;
+  }
+}
@@ -0,0 +1,493 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "libhaloc/binary_io.h"
+#include "libhaloc/hash_model.h"
+#include "libhaloc/kernels.h"
+
+// Model file signature and format version. Files with a newer version are
+// rejected by Load. Version 2 added the calibration.
+static const char kModelMagic[8] = {'H', 'A', 'L', 'O', 'C', 'M', 'D', 'L'};
+static const uint32_t kModelVersion = 2;
+
+using haloc::binary_io::ReadValue;
+using haloc::binary_io::WriteValue;
+
+haloc::HashModel::Params::Params() :
+  bucket_rows(DEFAULT_BUCKET_ROWS), bucket_cols(DEFAULT_BUCKET_COLS),
+  max_desc(DEFAULT_MAX_DESC), num_proj(DEFAULT_NUM_PROJ),
+  num_threads(DEFAULT_NUM_THREADS), seed(DEFAULT_SEED)
+{}
+
+haloc::HashModel::Calibration::Calibration() :
+  quant_offset(0.0), quant_scale(1.0/255.0)
+{}
+
+haloc::HashModel::HashModel() :
+  desc_length_(0), binary_(false), proj_stride_(0) {}
+
+haloc::HashModel::HashModel(const Params& params, const cv::Size& img_size,
+    const int& desc_length, const bool& binary) :
+  params_(params), img_size_(img_size), desc_length_(desc_length),
+  binary_(binary), proj_stride_(0) {
+  InitProjections(params_.max_desc);
+}
+
+void haloc::HashModel::ReserveScratch(Scratch& scratch,
+    const int& num_feat) const {
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+  const int max_features_x_bucket = static_cast<int>(
+    floor(params_.max_desc/num_buckets));
+  const int bytes = binary_ ? desc_length_ / 8 : 0;
+  scratch.bucket.reserve(num_feat);
+  scratch.count.reserve(num_buckets + 1);
+  scratch.next.reserve(num_buckets);
+  scratch.order.reserve(num_feat);
+  scratch.selected.reserve(num_buckets*max_features_x_bucket);
+  scratch.offsets.reserve(num_buckets + 1);
+  scratch.valid.reserve(num_buckets);
+  if (binary_) {
+    scratch.rows.reserve(max_features_x_bucket*bytes);
+    scratch.projected.reserve(params_.num_proj*desc_length_);
+  } else {
+    scratch.stacked.reserve(max_features_x_bucket*num_buckets*desc_length_);
+    scratch.projected.reserve(params_.num_proj*num_buckets*desc_length_);
+  }
+}
+
+bool haloc::HashModel::CheckDescriptors(const cv::Mat& desc) const {
+  if (desc.type() != CV_32F && desc.type() != CV_8U) return false;
+  return (desc.type() == CV_8U) == binary_ &&
+    DescriptorLength(desc) == desc_length_;
+}
+
+uint64_t haloc::HashModel::GetFingerprint() const {
+  std::vector<uint32_t> layout;
+  layout.push_back(params_.bucket_rows);
+  layout.push_back(params_.bucket_cols);
+  layout.push_back(params_.max_desc);
+  layout.push_back(params_.num_proj);
+  layout.push_back(img_size_.width);
+  layout.push_back(img_size_.height);
+  layout.push_back(desc_length_);
+  layout.push_back(binary_ ? 1 : 0);
+
+  // FNV-1a over the layout and the bytes of the projection vectors
+  uint64_t fingerprint = 14695981039346656037ULL;
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(layout.data());
+  for (uint i=0; i < layout.size()*sizeof(uint32_t); ++i)
+    fingerprint = (fingerprint ^ bytes[i]) * 1099511628211ULL;
+  for (uint i=0; i < r_.size(); ++i) {
+    bytes = reinterpret_cast<const uint8_t*>(r_[i].data());
+    for (uint j=0; j < r_[i].size()*sizeof(float); ++j)
+      fingerprint = (fingerprint ^ bytes[j]) * 1099511628211ULL;
+  }
+  return fingerprint;
+}
+
+std::shared_ptr<const haloc::HashModel> haloc::HashModel::Calibrated(
+    const Calibration& calibration) const {
+  std::shared_ptr<HashModel> model(new HashModel(*this));
+  model->calibration_ = calibration;
+  return model;
+}
+
+bool haloc::HashModel::Save(const std::string& filename) const {
+  std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot open " << filename <<
+      " to save the hashing model.");
+    return false;
+  }
+
+  // Header
+  file.write(kModelMagic, sizeof(kModelMagic));
+  WriteValue<uint32_t>(file, kModelVersion);
+  WriteValue<uint32_t>(file, params_.bucket_rows);
+  WriteValue<uint32_t>(file, params_.bucket_cols);
+  WriteValue<uint32_t>(file, params_.max_desc);
+  WriteValue<uint32_t>(file, params_.num_proj);
+  WriteValue<uint32_t>(file, params_.seed);
+  WriteValue<uint32_t>(file, img_size_.width);
+  WriteValue<uint32_t>(file, img_size_.height);
+  WriteValue<uint32_t>(file, desc_length_);
+  WriteValue<uint32_t>(file, binary_ ? 1 : 0);
+  WriteValue<uint32_t>(file, r_.size());
+  WriteValue<uint32_t>(file, r_.empty() ? 0 : r_[0].size());
+  WriteValue<float>(file, calibration_.quant_offset);
+  WriteValue<float>(file, calibration_.quant_scale);
+  WriteValue<uint32_t>(file, calibration_.sign_median.size());
+
+  // Signature thresholds and projection vectors
+  binary_io::WriteArray(file, calibration_.sign_median.data(),
+    calibration_.sign_median.size());
+  for (uint i=0; i < r_.size(); ++i)
+    binary_io::WriteArray(file, r_[i].data(), r_[i].size());
+
+  // The buffered data only reaches the file when it is closed
+  file.close();
+  if (file.fail()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot write the hashing model " <<
+      "to " << filename << ".");
+    return false;
+  }
+  return true;
+}
+
+std::shared_ptr<const haloc::HashModel> haloc::HashModel::Load(
+    const std::string& filename) {
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  if (!file.is_open()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot open the hashing model " <<
+      filename << ".");
+    return std::shared_ptr<const HashModel>();
+  }
+
+  // Header
+  char magic[sizeof(kModelMagic)];
+  file.read(magic, sizeof(magic));
+  const uint32_t version = ReadValue<uint32_t>(file);
+  if (!file.good() || memcmp(magic, kModelMagic, sizeof(magic)) != 0 ||
+      version == 0 || version > kModelVersion) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> " << filename << " is not a " <<
+      "hashing model or its format version is not supported.");
+    return std::shared_ptr<const HashModel>();
+  }
+  std::shared_ptr<HashModel> model(new HashModel());
+  model->params_.bucket_rows = ReadValue<uint32_t>(file);
+  model->params_.bucket_cols = ReadValue<uint32_t>(file);
+  model->params_.max_desc = ReadValue<uint32_t>(file);
+  model->params_.num_proj = ReadValue<uint32_t>(file);
+  model->params_.seed = ReadValue<uint32_t>(file);
+  model->img_size_.width = ReadValue<uint32_t>(file);
+  model->img_size_.height = ReadValue<uint32_t>(file);
+  model->desc_length_ = ReadValue<uint32_t>(file);
+  model->binary_ = ReadValue<uint32_t>(file) != 0;
+  const int num_vectors = ReadValue<uint32_t>(file);
+  const int v_size = ReadValue<uint32_t>(file);
+  Calibration& calibration = model->calibration_;
+  uint32_t num_medians = 0;
+  if (version >= 2) {
+    calibration.quant_offset = ReadValue<float>(file);
+    calibration.quant_scale = ReadValue<float>(file);
+    num_medians = ReadValue<uint32_t>(file);
+  }
+
+  // The layout must be the one InitProjections builds, and the file must
+  // hold exactly the vectors and thresholds before they are allocated
+  const Params& params = model->params_;
+  const int64_t num_buckets = static_cast<int64_t>(params.bucket_rows)*
+    params.bucket_cols;
+  const int64_t bucket_length = static_cast<int64_t>(params.num_proj)*
+    model->desc_length_;
+  if (!file.good() || params.bucket_rows <= 0 || params.bucket_cols <= 0 ||
+      params.num_proj <= 0 || params.max_desc < num_buckets ||
+      model->desc_length_ <= 0 ||
+      (model->binary_ && model->desc_length_ % 8 != 0) ||
+      num_vectors != params.num_proj ||
+      v_size != params.max_desc/num_buckets || v_size < num_vectors ||
+      !(calibration.quant_scale > 0.0) ||
+      (num_medians != 0 && num_medians != bucket_length) ||
+      binary_io::Remaining(file) != (static_cast<uint64_t>(num_vectors)*
+        v_size + num_medians)*sizeof(float)) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The hashing model " << filename <<
+      " is corrupted or truncated.");
+    return std::shared_ptr<const HashModel>();
+  }
+
+  // Signature thresholds and projection vectors
+  calibration.sign_median.resize(num_medians);
+  binary_io::ReadArray(file, calibration.sign_median.data(), num_medians);
+  model->r_.assign(num_vectors, std::vector<float>(v_size));
+  for (int i=0; i < num_vectors; ++i)
+    binary_io::ReadArray(file, model->r_[i].data(), v_size);
+  if (!file.good()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The hashing model " << filename <<
+      " is truncated.");
+    return std::shared_ptr<const HashModel>();
+  }
+  model->StackProjections();
+  return model;
+}
+
+void haloc::HashModel::InitProjections(const int& desc_size) {
+  // Initializations
+  std::mt19937 generator(params_.seed);
+  r_.clear();
+
+  // The maximum number of features per bucket
+  int max_features_x_bucket = static_cast<int>(
+    floor(params_.max_desc/(params_.bucket_cols*params_.bucket_rows)));
+
+  // The size of the descriptors may vary...
+  // But, we limit the number of descriptors per bucket.
+  int v_size = max_features_x_bucket;
+
+  // We will generate N-orthogonal vectors creating a linear system of type Ax=b
+  // Generate a first random vector
+  std::vector<float> r = ComputeRandomVector(v_size, generator);
+  r_.push_back(UnitVector(r));
+
+  // Generate the set of orthogonal vectors
+  for (uint i=1; i < params_.num_proj; i++) {
+    // Generate a random vector of the correct size
+    std::vector<float> new_v = ComputeRandomVector(v_size - i,
+      generator);
+
+    // Get the right terms (b)
+    Eigen::VectorXf b(r_.size());
+    for (uint n=0; n < r_.size(); n++) {
+      std::vector<float> cur_v = r_[n];
+      float sum = 0.0;
+      for (uint m=0; m < new_v.size(); m++)
+        sum += new_v[m]*cur_v[m];
+      b(n) = -sum;
+    }
+
+    // Get the matrix of equations (A)
+    Eigen::MatrixXf A(i, i);
+    for (uint n=0; n < r_.size(); n++) {
+      uint k = 0;
+      for (uint m=r_[n].size()-i; m < r_[n].size(); m++) {
+        A(n, k) = r_[n][m];
+        k++;
+      }
+    }
+
+    // Apply the solver
+    Eigen::VectorXf x = A.colPivHouseholderQr().solve(b);
+
+    // Add the solutions to the new vector
+    for (uint n=0; n < r_.size(); n++)
+      new_v.push_back(x(n));
+    new_v = UnitVector(new_v);
+
+    // Push the new vector
+    r_.push_back(new_v);
+  }
+
+  StackProjections();
+}
+
+void haloc::HashModel::StackProjections() {
+  // Stack the vectors as aligned rows of the projection matrix
+  const int v_size = r_.empty() ? 0 : r_[0].size();
+  proj_stride_ = AlignedStride(v_size);
+  proj_.assign(r_.size()*proj_stride_, 0.0f);
+  for (uint i=0; i < r_.size(); ++i)
+    std::copy(r_[i].begin(), r_[i].end(), proj_.begin() + i*proj_stride_);
+}
+
+std::vector<float> haloc::HashModel::ComputeRandomVector(const int& size,
+    std::mt19937& generator) {
+  // The 24 upper bits of every output fill the float mantissa exactly
+  std::vector<float> h;
+  for (int i=0; i < size; i++)
+    h.push_back(static_cast<float>(generator() >> 8) / 16777216.0f);
+  return h;
+}
+
+std::vector<float> haloc::HashModel::UnitVector(
+    const std::vector<float>& x) {
+  // Compute the norm
+  float sum = 0.0;
+  for (uint i=0; i < x.size(); i++)
+    sum += pow(x[i], 2.0);
+  float x_norm = sqrt(sum);
+
+  // x^ = x/|x|
+  std::vector<float> out;
+  for (uint i=0; i < x.size(); i++)
+    out.push_back(x[i] / x_norm);
+
+  return out;
+}
+
+void haloc::HashModel::ComputeHash(const std::vector<cv::KeyPoint>& kp,
+    const cv::Mat& desc, State& state, Scratch& scratch, float* hash) const {
+  // Bucket descriptors
+  BucketDescriptors(kp, state, scratch);
+
+  // Get a hash for every bucket
+  ProjectDescriptors(desc, scratch, hash);
+}
+
+void haloc::HashModel::BucketDescriptors(
+    const std::vector<cv::KeyPoint>& kp, State& state,
+    Scratch& scratch) const {
+  const int num_buckets = params_.bucket_cols*params_.bucket_rows;
+
+  // Compute width and height of the buckets
+  float bucket_width  = img_size_.width / params_.bucket_cols;
+  float bucket_height = img_size_.height / params_.bucket_rows;
+
+  // Bucket of every keypoint, clamped to the grid
+  std::vector<int>& bucket = scratch.bucket;
+  std::vector<int>& count = scratch.count;
+  bucket.resize(kp.size());
+  count.assign(num_buckets + 1, 0);
+  for (uint i=0; i < kp.size(); ++i) {
+    int u = static_cast<int>(floor(kp[i].pt.x/bucket_width));
+    int v = static_cast<int>(floor(kp[i].pt.y/bucket_height));
+    u = std::max(0, std::min(u, params_.bucket_cols - 1));
+    v = std::max(0, std::min(v, params_.bucket_rows - 1));
+    bucket[i] = v*params_.bucket_cols + u;
+    count[bucket[i] + 1]++;
+  }
+
+  // Counting sort of the keypoint indices by bucket
+  for (int i=0; i < num_buckets; ++i) count[i + 1] += count[i];
+  std::vector<int>& order = scratch.order;
+  std::vector<int>& next = scratch.next;
+  order.resize(kp.size());
+  next.assign(count.begin(), count.end() - 1);
+  for (uint i=0; i < kp.size(); ++i) order[next[bucket[i]]++] = i;
+
+  // The maximum number of features per bucket
+  int max_features_x_bucket = static_cast<int>(
+    floor(params_.max_desc/(params_.bucket_cols*params_.bucket_rows)));
+
+  // Select the best keypoints for each bucket. Ties keep the original order.
+  auto by_response = [&](const int& a, const int& b) {
+    return kp[a].response > kp[b].response ||
+      (kp[a].response == kp[b].response && a < b);
+  };
+  std::vector<int>& selected = scratch.selected;
+  std::vector<int>& offsets = scratch.offsets;
+  selected.clear();
+  offsets.assign(1, 0);
+  for (int i=0; i < num_buckets; ++i) {
+    std::vector<int>::iterator first = order.begin() + count[i];
+    std::vector<int>::iterator last = order.begin() + count[i + 1];
+    const int num_kp = std::min(static_cast<int>(last - first),
+      max_features_x_bucket);
+    std::partial_sort(first, first + num_kp, last, by_response);
+    for (std::vector<int>::iterator it = first; it != last; ++it) {
+      if (it < first + num_kp) {
+        selected.push_back(*it);
+        state.bucketed_kp.push_back(kp[*it]);
+      } else {
+        state.unbucketed_kp.push_back(kp[*it]);
+      }
+    }
+    offsets.push_back(selected.size());
+    state.num_kp_per_bucket.push_back(num_kp);
+  }
+}
+
+void haloc::HashModel::ProjectDescriptors(const cv::Mat& desc,
+    Scratch& scratch, float* hash) const {
+  const std::vector<int>& selected = scratch.selected;
+  const std::vector<int>& offsets = scratch.offsets;
+
+  // The maximum number of features per bucket
+  int max_features_x_bucket = static_cast<int>(
+    floor(params_.max_desc/(params_.bucket_cols*params_.bucket_rows)));
+
+  // Buckets with too few features are left empty
+  const int num_buckets = offsets.size() - 1;
+  const int min_feat = static_cast<int>(0.7 * max_features_x_bucket);
+  const int bucket_length = desc_length_*params_.num_proj;
+  std::fill(hash, hash + num_buckets*bucket_length, 0.0f);
+
+  std::vector<int>& valid = scratch.valid;
+  valid.clear();
+  int max_rows = 0;
+  for (int i=0; i < num_buckets; ++i) {
+    const int rows = offsets[i + 1] - offsets[i];
+    if (rows < min_feat || rows == 0) continue;
+    if (rows > r_[0].size()) {
+      ROS_ERROR_STREAM("[Haloc:] ERROR -> The number of descriptors is " <<
+        "larger than the size of the projection vector. This should not " <<
+        "happen.");
+      continue;
+    }
+    valid.push_back(i);
+    max_rows = std::max(max_rows, rows);
+  }
+  if (valid.empty()) return;
+
+  // Binary descriptors, bucket by bucket straight from the packed bytes. The
+  // rows of a bucket are gathered so the kernel reads them with a fixed step.
+  if (binary_) {
+    const int num_bytes = desc.cols;
+    std::vector<uint8_t>& rows = scratch.rows;
+    AlignedFloatVector& projected = scratch.projected;
+    rows.resize(max_rows*num_bytes);
+    projected.resize(params_.num_proj*desc_length_);
+    for (uint i=0; i < valid.size(); ++i) {
+      const int num_rows = offsets[valid[i] + 1] - offsets[valid[i]];
+      const int* bucket_rows = &selected[offsets[valid[i]]];
+      for (int m=0; m < num_rows; ++m) {
+        const uint8_t* row = desc.ptr<uint8_t>(bucket_rows[m]);
+        std::copy(row, row + num_bytes, rows.begin() + m*num_bytes);
+      }
+      kernels::ProjectBits(proj_.data(), proj_stride_, params_.num_proj,
+        rows.data(), num_bytes, num_rows, num_bytes, projected.data());
+      const float scale = 0.5 / static_cast<float>(num_rows);
+      float* bucketed_hash = hash + valid[i]*bucket_length;
+      for (int n=0; n < params_.num_proj*desc_length_; ++n)
+        bucketed_hash[n] = 0.5 + scale*projected[n];
+    }
+    return;
+  }
+
+  // Stack the buckets side by side: column block i holds the descriptors of
+  // the i-th valid bucket, padded with zero rows up to max_rows. Row m is
+  // always projected with the m-th element of the random vectors, so a single
+  // product computes the projections of all the buckets.
+  const int cols = valid.size()*desc_length_;
+  AlignedFloatVector& stacked = scratch.stacked;
+  stacked.assign(max_rows*cols, 0.0f);
+  for (uint i=0; i < valid.size(); ++i) {
+    for (int m=offsets[valid[i]]; m < offsets[valid[i] + 1]; ++m) {
+      const float* row = desc.ptr<float>(selected[m]);
+      std::copy(row, row + desc_length_,
+        stacked.data() + (m - offsets[valid[i]])*cols + i*desc_length_);
+    }
+  }
+  AlignedFloatVector& projected = scratch.projected;
+  projected.resize(params_.num_proj*cols);
+#ifdef EIGEN_USE_BLAS
+  Eigen::Map<const RowMatrix, 0, Eigen::OuterStride<> > r(proj_.data(),
+    params_.num_proj, max_rows, Eigen::OuterStride<>(proj_stride_));
+  Eigen::Map<const RowMatrix> x(stacked.data(), max_rows, cols);
+  Eigen::Map<RowMatrix> y(projected.data(), params_.num_proj, cols);
+  y.noalias() = r * x;
+#else
+  kernels::Project(proj_.data(), proj_stride_, params_.num_proj,
+    stacked.data(), max_rows, cols, projected.data());
+#endif
+
+  // The per element normalization (r*d + 1)/2 averaged over the rows of the
+  // bucket is affine, so it reduces to 0.5 + sum(r*d) / (2*rows).
+  for (uint i=0; i < valid.size(); ++i) {
+    const float scale = 0.5 / static_cast<float>(
+      offsets[valid[i] + 1] - offsets[valid[i]]);
+    float* bucketed_hash = hash + valid[i]*bucket_length;
+    for (int p=0; p < params_.num_proj; ++p) {
+      const float* row = projected.data() + p*cols + i*desc_length_;
+      for (int n=0; n < desc_length_; ++n)
+        bucketed_hash[p*desc_length_ + n] = 0.5 + scale*row[n];
+    }
+  }
+}
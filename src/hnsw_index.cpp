@@ -0,0 +1,222 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <unordered_set>
+
+#include "libhaloc/distance_profile.h"
+#include "libhaloc/hnsw_index.h"
+
+haloc::HnswIndex::Params::Params() :
+  max_links(DEFAULT_MAX_LINKS), ef_construction(DEFAULT_EF_CONSTRUCTION),
+  ef_search(DEFAULT_EF_SEARCH), eps(DEFAULT_EPS), tie_eps(DEFAULT_TIE_EPS),
+  seed(DEFAULT_SEED)
+{}
+
+haloc::HnswIndex::HnswIndex(const Hash& hash) :
+  hash_(hash), entry_(-1), max_layer_(-1) {
+  Clear();
+}
+
+bool haloc::HnswIndex::Add(const int& id, const std::vector<float>& hash) {
+  BucketedHash bucketed = hash_.BuildBucketedHash(hash);
+
+  // Sanity checks
+  if (bucketed.bucket_sum.empty() ||
+      (!nodes_.empty() && hash.size() != nodes_[0].hash.hash.size())) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot add frame " << id << " to " <<
+      "the index: the hash length is " << hash.size() << " and the index " <<
+      "expects " << hash_.GetHashLength() << ".");
+    return false;
+  }
+  if (node_ids_.count(id) > 0) {
+    ROS_WARN_STREAM("[Haloc:] WARNING -> Frame " << id << " is already in " <<
+      "the index.");
+    return false;
+  }
+
+  // Exponentially decaying layer probability
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  const double level_mult = 1.0 / log(std::max(params_.max_links, 2));
+  const int level = static_cast<int>(
+    floor(-log(1.0 - uniform(generator_)) * level_mult));
+
+  const int node = nodes_.size();
+  nodes_.push_back(Node());
+  nodes_[node].id = id;
+  nodes_[node].hash.hash.swap(bucketed.hash);
+  nodes_[node].hash.bucket_sum.swap(bucketed.bucket_sum);
+  nodes_[node].hash.occupancy = bucketed.occupancy;
+  nodes_[node].links.resize(level + 1);
+  node_ids_[id] = node;
+  if (node == 0) {
+    entry_ = node;
+    max_layer_ = level;
+    return true;
+  }
+
+  // Greedy descent through the layers above the new node
+  const BucketedHash& query = nodes_[node].hash;
+  std::vector<Candidate> entry(1,
+    Candidate(Distance(query, entry_), entry_));
+  for (int l=max_layer_; l > level; --l)
+    entry = SearchLayer(query, entry, 1, l, -1, 0);
+
+  // Link the new node to its closest nodes on every layer
+  for (int l=std::min(level, max_layer_); l >= 0; --l) {
+    entry = SearchLayer(query, entry, params_.ef_construction, l, -1, 0);
+    const int num_links = std::min(static_cast<int>(entry.size()),
+      params_.max_links);
+    for (int i=0; i < num_links; ++i) {
+      const int neighbor = entry[i].second;
+      nodes_[node].links[l].push_back(neighbor);
+      nodes_[neighbor].links[l].push_back(node);
+      ShrinkLinks(neighbor, l);
+    }
+  }
+  if (level > max_layer_) {
+    entry_ = node;
+    max_layer_ = level;
+  }
+  return true;
+}
+
+void haloc::HnswIndex::Clear() {
+  nodes_.clear();
+  node_ids_.clear();
+  entry_ = -1;
+  max_layer_ = -1;
+  generator_.seed(params_.seed);
+}
+
+std::vector<haloc::Match> haloc::HnswIndex::Query(
+    const std::vector<float>& hash, const int& k, const int& query_id,
+    const int& min_neighbor, const int& ef) const {
+  if (nodes_.empty() || k <= 0) return std::vector<Match>();
+  const BucketedHash query = hash_.BuildBucketedHash(hash);
+  if (query.bucket_sum.empty() ||
+      hash.size() != nodes_[0].hash.hash.size()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The query hash length is " <<
+      hash.size() << " and the index expects " <<
+      nodes_[0].hash.hash.size() << ".");
+    return std::vector<Match>();
+  }
+
+  // The upper layers only lead to the entry point of the bottom layer, so
+  // the excluded frames are not filtered there
+  std::vector<Candidate> entry(1,
+    Candidate(Distance(query, entry_), entry_));
+  for (int l=max_layer_; l > 0; --l)
+    entry = SearchLayer(query, entry, 1, l, -1, 0);
+  const int list_size = std::max((ef > 0) ? ef : params_.ef_search, k);
+  entry = SearchLayer(query, entry, list_size, 0, query_id, min_neighbor);
+
+  // The graph distance is a ranking proxy: report the exact overlap
+  TopMatches top(k);
+  for (uint i=0; i < entry.size(); ++i) {
+    const Node& node = nodes_[entry[i].second];
+    const int overlap = hash_.CalcDist(query, node.hash, params_.eps, true);
+    if (overlap > 0) top.Push(Match(node.id, overlap));
+  }
+  return top.Sorted();
+}
+
+float haloc::HnswIndex::Distance(const BucketedHash& hash,
+    const int& node) const {
+  const Hash::Params params = hash_.GetParams();
+  const int num_buckets = params.bucket_rows*params.bucket_cols;
+  const DistanceProfile profile = hash_.CalcDistProfile(hash,
+    nodes_[node].hash, params_.tie_eps);
+  const int overlap = profile.Overlap(params_.eps);
+
+  // Threshold needed to overlap one more bucket, mapped to (0, 1]
+  float tie = 1.0;
+  if (params_.tie_eps > params_.eps) {
+    float next = params_.tie_eps;
+    if (overlap < profile.eps_k.size())
+      next = std::min(profile.eps_k[overlap], params_.tie_eps);
+    tie = (next - params_.eps) / (params_.tie_eps - params_.eps);
+  }
+  return (num_buckets - overlap) + tie;
+}
+
+std::vector<haloc::HnswIndex::Candidate> haloc::HnswIndex::SearchLayer(
+    const BucketedHash& hash, const std::vector<Candidate>& entry,
+    const int& ef, const int& layer, const int& query_id,
+    const int& min_neighbor) const {
+  // Nodes to expand (closest on top) and results (furthest on top)
+  std::priority_queue<Candidate, std::vector<Candidate>,
+    std::greater<Candidate> > candidates;
+  std::priority_queue<Candidate> results;
+  std::unordered_set<int> visited;
+  for (uint i=0; i < entry.size(); ++i) {
+    if (!visited.insert(entry[i].second).second) continue;
+    candidates.push(entry[i]);
+    const int id = nodes_[entry[i].second].id;
+    if (query_id < 0 || abs(id - query_id) > min_neighbor)
+      results.push(entry[i]);
+  }
+  while (results.size() > ef) results.pop();
+
+  while (!candidates.empty()) {
+    const Candidate current = candidates.top();
+    if (results.size() >= ef && current.first > results.top().first) break;
+    candidates.pop();
+
+    const std::vector< std::vector<int> >& links =
+      nodes_[current.second].links;
+    if (layer >= links.size()) continue;
+    for (uint i=0; i < links[layer].size(); ++i) {
+      const int neighbor = links[layer][i];
+      if (!visited.insert(neighbor).second) continue;
+      const float dist = Distance(hash, neighbor);
+      if (results.size() >= ef && dist >= results.top().first) continue;
+
+      // Excluded nodes are expanded but never returned
+      candidates.push(Candidate(dist, neighbor));
+      const int id = nodes_[neighbor].id;
+      if (query_id >= 0 && abs(id - query_id) <= min_neighbor) continue;
+      results.push(Candidate(dist, neighbor));
+      if (results.size() > ef) results.pop();
+    }
+  }
+
+  std::vector<Candidate> found(results.size());
+  for (int i=found.size()-1; i >= 0; --i) {
+    found[i] = results.top();
+    results.pop();
+  }
+  return found;
+}
+
+void haloc::HnswIndex::ShrinkLinks(const int& node, const int& layer) {
+  std::vector<int>& links = nodes_[node].links[layer];
+  const uint max_links = (layer == 0) ? 2*params_.max_links :
+    params_.max_links;
+  if (links.size() <= max_links) return;
+
+  std::vector<Candidate> ranked(links.size());
+  for (uint i=0; i < links.size(); ++i)
+    ranked[i] = Candidate(Distance(nodes_[node].hash, links[i]), links[i]);
+  std::partial_sort(ranked.begin(), ranked.begin() + max_links, ranked.end());
+  for (uint i=0; i < max_links; ++i) links[i] = ranked[i].second;
+  links.resize(max_links);
+}
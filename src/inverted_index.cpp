@@ -0,0 +1,153 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "libhaloc/inverted_index.h"
+
+haloc::InvertedIndex::Params::Params() :
+  cell_width(DEFAULT_CELL_WIDTH), num_groups(DEFAULT_NUM_GROUPS),
+  min_votes(DEFAULT_MIN_VOTES)
+{}
+
+haloc::InvertedIndex::InvertedIndex(const Hash& hash) :
+  hash_(hash), db_(hash) {}
+
+bool haloc::InvertedIndex::Add(const int& id,
+    const std::vector<float>& hash) {
+  if (!db_.Add(id, hash)) return false;
+
+  // Post every non empty bucket under its code
+  const Hash::Params params = hash_.GetParams();
+  const int num_buckets = params.bucket_rows*params.bucket_cols;
+  const int bucket_length = hash.size() / num_buckets;
+  std::vector<uint64_t>& keys = frame_keys_[id];
+  std::vector<int> cells;
+  for (int b=0; b < num_buckets; ++b) {
+    const float* bucket = &hash[b*bucket_length];
+    if (std::accumulate(bucket, bucket + bucket_length, 0.0) == 0.0) continue;
+    ComputeCells(bucket, cells);
+    const uint64_t key = Key(cells);
+    postings_.Add(key, id, b);
+    keys.push_back(key);
+  }
+  return true;
+}
+
+bool haloc::InvertedIndex::Remove(const int& id) {
+  if (!db_.Remove(id)) return false;
+
+  std::unordered_map<int, std::vector<uint64_t> >::iterator it =
+    frame_keys_.find(id);
+  if (it == frame_keys_.end()) return true;
+  for (uint i=0; i < it->second.size(); ++i)
+    postings_.Remove(it->second[i], id);
+  frame_keys_.erase(it);
+  return true;
+}
+
+void haloc::InvertedIndex::Clear() {
+  db_.Clear();
+  postings_.Clear();
+  frame_keys_.clear();
+}
+
+std::vector<haloc::Match> haloc::InvertedIndex::Query(
+    const std::vector<float>& hash, const int& k, float eps,
+    const int& query_id, const int& min_neighbor) const {
+  if (db_.Size() == 0 || k <= 0) return std::vector<Match>();
+  if (params_.cell_width <= 0.0) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The index cell width (" <<
+      params_.cell_width << ") must be positive.");
+    return std::vector<Match>();
+  }
+
+  // The cells of two matching buckets differ at most by radius in every
+  // dimension. Too many neighbour codes are slower than the exact scan.
+  const int radius = std::max(1,
+    static_cast<int>(ceil(eps / params_.cell_width)));
+  const int side = 2*radius + 1;
+  int num_neighbors = 1;
+  for (int g=0; g < params_.num_groups; ++g) {
+    if (num_neighbors > kMaxNeighborCodes / side) {
+      ROS_WARN_STREAM("[Haloc:] WARNING -> The query eps (" << eps <<
+        ") is too large for the index cell width (" << params_.cell_width <<
+        "), scanning the whole database.");
+      return db_.Query(hash, k, eps, query_id, min_neighbor);
+    }
+    num_neighbors *= side;
+  }
+
+  const Hash::Params params = hash_.GetParams();
+  const int num_buckets = params.bucket_rows*params.bucket_cols;
+  const int bucket_length = hash.size() / num_buckets;
+  if (bucket_length*num_buckets != hash.size()) return std::vector<Match>();
+
+  // Vote for (frame, shift) for every posting near a query bucket
+  ShiftVotes votes(num_buckets, query_id, min_neighbor);
+  std::vector<int> cells, neighbor(params_.num_groups);
+  for (int j=0; j < num_buckets; ++j) {
+    const float* bucket = &hash[j*bucket_length];
+    if (std::accumulate(bucket, bucket + bucket_length, 0.0) == 0.0) continue;
+    ComputeCells(bucket, cells);
+
+    // All the codes at most radius cells away in every dimension
+    for (int n=0; n < num_neighbors; ++n) {
+      int code = n;
+      for (int g=0; g < params_.num_groups; ++g) {
+        neighbor[g] = cells[g] + (code % side) - radius;
+        code /= side;
+      }
+      const std::vector<Posting>* list = postings_.Find(Key(neighbor));
+      if (list) votes.Vote(*list, j);
+    }
+  }
+
+  // Candidates with enough matching buckets in a single shift
+  const std::vector<Match> best = votes.BestShifts();
+  std::vector<int> candidates;
+  for (uint i=0; i < best.size(); ++i)
+    if (best[i].overlap >= params_.min_votes) candidates.push_back(best[i].id);
+
+  // Exact rerank
+  return db_.Rerank(hash, candidates, k, eps, query_id, min_neighbor);
+}
+
+void haloc::InvertedIndex::ComputeCells(const float* bucket,
+    std::vector<int>& cells) const {
+  const Hash::Params params = hash_.GetParams();
+  const int num_buckets = params.bucket_rows*params.bucket_cols;
+  const int bucket_length = hash_.GetHashLength() / num_buckets;
+  const int group_length =
+    (bucket_length + params_.num_groups - 1) / params_.num_groups;
+
+  cells.resize(params_.num_groups);
+  for (int g=0; g < params_.num_groups; ++g) {
+    const int first = std::min(g*group_length, bucket_length);
+    const int last = std::min(first + group_length, bucket_length);
+    const double sum = std::accumulate(bucket + first, bucket + last, 0.0);
+    cells[g] = static_cast<int>(floor(sum / params_.cell_width));
+  }
+}
+
+uint64_t haloc::InvertedIndex::Key(const std::vector<int>& cells) {
+  CellsKey key;
+  for (uint i=0; i < cells.size(); ++i) key.Add(cells[i]);
+  return key.Get();
+}
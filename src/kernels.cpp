@@ -0,0 +1,548 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <limits>
+
+#include "libhaloc/kernels.h"
+
+// The vector kernels are compiled with per-function target attributes, so
+// the rest of the library keeps the baseline flags and the binary still runs
+// on CPUs without these extensions. They use 64-bit lane extracts, so 32-bit
+// x86 builds get the scalar kernels.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HALOC_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace haloc {
+namespace kernels {
+
+// Number of elements between two checks of the bound in the L1 kernels. The
+// partial sums only grow, so once they exceed the bound the final sum will
+// exceed it too.
+static const int kBoundCheckStep = 64;
+
+// Same for the SAD kernels, in bytes
+static const int kSadBoundCheckStep = 256;
+
+// Scalar reference kernels
+
+float L1DistanceScalar(const float* a, const float* b, const int& n,
+    const float& bound) {
+  float sum = 0.0;
+  for (int i=0; i < n; ++i) {
+    sum += fabs(a[i] - b[i]);
+    if ((i & (kBoundCheckStep - 1)) == kBoundCheckStep - 1 && sum > bound)
+      return sum;
+  }
+  return sum;
+}
+
+uint32_t SadDistanceScalar(const uint8_t* a, const uint8_t* b, const int& n,
+    const uint32_t& bound) {
+  uint32_t sum = 0;
+  for (int i=0; i < n; ++i) {
+    sum += (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+    if ((i & (kSadBoundCheckStep - 1)) == kSadBoundCheckStep - 1 &&
+        sum > bound)
+      return sum;
+  }
+  return sum;
+}
+
+uint32_t HammingDistanceScalar(const uint64_t* a, const uint64_t* b,
+    const int& n) {
+  uint32_t sum = 0;
+  for (int i=0; i < n; ++i) {
+    // Bit counting without the popcnt instruction
+    uint64_t x = a[i] ^ b[i];
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    sum += (x * 0x0101010101010101ULL) >> 56;
+  }
+  return sum;
+}
+
+void ProjectScalar(const float* r, const int& r_stride, const int& num_proj,
+    const float* x, const int& rows, const int& cols, float* out) {
+  for (int p=0; p < num_proj; ++p) {
+    float* out_row = out + p*cols;
+    for (int c=0; c < cols; ++c) out_row[c] = 0.0;
+    for (int m=0; m < rows; ++m) {
+      const float w = r[p*r_stride + m];
+      const float* x_row = x + m*cols;
+      for (int c=0; c < cols; ++c)
+        out_row[c] += w * x_row[c];
+    }
+  }
+}
+
+void ProjectBitsScalar(const float* r, const int& r_stride,
+    const int& num_proj, const uint8_t* x, const int& x_step, const int& rows,
+    const int& num_bytes, float* out) {
+  const int num_bits = 8*num_bytes;
+  for (int p=0; p < num_proj; ++p) {
+    // Sum of the weights of the set bits, the clear ones follow from the
+    // total: sum(w*(2b - 1)) = 2*sum(w*b) - sum(w)
+    float* out_row = out + p*num_bits;
+    for (int n=0; n < num_bits; ++n) out_row[n] = 0.0;
+    float total = 0.0;
+    for (int m=0; m < rows; ++m) {
+      const float w = r[p*r_stride + m];
+      const uint8_t* x_row = x + m*x_step;
+      total += w;
+      for (int j=0; j < num_bytes; ++j) {
+        for (unsigned int bits=x_row[j]; bits; bits &= bits - 1)
+          out_row[8*j + __builtin_ctz(bits)] += w;
+      }
+    }
+    for (int n=0; n < num_bits; ++n) out_row[n] = 2.0*out_row[n] - total;
+  }
+}
+
+#ifdef HALOC_X86_KERNELS
+
+// Adds the absolute differences of the last elements to a SAD
+static inline uint32_t SadTail(const uint8_t* a, const uint8_t* b,
+    int i, const int& n, uint32_t sum) {
+  for (; i < n; ++i) sum += (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+  return sum;
+}
+
+// POPCNT kernels
+
+__attribute__((target("popcnt")))
+static uint32_t HammingDistancePopcnt(const uint64_t* a, const uint64_t* b,
+    const int& n) {
+  uint64_t sum = 0;
+  for (int i=0; i < n; ++i) sum += __builtin_popcountll(a[i] ^ b[i]);
+  return sum;
+}
+
+// SSE4.2 kernels
+
+__attribute__((target("sse4.2")))
+static inline uint32_t ReduceSadSse42(const __m128i& acc) {
+  return _mm_cvtsi128_si64(acc) + _mm_extract_epi64(acc, 1);
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t SadDistanceSse42(const uint8_t* a, const uint8_t* b,
+    const int& n, const uint32_t& bound) {
+  __m128i acc = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    if (((i + 16) & (kSadBoundCheckStep - 1)) == 0) {
+      const uint32_t partial = ReduceSadSse42(acc);
+      if (partial > bound) return partial;
+    }
+  }
+  return SadTail(a, b, i, n, ReduceSadSse42(acc));
+}
+
+__attribute__((target("sse4.2")))
+static inline float ReduceSse42(const __m128& acc0, const __m128& acc1) {
+  __m128 acc = _mm_add_ps(acc0, acc1);
+  acc = _mm_hadd_ps(acc, acc);
+  acc = _mm_hadd_ps(acc, acc);
+  return _mm_cvtss_f32(acc);
+}
+
+__attribute__((target("sse4.2")))
+static float L1DistanceSse42(const float* a, const float* b, const int& n,
+    const float& bound) {
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 acc0 = _mm_setzero_ps();
+  __m128 acc1 = _mm_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+    acc0 = _mm_add_ps(acc0, _mm_andnot_ps(sign, d0));
+    acc1 = _mm_add_ps(acc1, _mm_andnot_ps(sign, d1));
+    if (((i + 8) & (kBoundCheckStep - 1)) == 0) {
+      const float partial = ReduceSse42(acc0, acc1);
+      if (partial > bound) return partial;
+    }
+  }
+  float sum = ReduceSse42(acc0, acc1);
+  for (; i < n; ++i) sum += fabs(a[i] - b[i]);
+  return sum;
+}
+
+__attribute__((target("sse4.2")))
+static void ProjectSse42(const float* r, const int& r_stride,
+    const int& num_proj, const float* x, const int& rows, const int& cols,
+    float* out) {
+  for (int p=0; p < num_proj; ++p) {
+    const float* w = r + p*r_stride;
+    float* out_row = out + p*cols;
+    int c = 0;
+    for (; c + 4 <= cols; c += 4) {
+      __m128 acc = _mm_setzero_ps();
+      for (int m=0; m < rows; ++m) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(w[m]),
+          _mm_loadu_ps(x + m*cols + c)));
+      }
+      _mm_storeu_ps(out_row + c, acc);
+    }
+    for (; c < cols; ++c) {
+      float acc = 0.0;
+      for (int m=0; m < rows; ++m) acc += w[m] * x[m*cols + c];
+      out_row[c] = acc;
+    }
+  }
+}
+
+// AVX2 kernels
+
+__attribute__((target("avx2,fma")))
+static inline float ReduceAvx2(const __m256& acc0, const __m256& acc1) {
+  __m256 acc = _mm256_add_ps(acc0, acc1);
+  __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc),
+    _mm256_extractf128_ps(acc, 1));
+  half = _mm_hadd_ps(half, half);
+  half = _mm_hadd_ps(half, half);
+  return _mm_cvtss_f32(half);
+}
+
+__attribute__((target("avx2,fma")))
+static float L1DistanceAvx2(const float* a, const float* b, const int& n,
+    const float& bound) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8),
+      _mm256_loadu_ps(b + i + 8));
+    acc0 = _mm256_add_ps(acc0, _mm256_andnot_ps(sign, d0));
+    acc1 = _mm256_add_ps(acc1, _mm256_andnot_ps(sign, d1));
+    if (((i + 16) & (kBoundCheckStep - 1)) == 0) {
+      const float partial = ReduceAvx2(acc0, acc1);
+      if (partial > bound) return partial;
+    }
+  }
+  float sum = ReduceAvx2(acc0, acc1);
+  for (; i < n; ++i) sum += fabs(a[i] - b[i]);
+  return sum;
+}
+
+// Without FMA: every column adds the same products in the same order as the
+// scalar reference, so the projections (and the hashes) are bit-identical on
+// every CPU. The file is built with -ffp-contract=off for the same reason.
+__attribute__((target("avx2")))
+static void ProjectAvx2(const float* r, const int& r_stride,
+    const int& num_proj, const float* x, const int& rows, const int& cols,
+    float* out) {
+  for (int p=0; p < num_proj; ++p) {
+    const float* w = r + p*r_stride;
+    float* out_row = out + p*cols;
+    int c = 0;
+    for (; c + 16 <= cols; c += 16) {
+      __m256 acc0 = _mm256_setzero_ps();
+      __m256 acc1 = _mm256_setzero_ps();
+      for (int m=0; m < rows; ++m) {
+        const __m256 wm = _mm256_set1_ps(w[m]);
+        acc0 = _mm256_add_ps(acc0,
+          _mm256_mul_ps(wm, _mm256_loadu_ps(x + m*cols + c)));
+        acc1 = _mm256_add_ps(acc1,
+          _mm256_mul_ps(wm, _mm256_loadu_ps(x + m*cols + c + 8)));
+      }
+      _mm256_storeu_ps(out_row + c, acc0);
+      _mm256_storeu_ps(out_row + c + 8, acc1);
+    }
+    for (; c < cols; ++c) {
+      float acc = 0.0;
+      for (int m=0; m < rows; ++m) acc += w[m] * x[m*cols + c];
+      out_row[c] = acc;
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t ReduceSadAvx2(const __m256i& acc) {
+  const __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc),
+    _mm256_extracti128_si256(acc, 1));
+  return _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1);
+}
+
+__attribute__((target("avx2")))
+static uint32_t SadDistanceAvx2(const uint8_t* a, const uint8_t* b,
+    const int& n, const uint32_t& bound) {
+  __m256i acc = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const __m256i va = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(a + i));
+    const __m256i vb = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(b + i));
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+    if (((i + 32) & (kSadBoundCheckStep - 1)) == 0) {
+      const uint32_t partial = ReduceSadAvx2(acc);
+      if (partial > bound) return partial;
+    }
+  }
+  return SadTail(a, b, i, n, ReduceSadAvx2(acc));
+}
+
+// AVX-512 kernels
+
+__attribute__((target("avx512f")))
+static float L1DistanceAvx512(const float* a, const float* b, const int& n,
+    const float& bound) {
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16),
+      _mm512_loadu_ps(b + i + 16));
+    acc0 = _mm512_add_ps(acc0, _mm512_abs_ps(d0));
+    acc1 = _mm512_add_ps(acc1, _mm512_abs_ps(d1));
+    if (((i + 32) & (kBoundCheckStep - 1)) == 0) {
+      const float partial = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+      if (partial > bound) return partial;
+    }
+  }
+  if (i + 16 <= n) {
+    __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    acc0 = _mm512_add_ps(acc0, _mm512_abs_ps(d0));
+    i += 16;
+  }
+  float sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+  for (; i < n; ++i) sum += fabs(a[i] - b[i]);
+  return sum;
+}
+
+// Same accumulation order as ProjectScalar, see ProjectAvx2
+__attribute__((target("avx512f")))
+static void ProjectAvx512(const float* r, const int& r_stride,
+    const int& num_proj, const float* x, const int& rows, const int& cols,
+    float* out) {
+  for (int p=0; p < num_proj; ++p) {
+    const float* w = r + p*r_stride;
+    float* out_row = out + p*cols;
+    int c = 0;
+    for (; c + 16 <= cols; c += 16) {
+      __m512 acc = _mm512_setzero_ps();
+      for (int m=0; m < rows; ++m) {
+        acc = _mm512_add_ps(acc, _mm512_mul_ps(_mm512_set1_ps(w[m]),
+          _mm512_loadu_ps(x + m*cols + c)));
+      }
+      _mm512_storeu_ps(out_row + c, acc);
+    }
+    if (c < cols) {
+      // Masked tail, so the remaining columns also use the vector unit
+      const __mmask16 mask = static_cast<__mmask16>((1u << (cols - c)) - 1);
+      __m512 acc = _mm512_setzero_ps();
+      for (int m=0; m < rows; ++m) {
+        acc = _mm512_add_ps(acc, _mm512_mul_ps(_mm512_set1_ps(w[m]),
+          _mm512_maskz_loadu_ps(mask, x + m*cols + c)));
+      }
+      _mm512_mask_storeu_ps(out_row + c, mask, acc);
+    }
+  }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint32_t SadDistanceAvx512(const uint8_t* a, const uint8_t* b,
+    const int& n, const uint32_t& bound) {
+  __m512i acc = _mm512_setzero_si512();
+  int i = 0;
+  for (; i + 64 <= n; i += 64) {
+    acc = _mm512_add_epi64(acc, _mm512_sad_epu8(_mm512_loadu_si512(a + i),
+      _mm512_loadu_si512(b + i)));
+    if (((i + 64) & (kSadBoundCheckStep - 1)) == 0) {
+      const uint32_t partial = _mm512_reduce_add_epi64(acc);
+      if (partial > bound) return partial;
+    }
+  }
+  if (i < n) {
+    // Masked tail: the missing bytes load as 0 in both vectors
+    const __mmask64 mask = (1ULL << (n - i)) - 1;
+    acc = _mm512_add_epi64(acc, _mm512_sad_epu8(
+      _mm512_maskz_loadu_epi8(mask, a + i),
+      _mm512_maskz_loadu_epi8(mask, b + i)));
+  }
+  return _mm512_reduce_add_epi64(acc);
+}
+
+__attribute__((target("avx512f")))
+static void ProjectBitsAvx512(const float* r, const int& r_stride,
+    const int& num_proj, const uint8_t* x, const int& x_step, const int& rows,
+    const int& num_bytes, float* out) {
+  const int num_bits = 8*num_bytes;
+  for (int p=0; p < num_proj; ++p) {
+    const float* w = r + p*r_stride;
+    float total = 0.0;
+    for (int m=0; m < rows; ++m) total += w[m];
+    const __m512 total_v = _mm512_set1_ps(total);
+    float* out_row = out + p*num_bits;
+
+    // Two descriptor bytes are the add mask of 16 output lanes
+    for (int j=0; j < num_bytes; j += 2) {
+      const bool tail = (j + 1 == num_bytes);
+      __m512 acc = _mm512_setzero_ps();
+      for (int m=0; m < rows; ++m) {
+        const uint8_t* x_row = x + m*x_step;
+        const __mmask16 bits = tail ? x_row[j] :
+          static_cast<__mmask16>(x_row[j] | (x_row[j + 1] << 8));
+        acc = _mm512_mask_add_ps(acc, bits, acc, _mm512_set1_ps(w[m]));
+      }
+      const __m512 res = _mm512_sub_ps(_mm512_add_ps(acc, acc), total_v);
+      _mm512_mask_storeu_ps(out_row + 8*j, tail ? 0x00FF : 0xFFFF, res);
+    }
+  }
+}
+
+#endif  // HALOC_X86_KERNELS
+
+// Runtime dispatch
+
+typedef float (*L1DistanceFn)(const float*, const float*, const int&,
+  const float&);
+typedef uint32_t (*SadDistanceFn)(const uint8_t*, const uint8_t*,
+  const int&, const uint32_t&);
+typedef uint32_t (*HammingDistanceFn)(const uint64_t*, const uint64_t*,
+  const int&);
+typedef void (*ProjectFn)(const float*, const int&, const int&, const float*,
+  const int&, const int&, float*);
+typedef void (*ProjectBitsFn)(const float*, const int&, const int&,
+  const uint8_t*, const int&, const int&, const int&, float*);
+
+/**
+ * @brief      The kernels selected for the running CPU, using at most a given
+ *             instruction set.
+ */
+struct Dispatch {
+  explicit Dispatch(const Isa& max_isa = AVX512) : isa(SCALAR),
+      l1_distance(&L1DistanceScalar), sad_distance(&SadDistanceScalar),
+      hamming_distance(&HammingDistanceScalar), project(&ProjectScalar),
+      project_bits(&ProjectBitsScalar) {
+#ifdef HALOC_X86_KERNELS
+    __builtin_cpu_init();
+    if (max_isa == SCALAR) return;
+    if (__builtin_cpu_supports("popcnt"))
+      hamming_distance = &HammingDistancePopcnt;
+    if (max_isa >= AVX512 && __builtin_cpu_supports("avx512f")) {
+      isa = AVX512;
+      l1_distance = &L1DistanceAvx512;
+      sad_distance = __builtin_cpu_supports("avx512bw") ?
+        &SadDistanceAvx512 : &SadDistanceAvx2;
+      project = &ProjectAvx512;
+      project_bits = &ProjectBitsAvx512;
+    } else if (max_isa >= AVX2 && __builtin_cpu_supports("avx2") &&
+        __builtin_cpu_supports("fma")) {
+      isa = AVX2;
+      l1_distance = &L1DistanceAvx2;
+      sad_distance = &SadDistanceAvx2;
+      project = &ProjectAvx2;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+      isa = SSE42;
+      l1_distance = &L1DistanceSse42;
+      sad_distance = &SadDistanceSse42;
+      project = &ProjectSse42;
+    }
+#endif
+  }
+
+  Isa isa;
+  L1DistanceFn l1_distance;
+  SadDistanceFn sad_distance;
+  HammingDistanceFn hamming_distance;
+  ProjectFn project;
+  ProjectBitsFn project_bits;
+};
+
+static Dispatch& GetDispatch() {
+  static Dispatch dispatch;
+  return dispatch;
+}
+
+Isa GetIsa() {
+  return GetDispatch().isa;
+}
+
+bool SetIsa(const Isa& isa) {
+  const Dispatch dispatch(isa);
+  if (dispatch.isa != isa) return false;
+  GetDispatch() = dispatch;
+  return true;
+}
+
+const char* GetIsaName(const Isa& isa) {
+  switch (isa) {
+    case SSE42: return "SSE4.2";
+    case AVX2: return "AVX2";
+    case AVX512: return "AVX-512";
+    default: return "scalar";
+  }
+}
+
+float L1Distance(const float* a, const float* b, const int& n) {
+  return GetDispatch().l1_distance(a, b, n,
+    std::numeric_limits<float>::infinity());
+}
+
+float L1DistanceBounded(const float* a, const float* b, const int& n,
+    const float& bound) {
+  return GetDispatch().l1_distance(a, b, n, bound);
+}
+
+float L1DistanceScalar(const float* a, const float* b, const int& n) {
+  return L1DistanceScalar(a, b, n, std::numeric_limits<float>::infinity());
+}
+
+uint32_t SadDistance(const uint8_t* a, const uint8_t* b, const int& n) {
+  return GetDispatch().sad_distance(a, b, n,
+    std::numeric_limits<uint32_t>::max());
+}
+
+uint32_t SadDistanceBounded(const uint8_t* a, const uint8_t* b, const int& n,
+    const uint32_t& bound) {
+  return GetDispatch().sad_distance(a, b, n, bound);
+}
+
+uint32_t SadDistanceScalar(const uint8_t* a, const uint8_t* b, const int& n) {
+  return SadDistanceScalar(a, b, n, std::numeric_limits<uint32_t>::max());
+}
+
+uint32_t HammingDistance(const uint64_t* a, const uint64_t* b,
+    const int& n) {
+  return GetDispatch().hamming_distance(a, b, n);
+}
+
+void Project(const float* r, const int& r_stride, const int& num_proj,
+    const float* x, const int& rows, const int& cols, float* out) {
+  GetDispatch().project(r, r_stride, num_proj, x, rows, cols, out);
+}
+
+void ProjectBits(const float* r, const int& r_stride, const int& num_proj,
+    const uint8_t* x, const int& x_step, const int& rows, const int& num_bytes,
+    float* out) {
+  GetDispatch().project_bits(r, r_stride, num_proj, x, x_step, rows,
+    num_bytes, out);
+}
+
+}  // namespace kernels
+}  // namespace haloc
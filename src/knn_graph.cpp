@@ -0,0 +1,279 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <cmath>
+#include <numeric>
+
+#include "libhaloc/distance_profile.h"
+#include "libhaloc/knn_graph.h"
+
+haloc::KnnGraphBuilder::Params::Params() :
+  k(DEFAULT_K),
+  max_iterations(DEFAULT_MAX_ITERATIONS),
+  sample_rate(DEFAULT_SAMPLE_RATE),
+  delta(DEFAULT_DELTA),
+  tie_eps(DEFAULT_TIE_EPS),
+  num_sequence_seeds(DEFAULT_NUM_SEQUENCE_SEEDS),
+  min_neighbor(DEFAULT_MIN_NEIGHBOR),
+  batch_size(DEFAULT_BATCH_SIZE),
+  num_threads(DEFAULT_NUM_THREADS),
+  seed(DEFAULT_SEED)
+{}
+
+haloc::KnnGraphBuilder::KnnGraphBuilder(const Hash& hash) :
+  hash_(hash), num_iterations_(0), num_distances_(0) {}
+
+std::vector< std::vector<haloc::Match> > haloc::KnnGraphBuilder::Build(
+    const std::vector<BucketedHash>& hashes, float eps) {
+  num_iterations_ = 0;
+  num_distances_ = 0;
+  const int n = hashes.size();
+  const int k = std::max(1, params_.k);
+  std::vector< std::vector<Match> > graph(n);
+  if (n < 2) return graph;
+  if (!pool_) pool_.reset(new WorkerPool(params_.num_threads));
+  std::mt19937 generator(params_.seed);
+
+  // Initial neighbours: the closest frames in time out of the neighbourhood
+  // window, which are similar along a trajectory, then random frames. The
+  // draws are serial, so the graph does not depend on the number of threads.
+  std::vector< std::vector<int> > initial(n);
+  const int gap = std::max(0, params_.min_neighbor) + 1;
+  for (int v=0; v < n; ++v) {
+    for (int d=gap; d < gap + params_.num_sequence_seeds; ++d) {
+      if (v - d >= 0) initial[v].push_back(v - d);
+      if (v + d < n) initial[v].push_back(v + d);
+    }
+  }
+  std::uniform_int_distribution<int> uniform(0, n - 1);
+  for (int v=0; v < n; ++v) {
+    for (int attempt=0; attempt < 3*k && initial[v].size() < k; ++attempt) {
+      const int u = uniform(generator);
+      if (Linkable(u, v) && std::find(initial[v].begin(), initial[v].end(),
+          u) == initial[v].end())
+        initial[v].push_back(u);
+    }
+  }
+  std::vector< std::vector<int> > initial_overlap(n);
+  std::vector< std::vector<float> > initial_tie(n);
+  pool_->ParallelFor(n, 64, [&](int begin, int end) {
+    for (int v=begin; v < end; ++v) {
+      initial_overlap[v].resize(initial[v].size());
+      initial_tie[v].resize(initial[v].size());
+      for (uint m=0; m < initial[v].size(); ++m) {
+        Distance(hashes[v], hashes[initial[v][m]], eps, initial_overlap[v][m],
+          initial_tie[v][m]);
+      }
+    }
+  });
+  std::vector< std::vector<Neighbor> > lists(n);
+  for (int v=0; v < n; ++v) {
+    num_distances_ += initial[v].size();
+    for (uint m=0; m < initial[v].size(); ++m)
+      Insert(lists[v], initial[v][m], initial_overlap[v][m], initial_tie[v][m]);
+  }
+
+  const int sample_size = std::max(1,
+    static_cast<int>(round(params_.sample_rate*k)));
+  const int batch_size = std::max(1, params_.batch_size);
+  for (int iter=0; iter < params_.max_iterations; ++iter) {
+    // Every frame joins a sample of its new neighbours with each other and
+    // with its old ones, in both directions of the links
+    std::vector< std::vector<int> > new_ids(n), old_ids(n);
+    std::vector< std::vector<int> > new_reverse(n), old_reverse(n);
+    for (int v=0; v < n; ++v) {
+      for (uint m=0; m < lists[v].size(); ++m) {
+        const Neighbor& neighbor = lists[v][m];
+        if (neighbor.is_new)
+          new_ids[v].push_back(neighbor.match.id);
+        else
+          old_ids[v].push_back(neighbor.match.id);
+      }
+      Sample(new_ids[v], sample_size, generator);
+
+      // The sampled neighbours are not new any more
+      for (uint m=0; m < lists[v].size(); ++m) {
+        Neighbor& neighbor = lists[v][m];
+        if (neighbor.is_new && std::find(new_ids[v].begin(),
+            new_ids[v].end(), neighbor.match.id) != new_ids[v].end())
+          neighbor.is_new = false;
+      }
+      for (uint m=0; m < new_ids[v].size(); ++m)
+        new_reverse[new_ids[v][m]].push_back(v);
+      for (uint m=0; m < old_ids[v].size(); ++m)
+        old_reverse[old_ids[v][m]].push_back(v);
+    }
+    for (int v=0; v < n; ++v) {
+      Sample(new_reverse[v], sample_size, generator);
+      Sample(old_reverse[v], sample_size, generator);
+      new_ids[v].insert(new_ids[v].end(), new_reverse[v].begin(),
+        new_reverse[v].end());
+      old_ids[v].insert(old_ids[v].end(), old_reverse[v].begin(),
+        old_reverse[v].end());
+      std::sort(new_ids[v].begin(), new_ids[v].end());
+      new_ids[v].erase(std::unique(new_ids[v].begin(), new_ids[v].end()),
+        new_ids[v].end());
+      std::sort(old_ids[v].begin(), old_ids[v].end());
+      old_ids[v].erase(std::unique(old_ids[v].begin(), old_ids[v].end()),
+        old_ids[v].end());
+    }
+
+    // The distances of a batch are computed in parallel and applied in
+    // frame order, so the lists only change between batches
+    int64_t changes = 0;
+    for (int begin=0; begin < n; begin += batch_size) {
+      const int end = std::min(begin + batch_size, n);
+      std::vector< std::vector<Update> > updates(end - begin);
+      pool_->ParallelFor(end - begin, 16, [&](int first, int last) {
+        for (int v=begin + first; v < begin + last; ++v) {
+          std::vector<Update>& out = updates[v - begin];
+          const std::vector<int>& new_v = new_ids[v];
+          const std::vector<int>& old_v = old_ids[v];
+          auto join = [&](const int& a, const int& b) {
+            if (a == b || !Linkable(a, b)) return;
+            Update update;
+            update.a = a;
+            update.b = b;
+            Distance(hashes[a], hashes[b], eps, update.overlap, update.tie);
+            out.push_back(update);
+          };
+          for (uint i=0; i < new_v.size(); ++i) {
+            for (uint j=i + 1; j < new_v.size(); ++j) join(new_v[i], new_v[j]);
+            for (uint j=0; j < old_v.size(); ++j) join(new_v[i], old_v[j]);
+          }
+        }
+      });
+      for (uint b=0; b < updates.size(); ++b) {
+        num_distances_ += updates[b].size();
+        for (uint u=0; u < updates[b].size(); ++u) {
+          const Update& update = updates[b][u];
+          changes += Insert(lists[update.a], update.b, update.overlap,
+            update.tie);
+          changes += Insert(lists[update.b], update.a, update.overlap,
+            update.tie);
+        }
+      }
+    }
+    num_iterations_++;
+    if (changes <= params_.delta*n*k) break;
+  }
+
+  // Only the overlapping neighbours are returned
+  for (int v=0; v < n; ++v) {
+    for (uint m=0; m < lists[v].size(); ++m)
+      if (lists[v][m].match.overlap > 0) graph[v].push_back(lists[v][m].match);
+  }
+  return graph;
+}
+
+double haloc::KnnGraphBuilder::EstimateRecall(
+    const std::vector<BucketedHash>& hashes,
+    const std::vector< std::vector<Match> >& graph, float eps,
+    const int& num_samples) {
+  const int n = hashes.size();
+  if (graph.size() != n) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The graph has " << graph.size() <<
+      " frames and there are " << n << " hashes.");
+    return 0.0;
+  }
+  if (n == 0 || num_samples <= 0) return 1.0;
+  if (!pool_) pool_.reset(new WorkerPool(params_.num_threads));
+
+  // Sampled frames
+  std::mt19937 generator(params_.seed);
+  std::vector<int> frames(n);
+  std::iota(frames.begin(), frames.end(), 0);
+  Sample(frames, num_samples, generator);
+
+  // Exact neighbours by brute force
+  const int k = std::max(1, params_.k);
+  std::vector< std::vector<Match> > exact(frames.size());
+  pool_->ParallelFor(frames.size(), 1, [&](int begin, int end) {
+    for (int s=begin; s < end; ++s) {
+      const int v = frames[s];
+      TopMatches top(k);
+      for (int u=0; u < n; ++u) {
+        if (!Linkable(u, v)) continue;
+        const int overlap = hash_.CalcDist(hashes[v], hashes[u], eps, true);
+        if (overlap > 0) top.Push(Match(u, overlap));
+      }
+      exact[s] = top.Sorted();
+    }
+  });
+
+  // A graph neighbour as good as the worst exact one is a hit
+  int64_t found = 0, total = 0;
+  for (uint s=0; s < frames.size(); ++s) {
+    if (exact[s].empty()) continue;
+    const int min_overlap = exact[s].back().overlap;
+    const std::vector<Match>& neighbors = graph[frames[s]];
+    int hits = 0;
+    for (uint m=0; m < neighbors.size(); ++m)
+      if (neighbors[m].overlap >= min_overlap) hits++;
+    found += std::min<int>(hits, exact[s].size());
+    total += exact[s].size();
+  }
+  return (total == 0) ? 1.0 : static_cast<double>(found) / total;
+}
+
+void haloc::KnnGraphBuilder::Distance(const BucketedHash& hash_1,
+    const BucketedHash& hash_2, float eps, int& overlap, float& tie) const {
+  if (params_.tie_eps <= eps) {
+    overlap = hash_.CalcDist(hash_1, hash_2, eps, true);
+    tie = 1.0;
+    return;
+  }
+  const DistanceProfile profile = hash_.CalcDistProfile(hash_1, hash_2,
+    params_.tie_eps);
+  overlap = profile.Overlap(eps);
+
+  // Threshold needed to overlap one more bucket, mapped to (0, 1]
+  float next = params_.tie_eps;
+  if (overlap < profile.eps_k.size())
+    next = std::min(profile.eps_k[overlap], params_.tie_eps);
+  tie = (next - eps) / (params_.tie_eps - eps);
+}
+
+bool haloc::KnnGraphBuilder::Insert(std::vector<Neighbor>& list,
+    const int& id, const int& overlap, const float& tie) {
+  const int k = std::max(1, params_.k);
+  Neighbor neighbor;
+  neighbor.match = Match(id, overlap);
+  neighbor.tie = tie;
+  neighbor.is_new = true;
+  if (list.size() == k && !(neighbor < list.back())) return false;
+  for (uint m=0; m < list.size(); ++m)
+    if (list[m].match.id == id) return false;
+
+  // Sorted insertion, dropping the worst one when the list is full
+  std::vector<Neighbor>::iterator it = list.begin();
+  while (it != list.end() && *it < neighbor) ++it;
+  list.insert(it, neighbor);
+  if (list.size() > k) list.pop_back();
+  return true;
+}
+
+void haloc::KnnGraphBuilder::Sample(std::vector<int>& list, const int& size,
+    std::mt19937& generator) {
+  if (list.size() <= size) return;
+  for (int i=0; i < size; ++i) {
+    std::uniform_int_distribution<int> uniform(i, list.size() - 1);
+    std::swap(list[i], list[uniform(generator)]);
+  }
+  list.resize(std::max(0, size));
+}
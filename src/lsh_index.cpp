@@ -0,0 +1,186 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "libhaloc/kernels.h"
+#include "libhaloc/lsh_index.h"
+
+haloc::LshIndex::Params::Params() :
+  num_tables(DEFAULT_NUM_TABLES), num_functions(DEFAULT_NUM_FUNCTIONS),
+  bucket_width(DEFAULT_BUCKET_WIDTH), max_candidates(DEFAULT_MAX_CANDIDATES),
+  seed(DEFAULT_SEED)
+{}
+
+haloc::LshIndex::LshIndex(const Hash& hash) :
+  hash_(hash), db_(hash), bucket_length_(0), func_stride_(0) {
+  Clear();
+}
+
+bool haloc::LshIndex::Add(const int& id, const std::vector<float>& hash) {
+  if (!db_.Add(id, hash)) return false;
+
+  // The functions are drawn when the bucket length is known
+  const Hash::Params params = hash_.GetParams();
+  const int bucket_length = hash.size() / (params.bucket_rows*
+    params.bucket_cols);
+  if (bucket_length != bucket_length_) InitFunctions(bucket_length);
+
+  std::vector<uint64_t> keys;
+  std::vector<bool> full;
+  ComputeKeys(hash, keys, full);
+  std::vector< std::pair<int, uint64_t> >& frame_keys = frame_keys_[id];
+  for (uint b=0; b < full.size(); ++b) {
+    if (!full[b]) continue;
+    for (int t=0; t < params_.num_tables; ++t) {
+      const uint64_t key = keys[b*params_.num_tables + t];
+      tables_[t].Add(key, id, b);
+      frame_keys.push_back(std::make_pair(t, key));
+    }
+  }
+  return true;
+}
+
+bool haloc::LshIndex::Remove(const int& id) {
+  if (!db_.Remove(id)) return false;
+
+  std::unordered_map<int, std::vector< std::pair<int, uint64_t> > >::iterator
+    it = frame_keys_.find(id);
+  if (it == frame_keys_.end()) return true;
+  for (uint i=0; i < it->second.size(); ++i)
+    tables_[it->second[i].first].Remove(it->second[i].second, id);
+  frame_keys_.erase(it);
+  return true;
+}
+
+void haloc::LshIndex::Clear() {
+  db_.Clear();
+  tables_.assign(params_.num_tables, PostingTable());
+  frame_keys_.clear();
+  bucket_length_ = 0;
+}
+
+std::vector<haloc::Match> haloc::LshIndex::Query(
+    const std::vector<float>& hash, const int& k, float eps,
+    const int& query_id, const int& min_neighbor) const {
+  if (db_.Size() == 0 || k <= 0) return std::vector<Match>();
+  const Hash::Params params = hash_.GetParams();
+  const int num_buckets = params.bucket_rows*params.bucket_cols;
+  if (hash.size() != num_buckets*bucket_length_) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The query hash length is " <<
+      hash.size() << " and the index expects " <<
+      num_buckets*bucket_length_ << ".");
+    return std::vector<Match>();
+  }
+  if (params_.bucket_width <= 0.0) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The LSH bucket width (" <<
+      params_.bucket_width << ") must be positive.");
+    return std::vector<Match>();
+  }
+  if (eps > params_.bucket_width) {
+    ROS_WARN_STREAM("[Haloc:] WARNING -> The query eps (" << eps << ") is " <<
+      "larger than the LSH bucket width (" << params_.bucket_width << "), " <<
+      "scanning the whole database.");
+    return db_.Query(hash, k, eps, query_id, min_neighbor);
+  }
+
+  // Vote for (frame, shift) for every colliding bucket
+  std::vector<uint64_t> keys;
+  std::vector<bool> full;
+  ComputeKeys(hash, keys, full);
+  ShiftVotes votes(num_buckets, query_id, min_neighbor);
+  for (int j=0; j < num_buckets; ++j) {
+    if (!full[j]) continue;
+    for (int t=0; t < params_.num_tables; ++t) {
+      const std::vector<Posting>* list =
+        tables_[t].Find(keys[j*params_.num_tables + t]);
+      if (list) votes.Vote(*list, j);
+    }
+  }
+
+  // Rank the frames by the votes of their best alignment
+  std::vector<Match> ranked = votes.BestShifts();
+  if (params_.max_candidates > 0 && ranked.size() > params_.max_candidates) {
+    std::nth_element(ranked.begin(), ranked.begin() + params_.max_candidates,
+      ranked.end());
+    ranked.resize(params_.max_candidates);
+  }
+  std::vector<int> candidates(ranked.size());
+  for (uint i=0; i < ranked.size(); ++i) candidates[i] = ranked[i].id;
+
+  // Exact verification
+  return db_.Rerank(hash, candidates, k, eps, query_id, min_neighbor);
+}
+
+void haloc::LshIndex::InitFunctions(const int& bucket_length) {
+  const int num_functions = params_.num_tables*params_.num_functions;
+  bucket_length_ = bucket_length;
+  func_stride_ = AlignedStride(bucket_length);
+  func_a_.assign(num_functions*func_stride_, 0.0f);
+  func_b_.resize(num_functions);
+
+  // The Cauchy distribution is 1-stable, so a*u - a*v is distributed as
+  // |u - v|_1 times a Cauchy variable
+  std::mt19937 generator(params_.seed);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  for (int f=0; f < num_functions; ++f) {
+    for (int m=0; m < bucket_length; ++m)
+      func_a_[f*func_stride_ + m] = tan(M_PI * (uniform(generator) - 0.5));
+    func_b_[f] = uniform(generator) * params_.bucket_width;
+  }
+}
+
+void haloc::LshIndex::ComputeKeys(const std::vector<float>& hash,
+    std::vector<uint64_t>& keys, std::vector<bool>& full) const {
+  const Hash::Params params = hash_.GetParams();
+  const int num_buckets = params.bucket_rows*params.bucket_cols;
+  const int num_functions = params_.num_tables*params_.num_functions;
+
+  // One bucket per column, so all the functions of all the buckets are
+  // evaluated with a single projection
+  std::vector<float> buckets(bucket_length_*num_buckets);
+  full.assign(num_buckets, false);
+  for (int b=0; b < num_buckets; ++b) {
+    double sum = 0.0;
+    for (int m=0; m < bucket_length_; ++m) {
+      buckets[m*num_buckets + b] = hash[b*bucket_length_ + m];
+      sum += hash[b*bucket_length_ + m];
+    }
+    full[b] = (sum != 0.0);
+  }
+  std::vector<float> projected(num_functions*num_buckets);
+  kernels::Project(&func_a_[0], func_stride_, num_functions, &buckets[0],
+    bucket_length_, num_buckets, &projected[0]);
+
+  // Key of the quantized values of the functions of every table
+  keys.assign(num_buckets*params_.num_tables, 0);
+  for (int b=0; b < num_buckets; ++b) {
+    if (!full[b]) continue;
+    for (int t=0; t < params_.num_tables; ++t) {
+      CellsKey key;
+      for (int f=t*params_.num_functions; f < (t+1)*params_.num_functions;
+          ++f) {
+        key.Add(static_cast<int>(floor(
+          (projected[f*num_buckets + b] + func_b_[f]) / params_.bucket_width)));
+      }
+      keys[b*params_.num_tables + t] = key.Get();
+    }
+  }
+}
@@ -0,0 +1,408 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#include "libhaloc/file_sync.h"
+#include "libhaloc/mapped_database.h"
+
+// File signature and format version. The readers accept any file whose
+// min_version is not newer than their own version.
+static const char kDatabaseMagic[8] = {'H', 'A', 'L', 'O', 'C', 'D', 'B', 0};
+static const uint32_t kDatabaseVersion = 1;
+
+// Pads the file with zeros up to the next kAlignment boundary
+static void PadFile(std::ofstream& file) {
+  static const char zeros[haloc::kAlignment] = {0};
+  const uint64_t pos = file.tellp();
+  file.write(zeros, haloc::AlignedByteStride(pos) - pos);
+}
+
+haloc::MappedDatabaseWriter::MappedDatabaseWriter(const Hash& hash) :
+  hash_(hash) {
+  memset(&header_, 0, sizeof(header_));
+}
+
+haloc::MappedDatabaseWriter::~MappedDatabaseWriter() {
+  if (IsOpen()) Discard();
+}
+
+bool haloc::MappedDatabaseWriter::Open(const std::string& filename) {
+  if (IsOpen()) Discard();
+  if (!hash_.IsInitialized()) {
+    ROS_ERROR("[Haloc:] ERROR -> The hash object must be initialized to "
+      "write a database.");
+    return false;
+  }
+
+  // Header with the layout of the hashes. The blocks are only known at
+  // Close, when the number of rows is.
+  const Hash::Params params = hash_.GetParams();
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, kDatabaseMagic, sizeof(kDatabaseMagic));
+  header_.version = kDatabaseVersion;
+  header_.min_version = kDatabaseVersion;
+  header_.header_size = AlignedByteStride(sizeof(header_));
+  header_.fingerprint = hash_.GetModel()->GetFingerprint();
+  header_.bucket_rows = params.bucket_rows;
+  header_.bucket_cols = params.bucket_cols;
+  header_.num_proj = params.num_proj;
+  header_.desc_length = hash_.GetModel()->GetDescriptorLength();
+  header_.hash_length = hash_.GetHashLength();
+  header_.hash_stride = AlignedStride(header_.hash_length);
+  header_.hashes_offset = header_.header_size;
+  padding_.assign(header_.hash_stride - header_.hash_length, 0.0f);
+  bucket_sums_.clear();
+  occupancy_.clear();
+  ids_.clear();
+
+  // Written next to the target and renamed at the end
+  filename_ = filename;
+  const std::string tmp_filename = filename_ + ".tmp";
+  file_.clear();
+  file_.open(tmp_filename.c_str(), std::ios::binary | std::ios::trunc);
+  if (file_.is_open()) {
+    file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+    PadFile(file_);
+  }
+  if (!file_.is_open() || file_.fail()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot open " << tmp_filename <<
+      " to write the database.");
+    Discard();
+    return false;
+  }
+  return true;
+}
+
+bool haloc::MappedDatabaseWriter::Append(const int& id,
+    const std::vector<float>& hash) {
+  if (!IsOpen()) return false;
+  if (hash.size() != header_.hash_length) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The hash of frame " << id <<
+      " has length " << hash.size() << " and the database expects " <<
+      header_.hash_length << ".");
+    return false;
+  }
+
+  // The hash row, zero padded up to the stride
+  file_.write(reinterpret_cast<const char*>(hash.data()),
+    hash.size()*sizeof(float));
+  file_.write(reinterpret_cast<const char*>(padding_.data()),
+    padding_.size()*sizeof(float));
+  if (file_.fail()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot write the database to " <<
+      filename_ << ".");
+    return false;
+  }
+
+  // Its summaries, written at Close
+  const int num_buckets = header_.bucket_rows*header_.bucket_cols;
+  bucket_sums_.resize(bucket_sums_.size() + num_buckets);
+  occupancy_.push_back(0);
+  hash_.SummarizeBuckets(hash.data(), &bucket_sums_[bucket_sums_.size() -
+    num_buckets], occupancy_.back());
+  ids_.push_back(id);
+  return true;
+}
+
+bool haloc::MappedDatabaseWriter::Close() {
+  if (!IsOpen()) return false;
+
+  // Index to find the ids. They must be unique.
+  const uint64_t num_rows = ids_.size();
+  std::vector< std::pair<int32_t, int32_t> > index(num_rows);
+  for (uint i=0; i < num_rows; ++i)
+    index[i] = std::make_pair(ids_[i], static_cast<int32_t>(i));
+  std::sort(index.begin(), index.end());
+  for (uint i=1; i < num_rows; ++i) {
+    if (index[i].first == index[i - 1].first) {
+      ROS_ERROR_STREAM("[Haloc:] ERROR -> Frame " << index[i].first <<
+        " was appended twice to the database " << filename_ << ".");
+      Discard();
+      return false;
+    }
+  }
+  std::vector<int32_t> flat_index(2*num_rows);
+  for (uint i=0; i < num_rows; ++i) {
+    flat_index[2*i] = index[i].first;
+    flat_index[2*i + 1] = index[i].second;
+  }
+
+  // The blocks after the hash rows
+  PadFile(file_);
+  header_.num_rows = num_rows;
+  header_.sums_offset = file_.tellp();
+  file_.write(reinterpret_cast<const char*>(bucket_sums_.data()),
+    bucket_sums_.size()*sizeof(float));
+  PadFile(file_);
+  header_.occupancy_offset = file_.tellp();
+  file_.write(reinterpret_cast<const char*>(occupancy_.data()),
+    num_rows*sizeof(uint64_t));
+  PadFile(file_);
+  header_.ids_offset = file_.tellp();
+  file_.write(reinterpret_cast<const char*>(ids_.data()),
+    num_rows*sizeof(int32_t));
+  PadFile(file_);
+  header_.index_offset = file_.tellp();
+  file_.write(reinterpret_cast<const char*>(flat_index.data()),
+    flat_index.size()*sizeof(int32_t));
+  PadFile(file_);
+  file_.seekp(0);
+  file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+  file_.close();
+
+  // The data must be on disk before the rename makes it visible, and the
+  // rename must be on disk before the callers rely on it (e.g. HashLog
+  // truncates the log once the snapshot is written)
+  const std::string tmp_filename = filename_ + ".tmp";
+  if (file_.fail() || !SyncFile(tmp_filename) ||
+      rename(tmp_filename.c_str(), filename_.c_str()) != 0) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot write the database to " <<
+      filename_ << ".");
+    Discard();
+    return false;
+  }
+  bucket_sums_.clear();
+  occupancy_.clear();
+  ids_.clear();
+  if (!SyncParentDirectory(filename_)) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot sync the directory of the " <<
+      "database " << filename_ << ".");
+    return false;
+  }
+  return true;
+}
+
+void haloc::MappedDatabaseWriter::Discard() {
+  file_.close();
+  remove((filename_ + ".tmp").c_str());
+  bucket_sums_.clear();
+  occupancy_.clear();
+  ids_.clear();
+}
+
+haloc::MappedDatabase::Params::Params() :
+  num_threads(DEFAULT_NUM_THREADS),
+  min_parallel_size(DEFAULT_MIN_PARALLEL_SIZE)
+{}
+
+haloc::MappedDatabase::MappedDatabase(const Hash& hash) :
+  hash_(hash), data_(NULL), size_(0), header_(NULL), hashes_(NULL),
+  bucket_sums_(NULL), occupancy_(NULL), ids_(NULL), index_(NULL),
+  pool_(new WorkerPool(params_.num_threads)) {}
+
+haloc::MappedDatabase::~MappedDatabase() {
+  Close();
+}
+
+bool haloc::MappedDatabase::Write(const std::string& filename,
+    const Hash& hash, const std::vector<int>& ids,
+    const std::vector< std::vector<float> >& hashes) {
+  if (ids.size() != hashes.size()) {
+    ROS_ERROR("[Haloc:] ERROR -> The ids and the hashes of the database "
+      "must have the same length.");
+    return false;
+  }
+  MappedDatabaseWriter writer(hash);
+  if (!writer.Open(filename)) return false;
+  for (uint i=0; i < hashes.size(); ++i)
+    if (!writer.Append(ids[i], hashes[i])) return false;
+  return writer.Close();
+}
+
+bool haloc::MappedDatabase::Open(const std::string& filename) {
+  Close();
+  if (!hash_.IsInitialized()) {
+    ROS_ERROR("[Haloc:] ERROR -> The hash object must be initialized to "
+      "open a database.");
+    return false;
+  }
+
+  // Map the whole file
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot open the database " <<
+      filename << ".");
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(MappedDatabaseHeader)) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> " << filename << " is not a " <<
+      "database.");
+    close(fd);
+    return false;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot map the database " <<
+      filename << ".");
+    return false;
+  }
+  data_ = static_cast<uint8_t*>(data);
+  size_ = st.st_size;
+  header_ = reinterpret_cast<const MappedDatabaseHeader*>(data_);
+
+  // Format
+  if (memcmp(header_->magic, kDatabaseMagic, sizeof(kDatabaseMagic)) != 0 ||
+      header_->min_version > kDatabaseVersion) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> " << filename << " is not a " <<
+      "database or its format version is not supported.");
+    Close();
+    return false;
+  }
+
+  // Model
+  const Hash::Params params = hash_.GetParams();
+  if (header_->fingerprint != hash_.GetModel()->GetFingerprint() ||
+      header_->bucket_rows != params.bucket_rows ||
+      header_->bucket_cols != params.bucket_cols ||
+      header_->num_proj != params.num_proj ||
+      header_->hash_length != hash_.GetHashLength()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The database " << filename <<
+      " was built with a different hashing model.");
+    Close();
+    return false;
+  }
+
+  // Blocks. Every row takes at least its hash and its occupancy, which
+  // bounds num_rows before the block sizes are computed.
+  const uint64_t num_rows = header_->num_rows;
+  const uint64_t num_buckets = header_->bucket_rows*header_->bucket_cols;
+  const uint64_t row_bytes = static_cast<uint64_t>(header_->hash_stride)*
+    sizeof(float) + sizeof(uint64_t);
+  const uint64_t offsets[] = {header_->hashes_offset, header_->sums_offset,
+    header_->occupancy_offset, header_->ids_offset, header_->index_offset};
+  bool valid = header_->hash_stride >= header_->hash_length &&
+    num_rows <= size_ / row_bytes && num_rows <= INT32_MAX &&
+    header_->hashes_offset % kAlignment == 0 &&
+    header_->sums_offset % sizeof(float) == 0 &&
+    header_->occupancy_offset % sizeof(uint64_t) == 0 &&
+    header_->ids_offset % sizeof(int32_t) == 0 &&
+    header_->index_offset % sizeof(int32_t) == 0;
+  for (uint i=0; i < sizeof(offsets)/sizeof(offsets[0]); ++i)
+    valid = valid && offsets[i] <= size_;
+  if (valid) {
+    const uint64_t ends[] = {
+      header_->hashes_offset + num_rows*header_->hash_stride*sizeof(float),
+      header_->sums_offset + num_rows*num_buckets*sizeof(float),
+      header_->occupancy_offset + num_rows*sizeof(uint64_t),
+      header_->ids_offset + num_rows*sizeof(int32_t),
+      header_->index_offset + 2*num_rows*sizeof(int32_t)};
+    for (uint i=0; i < sizeof(ends)/sizeof(ends[0]); ++i)
+      valid = valid && ends[i] <= size_;
+  }
+
+  // FindRow needs the index sorted by id, and pointing to existing rows
+  const int32_t* index = reinterpret_cast<const int32_t*>(
+    data_ + header_->index_offset);
+  for (uint64_t i=0; valid && i < num_rows; ++i) {
+    valid = index[2*i + 1] >= 0 && index[2*i + 1] < num_rows &&
+      (i == 0 || index[2*(i - 1)] < index[2*i]);
+  }
+  if (!valid) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The database " << filename <<
+      " is corrupted.");
+    Close();
+    return false;
+  }
+  hashes_ = reinterpret_cast<const float*>(data_ + header_->hashes_offset);
+  bucket_sums_ = reinterpret_cast<const float*>(data_ + header_->sums_offset);
+  occupancy_ = reinterpret_cast<const uint64_t*>(
+    data_ + header_->occupancy_offset);
+  ids_ = reinterpret_cast<const int32_t*>(data_ + header_->ids_offset);
+  index_ = reinterpret_cast<const int32_t*>(data_ + header_->index_offset);
+  return true;
+}
+
+void haloc::MappedDatabase::Close() {
+  if (data_ != NULL) munmap(data_, size_);
+  data_ = NULL;
+  size_ = 0;
+  header_ = NULL;
+  hashes_ = NULL;
+  bucket_sums_ = NULL;
+  occupancy_ = NULL;
+  ids_ = NULL;
+  index_ = NULL;
+}
+
+std::vector<int> haloc::MappedDatabase::GetIds() const {
+  if (!IsOpen()) return std::vector<int>();
+  return std::vector<int>(ids_, ids_ + header_->num_rows);
+}
+
+std::vector<float> haloc::MappedDatabase::GetHash(const int& id) const {
+  const int row = FindRow(id);
+  if (row < 0) return std::vector<float>();
+  const float* first = hashes_ + static_cast<size_t>(row)*
+    header_->hash_stride;
+  return std::vector<float>(first, first + header_->hash_length);
+}
+
+std::vector<haloc::Match> haloc::MappedDatabase::Query(
+    const std::vector<float>& hash, const int& k, float eps,
+    const int& query_id, const int& min_neighbor) const {
+  if (Size() == 0 || k <= 0) return std::vector<Match>();
+  if (hash.size() != header_->hash_length) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The query hash length is " <<
+      hash.size() << " and the database expects " << header_->hash_length <<
+      ".");
+    return std::vector<Match>();
+  }
+
+  // Query metadata
+  const int num_buckets = header_->bucket_rows*header_->bucket_cols;
+  std::vector<float> sum(num_buckets);
+  uint64_t occupancy = 0;
+  hash_.SummarizeBuckets(&hash[0], &sum[0], occupancy);
+
+  const auto row_id = [&](const int& row) {return ids_[row];};
+  const auto row_overlap = [&](const int& row) {
+    return hash_.CalcDist(&hash[0], &sum[0], occupancy,
+      hashes_ + static_cast<size_t>(row)*header_->hash_stride,
+      bucket_sums_ + static_cast<size_t>(row)*num_buckets,
+      occupancy_[row], eps, true);
+  };
+  return ScanTopMatches(Size(), k, query_id, min_neighbor, row_id,
+    row_overlap, pool_.get(), params_.min_parallel_size);
+}
+
+int haloc::MappedDatabase::FindRow(const int& id) const {
+  if (!IsOpen()) return -1;
+  int first = 0;
+  int last = header_->num_rows;
+  while (first < last) {
+    const int middle = first + (last - first) / 2;
+    if (index_[2*middle] < id)
+      first = middle + 1;
+    else
+      last = middle;
+  }
+  if (first == header_->num_rows || index_[2*first] != id) return -1;
+  return index_[2*first + 1];
+}
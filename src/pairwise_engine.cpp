@@ -0,0 +1,176 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "libhaloc/pairwise_engine.h"
+
+haloc::PairwiseEngine::Params::Params() :
+  tile_size(DEFAULT_TILE_SIZE),
+  cache_size(DEFAULT_CACHE_SIZE),
+  num_threads(DEFAULT_NUM_THREADS)
+{}
+
+haloc::PairwiseEngine::PairwiseEngine(const Hash& hash) : hash_(hash) {}
+
+int haloc::PairwiseEngine::GetTileSize() const {
+  if (params_.tile_size > 0) return params_.tile_size;
+
+  // The hashes and bucket sums of the rows and the columns of a tile share
+  // the budget. Before the hash object is initialized (a visit with other
+  // data) the tiles are as for a short hash.
+  const Hash::Params params = hash_.GetParams();
+  const int hash_length = hash_.GetHashLength();
+  if (hash_length <= 0) return 64;
+  const int64_t row_bytes = (static_cast<int64_t>(hash_length) +
+    params.bucket_rows*params.bucket_cols)*sizeof(float);
+  return std::max<int64_t>(1, params_.cache_size / (2*row_bytes));
+}
+
+int haloc::PairwiseEngine::GetNumThreads() {
+  if (!pool_) pool_.reset(new WorkerPool(params_.num_threads));
+  return pool_->GetNumThreads();
+}
+
+void haloc::PairwiseEngine::VisitLowerTriangle(const int& size,
+    const int& band, const PairFunction& fn) {
+  const int tile_size = GetTileSize();
+  const int min_gap = std::max(0, band) + 1;
+
+  // Only the tiles with some pair i - j >= min_gap. The first tile of every
+  // row of tiles is numbered, and a tile number is located by bisection.
+  const int num_tile_rows = (size + tile_size - 1) / tile_size;
+  std::vector<int> first_tile(num_tile_rows + 1, 0);
+  for (int t=0; t < num_tile_rows; ++t) {
+    const int last_row = std::min((t + 1)*tile_size, size) - 1;
+    const int num_cols = (last_row < min_gap) ? 0 :
+      (last_row - min_gap) / tile_size + 1;
+    first_tile[t + 1] = first_tile[t] + num_cols;
+  }
+
+  RunTiles(first_tile.back(), [&](int thread, int tile) {
+    const int t = std::upper_bound(first_tile.begin(), first_tile.end(),
+      tile) - first_tile.begin() - 1;
+    const int row = t*tile_size;
+    const int col = (tile - first_tile[t])*tile_size;
+    const int row_end = std::min(row + tile_size, size);
+    for (int i=row; i < row_end; ++i) {
+      // The band is cut out of the column range
+      const int col_end = std::min(col + tile_size, i - min_gap + 1);
+      for (int j=col; j < col_end; ++j) fn(thread, i, j);
+    }
+  });
+}
+
+void haloc::PairwiseEngine::VisitRectangle(const int& rows, const int& cols,
+    const PairFunction& fn) {
+  const int tile_size = GetTileSize();
+  const int num_tile_rows = (rows + tile_size - 1) / tile_size;
+  const int num_tile_cols = (cols + tile_size - 1) / tile_size;
+
+  RunTiles(num_tile_rows*num_tile_cols, [&](int thread, int tile) {
+    const int row = (tile / num_tile_cols)*tile_size;
+    const int col = (tile % num_tile_cols)*tile_size;
+    const int row_end = std::min(row + tile_size, rows);
+    const int col_end = std::min(col + tile_size, cols);
+    for (int i=row; i < row_end; ++i)
+      for (int j=col; j < col_end; ++j) fn(thread, i, j);
+  });
+}
+
+std::vector<haloc::PairMatch> haloc::PairwiseEngine::AllPairs(
+    const std::vector<BucketedHash>& hashes, float eps,
+    const int& min_overlap, const int& band) {
+  return CollectPairs([&](const PairFunction& fn) {
+    VisitLowerTriangle(hashes.size(), band, fn);
+  }, hashes, hashes, eps, min_overlap);
+}
+
+std::vector<haloc::PairMatch> haloc::PairwiseEngine::ManyVsMany(
+    const std::vector<BucketedHash>& queries,
+    const std::vector<BucketedHash>& database, float eps,
+    const int& min_overlap) {
+  return CollectPairs([&](const PairFunction& fn) {
+    VisitRectangle(queries.size(), database.size(), fn);
+  }, queries, database, eps, min_overlap);
+}
+
+void haloc::PairwiseEngine::RunTiles(const int& num_tiles,
+    const std::function<void(int, int)>& fn) {
+  if (num_tiles <= 0) return;
+
+  // Every thread owns a contiguous range of tiles, packed as begin << 32 |
+  // end so it is updated with one compare-and-swap. The owner takes the
+  // tiles from the front and the thieves from the back.
+  const int num_threads = GetNumThreads();
+  std::unique_ptr<std::atomic<uint64_t>[]> ranges(
+    new std::atomic<uint64_t>[num_threads]);
+  for (int t=0; t < num_threads; ++t) {
+    const uint64_t begin = static_cast<uint64_t>(num_tiles)*t / num_threads;
+    const uint64_t end = static_cast<uint64_t>(num_tiles)*(t + 1) /
+      num_threads;
+    ranges[t].store(begin << 32 | end);
+  }
+  const auto take = [&](std::atomic<uint64_t>& range, const bool& front) {
+    uint64_t current = range.load();
+    while (true) {
+      const uint64_t begin = current >> 32;
+      const uint64_t end = current & 0xffffffffULL;
+      if (begin >= end) return -1;
+      const uint64_t next = front ? ((begin + 1) << 32 | end) :
+        (begin << 32 | (end - 1));
+      if (range.compare_exchange_weak(current, next))
+        return static_cast<int>(front ? begin : end - 1);
+    }
+  };
+
+  // One chunk per thread index, so the index is never used by two threads
+  // at the same time
+  pool_->ParallelFor(num_threads, 1, [&](int begin, int end) {
+    for (int t=begin; t < end; ++t) {
+      for (int v=0; v < num_threads; ++v) {
+        std::atomic<uint64_t>& range = ranges[(t + v) % num_threads];
+        for (int tile=take(range, v == 0); tile >= 0;
+            tile=take(range, v == 0))
+          fn(t, tile);
+      }
+    }
+  });
+}
+
+std::vector<haloc::PairMatch> haloc::PairwiseEngine::CollectPairs(
+    const std::function<void(const PairFunction&)>& visit,
+    const std::vector<BucketedHash>& rows,
+    const std::vector<BucketedHash>& cols, float eps,
+    const int& min_overlap) {
+  // Per thread results, merged at the end
+  std::vector< std::vector<PairMatch> > found(GetNumThreads());
+  visit([&](int thread, int i, int j) {
+    int shift;
+    const int overlap = hash_.CalcDist(rows[i], cols[j], eps, shift, true);
+    if (overlap >= min_overlap) found[thread].push_back(
+      PairMatch(i, j, overlap, shift));
+  });
+
+  std::vector<PairMatch> pairs;
+  for (uint t=0; t < found.size(); ++t)
+    pairs.insert(pairs.end(), found[t].begin(), found[t].end());
+  std::sort(pairs.begin(), pairs.end());
+  return pairs;
+}
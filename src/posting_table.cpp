@@ -0,0 +1,81 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "libhaloc/posting_table.h"
+
+void haloc::PostingTable::Add(const uint64_t& key, const int& id,
+    const int& bucket) {
+  Posting posting;
+  posting.id = id;
+  posting.bucket = bucket;
+  lists_[key].push_back(posting);
+}
+
+void haloc::PostingTable::Remove(const uint64_t& key, const int& id) {
+  std::unordered_map<uint64_t, std::vector<Posting> >::iterator it =
+    lists_.find(key);
+  if (it == lists_.end()) return;
+  std::vector<Posting>& list = it->second;
+  for (uint i=0; i < list.size(); ++i) {
+    if (list[i].id != id) continue;
+    list[i] = list.back();
+    list.pop_back();
+    break;
+  }
+  if (list.empty()) lists_.erase(it);
+}
+
+const std::vector<haloc::Posting>* haloc::PostingTable::Find(
+    const uint64_t& key) const {
+  std::unordered_map<uint64_t, std::vector<Posting> >::const_iterator it =
+    lists_.find(key);
+  return (it == lists_.end()) ? NULL : &it->second;
+}
+
+haloc::ShiftVotes::ShiftVotes(const int& num_buckets, const int& query_id,
+    const int& min_neighbor) :
+  num_buckets_(num_buckets), query_id_(query_id),
+  min_neighbor_(min_neighbor) {}
+
+void haloc::ShiftVotes::Vote(const std::vector<Posting>& list,
+    const int& query_bucket) {
+  for (uint p=0; p < list.size(); ++p) {
+    const Posting& posting = list[p];
+
+    // Temporal neighbours are never loop closings
+    if (query_id_ >= 0 && abs(posting.id - query_id_) <= min_neighbor_)
+      continue;
+    std::vector<int>& frame_votes = votes_[posting.id];
+    if (frame_votes.empty()) frame_votes.resize(num_buckets_, 0);
+    frame_votes[(posting.bucket - query_bucket + num_buckets_) %
+      num_buckets_]++;
+  }
+}
+
+std::vector<haloc::Match> haloc::ShiftVotes::BestShifts() const {
+  std::vector<Match> best;
+  best.reserve(votes_.size());
+  for (std::unordered_map<int, std::vector<int> >::const_iterator it =
+      votes_.begin(); it != votes_.end(); ++it) {
+    best.push_back(Match(it->first,
+      *std::max_element(it->second.begin(), it->second.end())));
+  }
+  return best;
+}
@@ -0,0 +1,172 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <algorithm>
+
+#include "libhaloc/pq_database.h"
+
+haloc::PqDatabase::Params::Params() :
+  num_threads(DEFAULT_NUM_THREADS),
+  min_parallel_size(DEFAULT_MIN_PARALLEL_SIZE)
+{}
+
+haloc::PqDatabase::PqDatabase(const Hash& hash,
+    const ProductQuantizer& quantizer) :
+  hash_(hash), quantizer_(quantizer), num_buckets_(0), code_length_(0),
+  table_size_(0), pool_(new WorkerPool(params_.num_threads)) {}
+
+bool haloc::PqDatabase::Add(const int& id, const std::vector<float>& hash) {
+  if (!quantizer_.IsTrained()) {
+    ROS_ERROR("[Haloc:] ERROR -> The product quantizer must be trained "
+      "before adding frames.");
+    return false;
+  }
+
+  // The layout is taken from the codec when the first frame arrives
+  if (ids_.empty()) {
+    const Hash::Params params = hash_.GetParams();
+    num_buckets_ = params.bucket_rows*params.bucket_cols;
+    code_length_ = quantizer_.GetCodeLength();
+    table_size_ = code_length_*quantizer_.GetParams().num_centroids;
+  }
+
+  // Sanity checks
+  const int bucket_length = quantizer_.GetBucketLength();
+  if (hash.size() != num_buckets_*bucket_length ||
+      num_buckets_ > kMaxMaskBuckets) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot add frame " << id << " to " <<
+      "the database: the hash length is " << hash.size() << " and the " <<
+      "database expects " << num_buckets_*bucket_length << " (up to " <<
+      kMaxMaskBuckets << " buckets).");
+    return false;
+  }
+  if (Contains(id)) {
+    ROS_WARN_STREAM("[Haloc:] WARNING -> Frame " << id << " is already in " <<
+      "the database.");
+    return false;
+  }
+
+  // Only the non-empty buckets are encoded, the rest stay at code 0
+  std::vector<float> sum(num_buckets_);
+  uint64_t occupancy = 0;
+  hash_.SummarizeBuckets(&hash[0], &sum[0], occupancy);
+  const int row = ids_.size();
+  codes_.resize((row + 1)*num_buckets_*code_length_, 0);
+  for (int i=0; i < num_buckets_; ++i) {
+    if (!(occupancy & (1ULL << i))) continue;
+    quantizer_.Encode(&hash[i*bucket_length],
+      &codes_[(row*num_buckets_ + i)*code_length_]);
+  }
+  occupancy_.push_back(occupancy);
+  ids_.push_back(id);
+  rows_[id] = row;
+  return true;
+}
+
+bool haloc::PqDatabase::Remove(const int& id) {
+  std::unordered_map<int, int>::iterator it = rows_.find(id);
+  if (it == rows_.end()) return false;
+
+  // Move the last row into the gap to keep the arrays contiguous
+  const int row = it->second;
+  const int last = ids_.size() - 1;
+  const int row_size = num_buckets_*code_length_;
+  if (row != last) {
+    std::copy(codes_.begin() + last*row_size,
+      codes_.begin() + (last + 1)*row_size, codes_.begin() + row*row_size);
+    occupancy_[row] = occupancy_[last];
+    ids_[row] = ids_[last];
+    rows_[ids_[row]] = row;
+  }
+  codes_.resize(last*row_size);
+  occupancy_.pop_back();
+  ids_.pop_back();
+  rows_.erase(id);
+  return true;
+}
+
+void haloc::PqDatabase::Clear() {
+  codes_.clear();
+  occupancy_.clear();
+  ids_.clear();
+  rows_.clear();
+}
+
+std::vector<haloc::Match> haloc::PqDatabase::Query(
+    const std::vector<float>& hash, const int& k, float eps,
+    const int& query_id, const int& min_neighbor) const {
+  if (ids_.empty() || k <= 0) return std::vector<Match>();
+  const int bucket_length = quantizer_.GetBucketLength();
+  if (hash.size() != num_buckets_*bucket_length) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The query hash length is " <<
+      hash.size() << " and the database expects " <<
+      num_buckets_*bucket_length << ".");
+    return std::vector<Match>();
+  }
+
+  // One distance table per non-empty query bucket
+  std::vector<float> sum(num_buckets_);
+  uint64_t occupancy = 0;
+  hash_.SummarizeBuckets(&hash[0], &sum[0], occupancy);
+  std::vector<float> tables(num_buckets_*table_size_, 0.0f);
+  for (int i=0; i < num_buckets_; ++i) {
+    if (!(occupancy & (1ULL << i))) continue;
+    quantizer_.ComputeTable(&hash[i*bucket_length], &tables[i*table_size_]);
+  }
+
+  const auto row_id = [&](const int& row) {return ids_[row];};
+  const auto row_overlap = [&](const int& row) {
+    return CalcDist(tables, occupancy, row, eps);};
+  return ScanTopMatches(ids_.size(), k, query_id, min_neighbor, row_id,
+    row_overlap, pool_.get(), params_.min_parallel_size);
+}
+
+int haloc::PqDatabase::CalcDist(const std::vector<float>& tables,
+    const uint64_t& occupancy_q, const int& row, float eps) const {
+  const uint64_t occupancy = occupancy_[row];
+  const uint8_t* codes = &codes_[row*num_buckets_*code_length_];
+  const int max_overlap = std::min(CountBuckets(occupancy_q),
+    CountBuckets(occupancy));
+  int num_buckets_overlap = 0;
+
+  // Same shifts as Hash::CalcDist, with the bucket distances looked up in
+  // the tables of the query
+  for (int i=0; i < num_buckets_; ++i) {
+    if (num_buckets_overlap == max_overlap) break;
+
+    int comb_overlap = 0;
+    uint64_t pairs = occupancy_q &
+      RotateBucketMask(occupancy, i, num_buckets_);
+    int remaining = CountBuckets(pairs);
+    while (pairs) {
+      if (comb_overlap + remaining <= num_buckets_overlap) break;
+
+      const int idx_q = FirstBucket(pairs);
+      const int idx_f = (idx_q + i) % num_buckets_;
+      pairs &= pairs - 1;
+      remaining--;
+      const float dist = quantizer_.Distance(&tables[idx_q*table_size_],
+        codes + idx_f*code_length_);
+      if (dist <= eps) comb_overlap++;
+    }
+    if (comb_overlap > num_buckets_overlap) {
+      num_buckets_overlap = comb_overlap;
+    }
+  }
+  return num_buckets_overlap;
+}
@@ -0,0 +1,298 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <random>
+
+#include "libhaloc/binary_io.h"
+#include "libhaloc/kernels.h"
+#include "libhaloc/product_quantizer.h"
+
+// Codebook file signature and format version. Files with a newer version are
+// rejected by Load.
+static const char kCodebookMagic[8] = {'H', 'A', 'L', 'O', 'C', 'P', 'Q',
+  'Z'};
+static const uint32_t kCodebookVersion = 1;
+
+haloc::ProductQuantizer::Params::Params() :
+  num_subspaces(DEFAULT_NUM_SUBSPACES), num_centroids(DEFAULT_NUM_CENTROIDS),
+  num_iterations(DEFAULT_NUM_ITERATIONS), seed(DEFAULT_SEED)
+{}
+
+haloc::ProductQuantizer::ProductQuantizer(const Hash& hash) :
+  hash_(hash), trained_(false), bucket_length_(0) {}
+
+bool haloc::ProductQuantizer::Train(
+    const std::vector< std::vector<float> >& hashes) {
+  trained_ = false;
+  const Hash::Params params = hash_.GetParams();
+  const int num_buckets = params.bucket_rows*params.bucket_cols;
+  const int hash_length = hash_.GetHashLength();
+  const int bucket_length = hash_length / num_buckets;
+
+  // Sanity checks
+  if (params_.num_centroids < 1 || params_.num_centroids > 256) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The number of centroids must be " <<
+      "between 1 and 256 (codes are bytes), got " << params_.num_centroids <<
+      ".");
+    return false;
+  }
+  if (params_.num_subspaces < 1 || params_.num_subspaces > bucket_length) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The number of subspaces must be " <<
+      "between 1 and the bucket length (" << bucket_length << "), got " <<
+      params_.num_subspaces << ".");
+    return false;
+  }
+
+  // The training set: all the non-empty buckets
+  std::vector<float> samples;
+  for (uint h=0; h < hashes.size(); ++h) {
+    if (hashes[h].size() != hash_length) continue;
+    for (int i=0; i < num_buckets; ++i) {
+      const float* bucket = &hashes[h][i*bucket_length];
+      if (std::accumulate(bucket, bucket + bucket_length, 0.0) == 0.0)
+        continue;
+      samples.insert(samples.end(), bucket, bucket + bucket_length);
+    }
+  }
+  const int num_samples = samples.size() / std::max(bucket_length, 1);
+  if (num_samples == 0) {
+    ROS_ERROR("[Haloc:] ERROR -> Cannot train the product quantizer: no "
+      "valid buckets.");
+    return false;
+  }
+
+  InitSlices(bucket_length);
+
+  // k-medians on every slice
+  std::mt19937 generator(params_.seed);
+  const int k = params_.num_centroids;
+  centroids_.assign(params_.num_subspaces, AlignedFloatVector());
+  std::vector<int> assignment(num_samples);
+  std::vector<float> values;
+  for (int s=0; s < params_.num_subspaces; ++s) {
+    const int begin = slice_begin_[s];
+    const int length = slice_begin_[s + 1] - begin;
+    AlignedFloatVector& centroids = centroids_[s];
+    centroids.resize(k*length);
+
+    // Random distinct samples as the initial centroids (repeated if there
+    // are less samples than centroids)
+    std::vector<int> order(num_samples);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), generator);
+    for (int c=0; c < k; ++c) {
+      const float* sample = &samples[order[c % num_samples]*bucket_length];
+      std::copy(sample + begin, sample + begin + length,
+        centroids.begin() + c*length);
+    }
+
+    for (int it=0; it < params_.num_iterations; ++it) {
+      // Assignment step
+      bool changed = (it == 0);
+      for (int n=0; n < num_samples; ++n) {
+        const int c = ClosestCentroid(s, &samples[n*bucket_length + begin]);
+        if (c != assignment[n]) changed = true;
+        assignment[n] = c;
+      }
+      if (!changed) break;
+
+      // Update step: the per-coordinate median of every cluster
+      std::vector< std::vector<int> > members(k);
+      for (int n=0; n < num_samples; ++n)
+        members[assignment[n]].push_back(n);
+      for (int c=0; c < k; ++c) {
+        if (members[c].empty()) {
+          // Empty cluster, restart it from a random sample
+          const int n = generator() % num_samples;
+          std::copy(&samples[n*bucket_length + begin],
+            &samples[n*bucket_length + begin] + length,
+            centroids.begin() + c*length);
+          continue;
+        }
+        values.resize(members[c].size());
+        for (int m=0; m < length; ++m) {
+          for (uint j=0; j < members[c].size(); ++j)
+            values[j] = samples[members[c][j]*bucket_length + begin + m];
+          std::vector<float>::iterator middle = values.begin() +
+            values.size()/2;
+          std::nth_element(values.begin(), middle, values.end());
+          centroids[c*length + m] = *middle;
+        }
+      }
+    }
+  }
+  trained_ = true;
+  return true;
+}
+
+bool haloc::ProductQuantizer::Save(const std::string& filename) const {
+  using binary_io::WriteValue;
+  if (!trained_ || !hash_.IsInitialized()) {
+    ROS_ERROR("[Haloc:] ERROR -> The product quantizer must be trained "
+      "before saving its codebooks.");
+    return false;
+  }
+  std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot open " << filename <<
+      " to save the codebooks.");
+    return false;
+  }
+
+  // Header
+  file.write(kCodebookMagic, sizeof(kCodebookMagic));
+  WriteValue<uint32_t>(file, kCodebookVersion);
+  WriteValue<uint64_t>(file, hash_.GetModel()->GetFingerprint());
+  WriteValue<uint32_t>(file, params_.num_subspaces);
+  WriteValue<uint32_t>(file, params_.num_centroids);
+  WriteValue<uint32_t>(file, params_.num_iterations);
+  WriteValue<uint32_t>(file, params_.seed);
+  WriteValue<uint32_t>(file, bucket_length_);
+
+  // Centroids, slice after slice
+  for (uint s=0; s < centroids_.size(); ++s) {
+    binary_io::WriteArray(file, centroids_[s].data(),
+      centroids_[s].size());
+  }
+
+  // The buffered data only reaches the file when it is closed
+  file.close();
+  if (file.fail()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot write the codebooks to " <<
+      filename << ".");
+    return false;
+  }
+  return true;
+}
+
+bool haloc::ProductQuantizer::Load(const std::string& filename) {
+  using binary_io::ReadValue;
+  trained_ = false;
+  if (!hash_.IsInitialized()) {
+    ROS_ERROR("[Haloc:] ERROR -> The hash object must be initialized "
+      "before loading the codebooks.");
+    return false;
+  }
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  if (!file.is_open()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot open the codebooks " <<
+      filename << ".");
+    return false;
+  }
+
+  // Header
+  char magic[sizeof(kCodebookMagic)];
+  file.read(magic, sizeof(magic));
+  const uint32_t version = ReadValue<uint32_t>(file);
+  if (!file.good() || memcmp(magic, kCodebookMagic, sizeof(magic)) != 0 ||
+      version == 0 || version > kCodebookVersion) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> " << filename << " is not a " <<
+      "codebook file or its format version is not supported.");
+    return false;
+  }
+  const uint64_t fingerprint = ReadValue<uint64_t>(file);
+  Params params;
+  params.num_subspaces = ReadValue<uint32_t>(file);
+  params.num_centroids = ReadValue<uint32_t>(file);
+  params.num_iterations = ReadValue<uint32_t>(file);
+  params.seed = ReadValue<uint32_t>(file);
+  const int bucket_length = ReadValue<uint32_t>(file);
+  if (fingerprint != hash_.GetModel()->GetFingerprint()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The codebooks " << filename <<
+      " were trained for another hash model.");
+    return false;
+  }
+
+  // The layout must be the one Train builds, and the file must hold all the
+  // centroids before they are allocated
+  const Hash::Params hash_params = hash_.GetParams();
+  const int num_buckets = hash_params.bucket_rows*hash_params.bucket_cols;
+  if (!file.good() || params.num_centroids < 1 ||
+      params.num_centroids > 256 || params.num_subspaces < 1 ||
+      params.num_subspaces > bucket_length ||
+      bucket_length != hash_.GetHashLength() / num_buckets ||
+      binary_io::Remaining(file) != static_cast<uint64_t>(
+        params.num_centroids)*bucket_length*sizeof(float)) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The codebooks " << filename <<
+      " are corrupted or truncated.");
+    return false;
+  }
+
+  // Centroids
+  params_ = params;
+  InitSlices(bucket_length);
+  centroids_.assign(params_.num_subspaces, AlignedFloatVector());
+  for (int s=0; s < params_.num_subspaces; ++s) {
+    const int length = slice_begin_[s + 1] - slice_begin_[s];
+    centroids_[s].resize(params_.num_centroids*length);
+    binary_io::ReadArray(file, centroids_[s].data(), centroids_[s].size());
+  }
+  if (!file.good()) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The codebooks " << filename <<
+      " are truncated.");
+    return false;
+  }
+  trained_ = true;
+  return true;
+}
+
+void haloc::ProductQuantizer::Encode(const float* bucket,
+    uint8_t* code) const {
+  for (int s=0; s < params_.num_subspaces; ++s)
+    code[s] = ClosestCentroid(s, bucket + slice_begin_[s]);
+}
+
+void haloc::ProductQuantizer::ComputeTable(const float* bucket,
+    float* table) const {
+  for (int s=0; s < params_.num_subspaces; ++s) {
+    const int length = slice_begin_[s + 1] - slice_begin_[s];
+    const float* slice = bucket + slice_begin_[s];
+    for (int c=0; c < params_.num_centroids; ++c) {
+      table[s*params_.num_centroids + c] = kernels::L1Distance(slice,
+        &centroids_[s][c*length], length);
+    }
+  }
+}
+
+void haloc::ProductQuantizer::InitSlices(const int& bucket_length) {
+  bucket_length_ = bucket_length;
+  slice_begin_.resize(params_.num_subspaces + 1);
+  for (int s=0; s <= params_.num_subspaces; ++s)
+    slice_begin_[s] = s*bucket_length / params_.num_subspaces;
+}
+
+int haloc::ProductQuantizer::ClosestCentroid(const int& s,
+    const float* slice) const {
+  const int length = slice_begin_[s + 1] - slice_begin_[s];
+  int best = 0;
+  float best_dist = std::numeric_limits<float>::infinity();
+  for (int c=0; c < params_.num_centroids; ++c) {
+    const float dist = kernels::L1DistanceBounded(slice,
+      &centroids_[s][c*length], length, best_dist);
+    if (dist < best_dist) {
+      best_dist = dist;
+      best = c;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,149 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ros/ros.h>
+
+#include <algorithm>
+
+#include "libhaloc/quantized_database.h"
+
+haloc::QuantizedDatabase::Params::Params() :
+  num_threads(DEFAULT_NUM_THREADS),
+  min_parallel_size(DEFAULT_MIN_PARALLEL_SIZE),
+  rerank_size(DEFAULT_RERANK_SIZE)
+{}
+
+haloc::QuantizedDatabase::QuantizedDatabase(const Hash& hash) :
+  hash_(hash), hash_length_(0), code_stride_(0), num_buckets_(0),
+  float_db_(hash), pool_(new WorkerPool(params_.num_threads)) {
+  // The float hashes are only reranked, which is serial
+  HashDatabase::Params float_params;
+  float_params.num_threads = 1;
+  float_db_.SetParams(float_params);
+}
+
+bool haloc::QuantizedDatabase::Add(const int& id,
+    const std::vector<float>& hash) {
+  if (!hash_.IsQuantizationCalibrated()) {
+    ROS_ERROR("[Haloc:] ERROR -> The quantization of the hash object must "
+      "be calibrated before adding frames.");
+    return false;
+  }
+
+  // The layout is taken from the hash object when the first hash arrives
+  if (ids_.empty()) {
+    const Hash::Params params = hash_.GetParams();
+    hash_length_ = hash_.GetHashLength();
+    code_stride_ = AlignedByteStride(hash_length_);
+    num_buckets_ = params.bucket_rows*params.bucket_cols;
+  }
+
+  // Sanity checks
+  if (hash.size() != hash_length_ || hash_length_ == 0) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> Cannot add frame " << id << " to " <<
+      "the database: the hash length is " << hash.size() << " and the " <<
+      "database expects " << hash_length_ << ".");
+    return false;
+  }
+  if (Contains(id)) {
+    ROS_WARN_STREAM("[Haloc:] WARNING -> Frame " << id << " is already in " <<
+      "the database.");
+    return false;
+  }
+  const QuantizedHash quantized = hash_.Quantize(hash);
+  if (quantized.code.empty()) return false;
+  if (params_.rerank_size > 0 && !float_db_.Add(id, hash)) return false;
+
+  // Append a new row to every array
+  const int row = ids_.size();
+  codes_.resize((row + 1)*code_stride_, 0);
+  std::copy(quantized.code.begin(), quantized.code.end(),
+    codes_.begin() + row*code_stride_);
+  bucket_sums_.insert(bucket_sums_.end(), quantized.bucket_sum.begin(),
+    quantized.bucket_sum.end());
+  occupancy_.push_back(quantized.occupancy);
+  ids_.push_back(id);
+  rows_[id] = row;
+  return true;
+}
+
+bool haloc::QuantizedDatabase::Remove(const int& id) {
+  std::unordered_map<int, int>::iterator it = rows_.find(id);
+  if (it == rows_.end()) return false;
+  if (params_.rerank_size > 0) float_db_.Remove(id);
+
+  // Move the last row into the gap to keep the arrays contiguous
+  const int row = it->second;
+  const int last = ids_.size() - 1;
+  if (row != last) {
+    std::copy(codes_.begin() + last*code_stride_,
+      codes_.begin() + (last + 1)*code_stride_,
+      codes_.begin() + row*code_stride_);
+    std::copy(bucket_sums_.begin() + last*num_buckets_,
+      bucket_sums_.begin() + (last + 1)*num_buckets_,
+      bucket_sums_.begin() + row*num_buckets_);
+    occupancy_[row] = occupancy_[last];
+    ids_[row] = ids_[last];
+    rows_[ids_[row]] = row;
+  }
+  codes_.resize(last*code_stride_);
+  bucket_sums_.resize(last*num_buckets_);
+  occupancy_.pop_back();
+  ids_.pop_back();
+  rows_.erase(id);
+  return true;
+}
+
+void haloc::QuantizedDatabase::Clear() {
+  codes_.clear();
+  bucket_sums_.clear();
+  occupancy_.clear();
+  ids_.clear();
+  rows_.clear();
+  float_db_.Clear();
+}
+
+std::vector<haloc::Match> haloc::QuantizedDatabase::Query(
+    const std::vector<float>& hash, const int& k, float eps,
+    const int& query_id, const int& min_neighbor) const {
+  if (ids_.empty() || k <= 0) return std::vector<Match>();
+  if (hash.size() != hash_length_) {
+    ROS_ERROR_STREAM("[Haloc:] ERROR -> The query hash length is " <<
+      hash.size() << " and the database expects " << hash_length_ << ".");
+    return std::vector<Match>();
+  }
+  const QuantizedHash query = hash_.Quantize(hash);
+  if (query.code.empty()) return std::vector<Match>();
+
+  // With rerank, the quantized scan only preselects the candidates
+  const bool rerank = params_.rerank_size > 0;
+  const int scan_k = rerank ? std::max(k, params_.rerank_size) : k;
+  const auto row_id = [&](const int& row) {return ids_[row];};
+  const auto row_overlap = [&](const int& row) {
+    return hash_.CalcDist(&query.code[0], &query.bucket_sum[0],
+      query.occupancy, &codes_[row*code_stride_],
+      &bucket_sums_[row*num_buckets_], occupancy_[row], eps, true);
+  };
+  const std::vector<Match> matches = ScanTopMatches(ids_.size(), scan_k,
+    query_id, min_neighbor, row_id, row_overlap, pool_.get(),
+    params_.min_parallel_size);
+  if (!rerank) return matches;
+
+  // Exact verification
+  std::vector<int> candidates(matches.size());
+  for (uint i=0; i < matches.size(); ++i) candidates[i] = matches[i].id;
+  return float_db_.Rerank(hash, candidates, k, eps, query_id, min_neighbor);
+}
@@ -0,0 +1,112 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+
+#include "libhaloc/worker_pool.h"
+
+haloc::WorkerPool::WorkerPool(int num_threads) :
+  job_(NULL), job_size_(0), job_grain_(1), next_(0), pending_(0),
+  generation_(0), stop_(false) {
+  if (num_threads <= 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  // The calling thread also works, so we only need num_threads - 1 workers
+  for (int i=1; i < num_threads; ++i)
+    workers_.push_back(std::thread(&WorkerPool::WorkerLoop, this));
+}
+
+haloc::WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  job_cv_.notify_all();
+  for (uint i=0; i < workers_.size(); ++i)
+    workers_[i].join();
+}
+
+void haloc::WorkerPool::ParallelFor(const int& size, const int& grain,
+    const std::function<void(int, int)>& fn) {
+  if (size <= 0) return;
+  const int chunk = std::max(1, grain);
+
+  // Nothing to share
+  if (workers_.empty() || size <= chunk) {
+    fn(0, size);
+    return;
+  }
+
+  std::lock_guard<std::mutex> run_lock(run_mutex_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    job_ = &fn;
+    job_size_ = size;
+    job_grain_ = chunk;
+    next_ = 0;
+    pending_ = workers_.size();
+    generation_++;
+  }
+  job_cv_.notify_all();
+
+  // Work in the calling thread too
+  RunChunks();
+
+  // Wait for the workers, even if the job failed, since they still use it
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] {return pending_ == 0;});
+    job_ = NULL;
+    error = error_;
+    error_ = NULL;
+  }
+  if (error) std::rethrow_exception(error);
+}
+
+void haloc::WorkerPool::WorkerLoop() {
+  unsigned long seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_cv_.wait(lock, [&] {return stop_ || generation_ != seen;});
+      if (stop_) return;
+      seen = generation_;
+    }
+
+    RunChunks();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0) done_cv_.notify_one();
+    }
+  }
+}
+
+void haloc::WorkerPool::RunChunks() {
+  try {
+    while (true) {
+      int begin = next_.fetch_add(job_grain_);
+      if (begin >= job_size_) break;
+      (*job_)(begin, std::min(begin + job_grain_, job_size_));
+    }
+  } catch (...) {
+    // The other threads stop taking chunks
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_) error_ = std::current_exception();
+    next_ = job_size_;
+  }
+}
@@ -0,0 +1,162 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "libhaloc/candidate_file.h"
+
+namespace {
+
+class CandidateFileTest : public testing::Test {
+ protected:
+  void SetUp() {
+    filename_ = testing::TempDir() + "haloc_test.cnd";
+    std::remove(filename_.c_str());
+  }
+
+  void TearDown() {
+    std::remove(filename_.c_str());
+  }
+
+  // Writes 10 pairs (i, i / 2) with overlap i % 5 and shift i % 3, in blocks
+  // of 3, keeping the overlaps >= 2
+  void WritePairs() {
+    haloc::CandidateWriter::Params params;
+    params.min_overlap = 2;
+    params.buffer_size = 3;
+    haloc::CandidateWriter writer(params);
+    ASSERT_TRUE(writer.Open(filename_, 10, 8, 0.5));
+    for (int i=0; i < 10; ++i)
+      ASSERT_TRUE(writer.Append(haloc::PairMatch(i, i / 2, i % 5, i % 3)));
+    ASSERT_TRUE(writer.Close());
+  }
+
+  std::string ReadFile() {
+    std::ifstream file(filename_.c_str(), std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)),
+      std::istreambuf_iterator<char>());
+  }
+
+  void WriteFile(const std::string& bytes) {
+    std::ofstream file(filename_.c_str(), std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), bytes.size());
+  }
+
+  std::string filename_;
+};
+
+TEST_F(CandidateFileTest, RoundTripThroughTheMatrix) {
+  haloc::CandidateWriter::Params params;
+  params.min_overlap = 2;
+  params.buffer_size = 2;
+  haloc::CandidateWriter writer(params);
+  ASSERT_TRUE(writer.Open(filename_, 6, 5, 0.8));
+  std::vector<haloc::PairMatch> pairs;
+  pairs.push_back(haloc::PairMatch(5, 4, 12, 7));
+  pairs.push_back(haloc::PairMatch(3, 1, 1, 2));   // Below min_overlap
+  pairs.push_back(haloc::PairMatch(2, 0, 4, 0));   // Explicit shift 0
+  pairs.push_back(haloc::PairMatch(4, 2, 3, -1));  // Unknown shift
+  ASSERT_TRUE(writer.Append(pairs));
+  ASSERT_TRUE(writer.Append(haloc::PairMatch(5, 4, 9, 3)));  // Rewritten
+  EXPECT_EQ(writer.Size(), 4u);
+  ASSERT_TRUE(writer.Close());
+
+  haloc::CandidateReader reader;
+  ASSERT_TRUE(reader.Open(filename_));
+  EXPECT_EQ(reader.Size(), 4u);
+  EXPECT_EQ(reader.GetHeader().num_rows, 6u);
+  EXPECT_EQ(reader.GetHeader().num_cols, 5u);
+  EXPECT_EQ(reader.GetHeader().eps, 0.8f);
+  Eigen::SparseMatrix<int> overlap, shift;
+  ASSERT_TRUE(reader.ReadMatrix(overlap, &shift));
+  ASSERT_EQ(overlap.rows(), 6);
+  ASSERT_EQ(overlap.cols(), 5);
+  EXPECT_EQ(overlap.nonZeros(), 3);
+  EXPECT_EQ(shift.nonZeros(), 3);
+  EXPECT_EQ(overlap.coeff(5, 4), 9);
+  EXPECT_EQ(shift.coeff(5, 4), 3);
+  EXPECT_EQ(overlap.coeff(2, 0), 4);
+  EXPECT_EQ(overlap.coeff(4, 2), 3);
+  EXPECT_EQ(shift.coeff(4, 2), -1);
+  EXPECT_EQ(overlap.coeff(3, 1), 0);
+
+  // Shift 0 is stored, not dropped as a zero
+  bool found = false;
+  for (Eigen::SparseMatrix<int>::InnerIterator it(shift, 0); it; ++it)
+    if (it.row() == 2) found = (it.value() == 0);
+  EXPECT_TRUE(found);
+}
+
+TEST_F(CandidateFileTest, ReadsAnUnfinishedFile) {
+  WritePairs();
+  std::string bytes = ReadFile();
+  haloc::CandidateFileHeader header;
+  std::copy(bytes.begin(), bytes.begin() + sizeof(header),
+    reinterpret_cast<char*>(&header));
+  ASSERT_EQ(header.num_records, 6u);
+
+  // The count was never written and the last record is half written
+  header.num_records = haloc::CandidateFileHeader::kUnfinished;
+  std::copy(reinterpret_cast<const char*>(&header),
+    reinterpret_cast<const char*>(&header) + sizeof(header), bytes.begin());
+  bytes.append(sizeof(haloc::CandidateRecord) / 2, '\0');
+  WriteFile(bytes);
+
+  haloc::CandidateReader reader;
+  ASSERT_TRUE(reader.Open(filename_));
+  EXPECT_EQ(reader.Size(), 6u);
+  haloc::PairMatch pair;
+  int count = 0;
+  while (reader.Next(pair)) {
+    EXPECT_GE(pair.overlap, 2);
+    EXPECT_EQ(pair.j, pair.i / 2);
+    EXPECT_EQ(pair.overlap, pair.i % 5);
+    EXPECT_EQ(pair.shift, pair.i % 3);
+    count++;
+  }
+  EXPECT_EQ(count, 6);
+}
+
+TEST_F(CandidateFileTest, ReadsATruncatedFile) {
+  WritePairs();
+  const std::string bytes = ReadFile();
+  WriteFile(bytes.substr(0, bytes.size() - 3*sizeof(haloc::CandidateRecord) /
+    2));
+  haloc::CandidateReader reader;
+  ASSERT_TRUE(reader.Open(filename_));
+  EXPECT_EQ(reader.Size(), 4u);
+  Eigen::SparseMatrix<int> overlap;
+  ASSERT_TRUE(reader.ReadMatrix(overlap));
+  EXPECT_EQ(overlap.nonZeros(), 4);
+
+  // Not even a header
+  WriteFile(bytes.substr(0, sizeof(haloc::CandidateFileHeader) - 1));
+  EXPECT_FALSE(reader.Open(filename_));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
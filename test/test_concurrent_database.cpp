@@ -0,0 +1,193 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "libhaloc/concurrent_database.h"
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+
+namespace {
+
+// Groups of similar random frames
+std::vector< std::vector<float> > RandomHashes(haloc::Hash& hash,
+    const int& num_frames) {
+  std::mt19937 generator(12);
+  std::uniform_real_distribution<float> x(0.0, 639.0), y(0.0, 479.0);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  std::normal_distribution<float> noise(0.0, 0.02);
+  std::vector<cv::KeyPoint> kp(200);
+  cv::Mat base(200, 64, CV_32F), desc(200, 64, CV_32F);
+  std::vector< std::vector<float> > hashes;
+  for (int i=0; i < num_frames; ++i) {
+    if (i % 7 == 0) {
+      for (int k=0; k < base.rows; ++k) {
+        kp[k].pt.x = x(generator);
+        kp[k].pt.y = y(generator);
+        kp[k].response = uniform(generator);
+        for (int c=0; c < base.cols; ++c)
+          base.at<float>(k, c) = 0.4*uniform(generator) - 0.2;
+      }
+    }
+    for (int k=0; k < desc.rows; ++k) {
+      for (int c=0; c < desc.cols; ++c)
+        desc.at<float>(k, c) = base.at<float>(k, c) + noise(generator);
+    }
+    hashes.push_back(hash.GetHash(kp, desc, cv::Size(640, 480)));
+  }
+  return hashes;
+}
+
+// Run it under ThreadSanitizer (-fsanitize=thread) to check the publication
+// of the rows and the tombstones
+TEST(ConcurrentDatabase, QueriesWhileWriting) {
+  haloc::Hash hash;
+  const int num_frames = 400;
+  const std::vector< std::vector<float> > hashes = RandomHashes(hash,
+    num_frames);
+  haloc::ConcurrentDatabase::Params params;
+  params.segment_size = 37;
+  haloc::ConcurrentDatabase concurrent(hash, params);
+  haloc::HashDatabase reference(hash);
+  const float eps = 0.8;
+  const int min_neighbor = 3;
+
+  // Readers query while the writer adds and removes frames
+  std::atomic<bool> done(false);
+  std::atomic<int> num_excluded(0);
+  std::vector<std::thread> readers;
+  for (int t=0; t < 3; ++t) {
+    readers.push_back(std::thread([&, t]() {
+      for (int q=t; !done; q += 7) {
+        const int id = q % num_frames;
+        const std::vector<haloc::Match> matches = concurrent.Query(
+          hashes[id], 5, eps, id, min_neighbor);
+        for (uint m=0; m < matches.size(); ++m)
+          if (abs(matches[m].id - id) <= min_neighbor) num_excluded++;
+      }
+    }));
+  }
+  for (int i=0; i < num_frames; ++i) {
+    concurrent.Add(i, hashes[i]);
+    reference.Add(i, hashes[i]);
+    if (i % 10 == 9) {
+      concurrent.Remove(i - 5);
+      reference.Remove(i - 5);
+    }
+  }
+  done = true;
+  for (uint t=0; t < readers.size(); ++t) readers[t].join();
+  EXPECT_EQ(num_excluded, 0);
+
+  // Once the writer is done the results are the ones of HashDatabase
+  EXPECT_EQ(concurrent.Size(), reference.Size());
+  for (int q=0; q < num_frames; q += 3) {
+    const std::vector<haloc::Match> expected = reference.Query(hashes[q], 5,
+      eps, q, min_neighbor);
+    const std::vector<haloc::Match> result = concurrent.Query(hashes[q], 5,
+      eps, q, min_neighbor);
+    ASSERT_EQ(result.size(), expected.size()) << "query " << q;
+    for (uint m=0; m < result.size(); ++m) {
+      EXPECT_EQ(result[m].id, expected[m].id) << "query " << q;
+      EXPECT_EQ(result[m].overlap, expected[m].overlap) << "query " << q;
+    }
+  }
+}
+
+// Frames are removed and added again many more times than the capacity, so
+// the tombstones must be reclaimed, and the retired segments are freed once
+// the readers are done with them
+TEST(ConcurrentDatabase, ReclaimsRemovedRows) {
+  haloc::Hash hash;
+  const int num_frames = 120;
+  const std::vector< std::vector<float> > hashes = RandomHashes(hash,
+    num_frames);
+  haloc::ConcurrentDatabase::Params params;
+  params.segment_size = 16;
+  params.max_segments = 6;
+  haloc::ConcurrentDatabase concurrent(hash, params);
+  haloc::HashDatabase reference(hash);
+  const float eps = 0.8;
+
+  std::atomic<bool> done(false);
+  std::atomic<int> num_duplicates(0);
+  std::vector<std::thread> readers;
+  for (int t=0; t < 2; ++t) {
+    readers.push_back(std::thread([&, t]() {
+      for (int q=t; !done; q += 5) {
+        const std::vector<haloc::Match> matches = concurrent.Query(
+          hashes[q % num_frames], 20, eps);
+        for (uint m=0; m < matches.size(); ++m) {
+          for (uint n=m + 1; n < matches.size(); ++n)
+            if (matches[m].id == matches[n].id) num_duplicates++;
+        }
+      }
+    }));
+  }
+
+  // A window of 60 frames slides over the sequence 10 times: 1200 additions
+  // in a database of 96 rows
+  const int window = 60;
+  for (int i=0; i < 10*num_frames; ++i) {
+    const int id = i % num_frames;
+    if (i >= window) {
+      const int old_id = (i - window) % num_frames;
+      ASSERT_TRUE(concurrent.Remove(old_id));
+      reference.Remove(old_id);
+    }
+    ASSERT_TRUE(concurrent.Add(id, hashes[id])) << "addition " << i;
+    reference.Add(id, hashes[id]);
+    EXPECT_LE(concurrent.GetNumSegments(), params.max_segments);
+  }
+  done = true;
+  for (uint t=0; t < readers.size(); ++t) readers[t].join();
+  EXPECT_EQ(num_duplicates, 0);
+
+  // Without readers the retired segments are freed by the next writes
+  for (int i=0; i < 4 && concurrent.GetNumRetiredSegments() > 0; ++i) {
+    const int id = (10*num_frames - window + i) % num_frames;
+    concurrent.Remove(id);
+    concurrent.Add(id, hashes[id]);
+    reference.Remove(id);
+    reference.Add(id, hashes[id]);
+  }
+  EXPECT_EQ(concurrent.GetNumRetiredSegments(), 0);
+
+  EXPECT_EQ(concurrent.Size(), reference.Size());
+  for (int q=0; q < num_frames; q += 3) {
+    const std::vector<haloc::Match> expected = reference.Query(hashes[q], 5,
+      eps);
+    const std::vector<haloc::Match> result = concurrent.Query(hashes[q], 5,
+      eps);
+    ASSERT_EQ(result.size(), expected.size()) << "query " << q;
+    for (uint m=0; m < result.size(); ++m) {
+      EXPECT_EQ(result[m].id, expected[m].id) << "query " << q;
+      EXPECT_EQ(result[m].overlap, expected[m].overlap) << "query " << q;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,399 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_context.h"
+#include "libhaloc/kernels.h"
+
+// Counts the heap allocations of the whole test program
+static std::atomic<long> g_num_allocations(0);
+
+void* operator new(size_t size) {
+  g_num_allocations++;
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+namespace {
+
+/**
+ * @brief      The keypoints and float descriptors of a synthetic image.
+ */
+struct Frame {
+  std::vector<cv::KeyPoint> kp;
+  cv::Mat desc;
+  cv::Size size;
+};
+
+Frame RandomFrame(std::mt19937& generator, const int& num_kp,
+    const int& desc_length) {
+  std::uniform_real_distribution<float> x(0.0, 639.0), y(0.0, 479.0);
+  std::uniform_real_distribution<float> response(0.0, 1.0);
+  std::uniform_real_distribution<float> value(-0.2, 0.2);
+  Frame frame;
+  frame.size = cv::Size(640, 480);
+  frame.desc.create(num_kp, desc_length, CV_32F);
+  for (int i=0; i < num_kp; ++i) {
+    cv::KeyPoint kp;
+    kp.pt.x = x(generator);
+    kp.pt.y = y(generator);
+    kp.response = response(generator);
+    frame.kp.push_back(kp);
+    for (int c=0; c < desc_length; ++c)
+      frame.desc.at<float>(i, c) = value(generator);
+  }
+  return frame;
+}
+
+// Same scene with noisy descriptors and some lost keypoints
+Frame Perturb(std::mt19937& generator, const Frame& frame,
+    const float& noise) {
+  std::normal_distribution<float> normal(0.0, noise);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  Frame out = frame;
+  out.desc = frame.desc.clone();
+  for (int i=0; i < out.desc.rows; ++i) {
+    for (int c=0; c < out.desc.cols; ++c)
+      out.desc.at<float>(i, c) += normal(generator);
+    if (uniform(generator) < 0.1) out.kp[i].response = -1.0;
+  }
+  return out;
+}
+
+// Groups of similar frames, so the overlaps take every value
+std::vector<Frame> RandomSequence(std::mt19937& generator,
+    const int& num_frames) {
+  std::vector<Frame> frames;
+  Frame base;
+  for (int i=0; i < num_frames; ++i) {
+    if (i % 7 == 0) base = RandomFrame(generator, 200, 64);
+    frames.push_back(Perturb(generator, base, 0.01*(1 + i % 3)));
+  }
+  return frames;
+}
+
+/**
+ * @brief      Reference hash with the original bucketing: the keypoints of
+ *             every bucket are copied, sorted by response and their
+ *             descriptors projected bucket by bucket with the scalar kernel.
+ */
+std::vector<float> ReferenceHash(const haloc::HashModel& model,
+    const Frame& frame) {
+  const haloc::HashModel::Params params = model.GetParams();
+  const std::vector< std::vector<float> >& vectors = model.GetProjections();
+  const int r_stride = vectors[0].size();
+  std::vector<float> r;
+  for (uint p=0; p < vectors.size(); ++p)
+    r.insert(r.end(), vectors[p].begin(), vectors[p].end());
+  const int num_buckets = params.bucket_rows*params.bucket_cols;
+  const int max_per_bucket = params.max_desc / num_buckets;
+  const int desc_length = frame.desc.cols;
+  const float bucket_width = frame.size.width / params.bucket_cols;
+  const float bucket_height = frame.size.height / params.bucket_rows;
+
+  std::vector< std::vector<int> > buckets(num_buckets);
+  for (uint i=0; i < frame.kp.size(); ++i) {
+    int u = floor(frame.kp[i].pt.x / bucket_width);
+    int v = floor(frame.kp[i].pt.y / bucket_height);
+    u = std::max(0, std::min(u, params.bucket_cols - 1));
+    v = std::max(0, std::min(v, params.bucket_rows - 1));
+    buckets[v*params.bucket_cols + u].push_back(i);
+  }
+
+  std::vector<float> hash(model.GetHashLength(), 0.0);
+  for (int b=0; b < num_buckets; ++b) {
+    std::vector<int>& ids = buckets[b];
+    std::stable_sort(ids.begin(), ids.end(), [&](const int& i, const int& j) {
+      return frame.kp[i].response > frame.kp[j].response;});
+    ids.resize(std::min<int>(ids.size(), max_per_bucket));
+    const int rows = ids.size();
+    if (rows == 0 || rows < static_cast<int>(0.7*max_per_bucket)) continue;
+    std::vector<float> x(rows*desc_length);
+    for (int m=0; m < rows; ++m) {
+      for (int c=0; c < desc_length; ++c)
+        x[m*desc_length + c] = frame.desc.at<float>(ids[m], c);
+    }
+    std::vector<float> projected(params.num_proj*desc_length);
+    haloc::kernels::ProjectScalar(r.data(), r_stride, params.num_proj,
+      x.data(), rows, desc_length, projected.data());
+    const float scale = 0.5 / static_cast<float>(rows);
+    for (uint n=0; n < projected.size(); ++n)
+      hash[b*projected.size() + n] = 0.5 + scale*projected[n];
+  }
+  return hash;
+}
+
+TEST(Hash, PrunedCalcDistIsExhaustive) {
+  std::mt19937 generator(7);
+  haloc::Hash hash;
+  const std::vector<Frame> frames = RandomSequence(generator, 60);
+  std::vector< std::vector<float> > hashes;
+  std::vector<haloc::BucketedHash> bucketed;
+  for (uint i=0; i < frames.size(); ++i) {
+    hashes.push_back(hash.GetHash(frames[i].kp, frames[i].desc,
+      frames[i].size));
+    bucketed.push_back(hash.BuildBucketedHash(hashes.back()));
+  }
+
+  int num_overlapping = 0;
+  for (float eps=0.05; eps < 1.0; eps += 0.1) {
+    for (uint i=0; i < hashes.size(); ++i) {
+      for (uint j=0; j < i; ++j) {
+        const int expected = hash.CalcDist(hashes[i], hashes[j], eps, false);
+        EXPECT_EQ(hash.CalcDist(hashes[i], hashes[j], eps, true), expected);
+        EXPECT_EQ(hash.CalcDist(bucketed[i], bucketed[j], eps, false),
+          expected);
+        EXPECT_EQ(hash.CalcDist(bucketed[i], bucketed[j], eps, true),
+          expected);
+        int shift = 0, pruned_shift = 0;
+        hash.CalcDist(bucketed[i], bucketed[j], eps, shift, false);
+        EXPECT_EQ(hash.CalcDist(bucketed[i], bucketed[j], eps, pruned_shift,
+          true), expected);
+        EXPECT_EQ(pruned_shift, shift);
+        if (expected > 0) num_overlapping++;
+      }
+    }
+  }
+  EXPECT_GT(num_overlapping, 0);
+}
+
+TEST(Hash, BucketingMatchesReference) {
+  std::mt19937 generator(9);
+  haloc::Hash hash;
+  Frame first = RandomFrame(generator, 300, 64);
+  hash.GetHash(first.kp, first.desc, first.size);
+
+  for (int i=0; i < 30; ++i) {
+    Frame frame = RandomFrame(generator, 50 + generator() % 300, 64);
+
+    // Some keypoints out of the image and some equal responses
+    frame.kp[0].pt.x = -5.0;
+    frame.kp[1].pt.y = 900.0;
+    frame.kp[3].response = frame.kp[2].response;
+    const std::vector<float> expected = ReferenceHash(*hash.GetModel(),
+      frame);
+    const std::vector<float> result = hash.GetHash(frame.kp, frame.desc,
+      frame.size);
+    ASSERT_EQ(result.size(), expected.size());
+    for (uint n=0; n < result.size(); ++n)
+      ASSERT_EQ(result[n], expected[n]) << "frame " << i << ", element " << n;
+  }
+}
+
+TEST(Hash, GetHashDoesNotAllocate) {
+  std::mt19937 generator(9);
+  haloc::Hash hash;
+  std::vector<Frame> frames;
+  for (int i=0; i < 20; ++i)
+    frames.push_back(RandomFrame(generator, 150 + 5*i, 64));
+
+  // Warm up the scratch buffers with the largest image
+  std::vector<float> out;
+  for (uint i=0; i < frames.size(); ++i)
+    hash.GetHash(frames[i].kp, frames[i].desc, frames[i].size, out);
+  std::vector<float> buffer(hash.GetHashLength());
+
+  const long before = g_num_allocations;
+  for (int rep=0; rep < 5; ++rep) {
+    for (uint i=0; i < frames.size(); ++i) {
+      ASSERT_TRUE(hash.GetHash(frames[i].kp, frames[i].desc, frames[i].size,
+        out));
+      ASSERT_TRUE(hash.GetHash(frames[i].kp, frames[i].desc, frames[i].size,
+        buffer.data(), buffer.size()));
+    }
+  }
+  EXPECT_EQ(g_num_allocations - before, 0);
+  EXPECT_EQ(buffer, hash.GetHash(frames.back().kp, frames.back().desc,
+    frames.back().size));
+}
+
+TEST(Hash, ContextsShareTheModel) {
+  std::mt19937 generator(9);
+  haloc::Hash hash;
+  std::vector<Frame> frames;
+  std::vector< std::vector<float> > expected;
+  for (int i=0; i < 40; ++i) {
+    frames.push_back(RandomFrame(generator, 100 + 7*i, 64));
+    expected.push_back(hash.GetHash(frames[i].kp, frames[i].desc,
+      frames[i].size));
+  }
+
+  // Several threads hash against the same model with their own contexts
+  const std::shared_ptr<const haloc::HashModel> model = hash.GetModel();
+  const int num_threads = 4;
+  std::atomic<int> num_wrong(0);
+  std::vector<std::thread> threads;
+  for (int t=0; t < num_threads; ++t) {
+    threads.push_back(std::thread([&, t]() {
+      haloc::HashContext context(model);
+      for (int rep=0; rep < 20; ++rep) {
+        for (uint i=t; i < frames.size(); i += num_threads) {
+          if (context.GetHash(frames[i].kp, frames[i].desc) != expected[i])
+            num_wrong++;
+        }
+      }
+    }));
+  }
+  for (uint t=0; t < threads.size(); ++t) threads[t].join();
+  EXPECT_EQ(num_wrong, 0);
+
+  // A facade with the same model and the batch version
+  haloc::Hash other;
+  other.SetModel(model);
+  EXPECT_EQ(other.GetHash(frames[5].kp, frames[5].desc, frames[5].size),
+    expected[5]);
+  std::vector< std::vector<cv::KeyPoint> > kp;
+  std::vector<cv::Mat> desc;
+  std::vector<cv::Size> size;
+  for (uint i=0; i < frames.size(); ++i) {
+    kp.push_back(frames[i].kp);
+    desc.push_back(frames[i].desc);
+    size.push_back(frames[i].size);
+  }
+  cv::Mat hashes;
+  hash.GetHashes(kp, desc, size, hashes);
+  for (uint i=0; i < frames.size(); ++i) {
+    EXPECT_TRUE(std::equal(expected[i].begin(), expected[i].end(),
+      hashes.ptr<float>(i))) << "frame " << i;
+  }
+}
+
+TEST(Hash, ModelChangeResetsTheCalibration) {
+  std::mt19937 generator(11);
+  haloc::Hash hash;
+  const std::vector<Frame> frames = RandomSequence(generator, 30);
+  std::vector< std::vector<float> > hashes;
+  for (uint i=0; i < frames.size(); ++i) {
+    hashes.push_back(hash.GetHash(frames[i].kp, frames[i].desc,
+      frames[i].size));
+  }
+  ASSERT_TRUE(hash.CalibrateQuantization(hashes));
+  ASSERT_TRUE(hash.CalibrateSignature(hashes));
+  const float offset = hash.GetQuantizationOffset();
+  const float scale = hash.GetQuantizationScale();
+  const haloc::Hash defaults;
+
+  // The same model keeps the calibration
+  hash.SetModel(hash.GetModel());
+  EXPECT_EQ(hash.GetQuantizationOffset(), offset);
+  EXPECT_EQ(hash.GetQuantizationScale(), scale);
+  EXPECT_FALSE(hash.GetSignatureMedians().empty());
+
+  // Another model does not
+  haloc::HashModel::Params params;
+  params.seed = 3;
+  hash.SetModel(std::make_shared<const haloc::HashModel>(params,
+    frames[0].size, 64, false));
+  EXPECT_EQ(hash.GetQuantizationOffset(), defaults.GetQuantizationOffset());
+  EXPECT_EQ(hash.GetQuantizationScale(), defaults.GetQuantizationScale());
+  EXPECT_TRUE(hash.GetSignatureMedians().empty());
+
+  // Nor new parameters
+  ASSERT_TRUE(hash.CalibrateQuantization(hashes));
+  hash.SetParams(hash.GetParams());
+  EXPECT_EQ(hash.GetQuantizationScale(), defaults.GetQuantizationScale());
+}
+
+TEST(Hash, ModelFileKeepsTheCalibration) {
+  std::mt19937 generator(12);
+  haloc::Hash hash;
+  const std::vector<Frame> frames = RandomSequence(generator, 30);
+  std::vector< std::vector<float> > hashes;
+  for (uint i=0; i < frames.size(); ++i) {
+    hashes.push_back(hash.GetHash(frames[i].kp, frames[i].desc,
+      frames[i].size));
+  }
+  const uint64_t fingerprint = hash.GetModel()->GetFingerprint();
+  ASSERT_TRUE(hash.CalibrateQuantization(hashes));
+  ASSERT_TRUE(hash.CalibrateSignature(hashes));
+  EXPECT_EQ(hash.GetModel()->GetFingerprint(), fingerprint);
+
+  const std::string filename = testing::TempDir() + "haloc_model.bin";
+  ASSERT_TRUE(hash.GetModel()->Save(filename));
+  const std::shared_ptr<const haloc::HashModel> model =
+    haloc::HashModel::Load(filename);
+  ASSERT_TRUE(static_cast<bool>(model));
+  haloc::Hash loaded;
+  loaded.SetModel(model);
+  EXPECT_EQ(model->GetFingerprint(), fingerprint);
+  EXPECT_EQ(loaded.GetQuantizationOffset(), hash.GetQuantizationOffset());
+  EXPECT_EQ(loaded.GetQuantizationScale(), hash.GetQuantizationScale());
+  EXPECT_EQ(loaded.GetSignatureMedians(), hash.GetSignatureMedians());
+  EXPECT_EQ(loaded.Quantize(hashes[3]).code, hash.Quantize(hashes[3]).code);
+
+  // A truncated file is rejected before the vectors are read
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  const std::string bytes((std::istreambuf_iterator<char>(in)),
+    std::istreambuf_iterator<char>());
+  in.close();
+  std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+  out.write(bytes.data(), bytes.size() - 4);
+  out.close();
+  EXPECT_FALSE(static_cast<bool>(haloc::HashModel::Load(filename)));
+  std::remove(filename.c_str());
+}
+
+TEST(Hash, RejectsKeypointsWithoutDescriptors) {
+  std::mt19937 generator(13);
+  haloc::Hash hash;
+  const Frame frame = RandomFrame(generator, 400, 64);
+  const Frame other = RandomFrame(generator, 50, 64);
+  ASSERT_FALSE(hash.GetHash(frame.kp, frame.desc, frame.size).empty());
+
+  // 400 keypoints and 50 descriptors are never projected
+  EXPECT_TRUE(hash.GetHash(frame.kp, other.desc, frame.size).empty());
+  haloc::HashContext context(hash.GetModel());
+  EXPECT_TRUE(context.GetHash(frame.kp, other.desc).empty());
+
+  // Nor in a batch
+  std::vector< std::vector<cv::KeyPoint> > kp(2, frame.kp);
+  std::vector<cv::Mat> desc(2, frame.desc);
+  std::vector<cv::Size> size(2, frame.size);
+  desc[1] = other.desc;
+  cv::Mat hashes;
+  hash.GetHashes(kp, desc, size, hashes);
+  EXPECT_TRUE(hashes.empty());
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,199 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_log.h"
+
+namespace {
+
+// Random frames, hashed with the default model
+std::vector< std::vector<float> > RandomHashes(haloc::Hash& hash,
+    const int& num_frames) {
+  std::mt19937 generator(21);
+  std::uniform_real_distribution<float> x(0.0, 639.0), y(0.0, 479.0);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  std::vector<cv::KeyPoint> kp(100);
+  cv::Mat desc(100, 32, CV_32F);
+  std::vector< std::vector<float> > hashes;
+  for (int i=0; i < num_frames; ++i) {
+    for (int k=0; k < desc.rows; ++k) {
+      kp[k].pt.x = x(generator);
+      kp[k].pt.y = y(generator);
+      kp[k].response = uniform(generator);
+      for (int c=0; c < desc.cols; ++c)
+        desc.at<float>(k, c) = 0.4*uniform(generator) - 0.2;
+    }
+    hashes.push_back(hash.GetHash(kp, desc, cv::Size(640, 480)));
+  }
+  return hashes;
+}
+
+long FileSize(const std::string& filename) {
+  struct stat st;
+  return (stat(filename.c_str(), &st) == 0) ? st.st_size : -1;
+}
+
+// The recovered hash of every frame
+std::map<int, std::vector<float> > Recover(haloc::HashLog& log) {
+  std::vector<int> ids;
+  std::vector< std::vector<float> > hashes;
+  std::map<int, std::vector<float> > frames;
+  EXPECT_TRUE(log.Recover(ids, hashes));
+  for (uint i=0; i < ids.size(); ++i) {
+    EXPECT_EQ(frames.count(ids[i]), 0u) << "frame " << ids[i];
+    frames[ids[i]] = hashes[i];
+  }
+  return frames;
+}
+
+class HashLogTest : public testing::Test {
+ protected:
+  void SetUp() {
+    filename_ = testing::TempDir() + "haloc_test.log";
+    snapshot_ = testing::TempDir() + "haloc_test.snap";
+    std::remove(filename_.c_str());
+    std::remove(snapshot_.c_str());
+    hashes_ = RandomHashes(hash_, 12);
+  }
+
+  void TearDown() {
+    std::remove(filename_.c_str());
+    std::remove(snapshot_.c_str());
+  }
+
+  // Logs the first num_frames hashes and returns the size of a record
+  long WriteLog(const int& num_frames) {
+    haloc::HashLog log(hash_);
+    EXPECT_TRUE(log.Open(filename_, snapshot_));
+    const long header_size = FileSize(filename_);
+    for (int i=0; i < num_frames; ++i) EXPECT_TRUE(log.Append(i, hashes_[i]));
+    EXPECT_TRUE(log.Flush());
+    log.Close();
+    return (FileSize(filename_) - header_size) / num_frames;
+  }
+
+  // Appends bytes to the log
+  void AppendBytes(const std::string& bytes) {
+    std::ofstream file(filename_.c_str(), std::ios::binary | std::ios::app);
+    file.write(bytes.data(), bytes.size());
+  }
+
+  haloc::Hash hash_;
+  std::vector< std::vector<float> > hashes_;
+  std::string filename_;
+  std::string snapshot_;
+};
+
+TEST_F(HashLogTest, ReopensTheFlushedRecords) {
+  WriteLog(10);
+  haloc::HashLog log(hash_);
+  ASSERT_TRUE(log.Open(filename_, snapshot_));
+  const std::map<int, std::vector<float> > frames = Recover(log);
+  ASSERT_EQ(frames.size(), 10u);
+  for (int i=0; i < 10; ++i) EXPECT_EQ(frames.at(i), hashes_[i]);
+}
+
+TEST_F(HashLogTest, RecoverKeepsTheLastHash) {
+  haloc::HashLog log(hash_);
+  ASSERT_TRUE(log.Open(filename_, snapshot_));
+  ASSERT_TRUE(log.Append(1, hashes_[1]));
+  ASSERT_TRUE(log.Append(2, hashes_[2]));
+  ASSERT_TRUE(log.Append(1, hashes_[3]));
+  const std::map<int, std::vector<float> > frames = Recover(log);
+  ASSERT_EQ(frames.size(), 2u);
+  EXPECT_EQ(frames.at(1), hashes_[3]);
+  EXPECT_EQ(frames.at(2), hashes_[2]);
+}
+
+TEST_F(HashLogTest, CompactMovesTheRecordsToTheSnapshot) {
+  haloc::HashLog log(hash_);
+  ASSERT_TRUE(log.Open(filename_, snapshot_));
+  const long header_size = FileSize(filename_);
+  for (int i=0; i < 8; ++i) ASSERT_TRUE(log.Append(i, hashes_[i]));
+  ASSERT_TRUE(log.Flush());
+  ASSERT_TRUE(log.Compact());
+  EXPECT_EQ(FileSize(filename_), header_size);
+
+  // A later hash of a compacted frame replaces the snapshot one
+  ASSERT_TRUE(log.Append(3, hashes_[10]));
+  ASSERT_TRUE(log.Append(9, hashes_[9]));
+  log.Close();
+  haloc::HashLog reopened(hash_);
+  ASSERT_TRUE(reopened.Open(filename_, snapshot_));
+  const std::map<int, std::vector<float> > frames = Recover(reopened);
+  ASSERT_EQ(frames.size(), 9u);
+  for (int i=0; i < 8; ++i) {
+    if (i != 3) EXPECT_EQ(frames.at(i), hashes_[i]);
+  }
+  EXPECT_EQ(frames.at(3), hashes_[10]);
+  EXPECT_EQ(frames.at(9), hashes_[9]);
+}
+
+TEST_F(HashLogTest, DropsAShortTornRecord) {
+  WriteLog(6);
+  ASSERT_EQ(truncate(filename_.c_str(), FileSize(filename_) - 5), 0);
+  haloc::HashLog log(hash_);
+  ASSERT_TRUE(log.Open(filename_, snapshot_));
+  EXPECT_EQ(Recover(log).size(), 5u);
+}
+
+TEST_F(HashLogTest, DropsAZeroedFinalRecord) {
+  // The size of the file grew, but the data never reached the disk
+  const long record_size = WriteLog(6);
+  const long size = FileSize(filename_);
+  AppendBytes(std::string(record_size, '\0'));
+  haloc::HashLog log(hash_);
+  ASSERT_TRUE(log.Open(filename_, snapshot_));
+  EXPECT_EQ(FileSize(filename_), size);
+  const std::map<int, std::vector<float> > frames = Recover(log);
+  ASSERT_EQ(frames.size(), 6u);
+  EXPECT_EQ(frames.at(5), hashes_[5]);
+}
+
+TEST_F(HashLogTest, RefusesACorruptedRecordBeforeValidOnes) {
+  const long record_size = WriteLog(6);
+  const long size = FileSize(filename_);
+  const long header_size = size - 6*record_size;
+  const long offset = header_size + 2*record_size + record_size / 2;
+  std::fstream file(filename_.c_str(),
+    std::ios::binary | std::ios::in | std::ios::out);
+  file.seekg(offset);
+  const char byte = file.get();
+  file.seekp(offset);
+  file.put(~byte);
+  file.close();
+  haloc::HashLog log(hash_);
+  EXPECT_FALSE(log.Open(filename_, snapshot_));
+  EXPECT_EQ(FileSize(filename_), size);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,123 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+#include "libhaloc/hnsw_index.h"
+
+namespace {
+
+// Groups of similar random frames
+std::vector< std::vector<float> > RandomHashes(haloc::Hash& hash,
+    const int& num_frames) {
+  std::mt19937 generator(81);
+  std::uniform_real_distribution<float> x(0.0, 639.0), y(0.0, 479.0);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  std::normal_distribution<float> noise(0.0, 0.02);
+  std::vector<cv::KeyPoint> kp(200);
+  cv::Mat base(200, 64, CV_32F), desc(200, 64, CV_32F);
+  std::vector< std::vector<float> > hashes;
+  for (int i=0; i < num_frames; ++i) {
+    if (i % 5 == 0) {
+      for (int k=0; k < base.rows; ++k) {
+        kp[k].pt.x = x(generator);
+        kp[k].pt.y = y(generator);
+        kp[k].response = uniform(generator);
+        for (int c=0; c < base.cols; ++c)
+          base.at<float>(k, c) = 0.4*uniform(generator) - 0.2;
+      }
+    }
+    for (int k=0; k < desc.rows; ++k) {
+      for (int c=0; c < desc.cols; ++c)
+        desc.at<float>(k, c) = base.at<float>(k, c) + noise(generator);
+    }
+    hashes.push_back(hash.GetHash(kp, desc, cv::Size(640, 480)));
+  }
+  return hashes;
+}
+
+// The exact top k: every frame outside the exclusion window, scored with
+// CalcDist, best overlap first and then smallest id
+std::vector<haloc::Match> BruteForce(const haloc::Hash& hash,
+    const std::vector< std::vector<float> >& hashes, const int& q,
+    const int& k, const float& eps, const int& min_neighbor) {
+  std::vector<haloc::Match> matches;
+  for (uint i=0; i < hashes.size(); ++i) {
+    if (abs(static_cast<int>(i) - q) <= min_neighbor) continue;
+    const int overlap = hash.CalcDist(hashes[q], hashes[i], eps);
+    if (overlap > 0) matches.push_back(haloc::Match(i, overlap));
+  }
+  std::sort(matches.begin(), matches.end(),
+    [](const haloc::Match& a, const haloc::Match& b) {
+      return a.overlap > b.overlap || (a.overlap == b.overlap && a.id < b.id);
+    });
+  if (matches.size() > static_cast<uint>(k)) matches.resize(k);
+  return matches;
+}
+
+TEST(HnswIndex, FindsTheTopMatches) {
+  haloc::Hash hash;
+  const std::vector< std::vector<float> > hashes = RandomHashes(hash, 200);
+  haloc::HnswIndex index(hash);
+  haloc::HnswIndex::Params params;
+  params.max_links = 8;
+  params.seed = 5;
+  index.SetParams(params);
+  for (uint i=0; i < hashes.size(); ++i)
+    ASSERT_TRUE(index.Add(i, hashes[i]));
+  EXPECT_EQ(index.Size(), 200);
+  EXPECT_FALSE(index.Add(0, hashes[0]));
+
+  // Several frames can have the same overlap, so the recall counts the
+  // ranks where the overlap is the exact one
+  const int k = 5;
+  const int windows[] = {0, 2, 6};
+  for (uint w=0; w < sizeof(windows) / sizeof(windows[0]); ++w) {
+    int num_expected = 0, num_found = 0;
+    for (uint q=0; q < hashes.size(); q += 2) {
+      const std::vector<haloc::Match> expected = BruteForce(hash, hashes, q, k,
+        params.eps, windows[w]);
+      const std::vector<haloc::Match> result = index.Query(hashes[q], k, q,
+        windows[w]);
+      EXPECT_LE(result.size(), static_cast<uint>(k));
+      for (uint m=0; m < result.size(); ++m) {
+        EXPECT_GT(abs(result[m].id - static_cast<int>(q)), windows[w]) <<
+          "window " << windows[w] << " query " << q;
+        EXPECT_EQ(result[m].overlap, hash.CalcDist(hashes[q],
+          hashes[result[m].id], params.eps)) << "query " << q;
+        if (m < expected.size() && result[m].overlap == expected[m].overlap)
+          num_found++;
+      }
+      num_expected += expected.size();
+    }
+    ASSERT_GT(num_expected, 0);
+    EXPECT_GE(num_found, 0.9*num_expected) << "window " << windows[w];
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
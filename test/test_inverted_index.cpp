@@ -0,0 +1,106 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+#include "libhaloc/inverted_index.h"
+
+namespace {
+
+// Groups of similar random frames
+std::vector< std::vector<float> > RandomHashes(haloc::Hash& hash,
+    const int& num_frames) {
+  std::mt19937 generator(61);
+  std::uniform_real_distribution<float> x(0.0, 639.0), y(0.0, 479.0);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  std::normal_distribution<float> noise(0.0, 0.03);
+  std::vector<cv::KeyPoint> kp(200);
+  cv::Mat base(200, 64, CV_32F), desc(200, 64, CV_32F);
+  std::vector< std::vector<float> > hashes;
+  for (int i=0; i < num_frames; ++i) {
+    if (i % 4 == 0) {
+      for (int k=0; k < base.rows; ++k) {
+        kp[k].pt.x = x(generator);
+        kp[k].pt.y = y(generator);
+        kp[k].response = uniform(generator);
+        for (int c=0; c < base.cols; ++c)
+          base.at<float>(k, c) = 0.4*uniform(generator) - 0.2;
+      }
+    }
+    for (int k=0; k < desc.rows; ++k) {
+      for (int c=0; c < desc.cols; ++c)
+        desc.at<float>(k, c) = base.at<float>(k, c) + noise(generator);
+    }
+    hashes.push_back(hash.GetHash(kp, desc, cv::Size(640, 480)));
+  }
+  return hashes;
+}
+
+TEST(InvertedIndex, NeverMissesACandidate) {
+  haloc::Hash hash;
+  const std::vector< std::vector<float> > hashes = RandomHashes(hash, 48);
+  haloc::HashDatabase reference(hash);
+  for (uint i=0; i < hashes.size(); ++i) reference.Add(i, hashes[i]);
+
+  // The last cell width needs more neighbour codes than the index probes,
+  // so the whole database is scanned
+  const float cell_widths[] = {0.25, 0.5, 1.0, 2.0, 0.01};
+  const float eps[] = {0.4, 0.8, 1.6};
+  const int ks[] = {3, 48};
+  int num_matches = 0;
+  for (uint c=0; c < sizeof(cell_widths) / sizeof(cell_widths[0]); ++c) {
+    haloc::InvertedIndex index(hash);
+    haloc::InvertedIndex::Params params;
+    params.cell_width = cell_widths[c];
+    index.SetParams(params);
+    for (uint i=0; i < hashes.size(); ++i)
+      ASSERT_TRUE(index.Add(i, hashes[i]));
+
+    for (uint e=0; e < sizeof(eps) / sizeof(eps[0]); ++e) {
+      for (uint n=0; n < sizeof(ks) / sizeof(ks[0]); ++n) {
+        for (uint q=0; q < hashes.size(); q += 3) {
+          const std::vector<haloc::Match> expected = reference.Query(
+            hashes[q], ks[n], eps[e], q, 1);
+          const std::vector<haloc::Match> result = index.Query(hashes[q],
+            ks[n], eps[e], q, 1);
+          ASSERT_EQ(result.size(), expected.size()) << "cell width " <<
+            cell_widths[c] << " eps " << eps[e] << " query " << q;
+          num_matches += expected.size();
+          for (uint m=0; m < result.size(); ++m) {
+            EXPECT_EQ(result[m].id, expected[m].id) << "cell width " <<
+              cell_widths[c] << " eps " << eps[e] << " query " << q;
+            EXPECT_EQ(result[m].overlap, expected[m].overlap) <<
+              "cell width " << cell_widths[c] << " eps " << eps[e] <<
+              " query " << q;
+          }
+        }
+      }
+    }
+  }
+  EXPECT_GT(num_matches, 0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,162 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "libhaloc/kernels.h"
+
+namespace {
+
+using namespace haloc::kernels;
+
+// Lengths around the vector widths, to exercise every tail
+const int kSizes[] = {0, 1, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65,
+  127, 129, 255, 256, 257, 1000};
+
+/**
+ * @brief      Runs the tests once per instruction set supported by the CPU
+ *             and restores the best one afterwards.
+ */
+class KernelsTest : public ::testing::TestWithParam<Isa> {
+ protected:
+  void SetUp() {
+    best_ = GetIsa();
+    supported_ = SetIsa(GetParam());
+  }
+
+  void TearDown() {
+    SetIsa(best_);
+  }
+
+  std::vector<float> RandomFloats(const int& n) {
+    std::uniform_real_distribution<float> uniform(-1.0, 1.0);
+    std::vector<float> v(n);
+    for (uint i=0; i < v.size(); ++i) v[i] = uniform(generator_);
+    return v;
+  }
+
+  std::vector<uint8_t> RandomBytes(const int& n) {
+    std::uniform_int_distribution<int> uniform(0, 255);
+    std::vector<uint8_t> v(n);
+    for (uint i=0; i < v.size(); ++i) v[i] = uniform(generator_);
+    return v;
+  }
+
+  Isa best_;
+  bool supported_;
+  std::mt19937 generator_;
+};
+
+TEST_P(KernelsTest, L1Distance) {
+  if (!supported_) return;
+  for (const int& n : kSizes) {
+    const std::vector<float> a = RandomFloats(n), b = RandomFloats(n);
+    const float expected = L1DistanceScalar(a.data(), b.data(), n);
+    const float tolerance = 1e-5*(expected + 1.0);
+    EXPECT_NEAR(L1Distance(a.data(), b.data(), n), expected, tolerance) <<
+      "n = " << n;
+
+    // Below the bound the sum is complete, above it only has to exceed it
+    const float bound = 0.5*expected;
+    const float bounded = L1DistanceBounded(a.data(), b.data(), n, bound);
+    if (n > 0) EXPECT_GT(bounded, bound) << "n = " << n;
+    EXPECT_NEAR(L1DistanceBounded(a.data(), b.data(), n, 2.0*expected + 1.0),
+      expected, tolerance) << "n = " << n;
+  }
+}
+
+TEST_P(KernelsTest, SadDistance) {
+  if (!supported_) return;
+  for (const int& n : kSizes) {
+    const std::vector<uint8_t> a = RandomBytes(n), b = RandomBytes(n);
+    const uint32_t expected = SadDistanceScalar(a.data(), b.data(), n);
+    EXPECT_EQ(SadDistance(a.data(), b.data(), n), expected) << "n = " << n;
+    const uint32_t bound = expected / 2;
+    const uint32_t bounded = SadDistanceBounded(a.data(), b.data(), n, bound);
+    if (expected > 0) EXPECT_GT(bounded, bound) << "n = " << n;
+    EXPECT_EQ(SadDistanceBounded(a.data(), b.data(), n, expected), expected) <<
+      "n = " << n;
+  }
+}
+
+TEST_P(KernelsTest, HammingDistance) {
+  if (!supported_) return;
+  for (const int& n : kSizes) {
+    std::vector<uint64_t> a(n), b(n);
+    for (int i=0; i < n; ++i) {
+      a[i] = (static_cast<uint64_t>(generator_()) << 32) | generator_();
+      b[i] = (static_cast<uint64_t>(generator_()) << 32) | generator_();
+    }
+    EXPECT_EQ(HammingDistance(a.data(), b.data(), n),
+      HammingDistanceScalar(a.data(), b.data(), n)) << "n = " << n;
+  }
+}
+
+TEST_P(KernelsTest, ProjectIsBitIdentical) {
+  if (!supported_) return;
+  const int num_proj = 3;
+  const int r_stride = 131;
+  const std::vector<float> r = RandomFloats(num_proj*r_stride);
+  for (const int& rows : {1, 5, 128}) {
+    for (const int& cols : kSizes) {
+      const std::vector<float> x = RandomFloats(rows*cols);
+      std::vector<float> out(num_proj*cols), expected(num_proj*cols);
+      Project(r.data(), r_stride, num_proj, x.data(), rows, cols, out.data());
+      ProjectScalar(r.data(), r_stride, num_proj, x.data(), rows, cols,
+        expected.data());
+      for (uint i=0; i < out.size(); ++i) {
+        ASSERT_EQ(out[i], expected[i]) << "rows = " << rows << ", cols = " <<
+          cols << ", i = " << i;
+      }
+    }
+  }
+}
+
+TEST_P(KernelsTest, ProjectBitsIsBitIdentical) {
+  if (!supported_) return;
+  const int num_proj = 3;
+  const int r_stride = 131;
+  const std::vector<float> r = RandomFloats(num_proj*r_stride);
+  for (const int& rows : {1, 5, 128}) {
+    for (const int& num_bytes : {1, 2, 3, 5, 16, 31, 32, 33}) {
+      const int x_step = num_bytes + 3;
+      const std::vector<uint8_t> x = RandomBytes(rows*x_step);
+      std::vector<float> out(num_proj*8*num_bytes);
+      std::vector<float> expected(out.size());
+      ProjectBits(r.data(), r_stride, num_proj, x.data(), x_step, rows,
+        num_bytes, out.data());
+      ProjectBitsScalar(r.data(), r_stride, num_proj, x.data(), x_step, rows,
+        num_bytes, expected.data());
+      for (uint i=0; i < out.size(); ++i) {
+        ASSERT_EQ(out[i], expected[i]) << "rows = " << rows <<
+          ", num_bytes = " << num_bytes << ", i = " << i;
+      }
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(AllIsas, KernelsTest,
+  ::testing::Values(SCALAR, SSE42, AVX2, AVX512));
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
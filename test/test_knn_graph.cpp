@@ -0,0 +1,113 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+
+#include <random>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/knn_graph.h"
+
+namespace {
+
+// A trajectory that goes back to the places it visited: every place is seen
+// in several runs of consecutive frames
+std::vector<haloc::BucketedHash> RandomSequence(haloc::Hash& hash,
+    const int& num_frames) {
+  std::mt19937 generator(41);
+  std::uniform_real_distribution<float> x(0.0, 639.0), y(0.0, 479.0);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  std::normal_distribution<float> noise(0.0, 0.02);
+  const int num_places = 20;
+  std::vector< std::vector<cv::KeyPoint> > kp(num_places,
+    std::vector<cv::KeyPoint>(150));
+  std::vector<cv::Mat> places(num_places);
+  for (int p=0; p < num_places; ++p) {
+    places[p].create(150, 64, CV_32F);
+    for (int k=0; k < places[p].rows; ++k) {
+      kp[p][k].pt.x = x(generator);
+      kp[p][k].pt.y = y(generator);
+      kp[p][k].response = uniform(generator);
+      for (int c=0; c < places[p].cols; ++c)
+        places[p].at<float>(k, c) = 0.4*uniform(generator) - 0.2;
+    }
+  }
+  std::vector<haloc::BucketedHash> hashes;
+  cv::Mat desc(150, 64, CV_32F);
+  for (int i=0; i < num_frames; ++i) {
+    const int p = (i / 4) % num_places;
+    for (int k=0; k < desc.rows; ++k) {
+      for (int c=0; c < desc.cols; ++c)
+        desc.at<float>(k, c) = places[p].at<float>(k, c) + noise(generator);
+    }
+    hashes.push_back(hash.GetBucketedHash(kp[p], desc, cv::Size(640, 480)));
+  }
+  return hashes;
+}
+
+TEST(KnnGraphBuilder, FindsTheNeighbours) {
+  haloc::Hash hash;
+  const std::vector<haloc::BucketedHash> hashes = RandomSequence(hash, 240);
+  const float eps = 0.8;
+  haloc::KnnGraphBuilder builder(hash);
+  haloc::KnnGraphBuilder::Params params;
+  params.k = 5;
+  params.min_neighbor = 3;
+  params.num_threads = 1;
+  params.batch_size = 50;
+  builder.SetParams(params);
+  const std::vector< std::vector<haloc::Match> > graph = builder.Build(hashes,
+    eps);
+  ASSERT_EQ(graph.size(), hashes.size());
+  EXPECT_GT(builder.GetNumIterations(), 0);
+  EXPECT_GE(builder.EstimateRecall(hashes, graph, eps, 60), 0.9);
+
+  // The temporal neighbours are never linked
+  int num_links = 0;
+  for (uint v=0; v < graph.size(); ++v) {
+    EXPECT_LE(graph[v].size(), params.k);
+    for (uint m=0; m < graph[v].size(); ++m) {
+      EXPECT_GT(abs(graph[v][m].id - static_cast<int>(v)),
+        params.min_neighbor) << "frame " << v;
+      EXPECT_GT(graph[v][m].overlap, 0);
+      num_links++;
+    }
+  }
+  EXPECT_GT(num_links, 0);
+
+  // The graph does not depend on the number of threads
+  params.num_threads = 4;
+  builder.SetParams(params);
+  const std::vector< std::vector<haloc::Match> > parallel = builder.Build(
+    hashes, eps);
+  ASSERT_EQ(parallel.size(), graph.size());
+  for (uint v=0; v < graph.size(); ++v) {
+    ASSERT_EQ(parallel[v].size(), graph[v].size()) << "frame " << v;
+    for (uint m=0; m < graph[v].size(); ++m) {
+      EXPECT_EQ(parallel[v][m].id, graph[v][m].id) << "frame " << v;
+      EXPECT_EQ(parallel[v][m].overlap, graph[v][m].overlap) << "frame " << v;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,144 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+#include "libhaloc/lsh_index.h"
+
+namespace {
+
+// Groups of similar random frames
+std::vector< std::vector<float> > RandomHashes(haloc::Hash& hash,
+    const int& num_frames) {
+  std::mt19937 generator(71);
+  std::uniform_real_distribution<float> x(0.0, 639.0), y(0.0, 479.0);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  std::normal_distribution<float> noise(0.0, 0.02);
+  std::vector<cv::KeyPoint> kp(200);
+  cv::Mat base(200, 64, CV_32F), desc(200, 64, CV_32F);
+  std::vector< std::vector<float> > hashes;
+  for (int i=0; i < num_frames; ++i) {
+    if (i % 4 == 0) {
+      for (int k=0; k < base.rows; ++k) {
+        kp[k].pt.x = x(generator);
+        kp[k].pt.y = y(generator);
+        kp[k].response = uniform(generator);
+        for (int c=0; c < base.cols; ++c)
+          base.at<float>(k, c) = 0.4*uniform(generator) - 0.2;
+      }
+    }
+    for (int k=0; k < desc.rows; ++k) {
+      for (int c=0; c < desc.cols; ++c)
+        desc.at<float>(k, c) = base.at<float>(k, c) + noise(generator);
+    }
+    hashes.push_back(hash.GetHash(kp, desc, cv::Size(640, 480)));
+  }
+  return hashes;
+}
+
+class LshIndexTest : public testing::Test {
+ protected:
+  void SetUp() {
+    hashes_ = RandomHashes(hash_, 60);
+    for (uint i=0; i < hashes_.size(); ++i) reference_.Add(i, hashes_[i]);
+  }
+
+  // An index of all the hashes
+  void Build(const haloc::LshIndex::Params& params, haloc::LshIndex& index) {
+    index.SetParams(params);
+    for (uint i=0; i < hashes_.size(); ++i)
+      ASSERT_TRUE(index.Add(i, hashes_[i]));
+  }
+
+  haloc::Hash hash_;
+  haloc::HashDatabase reference_{hash_};
+  std::vector< std::vector<float> > hashes_;
+};
+
+TEST_F(LshIndexTest, AgreesWithHashDatabase) {
+  haloc::LshIndex::Params params;
+  params.seed = 7;
+  haloc::LshIndex index(hash_), same_seed(hash_);
+  Build(params, index);
+  Build(params, same_seed);
+
+  const float eps = 0.8;
+  const int k = 3;
+  int num_expected = 0, num_found = 0;
+  for (uint q=0; q < hashes_.size(); ++q) {
+    const std::vector<haloc::Match> expected = reference_.Query(hashes_[q], k,
+      eps, q, 0);
+    const std::vector<haloc::Match> result = index.Query(hashes_[q], k, eps,
+      q, 0);
+
+    // The same seed gives the same hash functions
+    const std::vector<haloc::Match> again = same_seed.Query(hashes_[q], k, eps,
+      q, 0);
+    ASSERT_EQ(again.size(), result.size()) << "query " << q;
+    for (uint m=0; m < result.size(); ++m) {
+      EXPECT_EQ(again[m].id, result[m].id) << "query " << q;
+      EXPECT_EQ(again[m].overlap, result[m].overlap) << "query " << q;
+    }
+
+    // Every candidate is verified with the exact distance
+    std::set<int> ids;
+    for (uint m=0; m < result.size(); ++m) {
+      EXPECT_NE(result[m].id, static_cast<int>(q));
+      EXPECT_EQ(result[m].overlap, hash_.CalcDist(hashes_[q],
+        hashes_[result[m].id], eps)) << "query " << q;
+      ids.insert(result[m].id);
+    }
+    for (uint m=0; m < expected.size(); ++m)
+      num_found += ids.count(expected[m].id);
+    num_expected += expected.size();
+  }
+  ASSERT_GT(num_expected, 0);
+  EXPECT_GE(num_found, 0.9*num_expected);
+}
+
+TEST_F(LshIndexTest, ScansWhenEpsIsLargerThanTheBucketWidth) {
+  haloc::LshIndex::Params params;
+  params.bucket_width = 0.5;
+  params.num_tables = 1;
+  haloc::LshIndex index(hash_);
+  Build(params, index);
+
+  const float eps = 0.8;
+  for (uint q=0; q < hashes_.size(); q += 3) {
+    const std::vector<haloc::Match> expected = reference_.Query(hashes_[q], 5,
+      eps, q, 1);
+    const std::vector<haloc::Match> result = index.Query(hashes_[q], 5, eps,
+      q, 1);
+    ASSERT_EQ(result.size(), expected.size()) << "query " << q;
+    for (uint m=0; m < result.size(); ++m) {
+      EXPECT_EQ(result[m].id, expected[m].id) << "query " << q;
+      EXPECT_EQ(result[m].overlap, expected[m].overlap) << "query " << q;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
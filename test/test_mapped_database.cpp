@@ -0,0 +1,189 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+#include "libhaloc/mapped_database.h"
+
+namespace {
+
+// Groups of similar random frames
+std::vector< std::vector<float> > RandomHashes(haloc::Hash& hash,
+    const int& num_frames) {
+  std::mt19937 generator(31);
+  std::uniform_real_distribution<float> x(0.0, 639.0), y(0.0, 479.0);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  std::normal_distribution<float> noise(0.0, 0.02);
+  std::vector<cv::KeyPoint> kp(200);
+  cv::Mat base(200, 64, CV_32F), desc(200, 64, CV_32F);
+  std::vector< std::vector<float> > hashes;
+  for (int i=0; i < num_frames; ++i) {
+    if (i % 6 == 0) {
+      for (int k=0; k < base.rows; ++k) {
+        kp[k].pt.x = x(generator);
+        kp[k].pt.y = y(generator);
+        kp[k].response = uniform(generator);
+        for (int c=0; c < base.cols; ++c)
+          base.at<float>(k, c) = 0.4*uniform(generator) - 0.2;
+      }
+    }
+    for (int k=0; k < desc.rows; ++k) {
+      for (int c=0; c < desc.cols; ++c)
+        desc.at<float>(k, c) = base.at<float>(k, c) + noise(generator);
+    }
+    hashes.push_back(hash.GetHash(kp, desc, cv::Size(640, 480)));
+  }
+  return hashes;
+}
+
+class MappedDatabaseTest : public testing::Test {
+ protected:
+  void SetUp() {
+    filename_ = testing::TempDir() + "haloc_test.db";
+    std::remove(filename_.c_str());
+    hashes_ = RandomHashes(hash_, 50);
+
+    // Ids out of order and with gaps
+    for (uint i=0; i < hashes_.size(); ++i)
+      ids_.push_back(3*((i*7) % hashes_.size()) + 1);
+  }
+
+  void TearDown() {
+    std::remove(filename_.c_str());
+  }
+
+  // The bytes of the database file
+  std::string ReadFile() {
+    std::ifstream file(filename_.c_str(), std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)),
+      std::istreambuf_iterator<char>());
+  }
+
+  void WriteFile(const std::string& bytes) {
+    std::ofstream file(filename_.c_str(), std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), bytes.size());
+  }
+
+  haloc::Hash hash_;
+  std::vector< std::vector<float> > hashes_;
+  std::vector<int> ids_;
+  std::string filename_;
+};
+
+TEST_F(MappedDatabaseTest, QueriesAsHashDatabase) {
+  ASSERT_TRUE(haloc::MappedDatabase::Write(filename_, hash_, ids_, hashes_));
+  haloc::MappedDatabase mapped(hash_);
+  ASSERT_TRUE(mapped.Open(filename_));
+  haloc::HashDatabase reference(hash_);
+  for (uint i=0; i < hashes_.size(); ++i) reference.Add(ids_[i], hashes_[i]);
+
+  EXPECT_EQ(mapped.Size(), hashes_.size());
+  EXPECT_EQ(mapped.GetIds(), ids_);
+  for (uint i=0; i < hashes_.size(); ++i) {
+    EXPECT_TRUE(mapped.Contains(ids_[i]));
+    EXPECT_FALSE(mapped.Contains(ids_[i] + 1));
+    EXPECT_EQ(mapped.GetHash(ids_[i]), hashes_[i]);
+  }
+  EXPECT_TRUE(mapped.GetHash(0).empty());
+
+  const float eps = 0.8;
+  for (uint q=0; q < hashes_.size(); q += 4) {
+    const std::vector<haloc::Match> expected = reference.Query(hashes_[q], 5,
+      eps, ids_[q], 3);
+    const std::vector<haloc::Match> result = mapped.Query(hashes_[q], 5, eps,
+      ids_[q], 3);
+    ASSERT_EQ(result.size(), expected.size()) << "query " << q;
+    for (uint m=0; m < result.size(); ++m) {
+      EXPECT_EQ(result[m].id, expected[m].id) << "query " << q;
+      EXPECT_EQ(result[m].overlap, expected[m].overlap) << "query " << q;
+    }
+  }
+}
+
+TEST_F(MappedDatabaseTest, RejectsATruncatedFile) {
+  ASSERT_TRUE(haloc::MappedDatabase::Write(filename_, hash_, ids_, hashes_));
+  const std::string bytes = ReadFile();
+  haloc::MappedDatabaseHeader header;
+  std::copy(bytes.begin(), bytes.begin() + sizeof(header),
+    reinterpret_cast<char*>(&header));
+
+  // The index is cut, then the header
+  WriteFile(bytes.substr(0, header.index_offset + sizeof(int32_t)));
+  haloc::MappedDatabase mapped(hash_);
+  EXPECT_FALSE(mapped.Open(filename_));
+  WriteFile(bytes.substr(0, sizeof(haloc::MappedDatabaseHeader) / 2));
+  EXPECT_FALSE(mapped.Open(filename_));
+}
+
+TEST_F(MappedDatabaseTest, RejectsAnotherModel) {
+  ASSERT_TRUE(haloc::MappedDatabase::Write(filename_, hash_, ids_, hashes_));
+  std::string bytes = ReadFile();
+  haloc::MappedDatabaseHeader header;
+  std::copy(bytes.begin(), bytes.begin() + sizeof(header),
+    reinterpret_cast<char*>(&header));
+  header.fingerprint ^= 1;
+  std::copy(reinterpret_cast<const char*>(&header),
+    reinterpret_cast<const char*>(&header) + sizeof(header), bytes.begin());
+  WriteFile(bytes);
+  haloc::MappedDatabase mapped(hash_);
+  EXPECT_FALSE(mapped.Open(filename_));
+}
+
+TEST_F(MappedDatabaseTest, RejectsAnUnsortedIndex) {
+  ASSERT_TRUE(haloc::MappedDatabase::Write(filename_, hash_, ids_, hashes_));
+  std::string bytes = ReadFile();
+  haloc::MappedDatabaseHeader header;
+  std::copy(bytes.begin(), bytes.begin() + sizeof(header),
+    reinterpret_cast<char*>(&header));
+
+  // The first two (id, row) pairs are swapped
+  const std::string::iterator index = bytes.begin() + header.index_offset;
+  std::swap_ranges(index, index + 2*sizeof(int32_t),
+    index + 2*sizeof(int32_t));
+  WriteFile(bytes);
+  haloc::MappedDatabase mapped(hash_);
+  EXPECT_FALSE(mapped.Open(filename_));
+}
+
+TEST_F(MappedDatabaseTest, WriterRejectsDuplicateIds) {
+  haloc::MappedDatabaseWriter writer(hash_);
+  ASSERT_TRUE(writer.Open(filename_));
+  EXPECT_TRUE(writer.Append(7, hashes_[0]));
+  EXPECT_TRUE(writer.Append(8, hashes_[1]));
+  EXPECT_TRUE(writer.Append(7, hashes_[2]));
+  EXPECT_FALSE(writer.Close());
+  EXPECT_NE(access(filename_.c_str(), F_OK), 0);
+  EXPECT_NE(access((filename_ + ".tmp").c_str(), F_OK), 0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
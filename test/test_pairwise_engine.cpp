@@ -0,0 +1,155 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/pairwise_engine.h"
+
+namespace {
+
+// Groups of similar random frames
+std::vector<haloc::BucketedHash> RandomHashes(haloc::Hash& hash,
+    const int& num_frames, const unsigned int& seed) {
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> x(0.0, 639.0), y(0.0, 479.0);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  std::normal_distribution<float> noise(0.0, 0.02);
+  std::vector<cv::KeyPoint> kp(200);
+  cv::Mat base(200, 64, CV_32F), desc(200, 64, CV_32F);
+  std::vector<haloc::BucketedHash> hashes;
+  for (int i=0; i < num_frames; ++i) {
+    if (i % 5 == 0) {
+      for (int k=0; k < base.rows; ++k) {
+        kp[k].pt.x = x(generator);
+        kp[k].pt.y = y(generator);
+        kp[k].response = uniform(generator);
+        for (int c=0; c < base.cols; ++c)
+          base.at<float>(k, c) = 0.4*uniform(generator) - 0.2;
+      }
+    }
+    for (int k=0; k < desc.rows; ++k) {
+      for (int c=0; c < desc.cols; ++c)
+        desc.at<float>(k, c) = base.at<float>(k, c) + noise(generator);
+    }
+    hashes.push_back(hash.GetBucketedHash(kp, desc, cv::Size(640, 480)));
+  }
+  return hashes;
+}
+
+// Counts the visits of every pair of a size x size matrix
+std::vector<int> CountVisits(haloc::PairwiseEngine& engine, const int& size,
+    const int& band) {
+  std::vector< std::vector<int> > counts(engine.GetNumThreads(),
+    std::vector<int>(size*size, 0));
+  engine.VisitLowerTriangle(size, band, [&](int thread, int i, int j) {
+    counts[thread][i*size + j]++;
+  });
+  std::vector<int> total(size*size, 0);
+  for (uint t=0; t < counts.size(); ++t)
+    for (int p=0; p < size*size; ++p) total[p] += counts[t][p];
+  return total;
+}
+
+TEST(PairwiseEngine, VisitsTheLowerTriangleOnce) {
+  haloc::Hash hash;
+  haloc::PairwiseEngine engine(hash);
+  haloc::PairwiseEngine::Params params;
+  params.tile_size = 7;
+  params.num_threads = 4;
+  engine.SetParams(params);
+
+  // 7 does not divide 45, and the bands cut the tiles in every way
+  const int size = 45;
+  const int bands[] = {0, 3, 10, 44, 100};
+  for (uint b=0; b < sizeof(bands) / sizeof(bands[0]); ++b) {
+    const std::vector<int> visits = CountVisits(engine, size, bands[b]);
+    for (int i=0; i < size; ++i) {
+      for (int j=0; j < size; ++j) {
+        EXPECT_EQ(visits[i*size + j], (i - j > bands[b]) ? 1 : 0) <<
+          "band " << bands[b] << " pair " << i << ", " << j;
+      }
+    }
+  }
+}
+
+TEST(PairwiseEngine, MatchesBruteForce) {
+  haloc::Hash hash;
+  const std::vector<haloc::BucketedHash> hashes = RandomHashes(hash, 60, 4);
+  std::vector<haloc::BucketedHash> queries = RandomHashes(hash, 20, 5);
+  queries.insert(queries.end(), hashes.begin() + 10, hashes.begin() + 15);
+  const float eps = 0.8;
+  const int band = 2;
+  haloc::PairwiseEngine engine(hash);
+  haloc::PairwiseEngine::Params params;
+  params.tile_size = 9;
+  params.num_threads = 3;
+  engine.SetParams(params);
+
+  // All the pairs, in row-major order
+  std::vector<haloc::PairMatch> expected;
+  for (uint i=0; i < hashes.size(); ++i) {
+    for (uint j=0; j + band < i; ++j) {
+      int shift;
+      const int overlap = hash.CalcDist(hashes[i], hashes[j], eps, shift);
+      if (overlap >= 1) expected.push_back(haloc::PairMatch(i, j, overlap,
+        shift));
+    }
+  }
+  ASSERT_FALSE(expected.empty());
+  std::vector<haloc::PairMatch> result = engine.AllPairs(hashes, eps, 1,
+    band);
+  ASSERT_EQ(result.size(), expected.size());
+  for (uint p=0; p < result.size(); ++p) {
+    EXPECT_EQ(result[p].i, expected[p].i);
+    EXPECT_EQ(result[p].j, expected[p].j);
+    EXPECT_EQ(result[p].overlap, expected[p].overlap);
+    EXPECT_EQ(result[p].shift, expected[p].shift);
+  }
+
+  // Every query against every frame, with the tile size of the hash length
+  params.tile_size = 0;
+  engine.SetParams(params);
+  EXPECT_GT(engine.GetTileSize(), 1);
+  expected.clear();
+  for (uint i=0; i < queries.size(); ++i) {
+    for (uint j=0; j < hashes.size(); ++j) {
+      int shift;
+      const int overlap = hash.CalcDist(queries[i], hashes[j], eps, shift);
+      if (overlap >= 2) expected.push_back(haloc::PairMatch(i, j, overlap,
+        shift));
+    }
+  }
+  ASSERT_FALSE(expected.empty());
+  result = engine.ManyVsMany(queries, hashes, eps, 2);
+  ASSERT_EQ(result.size(), expected.size());
+  for (uint p=0; p < result.size(); ++p) {
+    EXPECT_EQ(result[p].i, expected[p].i);
+    EXPECT_EQ(result[p].j, expected[p].j);
+    EXPECT_EQ(result[p].overlap, expected[p].overlap);
+    EXPECT_EQ(result[p].shift, expected[p].shift);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,187 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+#include "libhaloc/pq_database.h"
+#include "libhaloc/product_quantizer.h"
+
+namespace {
+
+// Groups of similar random frames
+std::vector< std::vector<float> > RandomHashes(haloc::Hash& hash,
+    const int& num_frames) {
+  std::mt19937 generator(51);
+  std::uniform_real_distribution<float> x(0.0, 639.0), y(0.0, 479.0);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  std::normal_distribution<float> noise(0.0, 0.02);
+  std::vector<cv::KeyPoint> kp(200);
+  cv::Mat base(200, 64, CV_32F), desc(200, 64, CV_32F);
+  std::vector< std::vector<float> > hashes;
+  for (int i=0; i < num_frames; ++i) {
+    if (i % 5 == 0) {
+      for (int k=0; k < base.rows; ++k) {
+        kp[k].pt.x = x(generator);
+        kp[k].pt.y = y(generator);
+        kp[k].response = uniform(generator);
+        for (int c=0; c < base.cols; ++c)
+          base.at<float>(k, c) = 0.4*uniform(generator) - 0.2;
+      }
+    }
+    for (int k=0; k < desc.rows; ++k) {
+      for (int c=0; c < desc.cols; ++c)
+        desc.at<float>(k, c) = base.at<float>(k, c) + noise(generator);
+    }
+    hashes.push_back(hash.GetHash(kp, desc, cv::Size(640, 480)));
+  }
+  return hashes;
+}
+
+class ProductQuantizerTest : public testing::Test {
+ protected:
+  void SetUp() {
+    filename_ = testing::TempDir() + "haloc_test.pq";
+    std::remove(filename_.c_str());
+    hashes_ = RandomHashes(hash_, 60);
+    params_.num_subspaces = 4;
+    params_.num_centroids = 32;
+    params_.seed = 3;
+  }
+
+  void TearDown() {
+    std::remove(filename_.c_str());
+  }
+
+  std::string ReadFile() {
+    std::ifstream file(filename_.c_str(), std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)),
+      std::istreambuf_iterator<char>());
+  }
+
+  void WriteFile(const std::string& bytes) {
+    std::ofstream file(filename_.c_str(), std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), bytes.size());
+  }
+
+  haloc::Hash hash_;
+  haloc::ProductQuantizer::Params params_;
+  std::vector< std::vector<float> > hashes_;
+  std::string filename_;
+};
+
+TEST_F(ProductQuantizerTest, LoadsTheSavedCodebooks) {
+  haloc::ProductQuantizer trained(hash_);
+  trained.SetParams(params_);
+  ASSERT_TRUE(trained.Train(hashes_));
+  ASSERT_TRUE(trained.Save(filename_));
+  haloc::ProductQuantizer loaded(hash_);
+  ASSERT_TRUE(loaded.Load(filename_));
+  ASSERT_TRUE(loaded.IsTrained());
+  EXPECT_EQ(loaded.GetCodeLength(), trained.GetCodeLength());
+  ASSERT_EQ(loaded.GetBucketLength(), trained.GetBucketLength());
+
+  // Every bucket gets the same code and the same distance table
+  const int bucket_length = trained.GetBucketLength();
+  const int code_length = trained.GetCodeLength();
+  const int table_size = code_length*params_.num_centroids;
+  std::vector<uint8_t> code(code_length), loaded_code(code_length);
+  std::vector<float> table(table_size), loaded_table(table_size);
+  for (uint h=0; h < hashes_.size(); h += 7) {
+    for (uint b=0; b + bucket_length <= hashes_[h].size();
+        b += bucket_length) {
+      trained.Encode(&hashes_[h][b], &code[0]);
+      loaded.Encode(&hashes_[h][b], &loaded_code[0]);
+      EXPECT_EQ(loaded_code, code) << "hash " << h << " bucket " << b;
+      trained.ComputeTable(&hashes_[h][b], &table[0]);
+      loaded.ComputeTable(&hashes_[h][b], &loaded_table[0]);
+      EXPECT_EQ(loaded_table, table) << "hash " << h << " bucket " << b;
+    }
+  }
+}
+
+TEST_F(ProductQuantizerTest, RejectsAnotherModelAndATruncatedFile) {
+  haloc::ProductQuantizer trained(hash_);
+  trained.SetParams(params_);
+  ASSERT_TRUE(trained.Train(hashes_));
+  ASSERT_TRUE(trained.Save(filename_));
+  const std::string bytes = ReadFile();
+
+  // The fingerprint follows the signature and the format version
+  std::string other = bytes;
+  other[8 + sizeof(uint32_t)] ^= 1;
+  WriteFile(other);
+  haloc::ProductQuantizer loaded(hash_);
+  EXPECT_FALSE(loaded.Load(filename_));
+  EXPECT_FALSE(loaded.IsTrained());
+
+  WriteFile(bytes.substr(0, bytes.size() - sizeof(float)));
+  EXPECT_FALSE(loaded.Load(filename_));
+  EXPECT_FALSE(loaded.IsTrained());
+  WriteFile(bytes.substr(0, 10));
+  EXPECT_FALSE(loaded.Load(filename_));
+}
+
+TEST_F(ProductQuantizerTest, QueriesCloseToHashDatabase) {
+  haloc::ProductQuantizer quantizer(hash_);
+  quantizer.SetParams(params_);
+  ASSERT_TRUE(quantizer.Train(hashes_));
+  haloc::PqDatabase compressed(hash_, quantizer);
+  haloc::HashDatabase reference(hash_);
+  for (uint i=0; i < hashes_.size(); ++i) {
+    ASSERT_TRUE(compressed.Add(i, hashes_[i]));
+    reference.Add(i, hashes_[i]);
+  }
+
+  // Most of the exact candidates are found
+  const float eps = 0.8;
+  const int k = 4;
+  int num_expected = 0, num_found = 0;
+  for (uint q=0; q < hashes_.size(); ++q) {
+    const std::vector<haloc::Match> expected = reference.Query(hashes_[q], k,
+      eps, q, 0);
+    const std::vector<haloc::Match> result = compressed.Query(hashes_[q], k,
+      eps, q, 0);
+    EXPECT_LE(result.size(), static_cast<uint>(k));
+    std::set<int> ids;
+    for (uint m=0; m < result.size(); ++m) {
+      EXPECT_NE(result[m].id, static_cast<int>(q));
+      ids.insert(result[m].id);
+    }
+    for (uint m=0; m < expected.size(); ++m)
+      num_found += ids.count(expected[m].id);
+    num_expected += expected.size();
+  }
+  ASSERT_GT(num_expected, 0);
+  EXPECT_GE(num_found, 0.8*num_expected);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
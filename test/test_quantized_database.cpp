@@ -0,0 +1,165 @@
+//  Copyright (c) 2017 Universitat de les Illes Balears
+//  This file is part of LIBHALOC.
+//
+//  LIBHALOC is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  LIBHALOC is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with LIBHALOC. If not, see <http://www.gnu.org/licenses/>.
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+#include <vector>
+
+#include "libhaloc/hash.h"
+#include "libhaloc/hash_database.h"
+#include "libhaloc/quantized_database.h"
+
+namespace {
+
+// Groups of similar random frames
+std::vector< std::vector<float> > RandomHashes(haloc::Hash& hash,
+    const int& num_frames) {
+  std::mt19937 generator(91);
+  std::uniform_real_distribution<float> x(0.0, 639.0), y(0.0, 479.0);
+  std::uniform_real_distribution<float> uniform(0.0, 1.0);
+  std::normal_distribution<float> noise(0.0, 0.02);
+  std::vector<cv::KeyPoint> kp(200);
+  cv::Mat base(200, 64, CV_32F), desc(200, 64, CV_32F);
+  std::vector< std::vector<float> > hashes;
+  for (int i=0; i < num_frames; ++i) {
+    if (i % 5 == 0) {
+      for (int k=0; k < base.rows; ++k) {
+        kp[k].pt.x = x(generator);
+        kp[k].pt.y = y(generator);
+        kp[k].response = uniform(generator);
+        for (int c=0; c < base.cols; ++c)
+          base.at<float>(k, c) = 0.4*uniform(generator) - 0.2;
+      }
+    }
+    for (int k=0; k < desc.rows; ++k) {
+      for (int c=0; c < desc.cols; ++c)
+        desc.at<float>(k, c) = base.at<float>(k, c) + noise(generator);
+    }
+    hashes.push_back(hash.GetHash(kp, desc, cv::Size(640, 480)));
+  }
+  return hashes;
+}
+
+class QuantizedDatabaseTest : public testing::Test {
+ protected:
+  void SetUp() {
+    hashes_ = RandomHashes(hash_, 60);
+    for (uint i=0; i < hashes_.size(); ++i) reference_.Add(i, hashes_[i]);
+  }
+
+  haloc::Hash hash_;
+  haloc::HashDatabase reference_{hash_};
+  std::vector< std::vector<float> > hashes_;
+};
+
+TEST_F(QuantizedDatabaseTest, NeedsACalibratedQuantization) {
+  haloc::QuantizedDatabase db(hash_);
+  EXPECT_FALSE(hash_.IsQuantizationCalibrated());
+  EXPECT_FALSE(db.Add(0, hashes_[0]));
+  EXPECT_EQ(db.Size(), 0);
+  ASSERT_TRUE(hash_.CalibrateQuantization(hashes_));
+  EXPECT_TRUE(hash_.IsQuantizationCalibrated());
+  EXPECT_TRUE(db.Add(0, hashes_[0]));
+  EXPECT_FALSE(db.Add(0, hashes_[1]));
+  EXPECT_EQ(db.Size(), 1);
+}
+
+TEST_F(QuantizedDatabaseTest, PrunesWithTheBucketSums) {
+  ASSERT_TRUE(hash_.CalibrateQuantization(hashes_));
+  haloc::QuantizedDatabase db(hash_);
+  std::vector<haloc::QuantizedHash> quantized;
+  for (uint i=0; i < hashes_.size(); ++i) {
+    ASSERT_TRUE(db.Add(i, hashes_[i]));
+    quantized.push_back(hash_.Quantize(hashes_[i]));
+  }
+
+  // The difference of the code sums bounds the SAD, so the pruned distance
+  // is the full one
+  const float eps[] = {0.4, 0.8, 1.6};
+  int num_overlaps = 0;
+  for (uint e=0; e < sizeof(eps) / sizeof(eps[0]); ++e) {
+    for (uint a=0; a < quantized.size(); a += 3) {
+      for (uint b=0; b < quantized.size(); ++b) {
+        const int overlap = hash_.CalcDist(quantized[a], quantized[b], eps[e]);
+        EXPECT_EQ(hash_.CalcDist(quantized[a], quantized[b], eps[e], true),
+          overlap) << "eps " << eps[e] << " pair " << a << ", " << b;
+        num_overlaps += (overlap > 0);
+      }
+    }
+  }
+  EXPECT_GT(num_overlaps, 0);
+
+  // The database scores with the same distance
+  const std::vector<haloc::Match> matches = db.Query(hashes_[7], 60, 0.8, 7,
+    0);
+  ASSERT_FALSE(matches.empty());
+  for (uint m=0; m < matches.size(); ++m) {
+    EXPECT_EQ(matches[m].overlap, hash_.CalcDist(quantized[7],
+      quantized[matches[m].id], 0.8));
+  }
+}
+
+TEST_F(QuantizedDatabaseTest, RerankAgreesWithHashDatabase) {
+  ASSERT_TRUE(hash_.CalibrateQuantization(hashes_));
+  const float eps = 0.8;
+  const int k = 4;
+  const int rerank_sizes[] = {12, 60};
+  for (uint r=0; r < sizeof(rerank_sizes) / sizeof(rerank_sizes[0]); ++r) {
+    haloc::QuantizedDatabase db(hash_);
+    haloc::QuantizedDatabase::Params params;
+    params.rerank_size = rerank_sizes[r];
+    db.SetParams(params);
+    for (uint i=0; i < hashes_.size(); ++i) ASSERT_TRUE(db.Add(i, hashes_[i]));
+
+    int num_expected = 0, num_found = 0;
+    for (uint q=0; q < hashes_.size(); ++q) {
+      const std::vector<haloc::Match> expected = reference_.Query(hashes_[q],
+        k, eps, q, 0);
+      const std::vector<haloc::Match> result = db.Query(hashes_[q], k, eps, q,
+        0);
+      std::set<int> ids;
+      for (uint m=0; m < result.size(); ++m) {
+        // The reranked overlaps are the exact ones
+        EXPECT_EQ(result[m].overlap, hash_.CalcDist(hashes_[q],
+          hashes_[result[m].id], eps)) << "query " << q;
+        ids.insert(result[m].id);
+      }
+      for (uint m=0; m < expected.size(); ++m)
+        num_found += ids.count(expected[m].id);
+      num_expected += expected.size();
+
+      // Reranking the whole database is the exact query
+      if (params.rerank_size < static_cast<int>(hashes_.size())) continue;
+      ASSERT_EQ(result.size(), expected.size()) << "query " << q;
+      for (uint m=0; m < result.size(); ++m) {
+        EXPECT_EQ(result[m].id, expected[m].id) << "query " << q;
+        EXPECT_EQ(result[m].overlap, expected[m].overlap) << "query " << q;
+      }
+    }
+    ASSERT_GT(num_expected, 0);
+    EXPECT_GE(num_found, 0.9*num_expected) << "rerank size " <<
+      params.rerank_size;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}